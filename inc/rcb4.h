@@ -92,6 +92,7 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <stddef.h>
 
 /**
  * @brief Private structure that holds all the connection information.
@@ -118,6 +119,250 @@ typedef struct s_rcb4_connection rcb4_connection;
  */
 typedef struct s_rcb4_comm rcb4_comm;
 
+/**
+ * @brief Private structure that holds a background acquisition stream.
+ * 
+ * The structure must be created using rcb4_stream_create() and deleted using
+ * rcb4_stream_delete() when you are no longer going to use it.
+ * 
+ * @sa rcb4_stream_create(), rcb4_stream_delete(), rcb4_stream_start()
+ */
+typedef struct s_rcb4_stream rcb4_stream;
+
+/**
+ * @brief Private structure that holds a multi-rate scheduler.
+ * 
+ * The structure must be created using rcb4_sched_create() and deleted using
+ * rcb4_sched_delete() when you are no longer going to use it.
+ * 
+ * @sa rcb4_sched_create(), rcb4_sched_delete(), rcb4_sched_tick()
+ */
+typedef struct s_rcb4_sched rcb4_sched;
+
+#define RCB4_SCHED_MAX_CHANNELS 32 //!< Maximum number of channels of a scheduler.
+
+/**
+ * @brief Private structure that holds a periodic executor.
+ * 
+ * The structure must be created using rcb4_rt_create() and deleted using
+ * rcb4_rt_delete() when you are no longer going to use it.
+ * 
+ * @sa rcb4_rt_create(), rcb4_rt_delete(), rcb4_rt_run()
+ */
+typedef struct s_rcb4_rt rcb4_rt;
+
+/**
+ * @brief Function called every cycle by a periodic executor.
+ * 
+ * @param conn is the connection the executor was created with.
+ * @param data is the user pointer given to rcb4_rt_create().
+ * @return 0 to keep running. Any other value stops the executor.
+ */
+typedef int (*rcb4_rt_step)(rcb4_connection* conn, void* data);
+
+/**
+ * @brief Statistics of a time measured every cycle, in nanoseconds.
+ */
+typedef struct s_rcb4_rt_time
+{
+	uint64_t last; //!< Value of the last cycle.
+	uint64_t min; //!< Minimum value.
+	uint64_t max; //!< Maximum value.
+	uint64_t total; //!< Sum of all the cycles (divide by the cycles to get the average).
+}rcb4_rt_time;
+
+/**
+ * @brief Statistics of a periodic executor.
+ * 
+ * @sa rcb4_rt_get_stats()
+ */
+typedef struct s_rcb4_rt_stats
+{
+	uint64_t cycles; //!< Number of cycles executed.
+	uint64_t missed; //!< Number of deadlines missed (cycles skipped because the step was too long).
+	rcb4_rt_time jitter; //!< How late each cycle started.
+	rcb4_rt_time step; //!< Duration of the step function.
+	rcb4_rt_time io; //!< Time the step held the connection (the other threads that use it don't count).
+}rcb4_rt_stats;
+
+/**
+ * @brief Private structure that holds a trajectory (a motion made of
+ * keyframes).
+ * 
+ * The structure must be created using rcb4_traj_create() and deleted using
+ * rcb4_traj_delete() when you are no longer going to use it.
+ * 
+ * @sa rcb4_traj_create(), rcb4_traj_delete(), rcb4_traj_play()
+ */
+typedef struct s_rcb4_traj rcb4_traj;
+
+#define RCB4_TRAJ_LINEAR 0 //!< Straight lines between keyframes.
+#define RCB4_TRAJ_CUBIC 1 //!< Cubic spline through the keyframes (continuous speed).
+#define RCB4_TRAJ_MINJERK 2 //!< Minimum-jerk profile between keyframes (stops at each keyframe).
+
+/**
+ * @brief Private structure that holds a motion loaded from a binary file.
+ * 
+ * The structure must be created using rcb4_motion_open() and deleted using
+ * rcb4_motion_close() when you are no longer going to use it.
+ * 
+ * @sa rcb4_motion_open(), rcb4_motion_close(), rcb4_motion_write()
+ */
+typedef struct s_rcb4_motion rcb4_motion;
+
+/**
+ * @brief Private structure that holds the persistent cache of the ROM of a
+ * robot.
+ * 
+ * @sa rcb4_rom_cache_open(), rcb4_rom_cache_close()
+ */
+typedef struct s_rcb4_rom_cache rcb4_rom_cache;
+
+/**
+ * @brief Private structure that holds a local copy of the whole ROM that can be
+ * edited in memory.
+ * 
+ * @sa rcb4_rom_mirror_create(), rcb4_rom_mirror_delete(), rcb4_rom_flush()
+ */
+typedef struct s_rcb4_rom_mirror rcb4_rom_mirror;
+
+/**
+ * @brief Private structure that maps motion names to the motion slots of the
+ * ROM.
+ * 
+ * @sa rcb4_motion_index_create(), rcb4_motion_index_delete(), rcb4_play_motion()
+ */
+typedef struct s_rcb4_motion_index rcb4_motion_index;
+
+/**
+ * @brief Private structure that holds a routine being assembled.
+ * 
+ * @sa rcb4_asm_create(), rcb4_asm_delete(), rcb4_asm_upload()
+ */
+typedef struct s_rcb4_asm rcb4_asm;
+
+#define RCB4_ASM_LABEL_MAX 32 //!< Maximum length of a label, including the '\0'.
+
+/**
+ * @brief Private structure that holds an expression graph to be compiled to
+ * robot commands.
+ * 
+ * @sa rcb4_expr_create(), rcb4_expr_delete(), rcb4_expr_compile()
+ */
+typedef struct s_rcb4_expr rcb4_expr;
+
+/**
+ * @brief Private structure that holds a list of operations to run inside the
+ * robot with a single call.
+ * 
+ * @sa rcb4_batch_create(), rcb4_batch_delete(), rcb4_batch_execute()
+ */
+typedef struct s_rcb4_batch rcb4_batch;
+
+#define RCB4_BATCH_MAILBOX_SIZE 118 //!< Bytes of RAM used by the mailbox of a batch (and of ROM by its trampoline).
+#define RCB4_BATCH_RESULT_SIZE 117 //!< Maximum bytes read by the operations of a batch.
+#define RCB4_BATCH_ROM_SIZE (17 + RCB4_BATCH_MAILBOX_SIZE) //!< Bytes of ROM used by a batch.
+
+/**
+ * @brief Private structure that holds servo frames staged in the RAM of the
+ * robot.
+ * 
+ * @sa rcb4_stage_create(), rcb4_stage_delete(), rcb4_stage_apply()
+ */
+typedef struct s_rcb4_stage rcb4_stage;
+
+#define RCB4_STAGE_MAX_SLOTS 4 //!< Maximum number of frames staged at the same time.
+#define RCB4_STAGE_REPLY_SIZE 6 //!< Bytes of RAM where the servos answer.
+#define RCB4_STAGE_RAM_SIZE(servos, slots) (RCB4_STAGE_REPLY_SIZE + 3 * (servos) * (slots)) //!< Bytes of RAM used by a stage.
+#define RCB4_STAGE_ROM_SIZE(servos, slots) ((9 * (servos) + 3) * (slots)) //!< Bytes of ROM used by a stage.
+
+/**
+ * @brief Private structure that holds a sampler that runs inside the robot.
+ * 
+ * @sa rcb4_sampler_create(), rcb4_sampler_delete(), rcb4_sampler_drain()
+ */
+typedef struct s_rcb4_sampler rcb4_sampler;
+
+#define RCB4_SAMPLER_RAM_SIZE 121 //!< Bytes of RAM used by a sampler.
+#define RCB4_SAMPLER_ROM_SIZE(slots) (29 * (slots) + 18) //!< Bytes of ROM used by a sampler with that many slots.
+
+/**
+ * @brief Private structure that drives several robots from a single thread.
+ * 
+ * @sa rcb4_reactor_create(), rcb4_reactor_delete(), rcb4_reactor_run()
+ */
+typedef struct s_rcb4_reactor rcb4_reactor;
+
+/**
+ * @brief Function called by a reactor when a request is done.
+ * 
+ * @param reactor is the reactor. New requests can be submitted from here.
+ * @param robot is the robot, as returned by rcb4_reactor_add().
+ * @param result is the size of the reply (0 if the command only returns the
+ * ACK), -10 if there was a timeout or < 0 if there was an error.
+ * @param reply is the data of the reply, NULL if there is none. Only valid
+ * during the call.
+ * @param data is the user pointer given to rcb4_reactor_submit().
+ */
+typedef void (*rcb4_reactor_done)(rcb4_reactor* reactor, int robot, int result, const uint8_t* reply, void* data);
+
+#define RCB4_REACTOR_EPOLL 0 //!< Reactor backend: write(), read() and epoll_wait(). @sa rcb4_reactor_create_backend()
+#define RCB4_REACTOR_URING 1 //!< Reactor backend: io_uring, one system call per iteration for all the robots. @sa rcb4_reactor_create_backend()
+#define RCB4_REACTOR_MAX_ROBOTS 64 //!< Maximum number of robots of a reactor.
+#define RCB4_REACTOR_QUEUE_SIZE 32 //!< Maximum number of requests waiting for each robot.
+
+/**
+ * @brief Private structure that shares a connection with other processes
+ * through a Unix socket.
+ * 
+ * @sa rcb4_server_create(), rcb4_server_delete(), rcb4_server_run()
+ */
+typedef struct s_rcb4_server rcb4_server;
+
+/**
+ * @brief Counters of a server.
+ * 
+ * @sa rcb4_server_get_stats()
+ */
+typedef struct s_rcb4_server_stats
+{
+	uint64_t requests; //!< Frames received from the clients.
+	uint64_t merged; //!< Reads answered with the reply of an identical read of the same batch.
+	uint64_t transactions; //!< Batches sent to the robot.
+	uint64_t failed; //!< Frames left without reply because the robot didn't answer.
+	uint32_t clients; //!< Clients connected now.
+}rcb4_server_stats;
+
+#define RCB4_SERVER_MAX_CLIENTS 32 //!< Maximum number of processes connected to a server.
+
+/**
+ * @brief Private structure that holds a shared memory bridge (telemetry and
+ * servo targets shared between processes).
+ * 
+ * @sa rcb4_bridge_create(), rcb4_bridge_open(), rcb4_bridge_delete()
+ */
+typedef struct s_rcb4_bridge rcb4_bridge;
+
+#define RCB4_STREAM_MAX_REGIONS 8 //!< Maximum number of RAM regions in a stream.
+#define RCB4_STREAM_MAX_SIZE 128 //!< Maximum number of bytes of a stream sample.
+
+/**
+ * @brief A sample acquired by a stream.
+ * 
+ * The data of all the regions of the stream is stored one after the other in
+ * the order they were added. Use rcb4_stream_get_ram() or rcb4_stream_get_ad()
+ * to get a value from it.
+ * 
+ * @sa rcb4_stream_latest(), rcb4_stream_read()
+ */
+typedef struct s_rcb4_sample
+{
+	uint64_t timestamp; //!< CLOCK_MONOTONIC time in nanoseconds when the sample was read.
+	uint64_t sequence; //!< Number of the sample since the stream was created.
+	uint16_t size; //!< Bytes used in data.
+	uint8_t data[RCB4_STREAM_MAX_SIZE]; //!< Raw RAM contents.
+}rcb4_sample;
+
 
 enum e_rcb4_command_types
 {
@@ -320,28 +565,22 @@ enum e_rcb4_command_types
 	 */
 	RCB4_COMM_MOD    = 0x0A,
 	
-	// TODO: Write this
 	/**
-	 * @brief Sets ICS using data already loaded in RAM.
-	 * 
-	 * @warning TO BE WRITTEN!!!!
+	 * @brief Sends data already loaded in RAM to the servos of an SIO line and
+	 * saves their answer in RAM.
 	 * 
-	 * Source must be set with rcb4_command_set_src_*() functions to be RAM,
-	 * ICS, a literal value or ROM.
+	 * The data is a raw ICS packet, for example a position command
+	 * (0x80 | ID, position bits 13~7, position bits 6~0).
 	 * 
-	 * Destination must be set with rcb4_command_set_dst_*() functions to RAM,
-	 * ICS or ROM, but rcb4_command_set_dst_com() can't be used.
+	 * The line is set with rcb4_command_set_ics(), the RAM address and size of
+	 * the packet with rcb4_command_set_src_ram() (up to 64 bytes) and where the
+	 * answer is saved with rcb4_command_set_dst_ram().
 	 * 
-	 * rcb4_command_set_dst_do_not_save() can be called to avoid saving the
-	 * result in destination. That will, however, set the corresponding CPU
-	 * flags.
-	 * Note that you still need to set the destination using another
-	 * rcb4_command_set_dst_*() function because the operation is still
-	 * (source AND destination), even if the result is not saved.
+	 * It is mostly useful inside routines in the ROM, to send packets prepared
+	 * in advance (see rcb4_stage_create()).
 	 * 
-	 * @warning Only the rcb4_command_set_src_* and the rcb4_command_set_dst_*()
-	 * functions are allowed.
-	 * @warning rcb4_command_set_dst_com() is not allowed.
+	 * @warning Only the rcb4_command_set_ics(), rcb4_command_set_src_ram() and
+	 * rcb4_command_set_dst_ram() functions are allowed.
 	 */
 	RCB4_COMM_ICS    = 0x0E,
 	
@@ -422,6 +661,11 @@ enum e_rcb4_command_types
  * at high speeds so it is imperative to call rcb4_deinit() to revert the
  * configuration to its initial state.
  * 
+ * The connection can be shared by several threads (for example a control
+ * loop, a logger and a user interface). Any thread can send commands, the
+ * transactions are serialized internally and the threads get the link in the
+ * order they asked for it.
+ * 
  * @param tty is the device to connect. Usually "/dev/ttyUSB0".
  * @return A new allocated rcb4_connection structure or NULL if something
  * failed (memory or connection).
@@ -429,6 +673,43 @@ enum e_rcb4_command_types
  */
 rcb4_connection* rcb4_init(const char* tty); //! Creates a new connection to the robot. Returns NULL on failure. Tries to guess the baudrate.
 
+#define RCB4_TRANSPORT_POLLABLE 0x01 //!< Has a file descriptor, so it can be used with rcb4_reactor_add().
+#define RCB4_TRANSPORT_SPEED 0x02 //!< The baudrate can be changed (real serial ports).
+#define RCB4_TRANSPORT_PACED 0x04 //!< The robot needs the fixed delays between commands.
+
+/**
+ * @brief Opens a connection to the robot through any transport.
+ *
+ * The uri selects how the frames reach the robot:
+ * - "tty:/dev/ttyUSB0" or just "/dev/ttyUSB0": a serial port, same as
+ * rcb4_init().
+ * - "pty:/dev/pts/3": a pseudo-terminal, for example a simulator or a serial
+ * to network bridge. No speed hack and no delays between commands.
+ * - "unix:/run/rcb4.sock": a stream socket that talks the same protocol.
+ * - "loop:" or "loop:rom.bin": an emulator of the board inside the process,
+ * optionally with a copy of a ROM. It runs the RAM, ROM and math commands and
+ * the routines of the ROM, the servo commands are only acknowledged. Useful to
+ * test programs without a robot.
+ *
+ * The transport must answer a ping before this function returns. The
+ * connection is closed with rcb4_deinit() whatever the transport.
+ *
+ * @param uri is the transport and the path.
+ * @return A new allocated rcb4_connection structure or NULL if something
+ * failed.
+ * @sa rcb4_init(), rcb4_get_capabilities().
+ */
+rcb4_connection* rcb4_open(const char* uri);
+
+/**
+ * @brief Tells what the transport of the connection can do.
+ *
+ * @param conn is the connection to the robot.
+ * @return A combination of RCB4_TRANSPORT_POLLABLE, RCB4_TRANSPORT_SPEED and
+ * RCB4_TRANSPORT_PACED.
+ */
+uint32_t rcb4_get_capabilities(const rcb4_connection* conn);
+
 /**
  * @brief Closes and resets the serial port and frees conn.
  * 
@@ -456,6 +737,40 @@ void rcb4_deinit(rcb4_connection* conn); // Disconnects, reconfigures the termin
  */
 int rcb4_command_ping(rcb4_connection* conn); // 0 = ACK, 1 = NACK, < 0 = Error (-10 = timeout)
 
+#define RCB4_LANE_REALTIME 0 //!< Default lane. Servo frames and everything the control loop needs.
+#define RCB4_LANE_BACKGROUND 1 //!< Telemetry, ROM transfers, diagnostics... Only uses the link when it is idle.
+
+/**
+ * @brief Sets the priority of the commands sent by the calling thread.
+ * 
+ * When several threads share a connection, a thread in the background lane
+ * waits until no real-time thread is waiting for the link before sending
+ * anything. Long transfers of the background lane (rcb4_rom_read(),
+ * rcb4_rom_write()...) also step aside between two chunks. So a real-time
+ * thread waits at most for the command of the background lane that is on the
+ * wire.
+ * 
+ * To avoid starving the background lane under heavy real-time traffic, each
+ * command of the background lane waits at most budget_usecs for an idle link.
+ * After that it takes its turn in the normal order.
+ * 
+ * The lane applies to every connection used from the calling thread. All
+ * the threads start in the real-time lane.
+ * 
+ * Example (a logger thread):
+ * @code
+ * rcb4_thread_set_lane(RCB4_LANE_BACKGROUND, 20000); // Wait up to 20ms for an idle link
+ * while(running)
+ *     rcb4_ad_read(conn, 0, &battery); // Never delays the control loop more than one read
+ * @endcode
+ * 
+ * @param lane is RCB4_LANE_REALTIME or RCB4_LANE_BACKGROUND.
+ * @param budget_usecs is the maximum time a command of the background lane
+ * waits for an idle link. 0 waits forever.
+ * @return 0 if OK.
+ */
+int rcb4_thread_set_lane(uint8_t lane, uint32_t budget_usecs);
+
 
 /************
  * COMMANDS *
@@ -930,6 +1245,55 @@ int rcb4_command_set_stretch(rcb4_comm* comm, uint8_t stretch); // Not implement
  */
 int rcb4_send_command(rcb4_connection* conn, const rcb4_comm* comm, uint8_t* reply);
 
+#define RCB4_EXCHANGE_PREFETCH 0x01 //!< rcb4_exchange(): send the read of the next cycle in advance.
+
+/**
+ * @brief Sends a command and a read back to back and waits once for both.
+ * 
+ * A control cycle usually reads the sensors (a MOV to COM) and writes the
+ * servos (a CONST, SERIES...). Sending them with two rcb4_send_command() calls
+ * means two round trips with their delays. This function writes both frames at
+ * once, the robot executes them in order and both replies are collected in a
+ * single wait.
+ * 
+ * With RCB4_EXCHANGE_PREFETCH the read is sent again as soon as the replies
+ * arrive. Its reply is collected later, so if the next call asks for the same
+ * read only the servo frame is sent and the data is already available. Note
+ * that in that case the data was read at the end of the previous exchange, not
+ * during the current one. If any other command is sent in between (by this or
+ * another thread) the prefetched data is dropped and the read is sent again,
+ * so it is never older than the previous exchange.
+ * 
+ * Example:
+ * @code
+ * uint16_t acc[2];
+ * 
+ * rcb4_command_recreate(read, RCB4_COMM_MOV);
+ * rcb4_command_set_src_ram(read, RCB4_AD_BASE_ADDR + 2*3, 4);
+ * rcb4_command_set_dst_com(read);
+ * 
+ * while(running)
+ * {
+ *     // servos was filled with the positions computed from the last reading
+ *     rcb4_exchange(conn, servos, read, (uint8_t*)acc, RCB4_EXCHANGE_PREFETCH);
+ *     // compute the new positions from acc...
+ * }
+ * @endcode
+ * 
+ * @param conn is the allocated connection to the robot.
+ * @param write is a command that only replies with an ACK (for example a servo
+ * command). Can be NULL.
+ * @param read is a command that replies with data (for example a MOV to COM).
+ * Can be NULL.
+ * @param reply is where the data of read is copied. Can be NULL.
+ * @param flags 0 or RCB4_EXCHANGE_PREFETCH.
+ * @return >= 0 on success, the bytes copied to reply.
+ * @return -10 if there was a timeout.
+ * @return < 0 on error.
+ * @sa rcb4_send_command().
+ */
+int rcb4_exchange(rcb4_connection* conn, const rcb4_comm* write, const rcb4_comm* read, uint8_t* reply, int flags);
+
 /**
  * @brief Jump to an address in ROM.
  * 
@@ -1026,6 +1390,16 @@ void rcb4_command_debug_print(const rcb4_comm* comm);
  */
 void rcb4_util_usleep(uint32_t usec); // Sleep for usec microseconds
 
+/**
+ * @brief Gets the current time in nanoseconds.
+ * 
+ * Uses CLOCK_MONOTONIC so the value is not affected by changes of the system
+ * date. Useful to compare with rcb4_sample::timestamp.
+ * 
+ * @return The monotonic time in nanoseconds.
+ */
+uint64_t rcb4_util_time_ns(void); // Monotonic time in nanoseconds
+
 /**
  * @brief Get the reading from the analog-digital conversor of the robot.
  * 
@@ -1038,6 +1412,2210 @@ void rcb4_util_usleep(uint32_t usec); // Sleep for usec microseconds
  */
 int rcb4_ad_read(rcb4_connection* conn, uint8_t ad_id, uint16_t* value); // ID from 0 to 10. Returns 0 if ok, AD value in "value"
 
+#define RCB4_HASH_INIT 0xCBF29CE484222325ULL //!< Initial value for rcb4_util_hash().
+
+/**
+ * @brief Hashes a buffer (64 bit FNV-1a).
+ * 
+ * The hash can be computed in pieces by passing the result of the previous
+ * call:
+ * @code
+ * uint64_t hash = RCB4_HASH_INIT;
+ * hash = rcb4_util_hash(hash, part1, size1);
+ * hash = rcb4_util_hash(hash, part2, size2);
+ * @endcode
+ * 
+ * @param hash is RCB4_HASH_INIT or the result of the previous call.
+ * @param data is the data to hash.
+ * @param size is the size of data in bytes.
+ * @return The new hash.
+ */
+uint64_t rcb4_util_hash(uint64_t hash, const void* data, size_t size);
+
+
+/*************
+ * STREAMING *
+ *************/
+
+/**
+ * @brief Creates a new acquisition stream.
+ * 
+ * A stream is a background thread that keeps reading a set of RAM regions of
+ * the robot and stores every reading (sample) with its timestamp in a ring
+ * buffer. The readers never block the acquisition thread and the acquisition
+ * thread never blocks the readers, so a control loop can get the last state of
+ * the sensors without waiting for the serial link.
+ * 
+ * The stream shares the connection with the rest of the functions of the
+ * library. Every access to the serial is serialized so you can keep sending
+ * commands while the stream is running.
+ * 
+ * @param conn is the connection to the robot.
+ * @return A new allocated stream or NULL if there was a memory error.
+ * @sa rcb4_stream_delete(), rcb4_stream_add_ram(), rcb4_stream_start().
+ */
+rcb4_stream* rcb4_stream_create(rcb4_connection* conn);
+
+/**
+ * @brief Stops the stream (if running) and frees it.
+ * 
+ * @param stream is the stream to delete. It can be NULL.
+ */
+void rcb4_stream_delete(rcb4_stream* stream);
+
+/**
+ * @brief Adds a RAM region to the stream.
+ * 
+ * The region will be read in every sample. Contiguous regions are merged and
+ * read with a single command.
+ * 
+ * @param stream is the stream. It must not be running.
+ * @param addr is the RAM address of the region.
+ * @param size is the size in bytes of the region.
+ * @return 0 if OK.
+ * @return -1 if the stream is running, the region is invalid or the sample
+ * would be bigger than RCB4_STREAM_MAX_SIZE.
+ */
+int rcb4_stream_add_ram(rcb4_stream* stream, uint16_t addr, uint8_t size);
+
+/**
+ * @brief Adds an analog-digital conversor to the stream.
+ * 
+ * @param stream is the stream. It must not be running.
+ * @param ad_id is the ID of the sensor. From 0 to 10.
+ * @return 0 if OK.
+ * @sa rcb4_stream_add_ram(), rcb4_stream_get_ad().
+ */
+int rcb4_stream_add_ad(rcb4_stream* stream, uint8_t ad_id);
+
+/**
+ * @brief Sets the period of the acquisition.
+ * 
+ * The period is kept using absolute times so it does not drift. If a sample
+ * takes longer than the period the next one is started immediately.
+ * 
+ * @param stream is the stream. It must not be running.
+ * @param usecs is the period in microseconds. 0 (default) reads as fast as the
+ * serial allows.
+ * @return 0 if OK.
+ */
+int rcb4_stream_set_period(rcb4_stream* stream, uint32_t usecs);
+
+/**
+ * @brief Starts the acquisition thread.
+ * 
+ * @param stream is the stream.
+ * @return 0 if OK (or if it was already running).
+ */
+int rcb4_stream_start(rcb4_stream* stream);
+
+/**
+ * @brief Stops the acquisition thread and waits for it to finish.
+ * 
+ * The samples already acquired can still be read.
+ * 
+ * @param stream is the stream.
+ * @return 0 if OK.
+ */
+int rcb4_stream_stop(rcb4_stream* stream);
+
+/**
+ * @brief Gets the latest sample.
+ * 
+ * This function never blocks and can be called from any thread.
+ * 
+ * @param stream is the stream.
+ * @param sample is where the sample is copied.
+ * @return 0 if OK.
+ * @return -1 if no sample has been acquired yet.
+ */
+int rcb4_stream_latest(const rcb4_stream* stream, rcb4_sample* sample);
+
+/**
+ * @brief Reads the samples in order.
+ * 
+ * Each reader keeps its own cursor (initialize it to 0). Every call copies the
+ * next sample and advances the cursor. If the reader is too slow and the
+ * samples were overwritten the cursor jumps to the oldest sample still
+ * available; compare rcb4_sample::sequence to know how many were lost.
+ * 
+ * This function never blocks and can be called from any thread.
+ * 
+ * @param stream is the stream.
+ * @param cursor is the position of the reader.
+ * @param sample is where the sample is copied.
+ * @return 1 if a sample was read.
+ * @return 0 if there are no new samples.
+ */
+int rcb4_stream_read(const rcb4_stream* stream, uint64_t* cursor, rcb4_sample* sample);
+
+/**
+ * @brief Gets a RAM value from a sample.
+ * 
+ * @param stream is the stream the sample belongs to.
+ * @param sample is the sample.
+ * @param addr is the RAM address of the value.
+ * @param value is where the value is copied.
+ * @param size is the size of the value in bytes.
+ * @return 0 if OK.
+ * @return -1 if the value is not part of the stream.
+ */
+int rcb4_stream_get_ram(const rcb4_stream* stream, const rcb4_sample* sample, uint16_t addr, void* value, uint8_t size);
+
+/**
+ * @brief Gets the reading of an analog-digital conversor from a sample.
+ * 
+ * @param stream is the stream the sample belongs to.
+ * @param sample is the sample.
+ * @param ad_id is the ID of the sensor. From 0 to 10.
+ * @param value specifies where to save the result.
+ * @return 0 if OK.
+ * @sa rcb4_stream_add_ad().
+ */
+int rcb4_stream_get_ad(const rcb4_stream* stream, const rcb4_sample* sample, uint8_t ad_id, uint16_t* value);
+
+/**
+ * @brief Gets the number of failed acquisitions.
+ * 
+ * @param stream is the stream.
+ * @return The number of samples that could not be read.
+ */
+uint32_t rcb4_stream_get_errors(const rcb4_stream* stream);
+
+
+/*****************
+ * ROM TRANSFERS *
+ *****************/
+
+#define RCB4_ROM_MAX_DEPTH 16 //!< Maximum value for rcb4_rom_set_pipeline().
+
+/**
+ * @brief Sets how many commands are sent before waiting for a reply in the ROM
+ * transfers.
+ * 
+ * The robot answers the commands in order, so there is no need to wait for an
+ * ACK to send the next chunk. A deeper pipeline keeps the link busy but needs
+ * the robot to buffer more data. The default is 4.
+ * 
+ * @param conn is the connection to the robot.
+ * @param depth is the number of commands on the wire, from 1 (no pipelining)
+ * to RCB4_ROM_MAX_DEPTH.
+ * @return 0 if OK.
+ */
+int rcb4_rom_set_pipeline(rcb4_connection* conn, uint8_t depth);
+
+/**
+ * @brief Writes a buffer to the ROM of the robot.
+ * 
+ * The buffer is sent in the biggest literal MOV commands allowed (120 bytes)
+ * and the ACKs are pipelined (see rcb4_rom_set_pipeline()).
+ * 
+ * @param conn is the connection to the robot.
+ * @param addr is the ROM address to write to.
+ * @param buf is the data to write.
+ * @param len is the size of buf in bytes. addr + len must not go past
+ * RCB4_MAX_ROM_ADDRESS.
+ * @return 0 if OK.
+ * @return < 0 if there was an error. Part of the data may have been written.
+ * @sa rcb4_rom_verify().
+ */
+int rcb4_rom_write(rcb4_connection* conn, uint32_t addr, const void* buf, uint32_t len);
+
+/**
+ * @brief Reads a region of the ROM of the robot.
+ * 
+ * The region is read in the biggest chunks allowed (125 bytes) and the
+ * requests are pipelined (see rcb4_rom_set_pipeline()).
+ * 
+ * @param conn is the connection to the robot.
+ * @param addr is the ROM address to read from.
+ * @param buf is where the data is saved.
+ * @param len is the number of bytes to read.
+ * @return 0 if OK.
+ */
+int rcb4_rom_read(rcb4_connection* conn, uint32_t addr, void* buf, uint32_t len);
+
+/**
+ * @brief Computes the hash of a region of the ROM.
+ * 
+ * The region is read like in rcb4_rom_read() but it is hashed as it arrives
+ * instead of being stored.
+ * 
+ * @param conn is the connection to the robot.
+ * @param addr is the ROM address.
+ * @param len is the number of bytes.
+ * @param hash is where the hash is saved (same as rcb4_util_hash() of the
+ * data starting with RCB4_HASH_INIT).
+ * @return 0 if OK.
+ */
+int rcb4_rom_hash(rcb4_connection* conn, uint32_t addr, uint32_t len, uint64_t* hash);
+
+/**
+ * @brief Checks that a region of the ROM has the expected contents.
+ * 
+ * @param conn is the connection to the robot.
+ * @param addr is the ROM address.
+ * @param buf is the expected data.
+ * @param len is the size of buf in bytes.
+ * @return 0 if the ROM matches buf.
+ * @return 1 if it is different.
+ * @return < 0 if there was an error.
+ */
+int rcb4_rom_verify(rcb4_connection* conn, uint32_t addr, const void* buf, uint32_t len);
+
+#define RCB4_SYNC_BLOCK_SIZE 1024 //!< Granularity of rcb4_rom_sync().
+
+/**
+ * @brief Results of a rcb4_rom_sync().
+ */
+typedef struct s_rcb4_sync_stats
+{
+	uint32_t blocks; //!< Blocks in the image.
+	uint32_t changed; //!< Blocks uploaded (or that should have been if there was an error).
+	uint32_t verified; //!< Blocks read back from the robot to check them.
+	uint32_t stale; //!< 1 if the index did not match the robot and every block was checked.
+	uint32_t bytes_written; //!< Bytes written to the ROM.
+}rcb4_sync_stats;
+
+/**
+ * @brief Uploads only the parts of an image that changed since the last sync.
+ * 
+ * A local index (one file per robot, index_dir/robot_id.idx) remembers the
+ * hash of every RCB4_SYNC_BLOCK_SIZE block written to the robot. The image is
+ * compared with the index and only the blocks that differ are written.
+ * 
+ * Before trusting the index, samples random blocks that should not have
+ * changed are read back from the robot. If any of them differs (somebody else
+ * wrote to the robot) all the blocks are checked.
+ * 
+ * @param conn is the connection to the robot.
+ * @param index_dir is the directory of the index files. NULL for the current
+ * directory.
+ * @param robot_id identifies the robot (for example its serial number). Must
+ * not contain '/'.
+ * @param addr is the ROM address of the image. Must be a multiple of
+ * RCB4_SYNC_BLOCK_SIZE.
+ * @param image is the ROM image.
+ * @param len is the size of the image in bytes.
+ * @param samples is the number of blocks to check against the robot.
+ * @param stats if not NULL, receives what was done.
+ * @return 0 if OK.
+ * @sa rcb4_rom_sync_forget().
+ */
+int rcb4_rom_sync(rcb4_connection* conn, const char* index_dir, const char* robot_id, uint32_t addr,
+                  const void* image, uint32_t len, uint32_t samples, rcb4_sync_stats* stats);
+
+/**
+ * @brief Deletes the index of a robot.
+ * 
+ * The next rcb4_rom_sync() will upload the whole image.
+ * 
+ * @param index_dir is the directory of the index files. NULL for the current
+ * directory.
+ * @param robot_id identifies the robot.
+ * @return 0 if OK.
+ */
+int rcb4_rom_sync_forget(const char* index_dir, const char* robot_id);
+
+/**
+ * @brief Opens the ROM cache of the robot.
+ * 
+ * The robot is identified by the hash of the start of its ROM (its
+ * configuration) and its cache is the file dir/<hash>.cache. The blocks read
+ * through rcb4_rom_cache_read() are kept there, so the next time the program
+ * starts they don't have to be read from the robot again.
+ * 
+ * Before trusting the file, samples random blocks are compared with the robot.
+ * If any of them differs the whole cache is discarded.
+ * 
+ * While the cache is open every write to the ROM done with this connection
+ * (rcb4_rom_write() or any command with a ROM destination) updates or
+ * invalidates the affected blocks. Writes from other programs are only
+ * detected by the sampling.
+ * 
+ * @param conn is the connection to the robot. Only one cache can be open per
+ * connection.
+ * @param dir is the directory of the cache files. NULL for the current
+ * directory.
+ * @param samples is the number of blocks to check against the robot.
+ * @return The cache or NULL if there was an error.
+ * @sa rcb4_rom_cache_close().
+ */
+rcb4_rom_cache* rcb4_rom_cache_open(rcb4_connection* conn, const char* dir, uint32_t samples);
+
+/**
+ * @brief Saves the cache (if it changed) and frees it.
+ * 
+ * @param cache is the cache to close. Can be NULL.
+ */
+void rcb4_rom_cache_close(rcb4_rom_cache* cache);
+
+/**
+ * @brief Reads a region of the ROM, from the cache when possible.
+ * 
+ * The blocks not in the cache are read from the robot (see rcb4_rom_read())
+ * and added to it.
+ * 
+ * @param cache is the cache.
+ * @param addr is the ROM address to read from.
+ * @param buf is where the data is saved.
+ * @param len is the number of bytes to read.
+ * @return 0 if OK.
+ */
+int rcb4_rom_cache_read(rcb4_rom_cache* cache, uint32_t addr, void* buf, uint32_t len);
+
+/**
+ * @brief Saves the cache to its file.
+ * 
+ * The file is replaced atomically, a crash never leaves a half written cache.
+ * rcb4_rom_cache_close() does this too.
+ * 
+ * @param cache is the cache.
+ * @return 0 if OK.
+ */
+int rcb4_rom_cache_flush(rcb4_rom_cache* cache);
+
+/**
+ * @brief Forgets the cached contents of a region of the ROM.
+ * 
+ * Only needed if the ROM was changed by other means than this connection
+ * (for example, by the robot itself).
+ * 
+ * @param cache is the cache.
+ * @param addr is the ROM address.
+ * @param len is the size of the region in bytes.
+ */
+void rcb4_rom_cache_invalidate(rcb4_rom_cache* cache, uint32_t addr, uint32_t len);
+
+#define RCB4_MIRROR_PAGE_SIZE 256 //!< Granularity of the dirty tracking of the ROM mirror.
+/**
+ * @brief Creates a mirror of the ROM of the robot.
+ * 
+ * The mirror maps the whole ROM address space (0x000000 to
+ * RCB4_MAX_ROM_ADDRESS) in memory, so the ROM can be edited with plain
+ * pointers and the changes sent later with rcb4_rom_flush().
+ * 
+ * The mirror remembers what the robot has in the pages loaded with
+ * rcb4_rom_mirror_load() (or already flushed), and only the bytes that changed
+ * there are sent. The other pages are only sent if they are marked with
+ * rcb4_rom_mirror_mark_dirty(), and then they are sent entirely.
+ * 
+ * The mirror is not thread safe.
+ * 
+ * @param conn is the connection to the robot.
+ * @param path is a file to keep the mirror in (it is created if needed), so the
+ * edits survive the program. NULL for a mirror only in memory.
+ * @return The mirror or NULL if there was an error.
+ * @sa rcb4_rom_mirror_delete().
+ */
+rcb4_rom_mirror* rcb4_rom_mirror_create(rcb4_connection* conn, const char* path);
+
+/**
+ * @brief Frees a mirror. The changes not flushed are not sent to the robot.
+ * 
+ * @param mirror is the mirror to delete. Can be NULL.
+ */
+void rcb4_rom_mirror_delete(rcb4_rom_mirror* mirror);
+
+/**
+ * @brief Gets the memory of the mirror.
+ * 
+ * @param mirror is the mirror.
+ * @return A pointer to RCB4_MAX_ROM_ADDRESS + 1 bytes, indexed by ROM address.
+ */
+uint8_t* rcb4_rom_mirror_get_data(rcb4_rom_mirror* mirror);
+
+/**
+ * @brief Reads a region of the ROM of the robot into the mirror.
+ * 
+ * The region is extended to whole pages. Its contents in the mirror are
+ * replaced with the ones of the robot. If the connection has a ROM cache open
+ * (see rcb4_rom_cache_open()) it is used.
+ * 
+ * @param mirror is the mirror.
+ * @param addr is the ROM address.
+ * @param len is the size of the region in bytes.
+ * @return 0 if OK.
+ */
+int rcb4_rom_mirror_load(rcb4_rom_mirror* mirror, uint32_t addr, uint32_t len);
+
+/**
+ * @brief Marks the pages of a region to be written entirely by the next flush.
+ * 
+ * Needed for the pages that were not loaded from the robot; the changes in
+ * loaded pages are found by rcb4_rom_flush() itself.
+ * 
+ * @param mirror is the mirror.
+ * @param addr is the ROM address.
+ * @param len is the size of the region in bytes.
+ */
+void rcb4_rom_mirror_mark_dirty(rcb4_rom_mirror* mirror, uint32_t addr, uint32_t len);
+
+/**
+ * @brief Sends the changes of the mirror to the robot.
+ * 
+ * The changed bytes are grouped in runs (small gaps of unchanged bytes are sent
+ * too if that saves a command) and each run is written with rcb4_rom_write().
+ * 
+ * @param mirror is the mirror.
+ * @return The number of bytes written to the ROM.
+ * @return < 0 if there was an error. The changes not written are kept for the
+ * next flush.
+ */
+int rcb4_rom_flush(rcb4_rom_mirror* mirror);
+
+
+/************************
+ * MULTI-RATE SCHEDULER *
+ ************************/
+
+/**
+ * @brief Creates a new multi-rate scheduler.
+ * 
+ * Not all the sensors need to be read at the same rate (for example the battery
+ * can be read once a second while the gyros are needed every control cycle).
+ * The scheduler takes a period for each channel (a RAM range) and builds a
+ * cyclic table of reads:
+ * - The channels that are due in the same tick and are close in RAM are read
+ * with a single MOV command.
+ * - The slow channels are placed in the ticks with less traffic so they don't
+ * steal link time from the fast ones.
+ * 
+ * The scheduler does not have its own thread. Call rcb4_sched_tick() once
+ * every tick_usecs (for example from your control loop).
+ * 
+ * @param conn is the connection to the robot.
+ * @param tick_usecs is the base period in microseconds. The periods of the
+ * channels are rounded to a multiple of it.
+ * @return A new allocated scheduler or NULL if there was an error.
+ * @sa rcb4_sched_delete(), rcb4_sched_add_ram(), rcb4_sched_tick().
+ */
+rcb4_sched* rcb4_sched_create(rcb4_connection* conn, uint32_t tick_usecs);
+
+/**
+ * @brief Frees the scheduler.
+ * 
+ * @param sched is the scheduler to delete. It can be NULL.
+ */
+void rcb4_sched_delete(rcb4_sched* sched);
+
+/**
+ * @brief Adds a RAM range to the scheduler.
+ * 
+ * @param sched is the scheduler.
+ * @param addr is the RAM address of the range.
+ * @param size is the size in bytes of the range.
+ * @param period_usecs is how often it must be read. It is rounded to the
+ * nearest multiple of the tick (minimum 1 tick).
+ * @return 0 if OK.
+ */
+int rcb4_sched_add_ram(rcb4_sched* sched, uint16_t addr, uint8_t size, uint32_t period_usecs);
+
+/**
+ * @brief Adds an analog-digital conversor to the scheduler.
+ * 
+ * @param sched is the scheduler.
+ * @param ad_id is the ID of the sensor. From 0 to 10.
+ * @param period_usecs is how often it must be read.
+ * @return 0 if OK.
+ * @sa rcb4_sched_add_ram(), rcb4_sched_get_ad().
+ */
+int rcb4_sched_add_ad(rcb4_sched* sched, uint8_t ad_id, uint32_t period_usecs);
+
+/**
+ * @brief Computes the cyclic table of reads.
+ * 
+ * The table lasts the least common multiple of the periods of all the
+ * channels. This function is called automatically by rcb4_sched_tick() after
+ * adding channels, call it yourself if you want to check for errors before
+ * starting.
+ * 
+ * @param sched is the scheduler.
+ * @return 0 if OK.
+ * @return -1 if there are no channels or the periods need a table too long.
+ */
+int rcb4_sched_build(rcb4_sched* sched);
+
+/**
+ * @brief Executes the reads of the current tick and advances to the next one.
+ * 
+ * @param sched is the scheduler.
+ * @return The number of MOV commands sent.
+ * @return < 0 if there was an error.
+ */
+int rcb4_sched_tick(rcb4_sched* sched);
+
+/**
+ * @brief Gets the last value read of a RAM range.
+ * 
+ * @param sched is the scheduler.
+ * @param addr is the RAM address.
+ * @param value is where the value is copied.
+ * @param size is the size of the value in bytes.
+ * @param timestamp if not NULL, receives the CLOCK_MONOTONIC time in
+ * nanoseconds when the value was read (the oldest byte if it spans several
+ * reads).
+ * @return 0 if OK.
+ * @return -1 if the value has not been read yet.
+ */
+int rcb4_sched_get_ram(const rcb4_sched* sched, uint16_t addr, void* value, uint8_t size, uint64_t* timestamp);
+
+/**
+ * @brief Gets the last reading of an analog-digital conversor.
+ * 
+ * @param sched is the scheduler.
+ * @param ad_id is the ID of the sensor. From 0 to 10.
+ * @param value specifies where to save the result.
+ * @param timestamp if not NULL, receives the time of the reading.
+ * @return 0 if OK.
+ * @sa rcb4_sched_add_ad().
+ */
+int rcb4_sched_get_ad(const rcb4_sched* sched, uint8_t ad_id, uint16_t* value, uint64_t* timestamp);
+
+/**
+ * @brief Print the cyclic table of the scheduler.
+ * 
+ * Prints to stdout the phase of every channel and the reads of every tick.
+ * 
+ * @param sched is the scheduler.
+ */
+void rcb4_sched_debug_print(const rcb4_sched* sched);
+
+
+/*********************
+ * PERIODIC EXECUTOR *
+ *********************/
+
+/**
+ * @brief Creates a new periodic executor.
+ * 
+ * The executor calls step every period_usecs. The deadlines are absolute so
+ * the period does not drift with the time spent in step. If a step takes
+ * longer than the period the lost cycles are skipped (and counted as missed)
+ * instead of being executed back to back.
+ * 
+ * Example:
+ * @code
+ * int balance(rcb4_connection* conn, void* data)
+ * {
+ *     // Read the sensors, compute and send the servo positions
+ *     return 0;
+ * }
+ * 
+ * rcb4_rt* rt = rcb4_rt_create(conn, 10000, balance, NULL); // 100Hz
+ * rcb4_rt_set_priority(rt, 80);
+ * rcb4_rt_run(rt);
+ * @endcode
+ * 
+ * @param conn is the connection to the robot.
+ * @param period_usecs is the period in microseconds.
+ * @param step is the function to call every cycle.
+ * @param data is a user pointer passed to step.
+ * @return A new allocated executor or NULL if there was an error.
+ * @sa rcb4_rt_delete(), rcb4_rt_run(), rcb4_rt_start().
+ */
+rcb4_rt* rcb4_rt_create(rcb4_connection* conn, uint32_t period_usecs, rcb4_rt_step step, void* data);
+
+/**
+ * @brief Stops the executor (if it was started with rcb4_rt_start()) and
+ * frees it.
+ * 
+ * @param rt is the executor to delete. It can be NULL.
+ */
+void rcb4_rt_delete(rcb4_rt* rt);
+
+/**
+ * @brief Sets the SCHED_FIFO priority of the loop.
+ * 
+ * Usually requires root or the CAP_SYS_NICE capability.
+ * 
+ * @param rt is the executor.
+ * @param priority is the real-time priority (1~99). 0 (default) keeps the
+ * normal scheduling policy.
+ * @return 0 if OK.
+ */
+int rcb4_rt_set_priority(rcb4_rt* rt, int priority);
+
+/**
+ * @brief Pins the loop to a CPU.
+ * 
+ * @param rt is the executor.
+ * @param cpu is the CPU number. -1 (default) lets the kernel choose.
+ * @return 0 if OK.
+ */
+int rcb4_rt_set_cpu(rcb4_rt* rt, int cpu);
+
+/**
+ * @brief Locks all the memory of the process to avoid page faults in the loop.
+ * 
+ * @param rt is the executor.
+ * @param enable 1 to call mlockall() before starting, 0 (default) to not.
+ * @return 0 if OK.
+ */
+int rcb4_rt_set_mlock(rcb4_rt* rt, int enable);
+
+/**
+ * @brief Runs the loop in the calling thread.
+ * 
+ * The real-time configuration is applied to the calling thread. The function
+ * returns when step returns a value other than 0 or when rcb4_rt_stop() is
+ * called from another thread.
+ * 
+ * @param rt is the executor.
+ * @return The value returned by step, 0 if stopped with rcb4_rt_stop().
+ * @return -1 if the real-time configuration failed.
+ */
+int rcb4_rt_run(rcb4_rt* rt);
+
+/**
+ * @brief Runs the loop in a new thread.
+ * 
+ * @param rt is the executor.
+ * @return 0 if OK.
+ * @sa rcb4_rt_stop().
+ */
+int rcb4_rt_start(rcb4_rt* rt);
+
+/**
+ * @brief Stops the loop.
+ * 
+ * If the loop was started with rcb4_rt_start() waits for the thread to finish.
+ * 
+ * @param rt is the executor.
+ * @return The value the loop finished with (see rcb4_rt_run()).
+ */
+int rcb4_rt_stop(rcb4_rt* rt);
+
+/**
+ * @brief Gets the statistics of the executor.
+ * 
+ * Can be called from any thread while the loop is running.
+ * 
+ * @param rt is the executor.
+ * @param stats is where the statistics are copied.
+ */
+void rcb4_rt_get_stats(const rcb4_rt* rt, rcb4_rt_stats* stats);
+
+/**
+ * @brief Clears the statistics of the executor.
+ * 
+ * If the loop is running they are cleared at the start of the next cycle.
+ * 
+ * @param rt is the executor.
+ */
+void rcb4_rt_reset_stats(rcb4_rt* rt);
+
+
+/**************
+ * TRAJECTORY *
+ **************/
+
+/**
+ * @brief Creates a new trajectory.
+ * 
+ * A trajectory is a list of timed keyframes. When it is played the positions
+ * of all the servos are interpolated in the computer and sent to the robot as
+ * RCB4_COMM_CONST commands every period_usecs.
+ * 
+ * The frame sent is always the one that corresponds to the elapsed time since
+ * the start, so if the link is slow some frames are dropped but the motion
+ * keeps its intended speed. The next frames are computed in advance while
+ * waiting for the robot.
+ * 
+ * Example:
+ * @code
+ * uint16_t pos[RCB4_ICS_QTY];
+ * rcb4_traj* traj = rcb4_traj_create(conn, 20000); // 50Hz
+ * 
+ * pos[18] = 7500; // ICS 19
+ * rcb4_traj_add_keyframe(traj, 0, 1ULL << 18, pos);
+ * pos[18] = 8500;
+ * rcb4_traj_add_keyframe(traj, 1000, 1ULL << 18, pos); // 1 second later
+ * 
+ * rcb4_traj_play(traj);
+ * rcb4_traj_delete(traj);
+ * @endcode
+ * 
+ * @param conn is the connection to the robot.
+ * @param period_usecs is the period of the frames in microseconds.
+ * @return A new allocated trajectory or NULL if there was an error.
+ * @sa rcb4_traj_delete(), rcb4_traj_add_keyframe(), rcb4_traj_play().
+ */
+rcb4_traj* rcb4_traj_create(rcb4_connection* conn, uint32_t period_usecs);
+
+/**
+ * @brief Frees the trajectory.
+ * 
+ * @param traj is the trajectory to delete. It can be NULL.
+ */
+void rcb4_traj_delete(rcb4_traj* traj);
+
+/**
+ * @brief Sets the interpolation between keyframes.
+ * 
+ * @param traj is the trajectory.
+ * @param mode is RCB4_TRAJ_LINEAR, RCB4_TRAJ_CUBIC or RCB4_TRAJ_MINJERK
+ * (default).
+ * @return 0 if OK.
+ */
+int rcb4_traj_set_interpolation(rcb4_traj* traj, int mode);
+
+/**
+ * @brief Sets the speed used in the RCB4_COMM_CONST frames.
+ * 
+ * As the positions are already interpolated the default (255, the fastest)
+ * is usually the right one.
+ * 
+ * @param traj is the trajectory.
+ * @param speed is the speed, from 1 to 255 being 1 the slowest.
+ * @return 0 if OK.
+ */
+int rcb4_traj_set_speed(rcb4_traj* traj, uint8_t speed);
+
+/**
+ * @brief Removes all the keyframes.
+ * 
+ * @param traj is the trajectory.
+ */
+void rcb4_traj_clear(rcb4_traj* traj);
+
+/**
+ * @brief Adds a keyframe at the end of the trajectory.
+ * 
+ * The servos that are not in mask keep the position of the previous keyframe.
+ * If a servo appears for the first time it holds its position from the start
+ * of the trajectory.
+ * 
+ * @param traj is the trajectory.
+ * @param time_ms is the time of the keyframe in milliseconds from the start.
+ * It must be greater than the time of the previous keyframe.
+ * @param mask selects the servos of the keyframe. Bit 0 is ICS 1, bit 35 is
+ * ICS 36.
+ * @param positions is an array of RCB4_ICS_QTY positions indexed by ICS - 1.
+ * Only the positions selected by mask are used.
+ * @return 0 if OK.
+ */
+int rcb4_traj_add_keyframe(rcb4_traj* traj, uint32_t time_ms, uint64_t mask, const uint16_t* positions);
+
+/**
+ * @brief Gets the duration of the trajectory.
+ * 
+ * @param traj is the trajectory.
+ * @return The time of the last keyframe in milliseconds.
+ */
+uint32_t rcb4_traj_get_duration(const rcb4_traj* traj);
+
+/**
+ * @brief Gets the interpolated positions at a given time.
+ * 
+ * @param traj is the trajectory.
+ * @param time_usecs is the time in microseconds from the start.
+ * @param positions is an array of RCB4_ICS_QTY where the positions are saved
+ * (indexed by ICS - 1).
+ * @return 0 if OK.
+ */
+int rcb4_traj_sample(rcb4_traj* traj, uint64_t time_usecs, uint16_t* positions);
+
+/**
+ * @brief Starts playing the trajectory without blocking.
+ * 
+ * Call rcb4_traj_update() periodically (for example from a rcb4_rt step) to
+ * send the frames.
+ * 
+ * @param traj is the trajectory.
+ * @return 0 if OK.
+ * @sa rcb4_traj_update(), rcb4_traj_play().
+ */
+int rcb4_traj_start(rcb4_traj* traj);
+
+/**
+ * @brief Sends the frame that corresponds to the current time.
+ * 
+ * Does nothing if that frame was already sent.
+ * 
+ * @param traj is the trajectory. It must have been started.
+ * @return 1 if the trajectory continues.
+ * @return 0 if the last frame has been sent.
+ * @return < 0 if there was an error.
+ */
+int rcb4_traj_update(rcb4_traj* traj);
+
+/**
+ * @brief Plays the whole trajectory and returns when it finishes.
+ * 
+ * @param traj is the trajectory.
+ * @return 0 if OK.
+ * @return < 0 if there was an error.
+ */
+int rcb4_traj_play(rcb4_traj* traj);
+
+
+/****************
+ * MOTION FILES *
+ ****************/
+
+/**
+ * @brief Opens a binary motion file.
+ * 
+ * A motion file holds a list of frames. Each frame has a time, a speed and the
+ * positions of the servos selected by the mask of the motion. The positions are
+ * stored servo by servo (all the frames of a servo are contiguous) and aligned
+ * so they can be processed with vector instructions.
+ * 
+ * The file is mapped in memory and used without copying it. Only the header is
+ * checked when opening, so opening hundreds of motions is fast. The data is
+ * checked (checksum and frames) the first time a frame is used or when
+ * rcb4_motion_validate() is called.
+ * 
+ * Example:
+ * @code
+ * rcb4_comm* comm = rcb4_command_create(RCB4_COMM_CONST);
+ * uint32_t cursor = 0;
+ * rcb4_motion* motion = rcb4_motion_open("walk.rcbm");
+ * 
+ * while(rcb4_motion_next(motion, &cursor, comm) > 0)
+ *     rcb4_send_command(conn, comm, NULL);
+ * 
+ * rcb4_motion_close(motion);
+ * @endcode
+ * 
+ * @param path is the file to open.
+ * @return A new allocated motion or NULL if there was an error.
+ * @sa rcb4_motion_close(), rcb4_motion_write().
+ */
+rcb4_motion* rcb4_motion_open(const char* path);
+
+/**
+ * @brief Unmaps the motion file and frees the motion.
+ * 
+ * @param motion is the motion to close. It can be NULL.
+ */
+void rcb4_motion_close(rcb4_motion* motion);
+
+/**
+ * @brief Checks the data of the motion.
+ * 
+ * Verifies the checksum and that the times increase and the speeds are valid.
+ * The result is remembered so it is only done once.
+ * 
+ * @param motion is the motion.
+ * @return 0 if the motion is valid.
+ */
+int rcb4_motion_validate(rcb4_motion* motion);
+
+/**
+ * @brief Gets the number of frames of the motion.
+ * 
+ * @param motion is the motion.
+ * @return The number of frames.
+ */
+uint32_t rcb4_motion_get_frames(const rcb4_motion* motion);
+
+/**
+ * @brief Gets the servos used by the motion.
+ * 
+ * @param motion is the motion.
+ * @return The servo mask. Bit 0 is ICS 1.
+ */
+uint64_t rcb4_motion_get_mask(const rcb4_motion* motion);
+
+/**
+ * @brief Gets the time of a frame.
+ * 
+ * @param motion is the motion.
+ * @param frame is the frame number.
+ * @return The time in milliseconds from the start of the motion.
+ */
+uint32_t rcb4_motion_get_time(const rcb4_motion* motion, uint32_t frame);
+
+/**
+ * @brief Gets the positions of a frame.
+ * 
+ * @param motion is the motion.
+ * @param frame is the frame number.
+ * @param positions is an array of RCB4_ICS_QTY indexed by ICS - 1. Only the
+ * servos in the mask of the motion are written.
+ * @return 0 if OK.
+ */
+int rcb4_motion_get_positions(rcb4_motion* motion, uint32_t frame, uint16_t* positions);
+
+/**
+ * @brief Builds the RCB4_COMM_CONST command of a frame.
+ * 
+ * @param motion is the motion.
+ * @param frame is the frame number.
+ * @param comm is an allocated command. It is recreated as RCB4_COMM_CONST.
+ * @return 0 if OK.
+ */
+int rcb4_motion_get_command(rcb4_motion* motion, uint32_t frame, rcb4_comm* comm);
+
+/**
+ * @brief Iterates over the frames of the motion.
+ * 
+ * Builds the RCB4_COMM_CONST command of the frame pointed by cursor and
+ * advances it. Initialize cursor to 0 to start from the first frame.
+ * 
+ * @param motion is the motion.
+ * @param cursor is the position of the iterator.
+ * @param comm is an allocated command. It is recreated as RCB4_COMM_CONST.
+ * @return 1 if a frame was built.
+ * @return 0 if there are no more frames.
+ * @return < 0 if there was an error.
+ */
+int rcb4_motion_next(rcb4_motion* motion, uint32_t* cursor, rcb4_comm* comm);
+
+/**
+ * @brief Writes a binary motion file.
+ * 
+ * @param path is the file to create.
+ * @param mask selects the servos of the motion. Bit 0 is ICS 1.
+ * @param frames is the number of frames.
+ * @param time is an array of frames times in milliseconds. Must increase.
+ * @param speed is an array of frames speeds, from 1 to 255.
+ * @param positions is an array of frames * RCB4_ICS_QTY positions, frame by
+ * frame and indexed by ICS - 1. Only the servos in mask are stored.
+ * @return 0 if OK.
+ */
+int rcb4_motion_write(const char* path, uint64_t mask, uint32_t frames, const uint32_t* time, const uint8_t* speed, const uint16_t* positions);
+
+
+/****************
+ * MOTION SLOTS *
+ ****************/
+
+#define RCB4_MOTION_ROM_BASE 0x0B80 //!< ROM address of the first motion slot.
+#define RCB4_MOTION_SLOT_SIZE 0x0800 //!< Size of a motion slot in the ROM.
+#define RCB4_MOTION_SLOTS 120 //!< Number of motion slots.
+#define RCB4_MOTION_NAME_MAX 32 //!< Maximum length of a motion name, including the '\0'.
+
+/**
+ * @brief ROM address of a motion slot (from 0 to RCB4_MOTION_SLOTS - 1).
+ */
+#define RCB4_MOTION_SLOT_ADDRESS(slot) (RCB4_MOTION_ROM_BASE + (uint32_t)(slot) * RCB4_MOTION_SLOT_SIZE)
+
+/**
+ * @brief Creates an empty motion index.
+ * 
+ * The index knows which motion slots of the ROM hold a motion and the names
+ * given to them, so a motion can be played by name without asking the robot
+ * anything.
+ * 
+ * Only the slot of each motion is kept. Its address follows from it (see
+ * RCB4_MOTION_SLOT_ADDRESS()) and the length is not needed: the CALL only
+ * takes the address, and the motion itself decides where it ends inside its
+ * RCB4_MOTION_SLOT_SIZE bytes.
+ * 
+ * @return The index or NULL if there was an error.
+ * @sa rcb4_motion_index_delete(), rcb4_motion_index_scan(),
+ * rcb4_motion_index_load().
+ */
+rcb4_motion_index* rcb4_motion_index_create(void);
+
+/**
+ * @brief Frees a motion index.
+ * 
+ * @param index is the index to delete. Can be NULL.
+ */
+void rcb4_motion_index_delete(rcb4_motion_index* index);
+
+/**
+ * @brief Finds the slots of the robot that hold a motion.
+ * 
+ * The first bytes of every slot are read, all of them in a single pipelined
+ * transfer; a slot that was never written (erased flash, all 0xFF) is empty.
+ * The names already in the index are kept.
+ * If the connection has a ROM cache open (see rcb4_rom_cache_open()) it is used,
+ * so the next time the program starts the scan doesn't use the serial link.
+ * 
+ * @param index is the index.
+ * @param conn is the connection to the robot.
+ * @return The number of slots in use.
+ * @return < 0 if there was an error.
+ */
+int rcb4_motion_index_scan(rcb4_motion_index* index, rcb4_connection* conn);
+
+/**
+ * @brief Gives a name to a motion slot.
+ * 
+ * The slot is marked as used. If the name was given to another slot it is
+ * moved to this one.
+ * 
+ * @param index is the index.
+ * @param slot is the slot, from 0 to RCB4_MOTION_SLOTS - 1.
+ * @param name is the name, shorter than RCB4_MOTION_NAME_MAX. "" to remove the
+ * name of the slot and keep it as used, NULL to clear the slot (no name and not
+ * used, for example after erasing its motion).
+ * @return 0 if OK.
+ */
+int rcb4_motion_index_set_name(rcb4_motion_index* index, uint8_t slot, const char* name);
+
+/**
+ * @brief Finds a motion by name.
+ * 
+ * @param index is the index.
+ * @param name is the name of the motion.
+ * @return The slot of the motion.
+ * @return -1 if there is no motion with that name.
+ */
+int rcb4_motion_index_find(const rcb4_motion_index* index, const char* name);
+
+/**
+ * @brief Saves the index to a text file.
+ * 
+ * Each used slot is a line with the slot number and its name ("-" if it has
+ * none). The file can be edited by hand to name the motions.
+ * 
+ * @param index is the index.
+ * @param path is the file.
+ * @return 0 if OK.
+ */
+int rcb4_motion_index_save(const rcb4_motion_index* index, const char* path);
+
+/**
+ * @brief Loads an index saved with rcb4_motion_index_save().
+ * 
+ * The slots and names of the file are added to the index. Empty lines and lines
+ * starting with '#' are ignored.
+ * 
+ * @param index is the index.
+ * @param path is the file.
+ * @return 0 if OK.
+ */
+int rcb4_motion_index_load(rcb4_motion_index* index, const char* path);
+
+/**
+ * @brief Plays a motion of the ROM by name.
+ * 
+ * The name is resolved in the index (no serial traffic) and a single CALL to
+ * the slot is sent.
+ * 
+ * @param conn is the connection to the robot.
+ * @param index is the index.
+ * @param name is the name of the motion.
+ * @return 0 if OK.
+ * @sa rcb4_call().
+ */
+int rcb4_play_motion(rcb4_connection* conn, const rcb4_motion_index* index, const char* name);
+
+
+/*************
+ * ASSEMBLER *
+ *************/
+
+/**
+ * @brief Creates an empty routine.
+ * 
+ * The robot can run from its ROM the same commands it receives through the
+ * serial link. A routine is a list of commands (built with the usual
+ * rcb4_command_*() functions), labels, jumps and calls, that is placed in the
+ * ROM with rcb4_asm_upload() and run with a single rcb4_call().
+ * 
+ * Example (increments a counter in RAM until it reaches 10):
+ * @code
+ * rcb4_asm* a = rcb4_asm_create();
+ * rcb4_comm* comm = rcb4_command_create(RCB4_COMM_ADD);
+ * uint8_t one = 1, ten = 10;
+ * 
+ * rcb4_asm_label(a, "loop");
+ * rcb4_command_set_src_literal(comm, &one, 1);
+ * rcb4_command_set_dst_ram(comm, 0x0460);
+ * rcb4_asm_add(a, comm);
+ * rcb4_command_recreate(comm, RCB4_COMM_SUB);
+ * rcb4_command_set_src_literal(comm, &ten, 1);
+ * rcb4_command_set_dst_ram(comm, 0x0460);
+ * rcb4_command_set_dst_do_not_save(comm);
+ * rcb4_asm_add(a, comm);
+ * rcb4_asm_jmp(a, "loop", RCB4_CONDITION_Z_CLR);
+ * rcb4_asm_ret(a);
+ * 
+ * rcb4_asm_upload(a, conn, 0x3F000);
+ * rcb4_call(conn, 0x3F000, RCB4_CONDITION_ALWAYS);
+ * @endcode
+ * 
+ * @return The routine or NULL if there was an error.
+ * @sa rcb4_asm_delete().
+ */
+rcb4_asm* rcb4_asm_create(void);
+
+/**
+ * @brief Frees a routine.
+ * 
+ * @param a is the routine to delete. Can be NULL.
+ */
+void rcb4_asm_delete(rcb4_asm* a);
+
+/**
+ * @brief Removes all the instructions and labels of a routine.
+ * 
+ * @param a is the routine.
+ */
+void rcb4_asm_clear(rcb4_asm* a);
+
+/**
+ * @brief Appends a command to a routine.
+ * 
+ * The command is copied, it can be modified or deleted afterwards.
+ * 
+ * @param a is the routine.
+ * @param comm is the command. A MOV to COM (rcb4_command_set_dst_com()) is not
+ * allowed.
+ * @return 0 if OK.
+ */
+int rcb4_asm_add(rcb4_asm* a, const rcb4_comm* comm);
+
+/**
+ * @brief Defines a label at the current end of a routine.
+ * 
+ * @param a is the routine.
+ * @param name is the name of the label, shorter than RCB4_ASM_LABEL_MAX.
+ * @return 0 if OK.
+ */
+int rcb4_asm_label(rcb4_asm* a, const char* name);
+
+/**
+ * @brief Appends a jump to a label.
+ * 
+ * The label can be defined later, it is resolved by rcb4_asm_link().
+ * 
+ * @param a is the routine.
+ * @param label is the destination.
+ * @param conditions are the same as in rcb4_jmp().
+ * @return 0 if OK.
+ */
+int rcb4_asm_jmp(rcb4_asm* a, const char* label, uint8_t conditions);
+
+/**
+ * @brief Appends a call to a label of the routine.
+ * 
+ * @param a is the routine.
+ * @param label is the destination. The code there must end with rcb4_asm_ret().
+ * @param conditions are the same as in rcb4_call().
+ * @return 0 if OK.
+ */
+int rcb4_asm_call(rcb4_asm* a, const char* label, uint8_t conditions);
+
+/**
+ * @brief Appends a call to a fixed ROM address (for example a motion slot or
+ * another routine).
+ * 
+ * @param a is the routine.
+ * @param addr is the ROM address.
+ * @param conditions are the same as in rcb4_call().
+ * @return 0 if OK.
+ */
+int rcb4_asm_call_addr(rcb4_asm* a, uint32_t addr, uint8_t conditions);
+
+/**
+ * @brief Appends a return.
+ * 
+ * @param a is the routine.
+ * @return 0 if OK.
+ */
+int rcb4_asm_ret(rcb4_asm* a);
+
+/**
+ * @brief Places a routine at a ROM address.
+ * 
+ * The addresses of the jumps and calls to labels are resolved.
+ * 
+ * @param a is the routine.
+ * @param base is the ROM address where the routine will be.
+ * @return 0 if OK.
+ * @return < 0 if a label is not defined or the routine doesn't fit.
+ */
+int rcb4_asm_link(rcb4_asm* a, uint32_t base);
+
+/**
+ * @brief Gets the code of a routine.
+ * 
+ * @param a is the routine.
+ * @param size if not NULL, receives the size of the code in bytes.
+ * @return The code. Only valid until the routine is modified.
+ */
+const uint8_t* rcb4_asm_get_code(const rcb4_asm* a, uint32_t* size);
+
+/**
+ * @brief Gets the ROM address of a label of a linked routine.
+ * 
+ * @param a is the routine.
+ * @param name is the label.
+ * @return The address of the label.
+ * @return -1 if the label doesn't exist or the routine is not linked.
+ */
+int32_t rcb4_asm_get_label(const rcb4_asm* a, const char* name);
+
+/**
+ * @brief Links a routine and writes it to the ROM of the robot.
+ * 
+ * @param a is the routine.
+ * @param conn is the connection to the robot.
+ * @param base is the ROM address where the routine is written.
+ * @return 0 if OK.
+ * @sa rcb4_asm_link(), rcb4_rom_write().
+ */
+int rcb4_asm_upload(rcb4_asm* a, rcb4_connection* conn, uint32_t base);
+
+
+/***************
+ * EXPRESSIONS *
+ ***************/
+
+/**
+ * @brief Creates an empty expression graph.
+ * 
+ * Expressions are built from constants, RAM variables and AD converters with
+ * the rcb4_expr_*() functions, which return the id of the new node (or < 0 if
+ * there was an error; an invalid operand makes the result invalid too, so the
+ * errors can be checked at the end). rcb4_expr_compile() then translates a node
+ * to commands of a routine (see rcb4_asm_create()) that compute it inside the
+ * robot.
+ * 
+ * All the values are 16 bits and the arithmetic wraps around, so fixed point
+ * gains are written as a multiplication followed by a shift. The robot
+ * compares, divides and shifts without sign, so keep the signals offset (like
+ * the servo positions, centered at 7500) when using rcb4_expr_div(),
+ * rcb4_expr_shr() or rcb4_expr_clamp().
+ * 
+ * Example (proportional reflex: servo target = 7500 + ((AD3 - 240) * gain) / 4,
+ * limited to 5000~10000). AD3 - 240 can be negative, so the sum is computed
+ * as 7500*4 + AD3*gain - 240*gain, that stays positive (for gains up to 34)
+ * until the shift:
+ * @code
+ * rcb4_expr* e = rcb4_expr_create(0x0470, 4);
+ * int gain = rcb4_expr_ram(e, 0x0468); // In RAM, the host can change it
+ * int sum = rcb4_expr_add(e, rcb4_expr_const(e, 7500*4), rcb4_expr_mul(e, rcb4_expr_ad(e, 3), gain));
+ * sum = rcb4_expr_sub(e, sum, rcb4_expr_mul(e, rcb4_expr_const(e, 240), gain));
+ * int out = rcb4_expr_clamp(e, rcb4_expr_shr(e, sum, 2), 5000, 10000);
+ * rcb4_expr_compile(e, out, 0x0460, a);
+ * @endcode
+ * 
+ * @param temp_addr is the RAM address of the temporaries used for intermediate
+ * results. Must not be used for anything else.
+ * @param temps is the number of temporaries (2 bytes each).
+ * @return The expression graph or NULL if there was an error.
+ * @sa rcb4_expr_delete(), rcb4_expr_compile().
+ */
+rcb4_expr* rcb4_expr_create(uint16_t temp_addr, uint8_t temps);
+
+/**
+ * @brief Frees an expression graph.
+ * 
+ * @param e is the expression graph to delete. Can be NULL.
+ */
+void rcb4_expr_delete(rcb4_expr* e);
+
+/**
+ * @brief Adds a constant.
+ * 
+ * @param e is the expression graph.
+ * @param value is the constant, from 0 to 65535. Negative constants are not
+ * accepted because the values are unsigned (see rcb4_expr_create()), subtract
+ * instead.
+ * @return The node or < 0 if there was an error.
+ */
+int rcb4_expr_const(rcb4_expr* e, int32_t value);
+
+/**
+ * @brief Adds a 16 bit RAM variable.
+ * 
+ * @param e is the expression graph.
+ * @param addr is the RAM address of the variable.
+ * @return The node or < 0 if there was an error.
+ */
+int rcb4_expr_ram(rcb4_expr* e, uint16_t addr);
+
+/**
+ * @brief Adds the value of an AD converter.
+ * 
+ * @param e is the expression graph.
+ * @param ad_id is the converter, from 0 to 10.
+ * @return The node or < 0 if there was an error.
+ */
+int rcb4_expr_ad(rcb4_expr* e, uint8_t ad_id);
+
+/**
+ * @brief Adds the node a + b.
+ * 
+ * @param e is the expression graph.
+ * @param a is the first operand.
+ * @param b is the second operand. It costs a temporary unless it is a constant
+ * or a variable.
+ * @return The node or < 0 if there was an error.
+ */
+int rcb4_expr_add(rcb4_expr* e, int a, int b);
+
+/**
+ * @brief Adds the node a - b. Same as rcb4_expr_add().
+ */
+int rcb4_expr_sub(rcb4_expr* e, int a, int b);
+
+/**
+ * @brief Adds the node a * b. Same as rcb4_expr_add().
+ */
+int rcb4_expr_mul(rcb4_expr* e, int a, int b);
+
+/**
+ * @brief Adds the node a / b (unsigned). Same as rcb4_expr_add().
+ */
+int rcb4_expr_div(rcb4_expr* e, int a, int b);
+
+/**
+ * @brief Adds the node a << shifts.
+ * 
+ * @param e is the expression graph.
+ * @param a is the operand.
+ * @param shifts is the number of bits, from 1 to 15.
+ * @return The node or < 0 if there was an error.
+ */
+int rcb4_expr_shl(rcb4_expr* e, int a, uint8_t shifts);
+
+/**
+ * @brief Adds the node a >> shifts (unsigned). Same as rcb4_expr_shl().
+ */
+int rcb4_expr_shr(rcb4_expr* e, int a, uint8_t shifts);
+
+/**
+ * @brief Adds the node a limited to [lo, hi] (unsigned).
+ * 
+ * Compiled as comparisons and conditional jumps, the routine must be linked
+ * with rcb4_asm_link() or rcb4_asm_upload().
+ * 
+ * @param e is the expression graph.
+ * @param a is the operand.
+ * @param lo is the minimum value.
+ * @param hi is the maximum value.
+ * @return The node or < 0 if there was an error.
+ */
+int rcb4_expr_clamp(rcb4_expr* e, int a, uint16_t lo, uint16_t hi);
+
+/**
+ * @brief Appends to a routine the commands that compute a node.
+ * 
+ * @param e is the expression graph.
+ * @param node is the node to compute.
+ * @param dst is the RAM address where the 16 bit result is saved. It can be one
+ * of the variables of the expression.
+ * @param a is the routine.
+ * @return 0 if OK.
+ * @return < 0 if the node is invalid or there are not enough temporaries.
+ */
+int rcb4_expr_compile(const rcb4_expr* e, int node, uint16_t dst, rcb4_asm* a);
+
+
+/*********
+ * BATCH *
+ *********/
+
+/**
+ * @brief Creates a batch executor.
+ * 
+ * A batch is a list of operations (any command except the MOVs to COM) that
+ * runs inside the robot in three transactions: the operations are written to a
+ * RAM mailbox with one MOV, a CALL runs a dispatcher in the ROM that copies
+ * them to a trampoline next to it and jumps there, and the values read by the
+ * operations are read back from a RAM result area with one more MOV.
+ * 
+ * The operations must fit in RCB4_BATCH_MAILBOX_SIZE bytes (minus 11 bytes
+ * used to close the list), around ten commands.
+ * 
+ * If the operations are the same as in the last execution the CALL goes
+ * straight to the trampoline, without writing the mailbox or the ROM.
+ * 
+ * @warning Each execution with different operations rewrites the trampoline
+ * in the ROM, which has a limited number of write cycles. Use it for
+ * occasional bursts of operations or for a fixed list, not for a list that
+ * changes in every cycle of a control loop; for those upload a fixed routine
+ * with rcb4_asm_upload() and change its parameters in RAM.
+ * 
+ * @param conn is the connection to the robot.
+ * @param rom_addr is where the dispatcher and the trampoline are placed
+ * (RCB4_BATCH_ROM_SIZE bytes).
+ * @param mailbox_addr is the RAM address of the mailbox
+ * (RCB4_BATCH_MAILBOX_SIZE bytes).
+ * @param result_addr is the RAM address of the result area
+ * (RCB4_BATCH_RESULT_SIZE + 1 bytes).
+ * @return The batch or NULL if there was an error.
+ * @sa rcb4_batch_install(), rcb4_batch_delete().
+ */
+rcb4_batch* rcb4_batch_create(rcb4_connection* conn, uint32_t rom_addr, uint16_t mailbox_addr, uint16_t result_addr);
+
+/**
+ * @brief Frees a batch executor.
+ * 
+ * @param batch is the batch to delete. Can be NULL.
+ */
+void rcb4_batch_delete(rcb4_batch* batch);
+
+/**
+ * @brief Writes the dispatcher of a batch to the ROM.
+ * 
+ * Only needed once per robot (and ROM address), the dispatcher stays in the
+ * ROM.
+ * 
+ * @param batch is the batch.
+ * @return 0 if OK.
+ */
+int rcb4_batch_install(rcb4_batch* batch);
+
+/**
+ * @brief Removes all the operations of a batch.
+ * 
+ * @param batch is the batch.
+ */
+void rcb4_batch_clear(rcb4_batch* batch);
+
+/**
+ * @brief Appends an operation to a batch.
+ * 
+ * @param batch is the batch.
+ * @param comm is the command. It is copied.
+ * @return 0 if OK.
+ * @return < 0 if the batch is full or the command is not allowed.
+ */
+int rcb4_batch_add(rcb4_batch* batch, const rcb4_comm* comm);
+
+/**
+ * @brief Appends an operation that reads RAM.
+ * 
+ * @param batch is the batch.
+ * @param addr is the RAM address to read.
+ * @param size is the number of bytes.
+ * @return The offset of the value in the results (see rcb4_batch_get_result()).
+ * @return < 0 if there was an error.
+ */
+int rcb4_batch_read_ram(rcb4_batch* batch, uint16_t addr, uint8_t size);
+
+/**
+ * @brief Runs the operations of a batch.
+ * 
+ * Returns when the robot has finished them and the results have been read.
+ * The operations are kept, so the same batch can be run again.
+ * 
+ * @param batch is the batch. rcb4_batch_install() must have been called.
+ * @return 0 if OK.
+ */
+int rcb4_batch_execute(rcb4_batch* batch);
+
+/**
+ * @brief Gets a value read by the last execution of a batch.
+ * 
+ * @param batch is the batch.
+ * @param offset is the value returned by rcb4_batch_read_ram().
+ * @param value is where the value is saved.
+ * @param size is the size of the value.
+ * @return 0 if OK.
+ */
+int rcb4_batch_get_result(const rcb4_batch* batch, int offset, void* value, uint8_t size);
+
+
+/*****************
+ * SERVO STAGING *
+ *****************/
+
+/**
+ * @brief Creates a servo frame stage.
+ * 
+ * A stage keeps up to RCB4_STAGE_MAX_SLOTS frames (the target positions of a
+ * set of servos) in the RAM of the robot, loaded in advance with
+ * rcb4_stage_load() while the link is free. Each slot has a routine in the ROM
+ * that sends its positions to the servos with RCB4_COMM_ICS, so
+ * rcb4_stage_apply() only has to send a 7 byte CALL at the right moment.
+ * 
+ * With two slots a frame can be loaded while the other is being applied
+ * (double buffering).
+ * 
+ * Example:
+ * @code
+ * rcb4_stage* stage = rcb4_stage_create(conn, 0x3FFFFF, 2, 0x0300, 0x3E000);
+ * rcb4_stage_install(stage); // Once per robot
+ * rcb4_stage_load(stage, 0, frame[0]);
+ * for(i = 0; i < frames; i++)
+ * {
+ *     rcb4_stage_apply(stage, i % 2); // Exactly at the time of frame i
+ *     rcb4_stage_load(stage, (i + 1) % 2, frame[i + 1]); // Meanwhile, the next one
+ *     ...
+ * }
+ * @endcode
+ * 
+ * @param conn is the connection to the robot.
+ * @param mask selects the servos. Bit 0 is ICS 1.
+ * @param slots is the number of frames, from 1 to RCB4_STAGE_MAX_SLOTS.
+ * @param ram_addr is the RAM address of the slots
+ * (RCB4_STAGE_RAM_SIZE(servos, slots) bytes).
+ * @param rom_addr is the ROM address of the routines
+ * (RCB4_STAGE_ROM_SIZE(servos, slots) bytes).
+ * @return The stage or NULL if there was an error.
+ * @sa rcb4_stage_install(), rcb4_stage_delete().
+ */
+rcb4_stage* rcb4_stage_create(rcb4_connection* conn, uint64_t mask, uint8_t slots, uint16_t ram_addr, uint32_t rom_addr);
+
+/**
+ * @brief Frees a stage.
+ * 
+ * @param stage is the stage to delete. Can be NULL.
+ */
+void rcb4_stage_delete(rcb4_stage* stage);
+
+/**
+ * @brief Writes the routines of a stage to the ROM.
+ * 
+ * Must be called before rcb4_stage_apply(). The routines stay in the ROM, but
+ * this function also prepares the stage so it must be called every time the
+ * stage is created.
+ * 
+ * @param stage is the stage.
+ * @return 0 if OK.
+ */
+int rcb4_stage_install(rcb4_stage* stage);
+
+/**
+ * @brief Loads a frame in a slot.
+ * 
+ * The frame is sent in the biggest literals allowed (up to 40 servos each).
+ * 
+ * @param stage is the stage.
+ * @param slot is the slot, from 0 to slots - 1.
+ * @param positions is an array of RCB4_ICS_QTY positions indexed by ICS - 1.
+ * Only the servos of the stage are used. From 0 to 0x3FFF.
+ * @return 0 if OK.
+ */
+int rcb4_stage_load(rcb4_stage* stage, uint8_t slot, const uint16_t* positions);
+
+/**
+ * @brief Applies the frame of a slot.
+ * 
+ * @param stage is the stage.
+ * @param slot is the slot.
+ * @return 0 if OK.
+ */
+int rcb4_stage_apply(rcb4_stage* stage, uint8_t slot);
+
+
+/********************
+ * ON-BOARD SAMPLER *
+ ********************/
+
+/**
+ * @brief Creates a sampler that runs inside the robot.
+ * 
+ * A routine in the ROM copies a RAM region (for example some AD converters)
+ * to a ring of slots in RAM as fast as the robot can run it, tagging each slot
+ * with a 16 bit counter. rcb4_sampler_drain() reads the whole ring with a single MOV
+ * and returns the samples not seen yet, so several samples come in each
+ * transaction and the sample rate doesn't depend on the latency of the link.
+ * 
+ * There is no head and tail pointer in the robot (it has no indirect
+ * addressing), each slot carries the counter instead and the host sorts the
+ * slots by it.
+ * 
+ * The ring has as many slots as fit in one read: 118 / (size + 2). It must be
+ * drained before the robot fills it, or the oldest samples are lost. The
+ * number of lost samples is only right if the robot takes less than 32768
+ * samples between two drains.
+ * 
+ * While the sampler runs the robot is busy with it: don't play motions or call
+ * other routines at the same time.
+ * 
+ * Example (accelerometers in AD 3 and 4):
+ * @code
+ * rcb4_sampler* sampler = rcb4_sampler_create(conn, RCB4_AD_BASE_ADDR + 2*3, 4, 0x0300, 0x3D000);
+ * rcb4_sampler_install(sampler); // Once per robot
+ * rcb4_sampler_start(sampler);
+ * while(running)
+ * {
+ *     n = rcb4_sampler_drain(sampler, samples, 32);
+ *     ...
+ * }
+ * rcb4_sampler_stop(sampler);
+ * @endcode
+ * 
+ * @param conn is the connection to the robot.
+ * @param addr is the RAM address of the region to sample.
+ * @param size is the size of the region, from 1 to 57 bytes.
+ * @param ram_addr is the RAM address of the ring (RCB4_SAMPLER_RAM_SIZE bytes).
+ * @param rom_addr is the ROM address of the routine
+ * (RCB4_SAMPLER_ROM_SIZE(slots) bytes).
+ * @return The sampler or NULL if there was an error.
+ * @sa rcb4_sampler_install(), rcb4_sampler_delete().
+ */
+rcb4_sampler* rcb4_sampler_create(rcb4_connection* conn, uint16_t addr, uint8_t size, uint16_t ram_addr, uint32_t rom_addr);
+
+/**
+ * @brief Frees a sampler. It doesn't stop it.
+ * 
+ * @param sampler is the sampler to delete. Can be NULL.
+ */
+void rcb4_sampler_delete(rcb4_sampler* sampler);
+
+/**
+ * @brief Writes the routine of a sampler to the ROM.
+ * 
+ * The routine stays in the ROM, but this function also prepares the sampler
+ * so it must be called every time the sampler is created.
+ * 
+ * @param sampler is the sampler.
+ * @return 0 if OK.
+ */
+int rcb4_sampler_install(rcb4_sampler* sampler);
+
+/**
+ * @brief Clears the ring and starts sampling.
+ * 
+ * @param sampler is the sampler.
+ * @return 0 if OK.
+ */
+int rcb4_sampler_start(rcb4_sampler* sampler);
+
+/**
+ * @brief Asks the routine to stop at the end of the current lap of the ring.
+ * 
+ * @param sampler is the sampler.
+ * @return 0 if OK.
+ */
+int rcb4_sampler_stop(rcb4_sampler* sampler);
+
+/**
+ * @brief Reads the new samples.
+ * 
+ * The robot has no clock the host can read, so the timestamps are spread
+ * evenly between the previous drain and this one.
+ * 
+ * @param sampler is the sampler.
+ * @param samples is where the samples are saved, oldest first. The data is a
+ * copy of the sampled region.
+ * @param max is the size of samples. If there are more new samples the oldest
+ * are dropped.
+ * @return The number of samples saved.
+ * @return < 0 if there was an error.
+ * @sa rcb4_sampler_get_lost().
+ */
+int rcb4_sampler_drain(rcb4_sampler* sampler, rcb4_sample* samples, int max);
+
+/**
+ * @brief Gets the number of samples lost (overwritten before being drained).
+ * 
+ * @param sampler is the sampler.
+ * @return The number of samples lost since the sampler was created.
+ */
+uint32_t rcb4_sampler_get_lost(const rcb4_sampler* sampler);
+
+
+/******************
+ * RAM OPERATIONS *
+ ******************/
+
+#define RCB4_RAM_VAR_MAX_SIZE 4 //!< Maximum size of a variable for the rcb4_ram_*() functions.
+
+/**
+ * @brief Sets bits of a variable in the RAM of the robot (variable |= mask).
+ * 
+ * The robot does the operation itself with a single OR command, so it takes
+ * one transaction instead of a read and a write, and nothing the robot writes
+ * to the variable in between is lost. The robot replies with the new value.
+ * 
+ * @param conn is the connection to the robot.
+ * @param addr is the RAM address of the variable.
+ * @param mask has the bits to set. Only the lower size bytes are used.
+ * @param size is the size of the variable, from 1 to 4 bytes.
+ * @param result is where the new value is saved. Can be NULL.
+ * @return 0 if OK.
+ * @sa rcb4_ram_clear_bits(), rcb4_ram_toggle_bits(), rcb4_ram_test_bits().
+ */
+int rcb4_ram_set_bits(rcb4_connection* conn, uint16_t addr, uint32_t mask, uint8_t size, uint32_t* result);
+
+/**
+ * @brief Clears bits of a variable in the RAM of the robot (variable &= ~mask).
+ * 
+ * Single AND command. @sa rcb4_ram_set_bits() for details.
+ * 
+ * @param conn is the connection to the robot.
+ * @param addr is the RAM address of the variable.
+ * @param mask has the bits to clear. Only the lower size bytes are used.
+ * @param size is the size of the variable, from 1 to 4 bytes.
+ * @param result is where the new value is saved. Can be NULL.
+ * @return 0 if OK.
+ */
+int rcb4_ram_clear_bits(rcb4_connection* conn, uint16_t addr, uint32_t mask, uint8_t size, uint32_t* result);
+
+/**
+ * @brief Toggles bits of a variable in the RAM of the robot (variable ^= mask).
+ * 
+ * Single XOR command. @sa rcb4_ram_set_bits() for details.
+ * 
+ * @param conn is the connection to the robot.
+ * @param addr is the RAM address of the variable.
+ * @param mask has the bits to toggle. Only the lower size bytes are used.
+ * @param size is the size of the variable, from 1 to 4 bytes.
+ * @param result is where the new value is saved. Can be NULL.
+ * @return 0 if OK.
+ */
+int rcb4_ram_toggle_bits(rcb4_connection* conn, uint16_t addr, uint32_t mask, uint8_t size, uint32_t* result);
+
+/**
+ * @brief Reads some bits of a variable in the RAM of the robot
+ * (variable & mask) without changing it.
+ * 
+ * Uses an AND command with rcb4_command_set_dst_do_not_save(), so the robot
+ * only replies with the masked value. Unlike a MOV to COM, it also updates the
+ * zero flag of the robot.
+ * 
+ * @param conn is the connection to the robot.
+ * @param addr is the RAM address of the variable.
+ * @param mask has the bits to read. Only the lower size bytes are used.
+ * @param size is the size of the variable, from 1 to 4 bytes.
+ * @param result is where (variable & mask) is saved.
+ * @return 0 if OK.
+ */
+int rcb4_ram_test_bits(rcb4_connection* conn, uint16_t addr, uint32_t mask, uint8_t size, uint32_t* result);
+
+/**
+ * @brief Adds a value to a counter in the RAM of the robot
+ * (variable += value).
+ * 
+ * Single ADD command. Negative values subtract. The robot can only add 8 and
+ * 16 bit variables. @sa rcb4_ram_set_bits() for details.
+ * 
+ * @param conn is the connection to the robot.
+ * @param addr is the RAM address of the variable.
+ * @param value is the value to add.
+ * @param size is the size of the variable, 1 or 2 bytes.
+ * @param result is where the new value is saved. Can be NULL.
+ * @return 0 if OK.
+ */
+int rcb4_ram_add(rcb4_connection* conn, uint16_t addr, int32_t value, uint8_t size, uint32_t* result);
+
+/**
+ * @brief Shifts a variable in the RAM of the robot.
+ * 
+ * Single SHIFT command. @sa rcb4_ram_set_bits() for details.
+ * 
+ * @param conn is the connection to the robot.
+ * @param addr is the RAM address of the variable.
+ * @param shifts is the number of bits to shift, from -127 to 127. Positive
+ * values shift to the left, negative values to the right.
+ * @param size is the size of the variable, from 1 to 4 bytes.
+ * @param result is where the new value is saved. Can be NULL.
+ * @return 0 if OK.
+ */
+int rcb4_ram_shift(rcb4_connection* conn, uint16_t addr, int8_t shifts, uint8_t size, uint32_t* result);
+
+
+/***********
+ * REACTOR *
+ ***********/
+
+/**
+ * @brief Creates a reactor to drive several robots from a single thread.
+ * 
+ * Each robot is a connection opened with rcb4_init(). The requests submitted
+ * to a robot are sent one after the other, but all the robots work at the
+ * same time: a single epoll loop collects the replies as they arrive and a
+ * timer wheel takes care of the deadlines, so one thread is enough for any
+ * number of robots and nothing sleeps a fixed delay.
+ * 
+ * While a connection belongs to a reactor it must only be used through the
+ * reactor.
+ * 
+ * Example:
+ * @code
+ * rcb4_reactor* reactor = rcb4_reactor_create();
+ * for(i = 0; i < robots; i++)
+ *     id[i] = rcb4_reactor_add(reactor, conn[i]);
+ * for(i = 0; i < robots; i++)
+ *     rcb4_reactor_submit(reactor, id[i], read_battery, battery_read, &battery[i]);
+ * while(rcb4_reactor_pending(reactor) > 0)
+ *     rcb4_reactor_run(reactor, -1);
+ * @endcode
+ * 
+ * @return The reactor or NULL if there was an error.
+ * @sa rcb4_reactor_add(), rcb4_reactor_delete().
+ */
+rcb4_reactor* rcb4_reactor_create(void);
+
+/**
+ * @brief Creates a reactor that uses a given backend to talk to the robots.
+ * 
+ * RCB4_REACTOR_EPOLL is what rcb4_reactor_create() uses.
+ * 
+ * RCB4_REACTOR_URING needs Linux 5.6 or newer. Each transaction is a chain of
+ * write, read and timeout that the kernel runs on its own. The chains of all
+ * the robots are queued and submitted by rcb4_reactor_run() in the same system
+ * call that waits for the replies, so there is one per iteration no matter the
+ * number of robots.
+ * 
+ * @param backend is RCB4_REACTOR_EPOLL or RCB4_REACTOR_URING.
+ * @return The reactor or NULL if there was an error (for example io_uring is
+ * not available).
+ * @sa rcb4_reactor_create().
+ */
+rcb4_reactor* rcb4_reactor_create_backend(uint8_t backend);
+
+/**
+ * @brief Frees a reactor.
+ * 
+ * The connections are given back to the user (they are not closed). The
+ * requests not done yet are dropped without calling their functions.
+ * 
+ * @param reactor is the reactor to delete. Can be NULL.
+ */
+void rcb4_reactor_delete(rcb4_reactor* reactor);
+
+/**
+ * @brief Adds a robot to a reactor.
+ * 
+ * The transport of the connection must be RCB4_TRANSPORT_POLLABLE, the "loop:"
+ * emulator can't be added.
+ * 
+ * @param reactor is the reactor.
+ * @param conn is the connection to the robot.
+ * @return The ID of the robot in the reactor (from 0 up).
+ * @return < 0 if there was an error.
+ */
+int rcb4_reactor_add(rcb4_reactor* reactor, rcb4_connection* conn);
+
+/**
+ * @brief Queues a command for a robot.
+ * 
+ * The command is copied, so it can be reused or deleted as soon as the
+ * function returns. If the robot is idle it is sent right away (with
+ * RCB4_REACTOR_URING it is queued and sent by the next rcb4_reactor_run()).
+ * 
+ * @param reactor is the reactor.
+ * @param robot is the ID of the robot.
+ * @param comm is the command.
+ * @param done is called with the reply from rcb4_reactor_run(). Can be NULL.
+ * @param data is passed to done.
+ * @return 0 if OK.
+ * @return < 0 if there was an error (for example the queue is full).
+ */
+int rcb4_reactor_submit(rcb4_reactor* reactor, int robot, const rcb4_comm* comm, rcb4_reactor_done done, void* data);
+
+/**
+ * @brief Waits for replies and deadlines and calls the functions of the
+ * requests that are done.
+ * 
+ * @param reactor is the reactor.
+ * @param timeout_ms is the maximum time to wait for something to happen in
+ * milliseconds. -1 waits until a request is done (and returns at once if
+ * there are no requests).
+ * @return The number of requests done.
+ * @return < 0 if there was an error.
+ */
+int rcb4_reactor_run(rcb4_reactor* reactor, int timeout_ms);
+
+/**
+ * @brief Gets the number of requests not done yet, all the robots.
+ * 
+ * @param reactor is the reactor.
+ * @return The number of requests queued or waiting for the reply.
+ */
+int rcb4_reactor_pending(const rcb4_reactor* reactor);
+
+
+
+/**********
+ * SERVER *
+ **********/
+
+/**
+ * @brief Creates a server that lets other processes use a connection.
+ * 
+ * Only one process can open the serial port. The server keeps the connection
+ * and listens on a Unix socket; the other processes connect with
+ * rcb4_open("unix:path") and use the usual functions. The clients send the
+ * same frames they would send to the robot, so nothing else changes for them.
+ * 
+ * The server collects the frames of all the clients and sends them to the
+ * robot in batches (as many as the pipeline depth of the connection, see
+ * rcb4_rom_set_pipeline()), so several processes don't pay the round trip one
+ * after the other. Identical reads of the same batch (for example two
+ * processes reading the AD converters) are sent only once. The clients of the
+ * real-time lane go first, see rcb4_client_set_lane().
+ * 
+ * samples/rcb4d.c is a complete daemon.
+ * 
+ * Example:
+ * @code
+ * rcb4_connection* conn = rcb4_init("/dev/ttyUSB0");
+ * rcb4_server* server = rcb4_server_create(conn, "/tmp/rcb4.sock");
+ * rcb4_server_run(server); // Until rcb4_server_stop()
+ * @endcode
+ * 
+ * @param conn is the connection to the robot. It can still be used by other
+ * threads of the process.
+ * @param path is the path of the socket. An old socket in the same path is
+ * removed.
+ * @return The server or NULL if there was an error.
+ * @sa rcb4_server_run(), rcb4_server_delete().
+ */
+rcb4_server* rcb4_server_create(rcb4_connection* conn, const char* path);
+
+/**
+ * @brief Disconnects the clients, removes the socket and frees a server.
+ * 
+ * The connection to the robot is not closed.
+ * 
+ * @param server is the server to delete. Can be NULL.
+ */
+void rcb4_server_delete(rcb4_server* server);
+
+/**
+ * @brief Serves the clients until rcb4_server_stop() is called.
+ * 
+ * @param server is the server.
+ * @return 0 if it was stopped.
+ * @return < 0 if there was an error.
+ */
+int rcb4_server_run(rcb4_server* server);
+
+/**
+ * @brief Makes rcb4_server_run() return.
+ * 
+ * It can be called from another thread or from a signal handler.
+ * 
+ * @param server is the server.
+ */
+void rcb4_server_stop(rcb4_server* server);
+
+/**
+ * @brief Gets the counters of a server.
+ * 
+ * @param server is the server.
+ * @param stats is where the counters are saved.
+ */
+void rcb4_server_get_stats(const rcb4_server* server, rcb4_server_stats* stats);
+
+/**
+ * @brief Tells the server the lane of a client.
+ * 
+ * Same idea as rcb4_thread_set_lane(), but between processes: the server only
+ * sends the frames of the background clients when no real-time client is
+ * waiting, or after 8 batches of the real-time lane in a row so they are
+ * never starved. All the clients start in the real-time lane.
+ * 
+ * @param conn is a connection opened with rcb4_open("unix:...").
+ * @param lane is RCB4_LANE_REALTIME or RCB4_LANE_BACKGROUND.
+ * @return 0 if OK.
+ */
+int rcb4_client_set_lane(rcb4_connection* conn, uint8_t lane);
+
+
+
+/**********
+ * BRIDGE *
+ **********/
+
+/**
+ * @brief Creates a shared memory bridge to the robot.
+ * 
+ * The bridge is a POSIX shared memory object (/dev/shm/name) that other
+ * processes map with rcb4_bridge_open(). It holds:
+ * - The samples of a stream: the latest one and a history ring, like
+ * rcb4_stream_latest() and rcb4_stream_read().
+ * - A mailbox of servo targets. Any process writes it with
+ * rcb4_bridge_set_targets() and a thread of the owner sends the last targets to
+ * the robot as a RCB4_COMM_CONST frame every period_usecs (only if they
+ * changed).
+ * 
+ * Reading the bridge is just a few memory accesses, without system calls or
+ * locks: the readers only retry if the writer was in the middle of an update.
+ * The writers of the targets take the mailbox in turns for the time it takes
+ * to copy them.
+ * 
+ * The object is only accessible by the user that creates it (mode 0600), the
+ * targets move real servos.
+ * 
+ * Example (owner):
+ * @code
+ * rcb4_stream* stream = rcb4_stream_create(conn);
+ * rcb4_stream_add_ad(stream, 1);
+ * rcb4_bridge* bridge = rcb4_bridge_create(conn, stream, "robot", 20000); // 50Hz
+ * rcb4_stream_start(stream);
+ * @endcode
+ * 
+ * Example (any other process):
+ * @code
+ * rcb4_bridge* bridge = rcb4_bridge_open("robot");
+ * rcb4_bridge_latest(bridge, &sample);
+ * rcb4_bridge_get_ad(bridge, &sample, 1, &value);
+ * rcb4_bridge_set_targets(bridge, 100, mask, positions);
+ * @endcode
+ * 
+ * @param conn is the connection to the robot.
+ * @param stream is the stream whose samples are shared. It must not be running
+ * yet. Can be NULL if only the targets are needed.
+ * @param name is the name of the shared memory object. An old object with the
+ * same name is replaced if the process that created it is dead. If it is
+ * still running the function fails.
+ * @param period_usecs is the period of the targets.
+ * @return The bridge or NULL if there was an error.
+ * @sa rcb4_bridge_open(), rcb4_bridge_delete().
+ */
+rcb4_bridge* rcb4_bridge_create(rcb4_connection* conn, rcb4_stream* stream, const char* name, uint32_t period_usecs);
+
+/**
+ * @brief Maps a bridge created by another process.
+ * 
+ * @param name is the name given to rcb4_bridge_create().
+ * @return The bridge or NULL if there was an error (it doesn't exist yet, or
+ * the owner uses another version of the library).
+ * @sa rcb4_bridge_create(), rcb4_bridge_delete().
+ */
+rcb4_bridge* rcb4_bridge_open(const char* name);
+
+/**
+ * @brief Unmaps a bridge and frees it.
+ * 
+ * If the bridge was created by this process, its thread is stopped, the stream
+ * is stopped too and the shared memory object is removed. The processes that
+ * have it open keep their mapping, but nothing is updated anymore.
+ * 
+ * @param bridge is the bridge to delete. Can be NULL.
+ */
+void rcb4_bridge_delete(rcb4_bridge* bridge);
+
+/**
+ * @brief Sets the target position of some servos.
+ * 
+ * The owner sends the targets in its next period. The servos not in mask keep
+ * their last target, so several processes can drive different servos.
+ * 
+ * @param bridge is the bridge.
+ * @param speed is the speed, from 1 to 255, for all the servos.
+ * @param mask selects the servos. Bit 0 is ICS 1, bit 35 is ICS 36.
+ * @param positions is an array of RCB4_ICS_QTY positions indexed by ICS - 1.
+ * Only the positions selected by mask are used.
+ * @return 0 if OK.
+ * @return -10 if another process doesn't release the mailbox (it was
+ * stopped while writing it, for example).
+ */
+int rcb4_bridge_set_targets(rcb4_bridge* bridge, uint8_t speed, uint64_t mask, const uint16_t* positions);
+
+/**
+ * @brief Gets the most recent sample of the bridge.
+ * 
+ * Same as rcb4_stream_latest().
+ * 
+ * @param bridge is the bridge.
+ * @param sample is where the sample is copied.
+ * @return 0 if OK.
+ * @return -1 if there are no samples yet.
+ */
+int rcb4_bridge_latest(const rcb4_bridge* bridge, rcb4_sample* sample);
+
+/**
+ * @brief Reads the next sample of the history of the bridge.
+ * 
+ * Same as rcb4_stream_read().
+ * 
+ * @param bridge is the bridge.
+ * @param cursor is the sequence number of the next sample to read. Start at 0.
+ * @param sample is where the sample is copied.
+ * @return 1 if a sample was read.
+ * @return 0 if there are no new samples.
+ */
+int rcb4_bridge_read(const rcb4_bridge* bridge, uint64_t* cursor, rcb4_sample* sample);
+
+/**
+ * @brief Gets the value of a RAM address from a sample of the bridge.
+ * 
+ * Same as rcb4_stream_get_ram().
+ * 
+ * @param bridge is the bridge.
+ * @param sample is the sample.
+ * @param addr is the RAM address.
+ * @param value is where the value is copied.
+ * @param size is the size of the value in bytes.
+ * @return 0 if OK.
+ */
+int rcb4_bridge_get_ram(const rcb4_bridge* bridge, const rcb4_sample* sample, uint16_t addr, void* value, uint8_t size);
+
+/**
+ * @brief Gets the value of an AD converter from a sample of the bridge.
+ * 
+ * @param bridge is the bridge.
+ * @param sample is the sample.
+ * @param ad_id is the ID of the AD, from 0 to 10.
+ * @param value is where the value is copied.
+ * @return 0 if OK.
+ */
+int rcb4_bridge_get_ad(const rcb4_bridge* bridge, const rcb4_sample* sample, uint8_t ad_id, uint16_t* value);
+
+/**
+ * @brief Gets the number of CONST frames that the owner failed to send.
+ * 
+ * @param bridge is the bridge.
+ * @return The number of errors.
+ */
+uint32_t rcb4_bridge_get_errors(const rcb4_bridge* bridge);
+
+
+
+/****************
+ * RECONNECTION *
+ ****************/
+
+#define RCB4_RESTORE_MAX 16 //!< Maximum number of commands registered with rcb4_restore_add().
+#define RCB4_RECONNECT_LAST_POSE 0x01 //!< Also send again the last CONST or SERIES frame after reconnecting.
+
+/**
+ * @brief Makes the connection reopen the device by itself if it is lost.
+ * 
+ * Without this, if the USB adapter is unplugged or glitches every command
+ * fails from then on. With it, when the device fails (not a timeout: an error
+ * of the device itself) the connection:
+ * - Reopens the same device. For a serial port it uses the link of
+ * /dev/serial/by-id, so it is found even if the kernel gives it another
+ * ttyUSB number.
+ * - Sets the speed found by rcb4_open() without probing again.
+ * - Pings the robot and sends the commands of rcb4_restore_add() (torque,
+ * stretch...) and, with RCB4_RECONNECT_LAST_POSE, the last pose sent.
+ * 
+ * The command that found the failure still returns an error, but the
+ * connection (and the streams, bridges... that use it) stays valid and the
+ * next commands work as soon as the device is back. The other threads just
+ * wait for the lock meanwhile. If the device is not back within timeout_ms,
+ * every command tries once more to reopen it before failing.
+ * 
+ * The reactor (rcb4_reactor_add()) doesn't reconnect the connections.
+ * 
+ * @param conn is the connection to the robot.
+ * @param timeout_ms is how long to keep trying to reopen the device. 0
+ * disables the reconnection (default).
+ * @param flags is 0 or RCB4_RECONNECT_LAST_POSE.
+ * @return 0 if OK.
+ * @sa rcb4_restore_add(), rcb4_get_reconnects().
+ */
+int rcb4_reconnect_enable(rcb4_connection* conn, uint32_t timeout_ms, uint32_t flags);
+
+/**
+ * @brief Registers a command to send after every reconnection.
+ * 
+ * The commands are sent in the order they were added. The command is copied,
+ * so it can be reused or deleted as soon as the function returns.
+ * 
+ * @param conn is the connection to the robot.
+ * @param comm is the command.
+ * @return 0 if OK.
+ * @return < 0 if there are already RCB4_RESTORE_MAX commands.
+ */
+int rcb4_restore_add(rcb4_connection* conn, const rcb4_comm* comm);
+
+/**
+ * @brief Removes all the commands registered with rcb4_restore_add().
+ * 
+ * @param conn is the connection to the robot.
+ */
+void rcb4_restore_clear(rcb4_connection* conn);
+
+/**
+ * @brief Gets the number of times the connection has reconnected.
+ * 
+ * @param conn is the connection to the robot.
+ * @return The number of successful reconnections.
+ */
+uint32_t rcb4_get_reconnects(const rcb4_connection* conn);
+
 #ifdef __cplusplus
 }
 #endif
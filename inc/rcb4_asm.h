@@ -0,0 +1,70 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_asm.h
+ * @brief Private structures of the assembler of on-board routines.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp)
+ * KATOLAB, Nagoya Institute of Technology.
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#ifndef RCB4_ASM_H
+#define RCB4_ASM_H
+
+#include "rcb4_private.h"
+
+
+struct s_rcb4_asm_label
+{
+	char name[RCB4_ASM_LABEL_MAX];
+	uint32_t offset; // From the start of the routine
+};
+
+// A JMP or CALL to a label, patched by rcb4_asm_link()
+struct s_rcb4_asm_fixup
+{
+	char label[RCB4_ASM_LABEL_MAX];
+	uint32_t offset; // Of the instruction
+};
+
+struct s_rcb4_asm
+{
+	uint8_t* code;
+	uint32_t size;
+	uint32_t capacity;
+	
+	struct s_rcb4_asm_label* labels;
+	uint32_t n_labels;
+	uint32_t max_labels;
+	
+	struct s_rcb4_asm_fixup* fixups;
+	uint32_t n_fixups;
+	uint32_t max_fixups;
+	
+	int32_t base; // Address of the last link, -1 if not linked
+};
+
+
+#endif // RCB4_ASM_H
@@ -0,0 +1,73 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_batch.h
+ * @brief Private structures of the batch executor.
+ * 
+ * @details The ROM area of a batch holds a small dispatcher followed by the
+ * trampoline the operations are copied to:
+ * 
+ *     rom_addr:      MOV RAM(mailbox, RCB4_BATCH_MAILBOX_SIZE) -> ROM(trampoline)
+ *                    JMP trampoline
+ *     trampoline:    (operations) ADD 1 -> RAM(result_addr) RET
+ * 
+ * The host writes the sequence number to RAM(result_addr) before the CALL, and
+ * the execution is done when it reads it back incremented. If the operations
+ * are the same as in the last execution the mailbox is not sent and the CALL
+ * goes straight to the trampoline, so the ROM is only written when they change.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp)
+ * KATOLAB, Nagoya Institute of Technology.
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#ifndef RCB4_BATCH_H
+#define RCB4_BATCH_H
+
+#include "rcb4_private.h"
+
+#define RCB4_BATCH_TAIL_SIZE (8 + 3) // ADD 1 to the sequence number (1 byte literal) and RET
+#define RCB4_BATCH_DISPATCHER_SIZE (RCB4_BATCH_ROM_SIZE - RCB4_BATCH_MAILBOX_SIZE) // MOV RAM to ROM and JMP
+#define RCB4_BATCH_MAX_POLLS 20 // Reads of the result area before giving up
+#define RCB4_BATCH_POLL_USECS 200 // First wait between reads of the result area, doubled every time
+#define RCB4_BATCH_POLL_MAX_USECS 5000
+
+struct s_rcb4_batch
+{
+	rcb4_connection* conn;
+	uint32_t rom_addr; // Dispatcher, the trampoline follows it
+	uint16_t mailbox_addr;
+	uint16_t result_addr; // Sequence number, then the results
+	
+	uint8_t seq; // Of the last execution
+	uint8_t ops[RCB4_BATCH_MAILBOX_SIZE]; // Encoded operations
+	uint8_t ops_size;
+	uint8_t trampoline[RCB4_BATCH_MAILBOX_SIZE]; // What the ROM has now, if loaded
+	int loaded; // 0 if the trampoline is unknown
+	uint8_t result[RCB4_BATCH_RESULT_SIZE + 1];
+	uint8_t result_size; // Bytes of results of the operations
+};
+
+
+#endif // RCB4_BATCH_H
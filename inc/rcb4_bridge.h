@@ -0,0 +1,106 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file rcb4_bridge.h
+ * @brief Private structures of the shared memory bridge.
+ * 
+ * @details The bridge is a POSIX shared memory object with the telemetry of a
+ * stream (the same ring and latest sample as rcb4_ring.h) and a mailbox of
+ * servo targets. The owner process publishes the samples and ships the
+ * targets to the robot; any other process maps the object and reads or writes
+ * it without system calls.
+ * 
+ * The shared part contains no pointers. It starts with a magic number and a
+ * version, written last, so a process that maps it while it is being created
+ * just finds it not ready.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp)
+ * KATOLAB, Nagoya Institute of Technology.
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#ifndef RCB4_BRIDGE_H
+#define RCB4_BRIDGE_H
+
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_ring.h"
+#include "rcb4_stream.h"
+
+#include <limits.h>
+#include <pthread.h>
+
+#define RCB4_BRIDGE_MAGIC 0x34424352 // "RCB4"
+#define RCB4_BRIDGE_VERSION 2
+#define RCB4_BRIDGE_MODE 0600 // Only the user of the owner can move the robot
+#define RCB4_BRIDGE_LOCK_SPINS 1000 // Before yielding the CPU to the writer that has the mailbox
+#define RCB4_BRIDGE_LOCK_TIMEOUT_NS 10000000ULL // 10ms
+
+/* Servo targets. A seqlock like the samples, but any process can write, so
+ * the writers first take the mailbox by storing their pid in writer with a
+ * CAS. If a writer is killed with the mailbox taken, the owner (or the next
+ * writer) sees that the pid is dead and takes it back. */
+struct s_rcb4_bridge_targets
+{
+	uint32_t seq;
+	int32_t writer; // pid of the process that has the mailbox, 0 if free
+	uint8_t speed;
+	uint64_t mask; // Bit 0 is ICS 1
+	uint16_t position[RCB4_ICS_QTY]; // Indexed by ICS - 1
+};
+
+struct s_rcb4_bridge_shared
+{
+	uint32_t magic; // Written last
+	uint32_t version;
+	int32_t owner; // pid, a new owner can't replace the object while it is alive
+	
+	// Layout of the samples, to find a value in them
+	struct s_rcb4_stream_region region[RCB4_STREAM_MAX_REGIONS];
+	int regions;
+	
+	uint32_t errors; // CONST frames that failed (accessed atomically)
+	
+	struct s_rcb4_bridge_targets targets;
+	struct s_rcb4_ring ring;
+};
+
+struct s_rcb4_bridge
+{
+	struct s_rcb4_bridge_shared* shared;
+	char name[NAME_MAX];
+	int owner; // Created it, unlinks it when deleted
+	
+	// Only in the owner
+	rcb4_connection* conn;
+	rcb4_stream* stream; // Publishes in shared->ring, can be NULL
+	uint32_t period_usecs;
+	uint32_t sent; // seq of the targets sent last
+	pthread_t thread;
+	int running; // Accessed atomically
+};
+
+
+#endif // RCB4_BRIDGE_H
@@ -67,6 +67,9 @@ struct s_rcb4_comm
 // Private functions
 uint8_t rcb4_command_calculate_checksum(const rcb4_comm* comm);
 uint8_t rcb4_command_get_response_size(const rcb4_comm* comm);
+uint8_t rcb4_command_encode(const rcb4_comm* comm, uint8_t* buffer);
+uint8_t rcb4_command_encode_jump(uint8_t type, uint32_t addr, uint8_t conditions, uint8_t* buffer); // RCB4_COMM_JMP or RCB4_COMM_CALL
+uint8_t rcb4_command_encode_ret(uint8_t* buffer);
 
 
 #endif // RCB4_COMMAND_H
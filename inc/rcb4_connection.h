@@ -37,24 +37,85 @@
 #define RCB4_CONNECTION_H
 
 #include "rcb4_private.h"
+#include "rcb4_transport.h"
+#include "rcb4_command.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <termios.h>
+#include <limits.h>
+#include <pthread.h>
 
-// This is the only speed available in linux without hacking the driver.
-#define RCB4_BAUD_RATE B115200
+// State of the read sent in advance by rcb4_exchange()
+#define RCB4_PREFETCH_NONE 0
+#define RCB4_PREFETCH_IN_FLIGHT 1 // Sent, the reply has not been read yet
+#define RCB4_PREFETCH_READY 2 // Reply read and stored in prefetch_data
+
+#define RCB4_ROM_DEFAULT_DEPTH 4
+
+#define RCB4_LOCK_SPINS 128 // Times a thread checks the lock before sleeping
+
+// State of the device (automatic reconnection)
+#define RCB4_LINK_UP 0
+#define RCB4_LINK_LOST 1 // Failed, the transport is still open
+#define RCB4_LINK_CLOSED 2 // Closed, reopened before the next write
+
+#define RCB4_RECONNECT_POLL_USECS 10000 // Between two attempts to reopen the device
 
 struct s_rcb4_connection
 {
-	int fd;
-	fd_set fdset;
-	struct termios old_cfg;
+	struct s_rcb4_transport transport;
+	
+	// Ticket lock: only one transaction can be on the wire at a time, and the
+	// threads get the connection in the order they asked for it
+	uint32_t lock_next; // Next ticket to hand out
+	uint32_t lock_owner; // Ticket that holds the lock (futex word)
+	uint32_t rt_waiting; // Real-time threads waiting for the lock (futex word)
+	uint32_t bg_waiting; // Background threads waiting for rt_waiting to reach 0
+	uint64_t lock_time; // When the current holder took the lock
+	
+	uint8_t prefetch_state;
+	uint8_t prefetch_size; // Size of the data of the reply
+	uint8_t prefetch_key_size;
+	uint8_t prefetch_key[RCB4_COMM_MESSAGE_SIZE_ALLOWED]; // The read command, to know if the next exchange asks the same
+	uint8_t prefetch_data[RCB4_COMM_MESSAGE_SIZE_ALLOWED];
+	
+	uint8_t rom_depth; // Commands sent before waiting for the first ACK in ROM transfers
+	struct s_rcb4_rom_cache* rom_cache; // Told about every write to the ROM, can be NULL
+	
+	// Automatic reconnection, everything protected by the lock
+	char path[PATH_MAX]; // Reopened after a failure. /dev/serial/by-id/... for a serial port if there is one
+	int fast; // Speed found when it was opened, reused without probing
+	uint8_t link; // RCB4_LINK_*
+	int recovering;
+	uint32_t reconnect_ms; // 0 = disabled
+	uint32_t reconnect_flags;
+	uint32_t reconnects; // Accessed atomically
+	rcb4_comm restore[RCB4_RESTORE_MAX]; // Sent after reconnecting
+	int restores;
+	uint8_t last_pose[RCB4_COMM_MESSAGE_SIZE_ALLOWED]; // Last CONST or SERIES frame
+	uint8_t last_pose_size;
 };
 
+// Private functions
+void rcb4_conn_lock(rcb4_connection* conn);
+void rcb4_conn_unlock(rcb4_connection* conn);
+int rcb4_conn_preempted(const rcb4_connection* conn); // 1 if the holder should let a real-time thread in
+uint64_t rcb4_thread_get_io_time(void); // Time the calling thread has held any connection
+int rcb4_conn_write(rcb4_connection* conn, const uint8_t* buffer, uint16_t length);
+int rcb4_conn_read(rcb4_connection* conn, uint8_t* buffer, uint16_t length, uint32_t timeout_usecs);
+void rcb4_conn_flush(rcb4_connection* conn); // Drops whatever has arrived
+void rcb4_conn_delay(rcb4_connection* conn, uint32_t usecs); // Only sleeps if the transport needs it
+int rcb4_conn_check_reply(const uint8_t* lbuf, uint8_t type, uint8_t ret_size, uint8_t* reply);
+int rcb4_conn_transact(rcb4_connection* conn, const rcb4_comm* comm, uint8_t* reply); // Lock must be held
+int rcb4_command_ping_locked(rcb4_connection* conn);
+void rcb4_conn_lost(rcb4_connection* conn); // The transport failed. Reconnects if enabled
+int rcb4_conn_recover(rcb4_connection* conn, uint32_t timeout_ms); // Reopens the device and restores its state
+void rcb4_conn_record(rcb4_connection* conn, const uint8_t* buffer, uint16_t length); // Remembers the last pose
+int rcb4_rom_read_strided(rcb4_connection* conn, uint32_t addr, uint32_t stride, uint32_t piece, void* buf, uint32_t count); // count pieces, stride bytes apart, in one transfer
+
 
 #endif // RCB4_CONNECTION_H
 
@@ -0,0 +1,72 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_expr.h
+ * @brief Private structures of the expression compiler.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp)
+ * KATOLAB, Nagoya Institute of Technology.
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#ifndef RCB4_EXPR_H
+#define RCB4_EXPR_H
+
+#include "rcb4_private.h"
+
+#define RCB4_EXPR_SIZE 2 // Every value is 16 bits
+
+enum e_rcb4_expr_op
+{
+	RCB4_EXPR_CONST,
+	RCB4_EXPR_RAM,
+	RCB4_EXPR_ADD,
+	RCB4_EXPR_SUB,
+	RCB4_EXPR_MUL,
+	RCB4_EXPR_DIV,
+	RCB4_EXPR_SHL,
+	RCB4_EXPR_SHR,
+	RCB4_EXPR_CLAMP
+};
+
+struct s_rcb4_expr_node
+{
+	uint8_t op;
+	int a, b; // Operands (nodes)
+	uint16_t value; // Constant, RAM address or number of shifts
+	uint16_t lo, hi; // Limits of the clamp
+};
+
+struct s_rcb4_expr
+{
+	struct s_rcb4_expr_node* node;
+	int nodes;
+	int max_nodes;
+	
+	uint16_t temp_addr; // RAM for intermediate results
+	uint8_t temps;
+};
+
+
+#endif // RCB4_EXPR_H
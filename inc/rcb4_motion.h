@@ -0,0 +1,88 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_motion.h
+ * @brief Binary motion file format.
+ * 
+ * @details A motion file is a header followed by three arrays:
+ * - time: uint32_t per frame, milliseconds from the start of the motion.
+ * - speed: uint8_t per frame, the speed of the RCB4_COMM_CONST command.
+ * - pos: uint16_t positions as a structure of arrays. Servo j (the j-th bit
+ * set in the mask) at frame f is pos[j * pos_stride + f]. Each row starts at a
+ * multiple of RCB4_MOTION_ALIGN bytes.
+ * 
+ * All the values are little endian. The checksum is the 32 bit FNV-1a of all
+ * the bytes after the header.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp)
+ * KATOLAB, Nagoya Institute of Technology.
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#ifndef RCB4_MOTION_H
+#define RCB4_MOTION_H
+
+#include "rcb4_private.h"
+
+#include <stddef.h>
+
+#define RCB4_MOTION_MAGIC 0x4D424352 // "RCBM"
+#define RCB4_MOTION_VERSION 1
+#define RCB4_MOTION_ALIGN 32 // Alignment of the arrays, in bytes
+#define RCB4_MOTION_MAX_FRAMES 1000000 // Keeps every offset in 32 bits
+
+#define RCB4_MOTION_NOT_VALIDATED 0
+#define RCB4_MOTION_VALID 1
+#define RCB4_MOTION_INVALID -1
+
+struct s_rcb4_motion_header
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t header_size;
+	uint64_t mask; // Bit 0 = ICS 1
+	uint32_t frames;
+	uint16_t servos; // Bits set in mask
+	uint16_t flags; // Reserved, 0
+	uint32_t time_offset; // Offsets from the start of the file
+	uint32_t speed_offset;
+	uint32_t pos_offset;
+	uint32_t pos_stride; // In positions, multiple of RCB4_MOTION_ALIGN / 2
+	uint32_t file_size;
+	uint32_t checksum;
+}__attribute__((__packed__));
+
+struct s_rcb4_motion
+{
+	const uint8_t* map;
+	size_t size;
+	struct s_rcb4_motion_header header; // Decoded, in the byte order of the host
+	const uint8_t* time; // Little endian uint32_t
+	const uint8_t* speed;
+	const uint8_t* pos; // Little endian uint16_t
+	int validated; // RCB4_MOTION_NOT_VALIDATED, RCB4_MOTION_VALID, RCB4_MOTION_INVALID
+};
+
+
+#endif // RCB4_MOTION_H
@@ -0,0 +1,55 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_motion_index.h
+ * @brief Private structure of the motion slot index.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp)
+ * KATOLAB, Nagoya Institute of Technology.
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#ifndef RCB4_MOTION_INDEX_H
+#define RCB4_MOTION_INDEX_H
+
+#include "rcb4_private.h"
+
+#define RCB4_MOTION_PROBE_SIZE 16 // Bytes read from each slot to know if it is used
+#define RCB4_MOTION_HASH_SIZE 256 // Entries of the name table, power of two and > 2 * RCB4_MOTION_SLOTS
+#define RCB4_MOTION_HASH_MASK (RCB4_MOTION_HASH_SIZE - 1)
+
+struct s_rcb4_motion_slot
+{
+	uint8_t used;
+	char name[RCB4_MOTION_NAME_MAX]; // "" if it has no name
+};
+
+struct s_rcb4_motion_index
+{
+	struct s_rcb4_motion_slot slot[RCB4_MOTION_SLOTS];
+	int16_t table[RCB4_MOTION_HASH_SIZE]; // Open addressing, slot of the name or -1
+};
+
+
+#endif // RCB4_MOTION_INDEX_H
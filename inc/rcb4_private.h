@@ -63,6 +63,14 @@
 // Don't update flag
 #define COMM_NUPDATE 0x80
 
+// Flow control commands. Not in the rcb4_comm_type enum, they are sent with
+// rcb4_jmp(), rcb4_call() and rcb4_ret()
+#define RCB4_COMM_JMP 0x0B
+#define RCB4_COMM_CALL 0x0C
+#define RCB4_COMM_RET 0x0D
+#define RCB4_COMM_JUMP_SIZE 7 // JMP and CALL: size, command, address (3), conditions, checksum
+#define RCB4_COMM_RET_SIZE 3 // RET: size, command, checksum
+
 union u_rcb4_dst_addr
 {
 	struct __attribute__((__packed__))
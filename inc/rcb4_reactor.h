@@ -0,0 +1,124 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file rcb4_reactor.h
+ * @brief Private structures of the multi-robot reactor.
+ * 
+ * @details Each robot has a queue of requests. Only the one at the head is on
+ * the wire; its reply is collected from the epoll loop as it arrives and its
+ * deadline is kept in a timer wheel shared by all the robots.
+ * 
+ * The wheel has one slot per tick. A robot waiting for a reply is linked in
+ * the slot of its deadline; deadlines further than one lap away share the
+ * slot with the current lap and are skipped until their lap comes.
+ * 
+ * With the io_uring backend the wheel is not used: each transaction is a
+ * linked chain WRITE -> READ -> LINK_TIMEOUT, and the kernel cancels the read
+ * when the deadline passes. If the reply arrives split, READ -> LINK_TIMEOUT
+ * is submitted again for the rest with the time left. The chains of all the
+ * robots are submitted together, with one io_uring_enter() per iteration.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp)
+ * KATOLAB, Nagoya Institute of Technology.
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#ifndef RCB4_REACTOR_H
+#define RCB4_REACTOR_H
+
+#include "rcb4_private.h"
+#include "rcb4_uring.h"
+
+#define RCB4_REACTOR_TICK_NS 1000000ULL // 1ms
+#define RCB4_REACTOR_WHEEL_SLOTS 512 // More than COMM_TIMEOUT_USECS, so a deadline is never more than one lap away
+#define RCB4_REACTOR_TIMEOUT_TICKS (COMM_TIMEOUT_USECS * 1000ULL / RCB4_REACTOR_TICK_NS)
+
+#define RCB4_REACTOR_URING_ENTRIES 256
+
+// Low bits of the user_data of the io_uring operations (the robots are aligned)
+#define RCB4_URING_OP_WRITE 1
+#define RCB4_URING_OP_READ 2
+#define RCB4_URING_OP_TIMEOUT 3
+#define RCB4_URING_OP_MASK 3
+#define RCB4_URING_HANGUP -2 // failed: EOF or EIO, the device is gone
+
+struct s_rcb4_reactor_request
+{
+	uint8_t frame[RCB4_COMM_MESSAGE_SIZE_ALLOWED]; // Encoded with the checksum
+	uint8_t length;
+	uint8_t type;
+	uint8_t ret_size; // 0 if only the ACK is expected
+	rcb4_reactor_done done;
+	void* data;
+};
+
+struct s_rcb4_reactor_robot
+{
+	rcb4_connection* conn;
+	int id;
+	int fd_flags; // Restored when the reactor is deleted
+	int broken; // Hung up, out of the epoll instance (if any)
+	
+	// Requests, the one at head is on the wire if busy
+	struct s_rcb4_reactor_request queue[RCB4_REACTOR_QUEUE_SIZE];
+	uint32_t head;
+	uint32_t count;
+	int busy;
+	
+	uint8_t rx[RCB4_COMM_MESSAGE_SIZE_ALLOWED + 3];
+	uint16_t received;
+	uint16_t expected;
+	
+	// io_uring backend
+	int inflight; // Operations of the chain not completed yet
+	int failed; // Result of the chain if something went wrong
+	uint64_t deadline; // ns
+	struct __kernel_timespec timeout; // Read by the kernel when the chain is submitted
+	
+	// Timer wheel (epoll backend)
+	uint64_t expires; // Tick
+	struct s_rcb4_reactor_robot* timer_next;
+	struct s_rcb4_reactor_robot** timer_pprev; // NULL if not in the wheel
+};
+
+struct s_rcb4_reactor
+{
+	uint8_t backend;
+	int epfd;
+	struct s_rcb4_uring uring;
+	struct __kernel_timespec wait; // Of the last rcb4_reactor_run() (io_uring backend)
+	uint64_t start; // ns, tick 0
+	uint64_t tick; // Next tick to expire
+	struct s_rcb4_reactor_robot* wheel[RCB4_REACTOR_WHEEL_SLOTS];
+	int timers; // Robots in the wheel
+	
+	struct s_rcb4_reactor_robot* robot[RCB4_REACTOR_MAX_ROBOTS];
+	int robots;
+	int pending; // Requests queued or on the wire, all the robots
+	int completed; // Since the last rcb4_reactor_run()
+};
+
+
+#endif // RCB4_REACTOR_H
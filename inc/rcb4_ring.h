@@ -0,0 +1,151 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_ring.h
+ * @brief Private lock-free sample ring and seqlock slot.
+ * 
+ * @details This header defines a single-writer, multi-reader ring of samples
+ * and a seqlock protected "latest value" slot. Readers never block the writer
+ * and never take a lock, they just retry if the writer was in the middle of
+ * an update.
+ * 
+ * The structures contain no pointers so they can be placed in any memory,
+ * including memory shared between processes.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp)
+ * KATOLAB, Nagoya Institute of Technology.
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#ifndef RCB4_RING_H
+#define RCB4_RING_H
+
+#include "rcb4_private.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#define RCB4_RING_SLOTS 256 // Must be a power of two
+#define RCB4_RING_MASK (RCB4_RING_SLOTS - 1)
+
+// Only the used part of the sample is copied
+#define RCB4_SAMPLE_COPY_SIZE(sample) (offsetof(rcb4_sample, data) + (sample)->size)
+
+struct s_rcb4_seqlock_sample
+{
+	uint32_t seq; // Odd while the writer is updating the sample
+	rcb4_sample sample;
+};
+
+struct s_rcb4_ring
+{
+	uint64_t head; // Sequence number of the next sample to be written
+	struct s_rcb4_seqlock_sample latest;
+	struct s_rcb4_seqlock_sample slot[RCB4_RING_SLOTS];
+};
+
+
+static inline
+void rcb4_seqlock_store(struct s_rcb4_seqlock_sample* s, const rcb4_sample* sample)
+{
+	uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+	
+	__atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&s->sample, sample, RCB4_SAMPLE_COPY_SIZE(sample));
+	__atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// Returns 0 if ok, -1 if nothing has been stored yet
+static inline
+int rcb4_seqlock_load(const struct s_rcb4_seqlock_sample* s, rcb4_sample* sample)
+{
+	uint32_t seq, size;
+	
+	for(;;)
+	{
+		seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		if(seq == 0)
+			return -1;
+		if(seq & 1) // Writer in progress
+			continue;
+		
+		size = __atomic_load_n(&s->sample.size, __ATOMIC_RELAXED);
+		if(size > RCB4_STREAM_MAX_SIZE) // Torn read, the check below will retry
+			size = RCB4_STREAM_MAX_SIZE;
+		memcpy(sample, &s->sample, offsetof(rcb4_sample, data) + size);
+		
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq)
+			return 0;
+	}
+}
+
+
+static inline
+void rcb4_ring_init(struct s_rcb4_ring* ring)
+{
+	memset(ring, 0, sizeof(*ring));
+}
+
+// Only one thread may push
+static inline
+void rcb4_ring_push(struct s_rcb4_ring* ring, rcb4_sample* sample)
+{
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	
+	sample->sequence = head;
+	rcb4_seqlock_store(&ring->slot[head & RCB4_RING_MASK], sample);
+	rcb4_seqlock_store(&ring->latest, sample);
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Reads the sample pointed by cursor and advances it. If the reader was too
+ * slow and the sample was overwritten, cursor jumps to the oldest sample still
+ * available (sample->sequence tells how many were lost).
+ * Returns 1 if a sample was read, 0 if there are no new samples. */
+static inline
+int rcb4_ring_read(const struct s_rcb4_ring* ring, uint64_t* cursor, rcb4_sample* sample)
+{
+	uint64_t head;
+	
+	for(;;)
+	{
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if(*cursor >= head)
+			return 0;
+		if(head - *cursor > RCB4_RING_SLOTS)
+			*cursor = head - RCB4_RING_SLOTS + 1; // Leave some margin to the writer
+		
+		if(rcb4_seqlock_load(&ring->slot[*cursor & RCB4_RING_MASK], sample) == 0 && sample->sequence == *cursor)
+		{
+			(*cursor)++;
+			return 1;
+		}
+		// Overwritten while we were reading it, try again from the new oldest
+	}
+}
+
+
+#endif // RCB4_RING_H
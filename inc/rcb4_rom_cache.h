@@ -0,0 +1,76 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_rom_cache.h
+ * @brief Private structures of the ROM read cache.
+ * 
+ * @details The cache file is a header, one valid flag per block and a full
+ * copy of the ROM (only the valid blocks mean something).
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp)
+ * KATOLAB, Nagoya Institute of Technology.
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#ifndef RCB4_ROM_CACHE_H
+#define RCB4_ROM_CACHE_H
+
+#include "rcb4_private.h"
+
+#include <pthread.h>
+
+#define RCB4_CACHE_MAGIC 0x43424352 // "RCBC"
+#define RCB4_CACHE_VERSION 1
+#define RCB4_CACHE_BLOCK_SIZE 1024
+#define RCB4_CACHE_BLOCKS ((RCB4_MAX_ROM_ADDRESS + 1) / RCB4_CACHE_BLOCK_SIZE)
+#define RCB4_CACHE_FINGERPRINT_SIZE 125 // Bytes at the start of the ROM hashed to identify the robot
+
+struct s_rcb4_cache_file
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t header_size;
+	uint32_t block_size;
+	uint32_t blocks;
+	uint64_t fingerprint;
+	uint8_t valid[RCB4_CACHE_BLOCKS];
+	uint8_t data[RCB4_MAX_ROM_ADDRESS + 1];
+}__attribute__((__packed__));
+
+struct s_rcb4_rom_cache
+{
+	rcb4_connection* conn;
+	char path[512];
+	pthread_mutex_t lock;
+	int dirty; // Must be saved
+	uint64_t generation; // Incremented by every write and invalidation
+	struct s_rcb4_cache_file file;
+};
+
+// Private functions, called when the library writes to the ROM
+void rcb4_rom_cache_update(rcb4_rom_cache* cache, uint32_t addr, const uint8_t* data, uint32_t len);
+void rcb4_rom_cache_command(rcb4_rom_cache* cache, const rcb4_comm* comm);
+
+
+#endif // RCB4_ROM_CACHE_H
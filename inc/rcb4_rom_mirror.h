@@ -0,0 +1,56 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_rom_mirror.h
+ * @brief Private structure of the local ROM mirror.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp)
+ * KATOLAB, Nagoya Institute of Technology.
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#ifndef RCB4_ROM_MIRROR_H
+#define RCB4_ROM_MIRROR_H
+
+#include "rcb4_private.h"
+
+#define RCB4_MIRROR_SIZE (RCB4_MAX_ROM_ADDRESS + 1)
+#define RCB4_MIRROR_PAGES (RCB4_MIRROR_SIZE / RCB4_MIRROR_PAGE_SIZE)
+
+/* Gaps of unchanged bytes up to this size are rewritten instead of starting
+ * another frame: a MOV costs 7 bytes of header and checksum plus a 4 byte ACK. */
+#define RCB4_MIRROR_MERGE_GAP (7 + 4)
+
+struct s_rcb4_rom_mirror
+{
+	rcb4_connection* conn;
+	int fd; // Backing file, -1 if anonymous
+	uint8_t* data; // The mapping, what the user wants the ROM to be
+	uint8_t* shadow; // What we know the ROM of the robot has
+	uint8_t known[RCB4_MIRROR_PAGES]; // The page of the shadow is valid
+	uint8_t dirty[RCB4_MIRROR_PAGES]; // The whole page must be written
+};
+
+
+#endif // RCB4_ROM_MIRROR_H
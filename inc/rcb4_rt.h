@@ -0,0 +1,63 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_rt.h
+ * @brief Private structure of the periodic executor.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp)
+ * KATOLAB, Nagoya Institute of Technology.
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#ifndef RCB4_RT_H
+#define RCB4_RT_H
+
+#include "rcb4_private.h"
+
+#include <pthread.h>
+
+struct s_rcb4_rt
+{
+	rcb4_connection* conn;
+	uint64_t period_ns;
+	rcb4_rt_step step;
+	void* data;
+	
+	// Real-time setup, applied by the thread that runs the loop
+	int priority; // SCHED_FIFO priority, 0 = Don't change the policy
+	int cpu; // -1 = Don't pin
+	int mlock;
+	
+	pthread_t thread;
+	int threaded; // Started with rcb4_rt_start()
+	int running; // Accessed atomically
+	int result; // Return value of the loop
+	
+	int reset; // Clear the stats in the next cycle (accessed atomically)
+	uint32_t seq; // Seqlock of stats, odd while it is being updated
+	rcb4_rt_stats stats;
+};
+
+
+#endif // RCB4_RT_H
@@ -0,0 +1,82 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_sampler.h
+ * @brief Private structures of the on-board sampler.
+ * 
+ * @details RAM layout, from ram_addr:
+ * 
+ *     stop (1), counter (2), slot 0: seq (2) data (size), slot 1: ...
+ * 
+ * The routine in the ROM is unrolled (the RCB4 has no indirect addressing):
+ * 
+ *     loop:  for each slot k:
+ *                MOV RAM(region, size) -> RAM(slot k data)
+ *                ADD 1 (2 bytes) -> RAM(counter, 2)
+ *                MOV RAM(counter, 2) -> RAM(slot k seq)
+ *            AND 0xFF, RAM(stop) (only the flags)
+ *            JMP loop if Z
+ *            RET
+ * 
+ * There is no head and tail pair: without indirect addressing the robot can't
+ * move a write pointer, and the host couldn't read both consistently anyway.
+ * Instead every slot is tagged with the 16 bit counter at the time it was
+ * written. The host reads the whole ring, keeps the slots with a tag newer
+ * than the last one it saw and counts the gaps as lost samples.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp)
+ * KATOLAB, Nagoya Institute of Technology.
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#ifndef RCB4_SAMPLER_H
+#define RCB4_SAMPLER_H
+
+#include "rcb4_private.h"
+
+#define RCB4_SAMPLER_RING_BYTES (RCB4_COMM_MESSAGE_SIZE_ALLOWED - 10) // The ring is drained with a single MOV
+#define RCB4_SAMPLER_STOP(s) ((s)->ram_addr)
+#define RCB4_SAMPLER_COUNTER(s) ((s)->ram_addr + 1)
+#define RCB4_SAMPLER_COUNTER_SIZE 2 // 16 bits, so a slow drain isn't mistaken for no new samples
+#define RCB4_SAMPLER_SLOT_SIZE(s) (RCB4_SAMPLER_COUNTER_SIZE + (s)->size)
+#define RCB4_SAMPLER_SLOT(s, k) ((s)->ram_addr + 1 + RCB4_SAMPLER_COUNTER_SIZE + (k) * RCB4_SAMPLER_SLOT_SIZE(s))
+
+struct s_rcb4_sampler
+{
+	rcb4_connection* conn;
+	uint16_t ram_addr;
+	uint32_t rom_addr;
+	uint16_t addr; // Region sampled
+	uint8_t size;
+	uint8_t slots;
+	int installed;
+	
+	uint16_t last; // Counter of the last sample drained
+	uint64_t sequence; // Samples drained or lost
+	uint64_t last_time; // Of the last drain with new samples
+	uint32_t lost;
+};
+
+
+#endif // RCB4_SAMPLER_H
@@ -0,0 +1,81 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_sched.h
+ * @brief Private structures of the multi-rate scheduler.
+ * 
+ * @details The scheduler keeps a list of channels (RAM ranges) with their
+ * periods and compiles them into a cyclic table of MOV reads, one row per tick
+ * of the hyperperiod.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp)
+ * KATOLAB, Nagoya Institute of Technology.
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#ifndef RCB4_SCHED_H
+#define RCB4_SCHED_H
+
+#include "rcb4_private.h"
+
+#define RCB4_SCHED_MAX_HYPERPERIOD 1024 // Maximum length of the cyclic table in ticks
+#define RCB4_SCHED_MAX_READ (RCB4_COMM_MESSAGE_SIZE_ALLOWED - 10) // Biggest RAM source of a MOV
+#define RCB4_SCHED_OVERHEAD 13 // Bytes on the wire of a MOV to COM apart from the data (10 sent, 3 received)
+
+struct s_rcb4_sched_channel
+{
+	uint16_t addr; // RAM address
+	uint8_t size;
+	uint16_t period; // In ticks
+	uint16_t phase; // First tick of the hyperperiod in which it is read
+};
+
+struct s_rcb4_sched_read
+{
+	uint16_t addr;
+	uint8_t size;
+};
+
+struct s_rcb4_sched
+{
+	rcb4_connection* conn;
+	uint32_t tick_usecs;
+	
+	struct s_rcb4_sched_channel channel[RCB4_SCHED_MAX_CHANNELS];
+	int channels;
+	
+	// Cyclic table. The reads of tick t are read[slot[t]] to read[slot[t+1]-1]
+	int dirty; // The table must be rebuilt before the next tick
+	uint16_t hyperperiod;
+	uint16_t* slot;
+	struct s_rcb4_sched_read* read;
+	uint64_t tick;
+	
+	// Last known value of the RAM and when each byte was read
+	uint8_t ram[RCB4_MAX_RAM_ADDRESS + 1];
+	uint64_t stamp[RCB4_MAX_RAM_ADDRESS + 1];
+};
+
+
+#endif // RCB4_SCHED_H
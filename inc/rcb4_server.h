@@ -0,0 +1,109 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file rcb4_server.h
+ * @brief Private structures of the server that shares a robot among processes.
+ * 
+ * @details The clients talk to the server with the same frames they would send
+ * to the robot, so any connection opened with rcb4_open("unix:...") works
+ * unchanged. The only extra frame is RCB4_SERVER_HELLO, answered by the server
+ * itself, that tells the lane of the client.
+ * 
+ * Each client has a queue of frames. Every iteration the server picks a lane,
+ * takes the frames of the clients of that lane in round robin and sends them
+ * to the robot in a single write, up to the pipeline depth of the connection.
+ * Reads (MOV to COM) identical to one already in the batch are not sent, they
+ * get a copy of its reply.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp)
+ * KATOLAB, Nagoya Institute of Technology.
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#ifndef RCB4_SERVER_H
+#define RCB4_SERVER_H
+
+#include "rcb4_private.h"
+
+#include <sys/un.h>
+
+#define RCB4_SERVER_QUEUE_SIZE 16 // Frames of a client not answered yet
+#define RCB4_SERVER_BATCH_SIZE 32 // Frames of a batch, merged reads included
+#define RCB4_SERVER_BACKGROUND_EVERY 8 // Batches of the real-time lane in a row before the background lane gets one
+#define RCB4_SERVER_EVENTS 16 // Per epoll_wait()
+
+#define RCB4_SERVER_HELLO 0xF0 // Not a command of the robot: 0x04, 0xF0, lane, SUM
+
+struct s_rcb4_server_request
+{
+	uint8_t frame[RCB4_COMM_MESSAGE_SIZE_ALLOWED]; // With the checksum
+	uint8_t length;
+	uint8_t reply_length; // Whole reply, 4 if only the ACK
+};
+
+struct s_rcb4_server_client
+{
+	int fd; // -1 once it has hung up
+	uint8_t lane;
+	
+	uint8_t rx[2 * RCB4_COMM_MESSAGE_SIZE_ALLOWED]; // Frames not complete yet
+	uint16_t rx_size;
+	
+	struct s_rcb4_server_request queue[RCB4_SERVER_QUEUE_SIZE];
+	uint32_t head;
+	uint32_t count;
+	uint32_t batched; // Taken by the current batch
+};
+
+// A frame of the current batch
+struct s_rcb4_server_slot
+{
+	struct s_rcb4_server_client* client;
+	const struct s_rcb4_server_request* req;
+	int same; // Slot whose reply is used (itself if it was sent)
+	uint16_t offset; // Of its reply in the buffer, if it was sent
+};
+
+struct s_rcb4_server
+{
+	rcb4_connection* conn;
+	int listen_fd;
+	int stop_fd; // eventfd, so rcb4_server_stop() can be called from a signal handler
+	int epfd;
+	struct sockaddr_un addr; // Unlinked when deleted
+	
+	struct s_rcb4_server_client* client[RCB4_SERVER_MAX_CLIENTS];
+	int clients;
+	int next; // First client of the next round robin
+	int pending; // Frames queued, all the clients
+	uint32_t realtime_streak;
+	
+	struct s_rcb4_server_slot slot[RCB4_SERVER_BATCH_SIZE];
+	
+	rcb4_server_stats stats;
+};
+
+
+#endif // RCB4_SERVER_H
@@ -0,0 +1,62 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_stage.h
+ * @brief Private structures of the servo frame staging.
+ * 
+ * @details A slot holds one ICS position packet per servo of the stage:
+ * 
+ *     0x80 | id, (position >> 7) & 0x7F, position & 0x7F
+ * 
+ * The RCB4 numbers its ICS alternating the two SIO lines: ICS n (from 0) is
+ * the servo with ID n / 2 on the line n % 2.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp)
+ * KATOLAB, Nagoya Institute of Technology.
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#ifndef RCB4_STAGE_H
+#define RCB4_STAGE_H
+
+#include "rcb4_private.h"
+
+#define RCB4_STAGE_PACKET_SIZE 3
+#define RCB4_STAGE_SIO(ics) (((ics) - 1) % 2) // ics from 1
+#define RCB4_STAGE_ID(ics) (((ics) - 1) / 2)
+
+struct s_rcb4_stage
+{
+	rcb4_connection* conn;
+	uint64_t mask;
+	uint8_t servos; // Bits set in mask
+	uint8_t slots;
+	uint16_t ram_addr; // Reply scratch, then the slots
+	uint32_t rom_addr;
+	int installed;
+	uint8_t call[RCB4_STAGE_MAX_SLOTS][RCB4_COMM_JUMP_SIZE]; // The CALL to each routine, ready to be sent
+};
+
+
+#endif // RCB4_STAGE_H
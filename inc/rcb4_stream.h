@@ -0,0 +1,72 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_stream.h
+ * @brief Private structure of the sensor stream.
+ * 
+ * @details This header defines the real stream structure used by the
+ * background acquisition thread.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp)
+ * KATOLAB, Nagoya Institute of Technology.
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#ifndef RCB4_STREAM_H
+#define RCB4_STREAM_H
+
+#include "rcb4_private.h"
+#include "rcb4_ring.h"
+
+#include <pthread.h>
+
+struct s_rcb4_stream_region
+{
+	uint16_t addr; // RAM address
+	uint8_t size;
+	uint8_t offset; // Where it goes in rcb4_sample::data
+};
+
+struct s_rcb4_stream
+{
+	rcb4_connection* conn;
+	struct s_rcb4_stream_region region[RCB4_STREAM_MAX_REGIONS];
+	int regions;
+	uint16_t sample_size;
+	uint32_t period_usecs; // 0 = As fast as the link allows
+	
+	pthread_t thread;
+	int running; // Accessed atomically
+	uint32_t errors; // Accessed atomically
+	
+	struct s_rcb4_ring* shared; // Also published here (rcb4_bridge), can be NULL
+	struct s_rcb4_ring ring; // Must be the last one: rcb4_stream_create() zeroes up to here
+};
+
+// Private functions
+int rcb4_stream_share(rcb4_stream* stream, struct s_rcb4_ring* ring);
+int rcb4_stream_find(const struct s_rcb4_stream_region* region, int regions, const rcb4_sample* sample, uint16_t addr, void* value, uint8_t size);
+
+
+#endif // RCB4_STREAM_H
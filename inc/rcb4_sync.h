@@ -0,0 +1,70 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_sync.h
+ * @brief Format of the ROM sync index.
+ * 
+ * @details The index remembers, for each block of the ROM of a robot, the hash
+ * and length of the data that was last written there. One file per robot:
+ * a header followed by one entry per block.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp)
+ * KATOLAB, Nagoya Institute of Technology.
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#ifndef RCB4_SYNC_H
+#define RCB4_SYNC_H
+
+#include "rcb4_private.h"
+
+#define RCB4_SYNC_MAGIC 0x53424352 // "RCBS"
+#define RCB4_SYNC_VERSION 1
+#define RCB4_SYNC_BLOCKS ((RCB4_MAX_ROM_ADDRESS + 1) / RCB4_SYNC_BLOCK_SIZE)
+#define RCB4_SYNC_MAX_ID 64 // Maximum length of a robot id
+
+struct s_rcb4_sync_header
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t header_size;
+	uint32_t block_size;
+	uint32_t blocks;
+}__attribute__((__packed__));
+
+struct s_rcb4_sync_block
+{
+	uint64_t hash; // rcb4_util_hash() of the first length bytes of the block
+	uint32_t length; // 0 = Unknown contents
+	uint32_t reserved;
+}__attribute__((__packed__));
+
+struct s_rcb4_sync_index
+{
+	struct s_rcb4_sync_header header;
+	struct s_rcb4_sync_block block[RCB4_SYNC_BLOCKS];
+}__attribute__((__packed__));
+
+
+#endif // RCB4_SYNC_H
@@ -0,0 +1,77 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_traj.h
+ * @brief Private structures of the trajectory engine.
+ * 
+ * @details The keyframes are stored as a structure of arrays: one row of
+ * RCB4_TRAJ_STRIDE floats per keyframe with all the servos, so the
+ * interpolation is a single loop over contiguous memory.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp)
+ * KATOLAB, Nagoya Institute of Technology.
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#ifndef RCB4_TRAJ_H
+#define RCB4_TRAJ_H
+
+#include "rcb4_private.h"
+#include "rcb4_command.h"
+
+#define RCB4_TRAJ_STRIDE 40 // RCB4_ICS_QTY rounded up to 32 bytes
+#define RCB4_TRAJ_ALIGN 32
+#define RCB4_TRAJ_LOOKAHEAD 8 // Frames computed in advance
+#define RCB4_TRAJ_INITIAL_KEYS 16
+
+struct s_rcb4_traj_frame
+{
+	int64_t number; // Frame number since the start, -1 = Empty
+	rcb4_comm comm;
+};
+
+struct s_rcb4_traj
+{
+	rcb4_connection* conn;
+	uint32_t period_usecs;
+	int mode; // RCB4_TRAJ_LINEAR, RCB4_TRAJ_CUBIC, RCB4_TRAJ_MINJERK
+	uint8_t speed; // Speed of the CONST frames
+	
+	// Keyframes
+	int keys;
+	int capacity;
+	uint32_t* time; // In milliseconds
+	float* pos; // keys rows of RCB4_TRAJ_STRIDE
+	float* tangent; // Same layout, in units per millisecond (cubic only)
+	uint64_t used; // Servos that appear in any keyframe (bit 0 = ICS 1)
+	int prepared; // The tangents are up to date
+	
+	// Playback
+	uint64_t start; // In nanoseconds, 0 = Not started
+	int64_t sent; // Last frame number sent
+	struct s_rcb4_traj_frame frame[RCB4_TRAJ_LOOKAHEAD];
+};
+
+
+#endif // RCB4_TRAJ_H
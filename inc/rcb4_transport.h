@@ -0,0 +1,115 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file rcb4_transport.h
+ * @brief Private interface between the connection and the link to the robot.
+ * 
+ * @details The protocol code never touches the link directly, it goes through
+ * the functions of the transport. Each backend (serial port, pseudo-terminal,
+ * Unix socket, in-process emulator) fills a struct s_rcb4_transport_ops.
+ * 
+ * A backend must provide open, write, read and close. flush can be NULL, and
+ * set_speed too unless the backend has RCB4_TRANSPORT_SPEED.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp)
+ * KATOLAB, Nagoya Institute of Technology.
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#ifndef RCB4_TRANSPORT_H
+#define RCB4_TRANSPORT_H
+
+#include "rcb4_private.h"
+
+#include <termios.h>
+
+// This is the only speed available in linux without hacking the driver.
+#define RCB4_BAUD_RATE B115200
+#define RCB4_FAST_BAUD_RATE 1250000 // Fastest speed that the robot can go
+
+#define RCB4_SERIAL_BY_ID "/dev/serial/by-id" // Links named after the adapter, kept by udev
+
+#define RCB4_LOOP_RX_SIZE 256 // Bytes of a frame not complete yet
+#define RCB4_LOOP_TX_SIZE 4096 // Replies not read yet
+#define RCB4_LOOP_MAX_STEPS 100000 // Commands run by a CALL before giving up (loops)
+#define RCB4_LOOP_MAX_DEPTH 16 // Nested CALLs inside the ROM
+
+struct s_rcb4_transport;
+
+// Serial port
+struct s_rcb4_tty
+{
+	struct termios old_cfg; // Restored when closed
+	struct termios cfg;
+	int closest_speed; // Of the speed hack
+};
+
+// In-process emulator of the board
+struct s_rcb4_loop
+{
+	uint8_t ram[RCB4_MAX_RAM_ADDRESS + 1];
+	uint8_t rom[RCB4_MAX_ROM_ADDRESS + 1];
+	int zero; // Flags of the last logic or math command
+	int carry;
+	
+	uint8_t rx[RCB4_LOOP_RX_SIZE];
+	uint16_t rx_size;
+	uint8_t tx[RCB4_LOOP_TX_SIZE];
+	uint32_t tx_head;
+	uint32_t tx_size;
+};
+
+struct s_rcb4_transport_ops
+{
+	const char* scheme; // Prefix of the URI, without the ':'
+	uint32_t caps; // RCB4_TRANSPORT_*
+	
+	int (*open)(struct s_rcb4_transport* t, const char* path); // 0 if ok
+	int (*write)(struct s_rcb4_transport* t, const uint8_t* buffer, uint16_t length); // Everything or -1
+	int (*read)(struct s_rcb4_transport* t, uint8_t* buffer, uint16_t length, uint64_t deadline); // 1~length bytes, -10 at the deadline, -1 on error
+	void (*flush)(struct s_rcb4_transport* t); // Drops whatever has arrived. Can be NULL
+	int (*set_speed)(struct s_rcb4_transport* t, int fast, float* error); // Only with RCB4_TRANSPORT_SPEED. Returns the baudrate
+	void (*close)(struct s_rcb4_transport* t);
+};
+
+struct s_rcb4_transport
+{
+	const struct s_rcb4_transport_ops* ops;
+	int fd; // For epoll and io_uring if RCB4_TRANSPORT_POLLABLE, -1 otherwise
+	void* data; // Private data of the backend
+};
+
+extern const struct s_rcb4_transport_ops rcb4_transport_tty;
+extern const struct s_rcb4_transport_ops rcb4_transport_pty;
+extern const struct s_rcb4_transport_ops rcb4_transport_unix;
+extern const struct s_rcb4_transport_ops rcb4_transport_loop;
+
+// Helpers for the backends built on a file descriptor
+int rcb4_transport_fd_write(struct s_rcb4_transport* t, const uint8_t* buffer, uint16_t length);
+int rcb4_transport_fd_read(struct s_rcb4_transport* t, uint8_t* buffer, uint16_t length, uint64_t deadline);
+int rcb4_transport_stable_path(const char* path, char* stable, size_t size);
+
+
+#endif // RCB4_TRANSPORT_H
@@ -0,0 +1,80 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file rcb4_uring.h
+ * @brief Private minimal io_uring wrapper.
+ * 
+ * @details Just what the reactor needs: set up the rings, get submission
+ * entries, submit them all with one system call and walk the completions.
+ * Uses the system calls directly, no liburing is needed.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp)
+ * KATOLAB, Nagoya Institute of Technology.
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#ifndef RCB4_URING_H
+#define RCB4_URING_H
+
+#include "rcb4_private.h"
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+struct s_rcb4_uring
+{
+	int fd; // -1 if not set up
+	
+	// Submission ring
+	void* sq_ring;
+	size_t sq_ring_size;
+	uint32_t* sq_head;
+	uint32_t* sq_tail;
+	uint32_t* sq_mask;
+	uint32_t* sq_array;
+	struct io_uring_sqe* sqes;
+	size_t sqes_size;
+	uint32_t sq_entries;
+	uint32_t queued; // Entries filled but not given to the kernel yet
+	
+	// Completion ring (may share the mapping with the submission ring)
+	void* cq_ring;
+	size_t cq_ring_size;
+	uint32_t* cq_head;
+	uint32_t* cq_tail;
+	uint32_t* cq_mask;
+	struct io_uring_cqe* cqes;
+};
+
+int rcb4_uring_init(struct s_rcb4_uring* u, uint32_t entries);
+void rcb4_uring_exit(struct s_rcb4_uring* u);
+int rcb4_uring_reserve(struct s_rcb4_uring* u, uint32_t n); // Makes sure the next n rcb4_uring_get_sqe() don't submit (chains)
+struct io_uring_sqe* rcb4_uring_get_sqe(struct s_rcb4_uring* u); // Zeroed. Submits the queued ones if the ring is full
+int rcb4_uring_enter(struct s_rcb4_uring* u, uint32_t wait); // Submits the queued entries and waits for wait completions
+struct io_uring_cqe* rcb4_uring_peek(struct s_rcb4_uring* u); // NULL if there are no completions
+void rcb4_uring_seen(struct s_rcb4_uring* u); // Frees the completion returned by rcb4_uring_peek()
+
+
+#endif // RCB4_URING_H
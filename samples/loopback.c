@@ -0,0 +1,1110 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright 2015 Alfonso Arbona Gimeno
+ */
+
+/* Runs the RAM operations, a routine made with the assembler, an expression,
+ * a batch, a stream, a scheduler, a periodic executor, the exchanges, a
+ * trajectory, a motion file, the ROM transfers, a ROM sync, a ROM cache, a ROM
+ * mirror, a motion index, a servo stage, an on-board sampler, the reactors
+ * (epoll and io_uring), a server, a bridge and the reconnection, and checks
+ * the results. By default against the "loop:" emulator, without a robot. Run
+ * it with the device of a real robot (./loopback /dev/ttyUSB0) to check that
+ * the emulator and the board agree.
+ * 
+ * WARNING: With a real robot it overwrites ROM_ADDR~ROM_ADDR+0xFFF, the motion
+ * slot MOTION_SLOT and the RAM variables 0x0460~0x047F, 0x0300~0x03FF. */
+
+#include "rcb4.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <dirent.h>
+#include <signal.h>
+#include <pthread.h>
+
+#define ROM_ADDR 0x3F000
+#define VAR_ADDR 0x0460
+#define MOTION_SLOT 119 // The last one
+
+rcb4_connection* con; // Connection to the robot
+rcb4_comm* comm = NULL; // Command to be sent
+rcb4_asm* routine = NULL;
+rcb4_expr* expr = NULL;
+rcb4_batch* batch = NULL;
+int failed = 0;
+
+void deinit(void)
+{
+	rcb4_batch_delete(batch);
+	rcb4_expr_delete(expr);
+	rcb4_asm_delete(routine);
+	rcb4_command_delete(comm);
+	rcb4_deinit(con);
+	
+	printf("Program closed.\n");
+}
+
+void check(const char* what, int err, uint32_t value, uint32_t expected)
+{
+	if(err != 0 || value != expected)
+	{
+		printf("%-24s FAIL (err = %d, value = %u, expected %u)\n", what, err, value, expected);
+		failed++;
+	}
+	else
+		printf("%-24s OK (%u)\n", what, value);
+}
+
+// Writes a 16 bits variable
+int set_var(uint16_t addr, uint16_t value)
+{
+	rcb4_command_recreate(comm, RCB4_COMM_MOV);
+	rcb4_command_set_src_literal(comm, &value, sizeof(value));
+	rcb4_command_set_dst_ram(comm, addr);
+	return rcb4_send_command(con, comm, NULL);
+}
+
+// Reads a 16 bits variable
+int get_var(uint16_t addr, uint16_t* value)
+{
+	uint8_t buffer[2];
+	
+	rcb4_command_recreate(comm, RCB4_COMM_MOV);
+	rcb4_command_set_src_ram(comm, addr, 2);
+	rcb4_command_set_dst_com(comm);
+	if(rcb4_send_command(con, comm, buffer) != 2)
+		return -1;
+	
+	*value = buffer[0] | (buffer[1] << 8);
+	return 0;
+}
+
+void test_ram(void)
+{
+	uint32_t result = 0;
+	int err;
+	
+	err = set_var(VAR_ADDR, 0x00F0);
+	err |= rcb4_ram_add(con, VAR_ADDR, 0x10, 2, &result);
+	check("RAM add", err, result, 0x0100);
+	
+	err = rcb4_ram_add(con, VAR_ADDR, -1, 2, &result);
+	check("RAM add (negative)", err, result, 0x00FF);
+	
+	err = rcb4_ram_shift(con, VAR_ADDR, 4, 2, &result);
+	check("RAM shift", err, result, 0x0FF0);
+	
+	err = rcb4_ram_clear_bits(con, VAR_ADDR, 0x00F0, 2, &result);
+	check("RAM clear bits", err, result, 0x0F00);
+	
+	err = rcb4_ram_set_bits(con, VAR_ADDR, 0x000F, 2, &result);
+	check("RAM set bits", err, result, 0x0F0F);
+}
+
+// The counter of the rcb4_asm_create() example: counts up to 10 inside the robot
+void test_asm(void)
+{
+	uint8_t one = 1, ten = 10;
+	uint16_t value = 0;
+	int err;
+	
+	routine = rcb4_asm_create();
+	if(!routine)
+	{
+		check("Assembler", -1, 0, 0);
+		return;
+	}
+	
+	err = set_var(VAR_ADDR + 2, 0);
+	err |= rcb4_asm_label(routine, "loop");
+	rcb4_command_recreate(comm, RCB4_COMM_ADD);
+	rcb4_command_set_src_literal(comm, &one, 1);
+	rcb4_command_set_dst_ram(comm, VAR_ADDR + 2);
+	err |= rcb4_asm_add(routine, comm);
+	rcb4_command_recreate(comm, RCB4_COMM_SUB);
+	rcb4_command_set_src_literal(comm, &ten, 1);
+	rcb4_command_set_dst_ram(comm, VAR_ADDR + 2);
+	rcb4_command_set_dst_do_not_save(comm);
+	err |= rcb4_asm_add(routine, comm);
+	err |= rcb4_asm_jmp(routine, "loop", RCB4_CONDITION_Z_CLR);
+	err |= rcb4_asm_ret(routine);
+	err |= rcb4_asm_upload(routine, con, ROM_ADDR);
+	err |= rcb4_call(con, ROM_ADDR, RCB4_CONDITION_ALWAYS);
+	usleep(10000); // The robot runs it after the ACK
+	err |= get_var(VAR_ADDR + 2, &value);
+	check("Assembler loop", err, value & 0xFF, 10);
+}
+
+// The reflex of the rcb4_expr_create() example, with the input in RAM instead of an AD
+void test_expr(void)
+{
+	const uint16_t input[] = {0, 200, 240, 300, 1023};
+	uint16_t value = 0;
+	int i, err, gain, sum, out, expected;
+	rcb4_asm* a;
+	char what[32];
+	
+	expr = rcb4_expr_create(VAR_ADDR + 0x10, 4);
+	a = rcb4_asm_create();
+	if(!expr || !a)
+	{
+		rcb4_asm_delete(a);
+		check("Expression", -1, 0, 0);
+		return;
+	}
+	
+	gain = rcb4_expr_ram(expr, VAR_ADDR + 4);
+	sum = rcb4_expr_add(expr, rcb4_expr_const(expr, 7500*4), rcb4_expr_mul(expr, rcb4_expr_ram(expr, VAR_ADDR + 6), gain));
+	sum = rcb4_expr_sub(expr, sum, rcb4_expr_mul(expr, rcb4_expr_const(expr, 240), gain));
+	out = rcb4_expr_clamp(expr, rcb4_expr_shr(expr, sum, 2), 5000, 10000);
+	err = rcb4_expr_compile(expr, out, VAR_ADDR + 8, a);
+	err |= rcb4_asm_ret(a);
+	err |= rcb4_asm_upload(a, con, ROM_ADDR + 0x100);
+	err |= set_var(VAR_ADDR + 4, 20);
+	rcb4_asm_delete(a);
+	
+	for(i = 0; i < (int)(sizeof(input) / sizeof(input[0])); i++)
+	{
+		expected = 7500 + ((int)input[i] - 240) * 20 / 4;
+		if(expected > 10000)
+			expected = 10000;
+		if(expected < 5000)
+			expected = 5000;
+		
+		err |= set_var(VAR_ADDR + 6, input[i]);
+		err |= rcb4_call(con, ROM_ADDR + 0x100, RCB4_CONDITION_ALWAYS);
+		usleep(10000);
+		err |= get_var(VAR_ADDR + 8, &value);
+		snprintf(what, sizeof(what), "Expression (in = %u)", input[i]);
+		check(what, err, value, expected);
+	}
+}
+
+void test_batch(void)
+{
+	uint16_t value = 5, result = 0;
+	int i, err, offset;
+	
+	batch = rcb4_batch_create(con, ROM_ADDR + 0x200, 0x0300, 0x0380);
+	if(!batch)
+	{
+		check("Batch", -1, 0, 0);
+		return;
+	}
+	
+	err = set_var(VAR_ADDR + 10, 1000);
+	err |= rcb4_batch_install(batch);
+	rcb4_command_recreate(comm, RCB4_COMM_ADD);
+	rcb4_command_set_src_literal(comm, &value, sizeof(value));
+	rcb4_command_set_dst_ram(comm, VAR_ADDR + 10);
+	err |= rcb4_batch_add(batch, comm);
+	offset = rcb4_batch_read_ram(batch, VAR_ADDR + 10, 2);
+	if(offset < 0)
+		err = -1;
+	
+	for(i = 0; i < 3 && err == 0; i++) // The same operations, the trampoline is only written once
+		err = rcb4_batch_execute(batch);
+	if(err == 0)
+		err = rcb4_batch_get_result(batch, offset, &result, sizeof(result));
+	check("Batch", err, result, 1015);
+}
+
+// Reads a variable in the background while the main thread changes it
+void test_stream(void)
+{
+	rcb4_stream* stream;
+	rcb4_sample sample;
+	uint64_t cursor = 0, last = 0;
+	uint32_t samples = 0, gaps = 0;
+	uint16_t value = 0;
+	int err;
+	
+	stream = rcb4_stream_create(con);
+	if(!stream)
+	{
+		check("Stream", -1, 0, 0);
+		return;
+	}
+	
+	err = set_var(VAR_ADDR + 12, 1234);
+	err |= rcb4_stream_add_ram(stream, VAR_ADDR + 12, 2);
+	err |= rcb4_stream_set_period(stream, 1000);
+	err |= rcb4_stream_start(stream);
+	usleep(20000);
+	err |= set_var(VAR_ADDR + 12, 4321); // Shared with the stream thread
+	usleep(20000);
+	err |= rcb4_stream_stop(stream);
+	
+	while(rcb4_stream_read(stream, &cursor, &sample) == 1)
+	{
+		if(samples > 0 && sample.sequence != last + 1)
+			gaps++;
+		last = sample.sequence;
+		samples++;
+	}
+	err |= rcb4_stream_get_ram(stream, &sample, VAR_ADDR + 12, &value, 2);
+	check("Stream samples", (samples > 0) ? err : -1, gaps, 0);
+	check("Stream last value", err, value, 4321);
+	check("Stream errors", err, rcb4_stream_get_errors(stream), 0);
+	
+	rcb4_stream_delete(stream);
+}
+
+// A fast and a slow channel next to each other, the slow one is merged into the fast reads
+void test_sched(void)
+{
+	rcb4_sched* sched;
+	uint16_t fast = 0, slow = 0;
+	int i, err, movs = 0;
+	
+	sched = rcb4_sched_create(con, 1000);
+	if(!sched)
+	{
+		check("Scheduler", -1, 0, 0);
+		return;
+	}
+	
+	err = set_var(VAR_ADDR + 12, 111);
+	err |= set_var(VAR_ADDR + 14, 222);
+	err |= rcb4_sched_add_ram(sched, VAR_ADDR + 12, 2, 1000);
+	err |= rcb4_sched_add_ram(sched, VAR_ADDR + 14, 2, 4000);
+	err |= rcb4_sched_build(sched);
+	for(i = 0; i < 8 && err == 0; i++)
+	{
+		int sent = rcb4_sched_tick(sched);
+		if(sent < 0)
+			err = sent;
+		else
+			movs += sent;
+	}
+	
+	err |= rcb4_sched_get_ram(sched, VAR_ADDR + 12, &fast, 2, NULL);
+	err |= rcb4_sched_get_ram(sched, VAR_ADDR + 14, &slow, 2, NULL);
+	check("Scheduler fast channel", err, fast, 111);
+	check("Scheduler slow channel", err, slow, 222);
+	check("Scheduler MOVs (8 ticks)", err, movs, 8);
+	
+	rcb4_sched_delete(sched);
+}
+
+// Step of test_rt(): counts in the robot and stops at 10
+int rt_step(rcb4_connection* conn, void* data)
+{
+	uint32_t result = 0;
+	
+	(void)data;
+	if(rcb4_ram_add(conn, VAR_ADDR + 12, 1, 2, &result) != 0)
+		return -1;
+	return (result >= 10) ? 1 : 0;
+}
+
+void test_rt(void)
+{
+	rcb4_rt* rt;
+	rcb4_rt_stats stats;
+	uint16_t value = 0;
+	int err, ret;
+	
+	rt = rcb4_rt_create(con, 2000, rt_step, NULL);
+	if(!rt)
+	{
+		check("Executor", -1, 0, 0);
+		return;
+	}
+	
+	err = set_var(VAR_ADDR + 12, 0);
+	ret = rcb4_rt_run(rt);
+	rcb4_rt_get_stats(rt, &stats);
+	err |= get_var(VAR_ADDR + 12, &value);
+	check("Executor result", err, ret, 1);
+	check("Executor cycles", err, stats.cycles, 10);
+	check("Executor counter", err, value, 10);
+	check("Executor I/O time", err, stats.io.max > 0 && stats.io.max <= stats.step.max, 1);
+	
+	rcb4_rt_delete(rt);
+}
+
+// Sets the value the write of test_exchange() copies to the counter
+void set_write(rcb4_comm* write, uint16_t value)
+{
+	rcb4_command_recreate(write, RCB4_COMM_MOV);
+	rcb4_command_set_src_literal(write, &value, sizeof(value));
+	rcb4_command_set_dst_ram(write, VAR_ADDR + 12);
+}
+
+// The write sets the counter and the read gets it. With prefetch the read of a
+// call is the one sent at the end of the previous call, before its write
+void test_exchange(void)
+{
+	rcb4_comm* write = rcb4_command_create(RCB4_COMM_MOV);
+	rcb4_comm* read = rcb4_command_create(RCB4_COMM_MOV);
+	uint16_t value = 0;
+	int err;
+	
+	if(!write || !read)
+	{
+		rcb4_command_delete(write);
+		rcb4_command_delete(read);
+		check("Exchange", -1, 0, 0);
+		return;
+	}
+	
+	rcb4_command_set_src_ram(read, VAR_ADDR + 12, 2);
+	rcb4_command_set_dst_com(read);
+	
+	set_write(write, 1);
+	err = (rcb4_exchange(con, write, read, (uint8_t*)&value, 0) != 2);
+	check("Exchange", err, value, 1);
+	
+	set_write(write, 2);
+	err = (rcb4_exchange(con, write, read, (uint8_t*)&value, RCB4_EXCHANGE_PREFETCH) != 2);
+	check("Exchange (first prefetch)", err, value, 2);
+	set_write(write, 3);
+	err = (rcb4_exchange(con, write, read, (uint8_t*)&value, RCB4_EXCHANGE_PREFETCH) != 2);
+	check("Exchange (prefetched)", err, value, 2);
+	
+	err = set_var(VAR_ADDR + 12, 100); // Drops the prefetched read
+	set_write(write, 4);
+	err |= (rcb4_exchange(con, write, read, (uint8_t*)&value, RCB4_EXCHANGE_PREFETCH) != 2);
+	check("Exchange (dropped)", err, value, 4);
+	err = (rcb4_exchange(con, NULL, read, (uint8_t*)&value, 0) != 2);
+	check("Exchange (after prefetch)", err, value, 4);
+	
+	rcb4_command_delete(write);
+	rcb4_command_delete(read);
+}
+
+// ICS 1 goes from 7000 to 8000 in 100ms, ICS 2 only appears in the last keyframe
+void test_traj(void)
+{
+	rcb4_traj* traj;
+	uint16_t pos[36] = {0}; // One per ICS
+	int err;
+	
+	traj = rcb4_traj_create(con, 10000);
+	if(!traj)
+	{
+		check("Trajectory", -1, 0, 0);
+		return;
+	}
+	
+	err = rcb4_traj_set_interpolation(traj, RCB4_TRAJ_LINEAR);
+	pos[0] = 7000;
+	err |= rcb4_traj_add_keyframe(traj, 0, 0x01, pos);
+	pos[0] = 8000;
+	pos[1] = 8500;
+	err |= rcb4_traj_add_keyframe(traj, 100, 0x03, pos);
+	check("Trajectory duration", err, rcb4_traj_get_duration(traj), 100);
+	
+	err = rcb4_traj_sample(traj, 50000, pos);
+	check("Trajectory (50ms)", err, pos[0], 7500);
+	err = rcb4_traj_sample(traj, 0, pos);
+	check("Trajectory (new servo)", err, pos[1], 8500);
+	err = rcb4_traj_sample(traj, 200000, pos);
+	check("Trajectory (after end)", err, pos[0], 8000);
+	
+	check("Trajectory play", rcb4_traj_play(traj), 0, 0);
+	
+	rcb4_traj_delete(traj);
+}
+
+// Writes a motion of 3 frames of ICS 1 and 3, reads it back and sends it
+void test_motion(void)
+{
+	const uint32_t time[3] = {0, 500, 1000};
+	const uint8_t speed[3] = {10, 20, 30};
+	uint16_t pos[3][36], read[36]; // One per ICS
+	char path[] = "/tmp/loopback_XXXXXX";
+	rcb4_motion* motion;
+	uint32_t cursor = 0;
+	int i, fd, err, sent = 0;
+	
+	memset(pos, 0, sizeof(pos));
+	memset(read, 0, sizeof(read));
+	for(i = 0; i < 3; i++)
+	{
+		pos[i][0] = 7000 + 100*i;
+		pos[i][2] = 8000 - 100*i;
+	}
+	
+	fd = mkstemp(path);
+	if(fd < 0)
+	{
+		check("Motion file", -1, 0, 0);
+		return;
+	}
+	close(fd);
+	
+	err = rcb4_motion_write(path, 0x05, 3, time, speed, &pos[0][0]);
+	motion = rcb4_motion_open(path);
+	unlink(path); // Stays mapped
+	if(err != 0 || !motion)
+	{
+		rcb4_motion_close(motion);
+		check("Motion file", -1, 0, 0);
+		return;
+	}
+	
+	check("Motion validate", rcb4_motion_validate(motion), 0, 0);
+	check("Motion frames", 0, rcb4_motion_get_frames(motion), 3);
+	check("Motion mask", 0, rcb4_motion_get_mask(motion), 0x05);
+	check("Motion time", 0, rcb4_motion_get_time(motion, 1), 500);
+	err = rcb4_motion_get_positions(motion, 2, read);
+	check("Motion ICS 1", err, read[0], 7200);
+	check("Motion ICS 3", err, read[2], 7800);
+	
+	while((err = rcb4_motion_next(motion, &cursor, comm)) > 0)
+	{
+		if(rcb4_send_command(con, comm, NULL) != 0)
+			break;
+		sent++;
+	}
+	check("Motion sent", err, sent, 3);
+	
+	rcb4_motion_close(motion);
+}
+
+// Writes 1KB with the pipelined transfers and reads it back
+void test_rom(void)
+{
+	static uint8_t data[0x400], back[0x400];
+	uint64_t hash = 0;
+	int i, err;
+	
+	for(i = 0; i < (int)sizeof(data); i++)
+		data[i] = (uint8_t)(i * 7 + 3);
+	
+	err = rcb4_rom_set_pipeline(con, 4);
+	err |= rcb4_rom_write(con, ROM_ADDR + 0x400, data, sizeof(data));
+	err |= rcb4_rom_read(con, ROM_ADDR + 0x400, back, sizeof(back));
+	check("ROM write and read", err, memcmp(data, back, sizeof(data)) != 0, 0);
+	
+	check("ROM verify", 0, rcb4_rom_verify(con, ROM_ADDR + 0x400, data, sizeof(data)), 0);
+	data[0x123] ^= 0xFF;
+	check("ROM verify (different)", 0, rcb4_rom_verify(con, ROM_ADDR + 0x400, data, sizeof(data)), 1);
+	data[0x123] ^= 0xFF;
+	
+	err = rcb4_rom_hash(con, ROM_ADDR + 0x400, sizeof(data), &hash);
+	check("ROM hash", err, hash == rcb4_util_hash(RCB4_HASH_INIT, data, sizeof(data)), 1);
+}
+
+// Syncs 2 blocks: all of them the first time, none the second, then the one
+// that changed and finally the one written behind the back of the index
+void test_sync(void)
+{
+	static uint8_t image[2 * RCB4_SYNC_BLOCK_SIZE], back[2 * RCB4_SYNC_BLOCK_SIZE];
+	char dir[] = "/tmp/loopback_XXXXXX";
+	rcb4_sync_stats stats;
+	uint8_t other = 0x5A;
+	int i, err;
+	
+	for(i = 0; i < (int)sizeof(image); i++)
+		image[i] = (uint8_t)(i * 13 + 1);
+	if(!mkdtemp(dir))
+	{
+		check("ROM sync", -1, 0, 0);
+		return;
+	}
+	
+	err = rcb4_rom_sync(con, dir, "loopback", ROM_ADDR + 0x800, image, sizeof(image), 2, &stats);
+	check("ROM sync (first)", err, stats.changed, 2);
+	err = rcb4_rom_sync(con, dir, "loopback", ROM_ADDR + 0x800, image, sizeof(image), 2, &stats);
+	check("ROM sync (again)", err, stats.bytes_written, 0);
+	
+	image[RCB4_SYNC_BLOCK_SIZE + 5]++;
+	err = rcb4_rom_sync(con, dir, "loopback", ROM_ADDR + 0x800, image, sizeof(image), 2, &stats);
+	check("ROM sync (one changed)", err, stats.changed, 1);
+	
+	err = rcb4_rom_write(con, ROM_ADDR + 0x800, &other, 1); // Not in the index
+	err |= rcb4_rom_sync(con, dir, "loopback", ROM_ADDR + 0x800, image, sizeof(image), 2, &stats);
+	check("ROM sync (stale)", err, stats.stale && stats.changed == 1, 1);
+	err = rcb4_rom_read(con, ROM_ADDR + 0x800, back, sizeof(back));
+	check("ROM sync (read back)", err, memcmp(image, back, sizeof(image)) != 0, 0);
+	
+	rcb4_rom_sync_forget(dir, "loopback");
+	rmdir(dir);
+}
+
+// Deletes the files of a temporary directory and the directory. Returns how many files there were
+int remove_dir(const char* dir)
+{
+	char path[300];
+	struct dirent* entry;
+	DIR* d = opendir(dir);
+	int files = 0;
+	
+	if(!d)return -1;
+	while((entry = readdir(d)) != NULL)
+	{
+		if(entry->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		unlink(path);
+		files++;
+	}
+	closedir(d);
+	rmdir(dir);
+	return files;
+}
+
+// Reads the block of test_sync() through the cache, changes it and opens the cache again
+void test_rom_cache(void)
+{
+	static uint8_t data[RCB4_SYNC_BLOCK_SIZE], cached[RCB4_SYNC_BLOCK_SIZE];
+	char dir[] = "/tmp/loopback_XXXXXX";
+	rcb4_rom_cache* cache;
+	int err;
+	
+	if(!mkdtemp(dir) || !(cache = rcb4_rom_cache_open(con, dir, 1)))
+	{
+		check("ROM cache", -1, 0, 0);
+		return;
+	}
+	
+	err = rcb4_rom_read(con, ROM_ADDR + 0x800, data, sizeof(data));
+	err |= rcb4_rom_cache_read(cache, ROM_ADDR + 0x800, cached, sizeof(cached));
+	check("ROM cache read", err, memcmp(data, cached, sizeof(data)) != 0, 0);
+	
+	data[10]++;
+	err = rcb4_rom_write(con, ROM_ADDR + 0x800 + 10, &data[10], 1); // Updates the cache
+	err |= rcb4_rom_cache_read(cache, ROM_ADDR + 0x800, cached, sizeof(cached));
+	check("ROM cache (written)", err, memcmp(data, cached, sizeof(data)) != 0, 0);
+	
+	err = rcb4_rom_cache_flush(cache);
+	rcb4_rom_cache_close(cache);
+	cache = rcb4_rom_cache_open(con, dir, 1);
+	if(!cache)
+		err = -1;
+	else
+	{
+		memset(cached, 0, sizeof(cached));
+		err |= rcb4_rom_cache_read(cache, ROM_ADDR + 0x800, cached, sizeof(cached));
+		rcb4_rom_cache_close(cache);
+	}
+	check("ROM cache (reopened)", err, memcmp(data, cached, sizeof(data)) != 0, 0);
+	check("ROM cache files", 0, remove_dir(dir), 1);
+}
+
+// Edits the region of test_rom() in memory, only the changed bytes are sent
+void test_rom_mirror(void)
+{
+	static uint8_t back[0x400];
+	rcb4_rom_mirror* mirror;
+	uint8_t* rom;
+	int err;
+	
+	mirror = rcb4_rom_mirror_create(con, NULL);
+	if(!mirror)
+	{
+		check("ROM mirror", -1, 0, 0);
+		return;
+	}
+	rom = rcb4_rom_mirror_get_data(mirror);
+	
+	err = rcb4_rom_mirror_load(mirror, ROM_ADDR + 0x400, 0x400);
+	check("ROM mirror (no changes)", err, rcb4_rom_flush(mirror), 0);
+	
+	rom[ROM_ADDR + 0x410]++;
+	check("ROM mirror (1 byte)", 0, rcb4_rom_flush(mirror), 1);
+	rom[ROM_ADDR + 0x420]++;
+	rom[ROM_ADDR + 0x700]++;
+	check("ROM mirror (2 runs)", 0, rcb4_rom_flush(mirror), 2);
+	check("ROM mirror (flushed)", 0, rcb4_rom_flush(mirror), 0);
+	
+	rom[ROM_ADDR + 0xC00] = 0x42; // Not loaded, the whole page is written
+	rcb4_rom_mirror_mark_dirty(mirror, ROM_ADDR + 0xC00, 1);
+	check("ROM mirror (dirty page)", 0, rcb4_rom_flush(mirror), RCB4_MIRROR_PAGE_SIZE);
+	
+	err = rcb4_rom_read(con, ROM_ADDR + 0x400, back, sizeof(back));
+	check("ROM mirror (read back)", err, memcmp(rom + ROM_ADDR + 0x400, back, sizeof(back)) != 0, 0);
+	
+	rcb4_rom_mirror_delete(mirror);
+}
+
+// Writes a "motion" that counts in MOTION_SLOT, finds it and plays it by name
+void test_motion_index(void)
+{
+	rcb4_motion_index* index = rcb4_motion_index_create();
+	rcb4_motion_index* loaded = rcb4_motion_index_create();
+	char path[] = "/tmp/loopback_XXXXXX";
+	uint8_t erased[16]; // The start of the slot, what the scan looks at
+	uint16_t value = 0;
+	rcb4_asm* a = rcb4_asm_create();
+	int fd, used, err;
+	
+	if(!index || !loaded || !a)
+	{
+		rcb4_motion_index_delete(index);
+		rcb4_motion_index_delete(loaded);
+		rcb4_asm_delete(a);
+		check("Motion index", -1, 0, 0);
+		return;
+	}
+	
+	memset(erased, 0xFF, sizeof(erased));
+	err = rcb4_rom_write(con, RCB4_MOTION_SLOT_ADDRESS(MOTION_SLOT), erased, sizeof(erased));
+	used = rcb4_motion_index_scan(index, con);
+	
+	rcb4_command_recreate(comm, RCB4_COMM_MOV);
+	value = 0;
+	rcb4_command_set_src_literal(comm, &value, sizeof(value));
+	rcb4_command_set_dst_ram(comm, VAR_ADDR + 12);
+	err |= rcb4_asm_add(a, comm);
+	rcb4_command_recreate(comm, RCB4_COMM_ADD);
+	value = 1;
+	rcb4_command_set_src_literal(comm, &value, sizeof(value));
+	rcb4_command_set_dst_ram(comm, VAR_ADDR + 12);
+	err |= rcb4_asm_add(a, comm);
+	err |= rcb4_asm_ret(a);
+	err |= rcb4_asm_upload(a, con, RCB4_MOTION_SLOT_ADDRESS(MOTION_SLOT));
+	rcb4_asm_delete(a);
+	check("Motion index scan", (used < 0) ? used : err, rcb4_motion_index_scan(index, con) - used, 1);
+	
+	err = rcb4_motion_index_set_name(index, MOTION_SLOT, "loopback");
+	check("Motion index find", err, rcb4_motion_index_find(index, "loopback"), MOTION_SLOT);
+	
+	fd = mkstemp(path);
+	if(fd >= 0)
+		close(fd);
+	err = (fd < 0) ? -1 : rcb4_motion_index_save(index, path);
+	err |= rcb4_motion_index_load(loaded, path);
+	unlink(path);
+	check("Motion index (loaded)", err, rcb4_motion_index_find(loaded, "loopback"), MOTION_SLOT);
+	
+	err = set_var(VAR_ADDR + 12, 5);
+	err |= rcb4_play_motion(con, loaded, "loopback");
+	usleep(10000); // The robot runs it after the ACK
+	err |= get_var(VAR_ADDR + 12, &value);
+	check("Motion index play", err, value, 1);
+	
+	rcb4_motion_index_delete(index);
+	rcb4_motion_index_delete(loaded);
+}
+
+// Stages two frames of ICS 1 and 4 and applies them. The emulator doesn't move
+// servos, so the packets are checked in RAM
+void test_stage(void)
+{
+	rcb4_stage* stage;
+	uint16_t pos[2][36] = {{0}}; // One per ICS
+	uint8_t packets[2 * 2 * 3];
+	int err;
+	
+	stage = rcb4_stage_create(con, 0x09, 2, 0x03E0, ROM_ADDR + 0x300);
+	if(!stage)
+	{
+		check("Stage", -1, 0, 0);
+		return;
+	}
+	
+	pos[0][0] = 7500;
+	pos[0][3] = 8000;
+	pos[1][0] = 7400;
+	pos[1][3] = 8100;
+	err = rcb4_stage_install(stage);
+	err |= rcb4_stage_load(stage, 0, pos[0]);
+	err |= rcb4_stage_load(stage, 1, pos[1]);
+	check("Stage load", err, 0, 0);
+	
+	// Slot by slot, 0x80 | ID, position (7 bits high, 7 bits low). ICS 4 is the ID 1 of the second line
+	rcb4_command_recreate(comm, RCB4_COMM_MOV);
+	rcb4_command_set_src_ram(comm, 0x03E0 + RCB4_STAGE_REPLY_SIZE, sizeof(packets));
+	rcb4_command_set_dst_com(comm);
+	err = (rcb4_send_command(con, comm, packets) != sizeof(packets));
+	check("Stage slot 0, ICS 1", err, (packets[1] << 7) | packets[2], 7500);
+	check("Stage slot 1, ICS 4 ID", err, packets[9], 0x81);
+	check("Stage slot 1, ICS 4", err, (packets[10] << 7) | packets[11], 8100);
+	
+	err = rcb4_stage_apply(stage, 1);
+	err |= rcb4_stage_apply(stage, 0);
+	check("Stage apply", err, 0, 0);
+	
+	rcb4_stage_delete(stage);
+}
+
+// Samples a variable inside the robot. The emulator runs the routine until its
+// step limit, so the ring is full and the rest of the samples were lost. The
+// counter of the routine says how many it took
+void test_sampler(void)
+{
+	rcb4_sampler* sampler;
+	rcb4_sample samples[32];
+	uint32_t value = 0;
+	uint16_t counter = 0;
+	int i, n, err, wrong = 0;
+	
+	sampler = rcb4_sampler_create(con, VAR_ADDR + 12, 4, 0x0300, ROM_ADDR + 0xD00);
+	if(!sampler)
+	{
+		check("Sampler", -1, 0, 0);
+		return;
+	}
+	
+	err = set_var(VAR_ADDR + 12, 0x1234);
+	err |= set_var(VAR_ADDR + 14, 0x5678);
+	err |= rcb4_sampler_install(sampler);
+	err |= rcb4_sampler_start(sampler);
+	err |= rcb4_sampler_stop(sampler);
+	usleep(10000); // The robot finishes the lap
+	
+	n = rcb4_sampler_drain(sampler, samples, 32);
+	for(i = 0; i < n; i++)
+	{
+		memcpy(&value, samples[i].data, 4);
+		if(samples[i].size != 4 || value != 0x56781234 || (i > 0 && samples[i].sequence != samples[i - 1].sequence + 1))
+			wrong++;
+	}
+	err |= get_var(0x0300 + 1, &counter); // After the stop flag
+	check("Sampler drain", (n > 0) ? err : -1, wrong, 0);
+	check("Sampler ring (118 / 6)", err, n, 19);
+	check("Sampler drained + lost", err, n + rcb4_sampler_get_lost(sampler), counter);
+	check("Sampler drain (again)", 0, rcb4_sampler_drain(sampler, samples, 32), 0);
+	
+	rcb4_sampler_delete(sampler);
+}
+
+// A server in a thread shares the connection through a Unix socket. Its
+// clients are pollable, unlike the "loop:" emulator
+rcb4_server* server = NULL;
+pthread_t server_thread;
+char server_path[64];
+
+void* server_run(void* data)
+{
+	rcb4_server_run((rcb4_server*)data);
+	return NULL;
+}
+
+int create_server(void)
+{
+	snprintf(server_path, sizeof(server_path), "/tmp/loopback_%d.sock", (int)getpid());
+	server = rcb4_server_create(con, server_path);
+	return server ? 0 : -1;
+}
+
+int run_server(void)
+{
+	if(pthread_create(&server_thread, NULL, server_run, server) != 0)
+	{
+		rcb4_server_delete(server);
+		server = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+// The clients stay connected, their frames wait in the socket until run_server()
+void pause_server(void)
+{
+	rcb4_server_stop(server);
+	pthread_join(server_thread, NULL);
+}
+
+// Disconnects the clients
+void stop_server(void)
+{
+	if(!server)return;
+	pause_server();
+	rcb4_server_delete(server);
+	server = NULL;
+}
+
+// Counts the replies of test_reactor(). Each robot adds to its own variable, so the results go 1, 2, 3...
+struct reactor_robot
+{
+	int done;
+	int failed;
+	int out_of_order;
+};
+
+void reactor_done(rcb4_reactor* reactor, int robot, int result, const uint8_t* reply, void* data)
+{
+	struct reactor_robot* r = (struct reactor_robot*)data;
+	
+	(void)reactor;
+	(void)robot;
+	r->done++;
+	if(result != 2)
+		r->failed++;
+	else if((reply[0] | (reply[1] << 8)) != r->done)
+		r->out_of_order++;
+}
+
+// Two clients of the server as two robots, 5 ADD each. Then the server goes away
+void test_reactor(uint8_t backend, const char* name)
+{
+	rcb4_connection* client[2] = {NULL, NULL};
+	struct reactor_robot robot[2];
+	rcb4_reactor* reactor;
+	uint16_t one = 1, value[2] = {0, 0};
+	char what[32], uri[80];
+	int i, j, err = 0, id[2];
+	
+	memset(robot, 0, sizeof(robot));
+	snprintf(what, sizeof(what), "Reactor (%s)", name);
+	reactor = rcb4_reactor_create_backend(backend);
+	if(!reactor && backend == RCB4_REACTOR_URING) // Needs Linux 5.6
+	{
+		printf("%-24s SKIPPED (not available)\n", what);
+		return;
+	}
+	if(!reactor || create_server() != 0 || run_server() != 0)
+	{
+		rcb4_reactor_delete(reactor);
+		check(what, -1, 0, 0);
+		return;
+	}
+	
+	snprintf(uri, sizeof(uri), "unix:%s", server_path);
+	for(i = 0; i < 2; i++)
+	{
+		client[i] = rcb4_open(uri);
+		id[i] = client[i] ? rcb4_reactor_add(reactor, client[i]) : -1;
+		err |= (id[i] < 0) ? -1 : set_var(VAR_ADDR + 12 + 2*i, 0);
+	}
+	
+	for(i = 0; i < 2 && err == 0; i++)
+	{
+		rcb4_command_recreate(comm, RCB4_COMM_ADD);
+		rcb4_command_set_src_literal(comm, &one, sizeof(one));
+		rcb4_command_set_dst_ram(comm, VAR_ADDR + 12 + 2*i);
+		for(j = 0; j < 5 && err == 0; j++)
+			err = rcb4_reactor_submit(reactor, id[i], comm, reactor_done, &robot[i]);
+	}
+	while(err == 0 && rcb4_reactor_pending(reactor) > 0)
+		err = (rcb4_reactor_run(reactor, 1000) < 0);
+	
+	err |= get_var(VAR_ADDR + 12, &value[0]);
+	err |= get_var(VAR_ADDR + 14, &value[1]);
+	snprintf(what, sizeof(what), "Reactor (%s) done", name);
+	check(what, err, robot[0].done + robot[1].done, 10);
+	snprintf(what, sizeof(what), "Reactor (%s) in order", name);
+	check(what, err, robot[0].failed + robot[1].failed + robot[0].out_of_order + robot[1].out_of_order, 0);
+	snprintf(what, sizeof(what), "Reactor (%s) values", name);
+	check(what, err, value[0] + value[1], 10);
+	
+	// The robot hangs up: the requests fail instead of waiting forever
+	stop_server();
+	rcb4_reactor_run(reactor, 100); // Sees the EOF (epoll only, io_uring isn't reading)
+	memset(robot, 0, sizeof(robot));
+	err = rcb4_reactor_submit(reactor, id[0], comm, reactor_done, &robot[0]);
+	err |= rcb4_reactor_submit(reactor, id[0], comm, reactor_done, &robot[0]);
+	for(i = 0; i < 10 && err == 0 && rcb4_reactor_pending(reactor) > 0; i++)
+		err = (rcb4_reactor_run(reactor, 1000) < 0);
+	snprintf(what, sizeof(what), "Reactor (%s) hung up", name);
+	check(what, err, robot[0].failed, 2);
+	
+	rcb4_reactor_delete(reactor);
+	for(i = 0; i < 2; i++)
+		rcb4_deinit(client[i]);
+}
+
+// Reply of test_server()
+void server_done(rcb4_reactor* reactor, int robot, int result, const uint8_t* reply, void* data)
+{
+	(void)reactor;
+	(void)robot;
+	*(int*)data = (result == 2) ? (reply[0] | (reply[1] << 8)) : -1;
+}
+
+// Two clients read the same variable at the same time: the robot is asked once
+void test_server(void)
+{
+	rcb4_connection* client[2] = {NULL, NULL};
+	rcb4_reactor* reactor = rcb4_reactor_create();
+	rcb4_server_stats stats;
+	uint16_t value = 0;
+	int i, err, id[2], result[2] = {-1, -1};
+	char uri[80];
+	
+	if(!reactor || create_server() != 0 || run_server() != 0)
+	{
+		rcb4_reactor_delete(reactor);
+		check("Server", -1, 0, 0);
+		return;
+	}
+	
+	err = set_var(VAR_ADDR + 12, 4242);
+	snprintf(uri, sizeof(uri), "unix:%s", server_path);
+	for(i = 0; i < 2; i++)
+	{
+		client[i] = rcb4_open(uri);
+		id[i] = client[i] ? rcb4_reactor_add(reactor, client[i]) : -1;
+		err |= (id[i] < 0) ? -1 : 0;
+	}
+	
+	// Both frames are sent while the server is paused, so they are in its next batch
+	pause_server();
+	rcb4_command_recreate(comm, RCB4_COMM_MOV);
+	rcb4_command_set_src_ram(comm, VAR_ADDR + 12, 2);
+	rcb4_command_set_dst_com(comm);
+	for(i = 0; i < 2 && err == 0; i++)
+		err = rcb4_reactor_submit(reactor, id[i], comm, server_done, &result[i]);
+	err |= run_server();
+	while(err == 0 && rcb4_reactor_pending(reactor) > 0)
+		err = (rcb4_reactor_run(reactor, 1000) < 0);
+	rcb4_reactor_delete(reactor); // The connections are ours again
+	
+	memset(&stats, 0, sizeof(stats));
+	if(server) // Gone if it couldn't run again
+		rcb4_server_get_stats(server, &stats);
+	check("Server client 1", err, result[0], 4242);
+	check("Server client 2", err, result[1], 4242);
+	check("Server merged reads", err, stats.merged, 1);
+	check("Server clients", err, stats.clients, 2);
+	
+	// A plain connection to the server works like one to the robot
+	err = client[0] ? (rcb4_send_command(client[0], comm, (uint8_t*)&value) != 2) : -1;
+	check("Server send command", err, value, 4242);
+	
+	for(i = 0; i < 2; i++)
+		rcb4_deinit(client[i]);
+	stop_server();
+}
+
+// Shares a stream through a bridge and reads it from a second mapping, like
+// another process would
+void test_bridge(void)
+{
+	rcb4_stream* stream = rcb4_stream_create(con);
+	rcb4_bridge* bridge = NULL;
+	rcb4_bridge* other = NULL;
+	rcb4_sample sample;
+	uint16_t pos[36] = {0}; // One per ICS
+	uint16_t value = 0;
+	char name[32];
+	int err;
+	
+	snprintf(name, sizeof(name), "loopback_%d", (int)getpid());
+	err = stream ? rcb4_stream_add_ram(stream, VAR_ADDR + 12, 2) : -1;
+	if(err == 0)
+		bridge = rcb4_bridge_create(con, stream, name, 2000);
+	if(bridge)
+		other = rcb4_bridge_open(name);
+	if(!other)
+	{
+		rcb4_bridge_delete(bridge);
+		rcb4_stream_delete(stream);
+		check("Bridge", -1, 0, 0);
+		return;
+	}
+	
+	err = set_var(VAR_ADDR + 12, 777);
+	err |= rcb4_stream_start(stream);
+	pos[0] = 7600;
+	err |= rcb4_bridge_set_targets(other, 100, 0x01, pos);
+	usleep(20000);
+	
+	err |= rcb4_bridge_latest(other, &sample);
+	err |= rcb4_bridge_get_ram(other, &sample, VAR_ADDR + 12, &value, 2);
+	check("Bridge sample", err, value, 777);
+	check("Bridge target errors", err, rcb4_bridge_get_errors(other), 0);
+	check("Bridge second owner", 0, rcb4_bridge_create(con, NULL, name, 2000) == NULL, 1);
+	
+	rcb4_bridge_delete(other);
+	rcb4_bridge_delete(bridge); // Stops the stream
+	rcb4_stream_delete(stream);
+}
+
+// A client of the server loses it and gets it back. The reconnection sends the
+// restore commands again
+void test_reconnect(void)
+{
+	rcb4_connection* client = NULL;
+	uint16_t value = 99;
+	char uri[80];
+	int err;
+	
+	if(create_server() == 0 && run_server() == 0)
+	{
+		snprintf(uri, sizeof(uri), "unix:%s", server_path);
+		client = rcb4_open(uri);
+	}
+	if(!client)
+	{
+		stop_server();
+		check("Reconnect", -1, 0, 0);
+		return;
+	}
+	
+	err = rcb4_reconnect_enable(client, 2000, 0);
+	rcb4_command_recreate(comm, RCB4_COMM_MOV);
+	rcb4_command_set_src_literal(comm, &value, sizeof(value));
+	rcb4_command_set_dst_ram(comm, VAR_ADDR + 16);
+	err |= rcb4_restore_add(client, comm);
+	err |= set_var(VAR_ADDR + 16, 0);
+	
+	stop_server(); // The device is gone...
+	err |= create_server(); // ...and back
+	err |= run_server();
+	
+	rcb4_command_recreate(comm, RCB4_COMM_MOV);
+	rcb4_command_set_src_ram(comm, VAR_ADDR + 16, 2);
+	rcb4_command_set_dst_com(comm);
+	check("Reconnect (failed)", 0, rcb4_send_command(client, comm, (uint8_t*)&value) < 0, 1);
+	value = 0;
+	err |= (rcb4_send_command(client, comm, (uint8_t*)&value) != 2);
+	check("Reconnect (restored)", err, value, 99);
+	check("Reconnect count", err, rcb4_get_reconnects(client), 1);
+	
+	rcb4_deinit(client);
+	stop_server();
+}
+
+int main(int argc, char *argv[])
+{
+	const char* uri = (argc > 1) ? argv[1] : "loop:";
+	
+	printf("Connecting to %s\n", uri);
+	con = rcb4_open(uri);
+	if(!con)return -1;
+	atexit(deinit);
+	
+	comm = rcb4_command_create(RCB4_COMM_MOV);
+	if(!comm)return -1;
+	
+	signal(SIGPIPE, SIG_IGN); // The reactor writes to the server after it is gone
+	
+	test_ram();
+	test_asm();
+	test_expr();
+	test_batch();
+	test_stream();
+	test_sched();
+	test_rt();
+	test_exchange();
+	test_traj();
+	test_motion();
+	test_rom();
+	test_sync();
+	test_rom_cache();
+	test_rom_mirror();
+	test_motion_index();
+	test_stage();
+	test_sampler();
+	test_reactor(RCB4_REACTOR_EPOLL, "epoll");
+	test_reactor(RCB4_REACTOR_URING, "io_uring");
+	test_server();
+	test_bridge();
+	test_reconnect();
+	
+	printf("%d checks failed.\n", failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,76 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Copyright 2015 Alfonso Arbona Gimeno
+ */
+
+/*
+ * rcb4d: keeps the connection to the robot and shares it with other processes.
+ * 
+ * Usage: rcb4d [robot] [socket]
+ * By default robot is /dev/ttyUSB0 (any uri of rcb4_open()) and socket is
+ * /tmp/rcb4.sock. The clients connect with rcb4_open("unix:/tmp/rcb4.sock").
+ */
+
+#include "rcb4.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+
+rcb4_connection* con; // Connection to the robot
+rcb4_server* server; // Server of the clients
+
+void stop(int sig)
+{
+	(void)sig;
+	rcb4_server_stop(server);
+}
+
+int main(int argc, char *argv[])
+{
+	const char* robot = (argc > 1) ? argv[1] : "/dev/ttyUSB0";
+	const char* path = (argc > 2) ? argv[2] : "/tmp/rcb4.sock";
+	rcb4_server_stats stats;
+	
+	printf("Connecting to the robot\n");
+	con = rcb4_open(robot);
+	if(!con)return -1;
+	
+	server = rcb4_server_create(con, path);
+	if(!server)
+	{
+		rcb4_deinit(con);
+		return -1;
+	}
+	
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+	
+	printf("Serving on %s\n", path);
+	rcb4_server_run(server);
+	
+	rcb4_server_get_stats(server, &stats);
+	printf("%llu frames, %llu merged, %llu transactions, %llu failed.\n",
+	       (unsigned long long)stats.requests, (unsigned long long)stats.merged,
+	       (unsigned long long)stats.transactions, (unsigned long long)stats.failed);
+	
+	rcb4_server_delete(server);
+	rcb4_deinit(con);
+	
+	printf("Exit correctly.\n");
+	return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Copyright 2015 Alfonso Arbona Gimeno
+ */
+
+#include "rcb4.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+// Uploads a ROM image to the robot, writing only what changed since the last time.
+// Usage: rom_sync robot_id image.bin [address] [tty]
+
+rcb4_connection* con = NULL; // Connection to the robot
+uint8_t* image = NULL;
+
+void deinit(void)
+{
+	free(image);
+	if(con)rcb4_deinit(con);
+	
+	printf("Exit correctly.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	FILE* file;
+	long size;
+	uint32_t addr = 0;
+	const char* tty = "/dev/ttyUSB0";
+	rcb4_sync_stats stats;
+	
+	if(argc < 3)
+	{
+		printf("Usage: %s robot_id image.bin [address] [tty]\n", argv[0]);
+		return -1;
+	}
+	if(argc > 3)
+		addr = strtoul(argv[3], NULL, 0);
+	if(argc > 4)
+		tty = argv[4];
+	atexit(deinit);
+	
+	file = fopen(argv[2], "rb");
+	if(!file)
+	{
+		fprintf(stderr, "Cannot open %s\n", argv[2]);
+		return -1;
+	}
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	image = (uint8_t*)malloc(size);
+	if(!image || fread(image, 1, size, file) != (size_t)size)
+	{
+		fprintf(stderr, "Cannot read %s\n", argv[2]);
+		fclose(file);
+		return -1;
+	}
+	fclose(file);
+	
+	printf("Connecting to the robot\n");
+	con = rcb4_init(tty);
+	if(!con)return -1;
+	
+	if(rcb4_rom_sync(con, NULL, argv[1], addr, image, size, 4, &stats) != 0)
+	{
+		fprintf(stderr, "Sync failed.\n");
+		return -1;
+	}
+	
+	printf("%u blocks, %u changed, %u verified%s, %u bytes written.\n", stats.blocks, stats.changed,
+	       stats.verified, stats.stale ? " (index was stale)" : "", stats.bytes_written);
+	
+	return 0;
+}
@@ -0,0 +1,77 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Copyright 2015 Alfonso Arbona Gimeno
+ */
+
+#include "rcb4.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+rcb4_connection* con; // Connection to the robot
+rcb4_stream* stream; // Sensor stream
+
+void deinit(void)
+{
+	rcb4_stream_delete(stream);
+	rcb4_deinit(con);
+	
+	printf("Exit correctly.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	rcb4_sample sample;
+	uint64_t cursor = 0, expected = 0;
+	uint16_t ad_value_1, ad_value_2;
+	
+	printf("Connecting to the robot\n");
+	con = rcb4_init("/dev/ttyUSB0");
+	if(!con)return -1;
+	atexit(deinit);
+	
+	printf("Ping: %d\n", rcb4_command_ping(con));
+	
+	stream = rcb4_stream_create(con);
+	if(!stream)return -1;
+	rcb4_stream_add_ad(stream, 1); // Front / back
+	rcb4_stream_add_ad(stream, 2); // Left / right
+	rcb4_stream_set_period(stream, 10000); // 100Hz
+	if(rcb4_stream_start(stream) != 0)return -1;
+	
+	
+	while(rcb4_stream_get_errors(stream) < 20)
+	{
+		// The main loop can do other work, the samples keep coming
+		rcb4_util_usleep(100000);
+		
+		while(rcb4_stream_read(stream, &cursor, &sample))
+		{
+			if(sample.sequence != expected)
+				printf("Lost %d samples\n", (int)(sample.sequence - expected));
+			expected = sample.sequence + 1;
+			
+			rcb4_stream_get_ad(stream, &sample, 1, &ad_value_1);
+			rcb4_stream_get_ad(stream, &sample, 2, &ad_value_2);
+			printf("%llu: %d, %d\n", (unsigned long long)sample.timestamp, ad_value_1, ad_value_2);
+		}
+	}
+	
+	
+	return 0;
+}
@@ -0,0 +1,357 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_asm.c
+ * @brief Assembler of routines that run inside the robot.
+ * 
+ * @details The robot runs from its ROM the same frames it receives through the
+ * serial link. These functions put a list of commands one after the other,
+ * resolve the labels used by the jumps and calls and upload the result, so a
+ * whole sequence of operations costs a single rcb4_call().
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_command.h"
+#include "rcb4_asm.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+rcb4_asm* rcb4_asm_create(void)
+{
+	rcb4_asm* a;
+	
+	a = (rcb4_asm*)malloc(sizeof(rcb4_asm));
+	if(!a)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return NULL;
+	}
+	
+	memset(a, 0, sizeof(rcb4_asm));
+	a->base = -1;
+	
+	return a;
+}
+
+void rcb4_asm_delete(rcb4_asm* a)
+{
+	if(!a)return;
+	
+	free(a->code);
+	free(a->labels);
+	free(a->fixups);
+	free(a);
+}
+
+void rcb4_asm_clear(rcb4_asm* a)
+{
+	assert(a);
+	
+	a->size = 0;
+	a->n_labels = 0;
+	a->n_fixups = 0;
+	a->base = -1;
+}
+
+// Makes room for size more bytes of code. Returns a pointer to them or NULL
+static
+uint8_t* rcb4_asm_reserve(rcb4_asm* a, uint32_t size)
+{
+	uint8_t* code;
+	uint32_t capacity;
+	
+	if(a->size + size > RCB4_MAX_ROM_ADDRESS + 1)
+	{
+		fprintf(stderr, "The routine doesn't fit in the ROM.\n");
+		return NULL;
+	}
+	
+	if(a->size + size > a->capacity)
+	{
+		capacity = a->capacity ? 2 * a->capacity : 256;
+		while(capacity < a->size + size)
+			capacity *= 2;
+		code = (uint8_t*)realloc(a->code, capacity);
+		if(!code)
+		{
+			fprintf(stderr, "Memory error.\n");
+			return NULL;
+		}
+		a->code = code;
+		a->capacity = capacity;
+	}
+	
+	a->base = -1; // The code changed
+	a->size += size;
+	return a->code + a->size - size;
+}
+
+static
+int rcb4_asm_check_label(const char* name)
+{
+	if(!name || name[0] == '\0' || strlen(name) >= RCB4_ASM_LABEL_MAX)
+	{
+		fprintf(stderr, "Invalid label. Maximum length: %d.\n", RCB4_ASM_LABEL_MAX - 1);
+		return -1;
+	}
+	
+	return 0;
+}
+
+static
+int rcb4_asm_find_label(const rcb4_asm* a, const char* name)
+{
+	uint32_t i;
+	
+	for(i = 0; i < a->n_labels; i++)
+	{
+		if(strcmp(a->labels[i].name, name) == 0)
+			return i;
+	}
+	
+	return -1;
+}
+
+int rcb4_asm_add(rcb4_asm* a, const rcb4_comm* comm)
+{
+	uint8_t* code;
+	
+	assert(a);
+	assert(comm);
+	
+	// Logic and math commands answer with a copy only when they come from the serial link
+	if(comm->type == RCB4_COMM_MOV && (comm->command.mov.type & COMM_DST_MASK) == COMM_DST_COM)
+	{
+		fprintf(stderr, "Invalid command. A MOV to COM can't be assembled.\n");
+		return -1;
+	}
+	
+	code = rcb4_asm_reserve(a, comm->size);
+	if(!code)
+		return -1;
+	
+	rcb4_command_encode(comm, code);
+	return 0;
+}
+
+int rcb4_asm_label(rcb4_asm* a, const char* name)
+{
+	struct s_rcb4_asm_label* labels;
+	
+	assert(a);
+	
+	if(rcb4_asm_check_label(name) != 0)
+		return -1;
+	if(rcb4_asm_find_label(a, name) >= 0)
+	{
+		fprintf(stderr, "The label %s already exists.\n", name);
+		return -1;
+	}
+	
+	if(a->n_labels == a->max_labels)
+	{
+		labels = (struct s_rcb4_asm_label*)realloc(a->labels, (a->max_labels ? 2 * a->max_labels : 16) * sizeof(struct s_rcb4_asm_label));
+		if(!labels)
+		{
+			fprintf(stderr, "Memory error.\n");
+			return -1;
+		}
+		a->labels = labels;
+		a->max_labels = a->max_labels ? 2 * a->max_labels : 16;
+	}
+	
+	strcpy(a->labels[a->n_labels].name, name);
+	a->labels[a->n_labels].offset = a->size;
+	a->n_labels++;
+	
+	return 0;
+}
+
+static
+int rcb4_asm_jump(rcb4_asm* a, uint8_t type, const char* label, uint8_t conditions)
+{
+	uint8_t* code;
+	struct s_rcb4_asm_fixup* fixups;
+	
+	assert(a);
+	
+	if(rcb4_asm_check_label(label) != 0)
+		return -1;
+	
+	if(a->n_fixups == a->max_fixups)
+	{
+		fixups = (struct s_rcb4_asm_fixup*)realloc(a->fixups, (a->max_fixups ? 2 * a->max_fixups : 16) * sizeof(struct s_rcb4_asm_fixup));
+		if(!fixups)
+		{
+			fprintf(stderr, "Memory error.\n");
+			return -1;
+		}
+		a->fixups = fixups;
+		a->max_fixups = a->max_fixups ? 2 * a->max_fixups : 16;
+	}
+	
+	code = rcb4_asm_reserve(a, RCB4_COMM_JUMP_SIZE);
+	if(!code)
+		return -1;
+	
+	rcb4_command_encode_jump(type, 0, conditions, code); // The address is set by rcb4_asm_link()
+	strcpy(a->fixups[a->n_fixups].label, label);
+	a->fixups[a->n_fixups].offset = a->size - RCB4_COMM_JUMP_SIZE;
+	a->n_fixups++;
+	
+	return 0;
+}
+
+int rcb4_asm_jmp(rcb4_asm* a, const char* label, uint8_t conditions)
+{
+	return rcb4_asm_jump(a, RCB4_COMM_JMP, label, conditions);
+}
+
+int rcb4_asm_call(rcb4_asm* a, const char* label, uint8_t conditions)
+{
+	return rcb4_asm_jump(a, RCB4_COMM_CALL, label, conditions);
+}
+
+int rcb4_asm_call_addr(rcb4_asm* a, uint32_t addr, uint8_t conditions)
+{
+	uint8_t* code;
+	
+	assert(a);
+	
+	if(addr > RCB4_MAX_ROM_ADDRESS)
+	{
+		fprintf(stderr, "Invalid ROM address. Allowed address: 0x000000~0x%06X\n", RCB4_MAX_ROM_ADDRESS);
+		return -1;
+	}
+	
+	code = rcb4_asm_reserve(a, RCB4_COMM_JUMP_SIZE);
+	if(!code)
+		return -1;
+	
+	rcb4_command_encode_jump(RCB4_COMM_CALL, addr, conditions, code);
+	return 0;
+}
+
+int rcb4_asm_ret(rcb4_asm* a)
+{
+	uint8_t* code;
+	
+	assert(a);
+	
+	code = rcb4_asm_reserve(a, RCB4_COMM_RET_SIZE);
+	if(!code)
+		return -1;
+	
+	rcb4_command_encode_ret(code);
+	return 0;
+}
+
+int rcb4_asm_link(rcb4_asm* a, uint32_t base)
+{
+	int l;
+	uint32_t i;
+	uint8_t* code;
+	
+	assert(a);
+	
+	if(base > RCB4_MAX_ROM_ADDRESS || a->size > RCB4_MAX_ROM_ADDRESS + 1 - base)
+	{
+		fprintf(stderr, "The routine doesn't fit at 0x%06X.\n", base);
+		return -1;
+	}
+	
+	for(i = 0; i < a->n_fixups; i++)
+	{
+		l = rcb4_asm_find_label(a, a->fixups[i].label);
+		if(l < 0)
+		{
+			fprintf(stderr, "Undefined label %s.\n", a->fixups[i].label);
+			return -1;
+		}
+		code = a->code + a->fixups[i].offset;
+		rcb4_command_encode_jump(code[1], base + a->labels[l].offset, code[5], code);
+	}
+	
+	a->base = base;
+	return 0;
+}
+
+const uint8_t* rcb4_asm_get_code(const rcb4_asm* a, uint32_t* size)
+{
+	assert(a);
+	
+	if(size)
+		*size = a->size;
+	
+	return a->code;
+}
+
+int32_t rcb4_asm_get_label(const rcb4_asm* a, const char* name)
+{
+	int l;
+	
+	assert(a);
+	assert(name);
+	
+	if(a->base < 0)
+	{
+		fprintf(stderr, "The routine is not linked.\n");
+		return -1;
+	}
+	
+	l = rcb4_asm_find_label(a, name);
+	if(l < 0)
+	{
+		fprintf(stderr, "Undefined label %s.\n", name);
+		return -1;
+	}
+	
+	return a->base + a->labels[l].offset;
+}
+
+int rcb4_asm_upload(rcb4_asm* a, rcb4_connection* conn, uint32_t base)
+{
+	int err;
+	
+	assert(a);
+	assert(conn);
+	
+	if(a->size == 0)
+	{
+		fprintf(stderr, "The routine is empty.\n");
+		return -1;
+	}
+	
+	err = rcb4_asm_link(a, base);
+	if(err != 0)
+		return err;
+	
+	return rcb4_rom_write(conn, base, a->code, a->size);
+}
@@ -0,0 +1,291 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_batch.c
+ * @brief Runs a list of operations inside the robot with a single call.
+ * 
+ * @details The operations are written to a RAM mailbox with one MOV and a
+ * dispatcher in the ROM copies them to a trampoline and runs them. The values
+ * read by the operations are left in a RAM result area that is read back with
+ * one more MOV, so a batch costs three transactions however many operations it
+ * has.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_connection.h"
+#include "rcb4_command.h"
+#include "rcb4_rom_cache.h"
+#include "rcb4_batch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+rcb4_batch* rcb4_batch_create(rcb4_connection* conn, uint32_t rom_addr, uint16_t mailbox_addr, uint16_t result_addr)
+{
+	rcb4_batch* batch;
+	
+	assert(conn);
+	
+	if(rom_addr + RCB4_BATCH_ROM_SIZE - 1 > RCB4_MAX_ROM_ADDRESS)
+	{
+		fprintf(stderr, "Invalid ROM address. Allowed address: 0x000000~0x%06X\n", RCB4_MAX_ROM_ADDRESS - RCB4_BATCH_ROM_SIZE + 1);
+		return NULL;
+	}
+	if(mailbox_addr + RCB4_BATCH_MAILBOX_SIZE - 1 > RCB4_MAX_RAM_ADDRESS ||
+	   result_addr + RCB4_BATCH_RESULT_SIZE > RCB4_MAX_RAM_ADDRESS)
+	{
+		fprintf(stderr, "Invalid RAM address. The mailbox or the result area don't fit in the RAM.\n");
+		return NULL;
+	}
+	if(mailbox_addr < result_addr + RCB4_BATCH_RESULT_SIZE + 1 && result_addr < mailbox_addr + RCB4_BATCH_MAILBOX_SIZE)
+	{
+		fprintf(stderr, "The mailbox and the result area overlap.\n");
+		return NULL;
+	}
+	
+	batch = (rcb4_batch*)malloc(sizeof(rcb4_batch));
+	if(!batch)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return NULL;
+	}
+	
+	memset(batch, 0, sizeof(rcb4_batch));
+	batch->conn = conn;
+	batch->rom_addr = rom_addr;
+	batch->mailbox_addr = mailbox_addr;
+	batch->result_addr = result_addr;
+	
+	return batch;
+}
+
+void rcb4_batch_delete(rcb4_batch* batch)
+{
+	if(!batch)return;
+	
+	free(batch);
+}
+
+int rcb4_batch_install(rcb4_batch* batch)
+{
+	int err;
+	rcb4_asm* a;
+	rcb4_comm* comm;
+	
+	assert(batch);
+	
+	a = rcb4_asm_create();
+	comm = rcb4_command_create(RCB4_COMM_MOV);
+	if(!a || !comm)
+	{
+		rcb4_asm_delete(a);
+		rcb4_command_delete(comm);
+		return -1;
+	}
+	
+	err = rcb4_command_set_src_ram(comm, batch->mailbox_addr, RCB4_BATCH_MAILBOX_SIZE);
+	if(err == 0)
+		err = rcb4_command_set_dst_rom(comm, batch->rom_addr + RCB4_BATCH_DISPATCHER_SIZE);
+	if(err == 0)
+		err = rcb4_asm_add(a, comm);
+	if(err == 0)
+		err = rcb4_asm_jmp(a, "trampoline", RCB4_CONDITION_ALWAYS);
+	if(err == 0)
+		err = rcb4_asm_label(a, "trampoline");
+	if(err == 0)
+		err = rcb4_asm_upload(a, batch->conn, batch->rom_addr);
+	batch->loaded = 0;
+	
+	rcb4_asm_delete(a);
+	rcb4_command_delete(comm);
+	return err;
+}
+
+void rcb4_batch_clear(rcb4_batch* batch)
+{
+	assert(batch);
+	
+	batch->ops_size = 0;
+	batch->result_size = 0;
+}
+
+int rcb4_batch_add(rcb4_batch* batch, const rcb4_comm* comm)
+{
+	assert(batch);
+	assert(comm);
+	
+	if(comm->type == RCB4_COMM_MOV && (comm->command.mov.type & COMM_DST_MASK) == COMM_DST_COM)
+	{
+		fprintf(stderr, "Invalid command. Use rcb4_batch_read_ram() to read values.\n");
+		return -1;
+	}
+	if(batch->ops_size + comm->size > RCB4_BATCH_MAILBOX_SIZE - RCB4_BATCH_TAIL_SIZE)
+	{
+		fprintf(stderr, "The batch is full.\n");
+		return -1;
+	}
+	
+	batch->ops_size += rcb4_command_encode(comm, batch->ops + batch->ops_size);
+	return 0;
+}
+
+int rcb4_batch_read_ram(rcb4_batch* batch, uint16_t addr, uint8_t size)
+{
+	int offset;
+	rcb4_comm comm;
+	
+	assert(batch);
+	
+	if(batch->result_size + size > RCB4_BATCH_RESULT_SIZE)
+	{
+		fprintf(stderr, "The result area is full.\n");
+		return -1;
+	}
+	
+	rcb4_command_recreate(&comm, RCB4_COMM_MOV);
+	if(rcb4_command_set_src_ram(&comm, addr, size) != 0 || rcb4_command_set_dst_ram(&comm, batch->result_addr + 1 + batch->result_size) != 0)
+		return -1;
+	if(rcb4_batch_add(batch, &comm) != 0)
+		return -1;
+	
+	offset = batch->result_size;
+	batch->result_size += size;
+	return offset;
+}
+
+int rcb4_batch_execute(rcb4_batch* batch)
+{
+	int err, poll, same, replies = 0;
+	rcb4_comm comm;
+	uint8_t frames[3 * RCB4_COMM_MESSAGE_SIZE_ALLOWED];
+	uint8_t ops[RCB4_BATCH_MAILBOX_SIZE];
+	uint8_t lbuf[12];
+	uint8_t one = 1, start;
+	uint32_t call, delay = RCB4_BATCH_POLL_USECS;
+	uint16_t length;
+	
+	assert(batch);
+	
+	// Close the list: count one more execution (to know it finished) and return
+	memcpy(ops, batch->ops, batch->ops_size);
+	rcb4_command_recreate(&comm, RCB4_COMM_ADD);
+	rcb4_command_set_src_literal(&comm, &one, 1);
+	rcb4_command_set_dst_ram(&comm, batch->result_addr);
+	length = batch->ops_size + rcb4_command_encode(&comm, ops + batch->ops_size);
+	length += rcb4_command_encode_ret(ops + length);
+	memset(ops + length, 0, RCB4_BATCH_MAILBOX_SIZE - length); // Never run
+	
+	// The same operations as last time are already in the trampoline, don't wear the ROM rewriting them
+	same = batch->loaded && memcmp(ops, batch->trampoline, RCB4_BATCH_MAILBOX_SIZE) == 0;
+	length = 0;
+	if(!same)
+	{
+		rcb4_command_recreate(&comm, RCB4_COMM_MOV);
+		rcb4_command_set_src_literal(&comm, ops, RCB4_BATCH_MAILBOX_SIZE);
+		rcb4_command_set_dst_ram(&comm, batch->mailbox_addr);
+		length += rcb4_command_encode(&comm, frames + length);
+		replies++;
+	}
+	
+	// The sequence number is set in RAM, the trampoline only increments it
+	start = batch->seq;
+	batch->seq = start + 1;
+	rcb4_command_recreate(&comm, RCB4_COMM_MOV);
+	rcb4_command_set_src_literal(&comm, &start, 1);
+	rcb4_command_set_dst_ram(&comm, batch->result_addr);
+	length += rcb4_command_encode(&comm, frames + length);
+	replies++;
+	
+	// Everything and the CALL in a single write, the robot runs them in order
+	call = same ? batch->rom_addr + RCB4_BATCH_DISPATCHER_SIZE : batch->rom_addr;
+	length += rcb4_command_encode_jump(RCB4_COMM_CALL, call, RCB4_CONDITION_ALWAYS, frames + length);
+	replies++;
+	
+	rcb4_conn_lock(batch->conn);
+	
+	// The dispatcher rewrites the trampoline
+	if(!same && batch->conn->rom_cache)
+		rcb4_rom_cache_invalidate(batch->conn->rom_cache, batch->rom_addr + RCB4_BATCH_DISPATCHER_SIZE, RCB4_BATCH_MAILBOX_SIZE);
+	
+	err = rcb4_conn_write(batch->conn, frames, length);
+	if(err == 0 && rcb4_conn_read(batch->conn, lbuf, 4 * replies, COMM_TIMEOUT_USECS) != 4 * replies)
+	{
+		fprintf(stderr, "Error executing the batch. No reply.\n");
+		err = -1;
+	}
+	if(err == 0 && !same)
+		err = rcb4_conn_check_reply(lbuf, RCB4_COMM_MOV, 0, NULL);
+	if(err == 0)
+		err = rcb4_conn_check_reply(lbuf + 4 * (replies - 2), RCB4_COMM_MOV, 0, NULL);
+	if(err == 0)
+		err = rcb4_conn_check_reply(lbuf + 4 * (replies - 1), RCB4_COMM_CALL, 0, NULL);
+	
+	// Wait for the sequence number, the results come with it. Give the robot some time between reads
+	rcb4_command_recreate(&comm, RCB4_COMM_MOV);
+	rcb4_command_set_src_ram(&comm, batch->result_addr, batch->result_size + 1);
+	rcb4_command_set_dst_com(&comm);
+	for(poll = 0; err == 0 && poll < RCB4_BATCH_MAX_POLLS; poll++)
+	{
+		if(rcb4_conn_transact(batch->conn, &comm, batch->result) != batch->result_size + 1)
+			err = -1;
+		else if(batch->result[0] == batch->seq)
+			break;
+		
+		rcb4_conn_delay(batch->conn, delay);
+		delay = (2 * delay > RCB4_BATCH_POLL_MAX_USECS) ? RCB4_BATCH_POLL_MAX_USECS : 2 * delay;
+	}
+	if(err == 0 && poll == RCB4_BATCH_MAX_POLLS)
+	{
+		fprintf(stderr, "Error executing the batch. The robot didn't finish it.\n");
+		err = -1;
+	}
+	
+	// If it failed we don't know how far the dispatcher got
+	batch->loaded = (err == 0);
+	if(err == 0)
+		memcpy(batch->trampoline, ops, RCB4_BATCH_MAILBOX_SIZE);
+	
+	rcb4_conn_unlock(batch->conn);
+	return err;
+}
+
+int rcb4_batch_get_result(const rcb4_batch* batch, int offset, void* value, uint8_t size)
+{
+	assert(batch);
+	assert(value);
+	
+	if(offset < 0 || offset + size > batch->result_size)
+	{
+		fprintf(stderr, "Invalid result offset.\n");
+		return -1;
+	}
+	
+	memcpy(value, batch->result + 1 + offset, size);
+	return 0;
+}
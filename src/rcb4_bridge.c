@@ -0,0 +1,448 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file rcb4_bridge.c
+ * @brief Shared memory bridge for the telemetry and the servo targets.
+ * 
+ * @details These functions put the samples of a stream and a mailbox of servo
+ * targets in POSIX shared memory. The process that owns the connection sends
+ * the targets to the robot as RCB4_COMM_CONST frames at a fixed rate; the
+ * other processes read the state and command poses through plain memory
+ * accesses.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_connection.h"
+#include "rcb4_command.h"
+#include "rcb4_stream.h"
+#include "rcb4_bridge.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// shm_open() wants a single leading '/'
+static
+int rcb4_bridge_name(rcb4_bridge* bridge, const char* name)
+{
+	if(strlen(name) + 2 > sizeof(bridge->name) || strchr(name + 1, '/') != NULL)
+	{
+		fprintf(stderr, "Invalid name for the shared memory: %s\n", name);
+		return -1;
+	}
+	
+	snprintf(bridge->name, sizeof(bridge->name), "%s%s", (name[0] == '/') ? "" : "/", name);
+	return 0;
+}
+
+static
+int rcb4_bridge_alive(int32_t pid)
+{
+	return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+// Removes the object left by an owner that was killed, but not the one of an owner that is running
+static
+int rcb4_bridge_claim(const char* name)
+{
+	int fd;
+	int32_t pid = 0;
+	struct stat st;
+	
+	fd = shm_open(name, O_RDONLY, 0);
+	if(fd < 0)
+		return (errno == ENOENT) ? 0 : -1;
+	
+	if(fstat(fd, &st) == 0 && (size_t)st.st_size == sizeof(struct s_rcb4_bridge_shared) &&
+	   pread(fd, &pid, sizeof(pid), offsetof(struct s_rcb4_bridge_shared, owner)) == sizeof(pid) && rcb4_bridge_alive(pid))
+	{
+		close(fd);
+		fprintf(stderr, "The shared memory %s is in use by the process %d.\n", name, (int)pid);
+		return -1;
+	}
+	close(fd);
+	
+	shm_unlink(name); // Who still has it mapped keeps the old one
+	return 0;
+}
+
+/* Takes the mailbox back from a writer that was killed with it. Returns 0 if
+ * it was free or has been freed. */
+static
+int rcb4_bridge_recover(struct s_rcb4_bridge_targets* mailbox)
+{
+	int32_t dead = __atomic_load_n(&mailbox->writer, __ATOMIC_ACQUIRE);
+	uint32_t seq;
+	
+	if(dead == 0)
+		return 0;
+	if(rcb4_bridge_alive(dead) || !__atomic_compare_exchange_n(&mailbox->writer, &dead, (int32_t)getpid(), 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return -1;
+	
+	// Half written targets are still targets of some writer, they are just published
+	seq = __atomic_load_n(&mailbox->seq, __ATOMIC_RELAXED);
+	if(seq & 1)
+		__atomic_store_n(&mailbox->seq, seq + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&mailbox->writer, 0, __ATOMIC_RELEASE);
+	
+	fprintf(stderr, "The process %d was killed while writing the targets. Mailbox recovered.\n", (int)dead);
+	return 0;
+}
+
+static
+void rcb4_bridge_send(rcb4_bridge* bridge, rcb4_comm* comm)
+{
+	struct s_rcb4_bridge_targets* mailbox = &bridge->shared->targets;
+	struct s_rcb4_bridge_targets targets;
+	uint32_t seq;
+	int i, err;
+	
+	// Latest targets, retrying if a writer was in the middle of an update
+	do
+	{
+		seq = __atomic_load_n(&mailbox->seq, __ATOMIC_ACQUIRE);
+		if(seq & 1) // It will be sent in the next period, unless the writer is dead
+		{
+			rcb4_bridge_recover(mailbox);
+			return;
+		}
+		if(seq == bridge->sent)
+			return; // Nothing new
+		memcpy(&targets, mailbox, sizeof(targets));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	}while(__atomic_load_n(&mailbox->seq, __ATOMIC_RELAXED) != seq);
+	
+	bridge->sent = seq;
+	if(targets.mask == 0)
+		return;
+	
+	rcb4_command_recreate(comm, RCB4_COMM_CONST);
+	rcb4_command_set_speed(comm, targets.speed);
+	for(i = 0; i < RCB4_ICS_QTY; i++)
+		if(targets.mask & (1ULL << i))
+			rcb4_command_set_servo(comm, i + 1, targets.speed, targets.position[i]);
+	
+	rcb4_conn_lock(bridge->conn);
+	err = rcb4_conn_transact(bridge->conn, comm, NULL);
+	rcb4_conn_unlock(bridge->conn);
+	
+	if(err < 0)
+		__atomic_add_fetch(&bridge->shared->errors, 1, __ATOMIC_RELAXED);
+}
+
+static
+void* rcb4_bridge_thread(void* arg)
+{
+	rcb4_bridge* bridge = (rcb4_bridge*)arg;
+	rcb4_comm comm;
+	struct timespec next;
+	
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	
+	while(__atomic_load_n(&bridge->running, __ATOMIC_ACQUIRE))
+	{
+		rcb4_bridge_send(bridge, &comm);
+		
+		// Absolute time so the period doesn't drift
+		next.tv_nsec += (long)(bridge->period_usecs % 1000000) * 1000;
+		next.tv_sec += bridge->period_usecs / 1000000 + next.tv_nsec / 1000000000;
+		next.tv_nsec %= 1000000000;
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR);
+	}
+	
+	return NULL;
+}
+
+rcb4_bridge* rcb4_bridge_create(rcb4_connection* conn, rcb4_stream* stream, const char* name, uint32_t period_usecs)
+{
+	rcb4_bridge* bridge;
+	int fd;
+	
+	assert(conn);
+	assert(name);
+	
+	if(period_usecs == 0)
+	{
+		fprintf(stderr, "Invalid period.\n");
+		return NULL;
+	}
+	
+	bridge = (rcb4_bridge*)malloc(sizeof(rcb4_bridge));
+	if(!bridge)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return NULL;
+	}
+	memset(bridge, 0, sizeof(rcb4_bridge));
+	if(rcb4_bridge_name(bridge, name) != 0)
+	{
+		free(bridge);
+		return NULL;
+	}
+	
+	if(rcb4_bridge_claim(bridge->name) != 0)
+	{
+		fprintf(stderr, "Error creating the shared memory %s.\n", bridge->name);
+		free(bridge);
+		return NULL;
+	}
+	fd = shm_open(bridge->name, O_RDWR | O_CREAT | O_EXCL, RCB4_BRIDGE_MODE);
+	if(fd < 0 || ftruncate(fd, sizeof(struct s_rcb4_bridge_shared)) != 0)
+	{
+		fprintf(stderr, "Error creating the shared memory %s.\n", bridge->name);
+		if(fd >= 0)
+		{
+			close(fd);
+			shm_unlink(bridge->name);
+		}
+		free(bridge);
+		return NULL;
+	}
+	bridge->shared = (struct s_rcb4_bridge_shared*)mmap(NULL, sizeof(struct s_rcb4_bridge_shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd); // The mapping keeps the object
+	if(bridge->shared == MAP_FAILED)
+	{
+		fprintf(stderr, "Error mapping the shared memory %s.\n", bridge->name);
+		shm_unlink(bridge->name);
+		free(bridge);
+		return NULL;
+	}
+	bridge->owner = 1;
+	bridge->conn = conn;
+	bridge->period_usecs = period_usecs;
+	
+	// ftruncate() already zeroed everything, including the ring and the targets
+	if(stream)
+	{
+		if(rcb4_stream_share(stream, &bridge->shared->ring) != 0)
+		{
+			rcb4_bridge_delete(bridge);
+			return NULL;
+		}
+		bridge->stream = stream;
+		memcpy(bridge->shared->region, stream->region, sizeof(stream->region));
+		bridge->shared->regions = stream->regions;
+	}
+	bridge->shared->version = RCB4_BRIDGE_VERSION;
+	bridge->shared->owner = (int32_t)getpid();
+	__atomic_store_n(&bridge->shared->magic, RCB4_BRIDGE_MAGIC, __ATOMIC_RELEASE);
+	
+	__atomic_store_n(&bridge->running, 1, __ATOMIC_RELEASE);
+	if(pthread_create(&bridge->thread, NULL, rcb4_bridge_thread, bridge) != 0)
+	{
+		fprintf(stderr, "Error creating the bridge thread.\n");
+		__atomic_store_n(&bridge->running, 0, __ATOMIC_RELEASE);
+		rcb4_bridge_delete(bridge);
+		return NULL;
+	}
+	
+	return bridge;
+}
+
+rcb4_bridge* rcb4_bridge_open(const char* name)
+{
+	rcb4_bridge* bridge;
+	struct stat st;
+	int fd;
+	
+	assert(name);
+	
+	bridge = (rcb4_bridge*)malloc(sizeof(rcb4_bridge));
+	if(!bridge)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return NULL;
+	}
+	memset(bridge, 0, sizeof(rcb4_bridge));
+	if(rcb4_bridge_name(bridge, name) != 0)
+	{
+		free(bridge);
+		return NULL;
+	}
+	
+	fd = shm_open(bridge->name, O_RDWR, 0);
+	if(fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size != sizeof(struct s_rcb4_bridge_shared))
+	{
+		fprintf(stderr, "Error opening the shared memory %s. Is the owner running the same version?\n", bridge->name);
+		if(fd >= 0)
+			close(fd);
+		free(bridge);
+		return NULL;
+	}
+	bridge->shared = (struct s_rcb4_bridge_shared*)mmap(NULL, sizeof(struct s_rcb4_bridge_shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(bridge->shared == MAP_FAILED)
+	{
+		fprintf(stderr, "Error mapping the shared memory %s.\n", bridge->name);
+		free(bridge);
+		return NULL;
+	}
+	
+	if(__atomic_load_n(&bridge->shared->magic, __ATOMIC_ACQUIRE) != RCB4_BRIDGE_MAGIC || bridge->shared->version != RCB4_BRIDGE_VERSION)
+	{
+		fprintf(stderr, "The shared memory %s is not ready.\n", bridge->name);
+		rcb4_bridge_delete(bridge);
+		return NULL;
+	}
+	
+	return bridge;
+}
+
+void rcb4_bridge_delete(rcb4_bridge* bridge)
+{
+	if(!bridge)return;
+	
+	if(bridge->owner)
+	{
+		if(__atomic_exchange_n(&bridge->running, 0, __ATOMIC_ACQ_REL))
+			pthread_join(bridge->thread, NULL);
+		if(bridge->stream) // It can't go on writing in memory that is not there
+		{
+			rcb4_stream_stop(bridge->stream);
+			rcb4_stream_share(bridge->stream, NULL);
+		}
+		shm_unlink(bridge->name); // The other processes keep their mapping until they close it
+	}
+	
+	munmap(bridge->shared, sizeof(struct s_rcb4_bridge_shared));
+	free(bridge);
+}
+
+int rcb4_bridge_set_targets(rcb4_bridge* bridge, uint8_t speed, uint64_t mask, const uint16_t* positions)
+{
+	struct s_rcb4_bridge_targets* mailbox;
+	uint32_t seq, spins;
+	int32_t free_writer, pid = (int32_t)getpid();
+	uint64_t deadline = 0;
+	int i;
+	
+	assert(bridge);
+	assert(positions);
+	
+	if(speed == 0)
+	{
+		fprintf(stderr, "Invalid speed value.\n");
+		return -1;
+	}
+	if(mask >> RCB4_ICS_QTY)
+	{
+		fprintf(stderr, "Invalid mask. Only %d servos.\n", RCB4_ICS_QTY);
+		return -1;
+	}
+	
+	mailbox = &bridge->shared->targets;
+	
+	// Take the mailbox. Other writers spin for the few nanoseconds it takes, unless the writer was preempted or killed
+	for(spins = 0;; spins++)
+	{
+		free_writer = 0;
+		if(__atomic_compare_exchange_n(&mailbox->writer, &free_writer, pid, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			break;
+		if(spins < RCB4_BRIDGE_LOCK_SPINS)
+			continue;
+		
+		if(deadline == 0)
+			deadline = rcb4_util_time_ns() + RCB4_BRIDGE_LOCK_TIMEOUT_NS;
+		else if(rcb4_util_time_ns() >= deadline && rcb4_bridge_recover(mailbox) != 0)
+		{
+			fprintf(stderr, "Error setting the targets. The process %d doesn't release the mailbox.\n", (int)free_writer);
+			return -10;
+		}
+		sched_yield();
+	}
+	
+	seq = __atomic_load_n(&mailbox->seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&mailbox->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	
+	// The servos not in mask keep the target of the last writer
+	mailbox->speed = speed;
+	mailbox->mask |= mask;
+	for(i = 0; i < RCB4_ICS_QTY; i++)
+		if(mask & (1ULL << i))
+			mailbox->position[i] = positions[i];
+	
+	__atomic_store_n(&mailbox->seq, seq + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&mailbox->writer, 0, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int rcb4_bridge_latest(const rcb4_bridge* bridge, rcb4_sample* sample)
+{
+	assert(bridge);
+	assert(sample);
+	
+	return rcb4_seqlock_load(&bridge->shared->ring.latest, sample);
+}
+
+int rcb4_bridge_read(const rcb4_bridge* bridge, uint64_t* cursor, rcb4_sample* sample)
+{
+	assert(bridge);
+	assert(cursor);
+	assert(sample);
+	
+	return rcb4_ring_read(&bridge->shared->ring, cursor, sample);
+}
+
+int rcb4_bridge_get_ram(const rcb4_bridge* bridge, const rcb4_sample* sample, uint16_t addr, void* value, uint8_t size)
+{
+	assert(bridge);
+	assert(sample);
+	assert(value);
+	
+	return rcb4_stream_find(bridge->shared->region, bridge->shared->regions, sample, addr, value, size);
+}
+
+int rcb4_bridge_get_ad(const rcb4_bridge* bridge, const rcb4_sample* sample, uint8_t ad_id, uint16_t* value)
+{
+	if(ad_id > RCB4_MAX_AD_ID)
+	{
+		fprintf(stderr, "Invalid parameter value. Allowed values [0~%d].\n", RCB4_MAX_AD_ID);
+		return -1;
+	}
+	
+	// TODO: Endian...
+	return rcb4_bridge_get_ram(bridge, sample, RCB4_AD_BASE_ADDR + 2*ad_id, value, 2);
+}
+
+uint32_t rcb4_bridge_get_errors(const rcb4_bridge* bridge)
+{
+	assert(bridge);
+	
+	return __atomic_load_n(&bridge->shared->errors, __ATOMIC_RELAXED);
+}
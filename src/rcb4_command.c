@@ -161,6 +161,46 @@ uint8_t rcb4_command_calculate_checksum(const rcb4_comm* comm)
 	return (uint8_t)sum; // We only need the lowest byte
 }
 
+// Copies the message with its checksum to buffer. Returns the number of bytes written
+uint8_t rcb4_command_encode(const rcb4_comm* comm, uint8_t* buffer)
+{
+	assert(comm);
+	assert(buffer);
+	
+	memcpy(buffer, (const uint8_t*)comm, comm->size - 1);
+	buffer[comm->size - 1] = rcb4_command_calculate_checksum(comm);
+	
+	return comm->size;
+}
+
+// JMP and CALL are not rcb4_comm commands. Returns the size of the frame
+uint8_t rcb4_command_encode_jump(uint8_t type, uint32_t addr, uint8_t conditions, uint8_t* buffer)
+{
+	assert(type == RCB4_COMM_JMP || type == RCB4_COMM_CALL);
+	assert(buffer);
+	
+	buffer[0] = RCB4_COMM_JUMP_SIZE;
+	buffer[1] = type;
+	buffer[2] = 0xFF & (addr); // Address
+	buffer[3] = 0xFF & (addr >> 8);
+	buffer[4] = 0xFF & (addr >> 16);
+	buffer[5] = 0x0F & conditions; // Conditions
+	buffer[6] = 0xFF & (buffer[0] + buffer[1] + buffer[2] + buffer[3] + buffer[4] + buffer[5]); // Checksum
+	
+	return RCB4_COMM_JUMP_SIZE;
+}
+
+uint8_t rcb4_command_encode_ret(uint8_t* buffer)
+{
+	assert(buffer);
+	
+	buffer[0] = RCB4_COMM_RET_SIZE;
+	buffer[1] = RCB4_COMM_RET;
+	buffer[2] = 0xFF & (buffer[0] + buffer[1]); // Checksum
+	
+	return RCB4_COMM_RET_SIZE;
+}
+
 // Returns the number of bytes to expect as answer (not including the size, command, checksum and ACK/NACK)
 uint8_t rcb4_command_get_response_size(const rcb4_comm* comm)
 {
@@ -170,7 +210,7 @@ uint8_t rcb4_command_get_response_size(const rcb4_comm* comm)
 	{
 		// Cases with variable message length:
 		case RCB4_COMM_MOV:
-			if((comm->command.mov.type & COMM_DST_COM) == 0)return 0; // Not to COM
+			if((comm->command.mov.type & COMM_DST_MASK) != COMM_DST_COM)return 0; // Not to COM (ROM also has the COM bit set)
 			
 			switch(comm->command.mov.type & COMM_SRC_MASK)
 			{
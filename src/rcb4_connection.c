@@ -36,15 +36,17 @@
 #include "rcb4_private.h"
 #include "rcb4_connection.h"
 #include "rcb4_command.h"
+#include "rcb4_rom_cache.h"
 
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
-#include <linux/serial.h>
-#include <fcntl.h>
-#include <termio.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
+static int rcb4_send_command_locked(rcb4_connection* conn, const rcb4_comm* comm, const uint8_t* command, uint8_t* reply);
 
 
 /* From http://cc.byexamples.com/2007/05/25/nanosleep-is-better-than-sleep-and-usleep/ */
@@ -72,179 +74,585 @@ void rcb4_util_usleep(uint32_t usec)
 	__nsleep(&req, &rem);
 }
 
+// Monotonic time in nanoseconds
+uint64_t rcb4_util_time_ns(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
 
 
-rcb4_connection* rcb4_init(const char* tty)
+
+static const struct s_rcb4_transport_ops* const rcb4_transports[] =
 {
-	struct termios cfg;
-	
-	if(!tty)return NULL;
+	&rcb4_transport_tty,
+	&rcb4_transport_pty,
+	&rcb4_transport_unix,
+	&rcb4_transport_loop
+};
+
+// Pings twice, the first one after a change of speed is usually lost
+static
+int rcb4_conn_try_ping(rcb4_connection* conn)
+{
+	if(rcb4_command_ping(conn) == 0)
+		return 0;
+	rcb4_conn_delay(conn, 2*COMM_DELAY_USECS);
+	return (rcb4_command_ping(conn) == 0) ? 0 : -1;
+}
+
+static
+rcb4_connection* rcb4_conn_open(const struct s_rcb4_transport_ops* ops, const char* path)
+{
+	int fast, baudrate;
+	float error;
 	
 	// Allocate the variable
 	rcb4_connection* conn = (rcb4_connection*)malloc(sizeof(rcb4_connection));
 	if(!conn)
 	{
-		fprintf(stderr, "Error opening %s for read/write.\nMemory error.\n", tty);
+		fprintf(stderr, "Error opening %s for read/write.\nMemory error.\n", path);
 		return NULL;
 	}
 	
-	// Check serial access
-	if((conn->fd = open(tty, O_RDWR | O_NOCTTY | O_SYNC)) < 0)
+	conn->transport.ops = ops;
+	conn->transport.fd = -1;
+	conn->transport.data = NULL;
+	if(ops->open(&conn->transport, path) != 0)
 	{
-		fprintf(stderr, "Error opening %s for read/write.\nCheck that you have permission to access the device and that it is plugged correctly.\n", tty);
 		free(conn);
 		return NULL;
 	}
 	
-	// Save old configuration
-	tcgetattr(conn->fd, &conn->old_cfg);
+	conn->lock_next = 0;
+	conn->lock_owner = 0;
+	conn->rt_waiting = 0;
+	conn->bg_waiting = 0;
+	conn->prefetch_state = RCB4_PREFETCH_NONE;
+	conn->rom_depth = RCB4_ROM_DEFAULT_DEPTH;
+	conn->rom_cache = NULL;
+	conn->fast = -1;
+	conn->link = RCB4_LINK_UP;
+	conn->recovering = 0;
+	conn->reconnect_ms = 0;
+	conn->reconnect_flags = 0;
+	conn->reconnects = 0;
+	conn->restores = 0;
+	conn->last_pose_size = 0;
+	
+	// The same adapter may come back with another name
+	if(ops == &rcb4_transport_tty)
+		rcb4_transport_stable_path(path, conn->path, sizeof(conn->path));
+	else
+		snprintf(conn->path, sizeof(conn->path), "%s", path);
 	
-	// Speed hack (https://stackoverflow.com/questions/4968529/how-to-set-baud-rate-to-307200-on-linux)
-	const int speed = 1250000; // Fastest speed that the robot can go
-	struct serial_struct ss;
-	ss.reserved_char[0] = 0;
-	if(ioctl(conn->fd, TIOCGSERIAL, &ss) < 0)
+	if(!(ops->caps & RCB4_TRANSPORT_SPEED))
 	{
-		fprintf(stderr, "Cannot set serial port speed. ioctl failed.\n");
-		close(conn->fd);
-		free(conn);
+		if(rcb4_conn_try_ping(conn) == 0)
+			return conn;
+		
+		fprintf(stderr, "Connection failed.\n");
+		rcb4_deinit(conn);
 		return NULL;
 	}
 	
-	ss.flags = (ss.flags & ~ASYNC_SPD_MASK) | ASYNC_SPD_CUST;
-	ss.custom_divisor = (ss.baud_base + (speed / 2)) / speed;
+	// Try the slow speed first and then ask the device for the fast one
+	for(fast = 0; fast < 2; fast++)
+	{
+		baudrate = ops->set_speed(&conn->transport, fast, &error);
+		if(baudrate < 0)
+		{
+			rcb4_deinit(conn);
+			return NULL;
+		}
+		
+		rcb4_conn_delay(conn, COMM_DELAY_USECS); // Wait a bit
+		
+		// Try pinging to see if the speed is correct
+		if(rcb4_conn_try_ping(conn) == 0)
+		{
+			printf("Baudrate set to %d [Error = %.2f%%].\n", baudrate, error);
+			conn->fast = fast;
+			return conn;
+		}
+	}
+	
+	// None of the speeds allowed us to ping. Maybe the robot is using another speed or there is a problem with the connection?
+	
+	fprintf(stderr, "Connection failed.\n");
+	rcb4_deinit(conn);
+	return NULL;
+}
+
+rcb4_connection* rcb4_init(const char* tty)
+{
+	if(!tty)return NULL;
+	
+	return rcb4_conn_open(&rcb4_transport_tty, tty);
+}
+
+rcb4_connection* rcb4_open(const char* uri)
+{
+	size_t i, len;
 	
-	if(ss.custom_divisor < 1) 
-		ss.custom_divisor = 1;
-	if(ioctl(conn->fd, TIOCSSERIAL, &ss) < 0 || ioctl(conn->fd, TIOCGSERIAL, &ss) < 0)
+	if(!uri)return NULL;
+	
+	for(i = 0; i < sizeof(rcb4_transports) / sizeof(rcb4_transports[0]); i++)
 	{
-		fprintf(stderr, "Cannot set serial port speed. ioctl failed.\n");
-		close(conn->fd);
-		free(conn);
+		len = strlen(rcb4_transports[i]->scheme);
+		if(strncmp(uri, rcb4_transports[i]->scheme, len) == 0 && uri[len] == ':')
+			return rcb4_conn_open(rcb4_transports[i], uri + len + 1);
+	}
+	
+	if(strchr(uri, ':') != NULL && uri[0] != '/' && uri[0] != '.')
+	{
+		fprintf(stderr, "Unknown transport in %s. Use tty:, pty:, unix: or loop:\n", uri);
 		return NULL;
 	}
 	
-	// Check that the speed is not too far away from what we want
-	int closestSpeed = ss.baud_base / ss.custom_divisor;
+	return rcb4_conn_open(&rcb4_transport_tty, uri); // Just a path
+}
+
+void rcb4_deinit(rcb4_connection* conn)
+{
+	if(!conn)return;
+	
+	if(conn->link != RCB4_LINK_CLOSED)
+		conn->transport.ops->close(&conn->transport);
+	free(conn);
+}
+
+uint32_t rcb4_get_capabilities(const rcb4_connection* conn)
+{
+	assert(conn);
 	
-	if(closestSpeed < speed * 98 / 100 || closestSpeed > speed * 102 / 100)
+	return conn->transport.ops->caps;
+}
+
+
+// Lane of the calling thread, used by rcb4_conn_lock()
+static __thread uint8_t rcb4_thread_lane = RCB4_LANE_REALTIME;
+static __thread uint32_t rcb4_thread_budget_usecs = 0;
+static __thread uint64_t rcb4_thread_io_ns = 0; // Time this thread has held the connections
+
+int rcb4_thread_set_lane(uint8_t lane, uint32_t budget_usecs)
+{
+	if(lane != RCB4_LANE_REALTIME && lane != RCB4_LANE_BACKGROUND)
 	{
-	    fprintf(stderr, "Cannot set serial port speed to %d. Closest possible is %d\n", speed, closestSpeed);
+		fprintf(stderr, "Invalid lane.\n");
+		return -1;
 	}
 	
-	// End of speed hack
+	rcb4_thread_lane = lane;
+	rcb4_thread_budget_usecs = budget_usecs;
+	return 0;
+}
+
+/* A ticket lock instead of a mutex: with a mutex the thread that has just
+ * released the connection usually takes it again before the others wake up,
+ * so a busy control loop can starve the logger or the UI. The transactions
+ * are long, so a short spin is enough and then the waiters sleep in a futex. */
+static
+void rcb4_ticket_lock(rcb4_connection* conn)
+{
+	int spins;
+	uint32_t ticket, owner;
 	
-	// Configure the terminal
-	bzero(&cfg, sizeof(cfg));
-	cfg.c_cflag = PARENB | CS8 | CLOCAL | CREAD; // Control flags: Parity (even), 8bits, ignore control lines, enable read
-	cfg.c_iflag = 0; // Input flags
-	cfg.c_oflag = 0; // Output flags
-	cfg.c_lflag = 0; // Local flags
-	cfg.c_cc[VTIME] = 0; // Inter-character timer off
-	cfg.c_cc[VMIN] = 1; // Minimum 1 byte to return from read()
+	ticket = __atomic_fetch_add(&conn->lock_next, 1, __ATOMIC_SEQ_CST);
+	for(spins = 0; (owner = __atomic_load_n(&conn->lock_owner, __ATOMIC_SEQ_CST)) != ticket; spins++)
+	{
+		if(spins >= RCB4_LOCK_SPINS) // Returns at once if the owner changed in between
+			syscall(SYS_futex, &conn->lock_owner, FUTEX_WAIT_PRIVATE, owner, NULL, NULL, 0);
+	}
+}
 
-	//cfsetispeed(&cfg, B38400); // Custom speed
-	//cfsetospeed(&cfg, B38400); // Custom speed
-	cfsetispeed(&cfg, RCB4_BAUD_RATE); // Input speed
-	cfsetospeed(&cfg, RCB4_BAUD_RATE); // Output speed
+static
+void rcb4_ticket_unlock(rcb4_connection* conn)
+{
+	uint32_t owner;
 	
-	tcflush(conn->fd, TCIFLUSH); // Flush old messages
+	owner = __atomic_add_fetch(&conn->lock_owner, 1, __ATOMIC_SEQ_CST);
+	// Somebody waiting? All the waiters wake up but only the next ticket goes on
+	if(__atomic_load_n(&conn->lock_next, __ATOMIC_SEQ_CST) != owner)
+		syscall(SYS_futex, &conn->lock_owner, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Background lane: waits until no real-time thread wants the connection, or
+ * until the latency budget runs out, and then queues like everybody else. */
+static
+void rcb4_ticket_lock_background(rcb4_connection* conn)
+{
+	uint32_t rt;
+	uint64_t now, deadline = UINT64_MAX;
+	struct timespec left;
 	
-	if(tcsetattr(conn->fd, TCSANOW, &cfg) != 0) // Apply the configuration (slow speed)
+	if(rcb4_thread_budget_usecs > 0)
+		deadline = rcb4_util_time_ns() + (uint64_t)rcb4_thread_budget_usecs * 1000;
+	
+	for(;;)
 	{
-		fprintf(stderr, "Error configuring the terminal.\n");
-		close(conn->fd);
-		free(conn);
-		return NULL;
+		__atomic_add_fetch(&conn->bg_waiting, 1, __ATOMIC_SEQ_CST);
+		while((rt = __atomic_load_n(&conn->rt_waiting, __ATOMIC_SEQ_CST)) > 0 && (now = rcb4_util_time_ns()) < deadline)
+		{
+			left.tv_sec = (deadline - now) / 1000000000ULL;
+			left.tv_nsec = (deadline - now) % 1000000000ULL;
+			syscall(SYS_futex, &conn->rt_waiting, FUTEX_WAIT_PRIVATE, rt, (deadline == UINT64_MAX) ? NULL : &left, NULL, 0);
+		}
+		__atomic_sub_fetch(&conn->bg_waiting, 1, __ATOMIC_SEQ_CST);
+		
+		rcb4_ticket_lock(conn);
+		if(__atomic_load_n(&conn->rt_waiting, __ATOMIC_SEQ_CST) == 0 || rcb4_util_time_ns() >= deadline)
+			return;
+		rcb4_ticket_unlock(conn); // A real-time thread came in the meantime, let it go first
 	}
+}
+
+void rcb4_conn_lock(rcb4_connection* conn)
+{
+	int err;
+	uint8_t lbuf[RCB4_COMM_MESSAGE_SIZE_ALLOWED];
 	
-	//fcntl(conn->fd, F_SETFL, FNDELAY); // Non-blocking
-	fcntl(conn->fd, F_SETFL, 0); // Blocking mode
+	if(rcb4_thread_lane == RCB4_LANE_BACKGROUND)
+	{
+		rcb4_ticket_lock_background(conn);
+	}
+	else
+	{
+		__atomic_add_fetch(&conn->rt_waiting, 1, __ATOMIC_SEQ_CST);
+		rcb4_ticket_lock(conn);
+		if(__atomic_sub_fetch(&conn->rt_waiting, 1, __ATOMIC_SEQ_CST) == 0 && __atomic_load_n(&conn->bg_waiting, __ATOMIC_SEQ_CST) > 0)
+			syscall(SYS_futex, &conn->rt_waiting, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+	}
 	
-	rcb4_util_usleep(COMM_DELAY_USECS); // Wait a bit
+	conn->lock_time = rcb4_util_time_ns();
 	
-	// Try pinging to see if the speed is correct
-	if(rcb4_command_ping(conn) == 0)
+	// A read sent by rcb4_exchange() is still on the wire, get it out of the way
+	if(conn->prefetch_state == RCB4_PREFETCH_IN_FLIGHT)
 	{
-		printf("Baudrate set to %d [Error = %.2f%%].\n", 115200, 0.0f);
-		return conn;
+		err = rcb4_conn_read(conn, lbuf, conn->prefetch_size + 3, COMM_TIMEOUT_USECS);
+		if(err == conn->prefetch_size + 3 && rcb4_conn_check_reply(lbuf, conn->prefetch_key[1], conn->prefetch_size, conn->prefetch_data) >= 0)
+		{
+			conn->prefetch_state = RCB4_PREFETCH_READY;
+		}
+		else
+		{
+			rcb4_conn_flush(conn); // Whatever arrived is garbage now
+			conn->prefetch_state = RCB4_PREFETCH_NONE;
+		}
 	}
-	rcb4_util_usleep(2*COMM_DELAY_USECS);
-	if(rcb4_command_ping(conn) == 0)
+}
+
+void rcb4_conn_unlock(rcb4_connection* conn)
+{
+	rcb4_thread_io_ns += rcb4_util_time_ns() - conn->lock_time;
+	rcb4_ticket_unlock(conn);
+}
+
+/* Long transfers made of several commands call this between commands. If it
+ * returns 1 they should release the lock as soon as nothing is on the wire. */
+int rcb4_conn_preempted(const rcb4_connection* conn)
+{
+	return rcb4_thread_lane == RCB4_LANE_BACKGROUND && __atomic_load_n(&conn->rt_waiting, __ATOMIC_SEQ_CST) > 0;
+}
+
+/* Used to measure the I/O time of a cycle. Per thread, so the time other
+ * threads hold the connection (a stream, a background thread...) doesn't count. */
+uint64_t rcb4_thread_get_io_time(void)
+{
+	return rcb4_thread_io_ns;
+}
+
+// Writes the whole buffer. Returns 0 if ok, -1 on error
+int rcb4_conn_write(rcb4_connection* conn, const uint8_t* buffer, uint16_t length)
+{
+	assert(conn);
+	
+	if(conn->link != RCB4_LINK_UP && rcb4_conn_recover(conn, 0) != 0) // Maybe it is back already
+		return -1;
+	
+	// Another command may change what the prefetched read saw, don't hand it out later
+	if(conn->prefetch_state == RCB4_PREFETCH_READY)
+		conn->prefetch_state = RCB4_PREFETCH_NONE;
+	
+	if(conn->transport.ops->write(&conn->transport, buffer, length) != 0)
 	{
-		printf("Baudrate set to %d [Error = %.2f%%].\n", 115200, 0.0f);
-		return conn;
+		fprintf(stderr, "Error sending the command. Write error.\n");
+		rcb4_conn_lost(conn);
+		return -1;
 	}
 	
-	// ping failed, try changing the device's speed
+	if(conn->reconnect_flags & RCB4_RECONNECT_LAST_POSE)
+		rcb4_conn_record(conn, buffer, length);
+	return 0;
+}
+
+// Reads exactly length bytes. Returns length if ok, -10 on timeout, -1 on error
+int rcb4_conn_read(rcb4_connection* conn, uint8_t* buffer, uint16_t length, uint32_t timeout_usecs)
+{
+	int err;
+	uint16_t received = 0;
+	uint64_t deadline;
 	
-	cfsetispeed(&cfg, B38400); // Custom speed
-	cfsetospeed(&cfg, B38400); // Custom speed
+	assert(conn);
 	
-	tcflush(conn->fd, TCIFLUSH); // Flush old messages
+	deadline = rcb4_util_time_ns() + (uint64_t)timeout_usecs * 1000;
 	
-	if(tcsetattr(conn->fd, TCSANOW, &cfg) != 0) // Apply the configuration (fast speed)
+	// The reply can arrive split in several chunks, keep reading until we have it all
+	while(received < length)
 	{
-		fprintf(stderr, "Error configuring the terminal.\n");
-		close(conn->fd);
-		free(conn);
-		return NULL;
+		err = conn->transport.ops->read(&conn->transport, buffer + received, length - received, deadline);
+		if(err == -10)
+			return -10;
+		if(err <= 0)
+		{
+			fprintf(stderr, "Error reading the reply. Read error.\n");
+			rcb4_conn_lost(conn);
+			return -1;
+		}
+		received += err;
 	}
 	
-	// Try pinging to see if the speed is correct
-	if(rcb4_command_ping(conn) == 0)
+	return received;
+}
+
+void rcb4_conn_flush(rcb4_connection* conn)
+{
+	if(conn->transport.ops->flush)
+		conn->transport.ops->flush(&conn->transport);
+}
+
+// The fixed delays of the original protocol are only needed by the real board
+void rcb4_conn_delay(rcb4_connection* conn, uint32_t usecs)
+{
+	if(conn->transport.ops->caps & RCB4_TRANSPORT_PACED)
+		rcb4_util_usleep(usecs);
+}
+
+/* Checks a reply already read into lbuf. ret_size == 0 means that only the
+ * ACK is expected. Returns ret_size if ok, -1 on invalid ACK, -2 on invalid
+ * reply. */
+int rcb4_conn_check_reply(const uint8_t* lbuf, uint8_t type, uint8_t ret_size, uint8_t* reply)
+{
+	int i;
+	uint8_t sum;
+	
+	if(ret_size == 0) // Only the ACK/NACK message
 	{
-		printf("Baudrate set to %d [Error = %.2f%%].\n", closestSpeed, 100.0*abs(closestSpeed - speed)/speed);
-		return conn;
+		// 0x04, CMD, ACK|NAK, SUM
+		if(lbuf[0] != 0x04 || lbuf[1] != type || lbuf[2] != RCB4_ACK || lbuf[3] != (uint8_t)(0x04 + type + RCB4_ACK))
+		{
+			fprintf(stderr, "Error sending the command. Invalid or missing ACK.\n");
+			return -1;
+		}
+		return 0;
 	}
-	rcb4_util_usleep(2*COMM_DELAY_USECS);
-	if(rcb4_command_ping(conn) == 0)
+	
+	// SIZE, CMD, DATA..., SUM
+	if(lbuf[0] != ret_size + 3 || lbuf[1] != type)
 	{
-		printf("Baudrate set to %d [Error = %.2f%%].\n", closestSpeed, 100.0*abs(closestSpeed - speed)/speed);
-		return conn;
+		fprintf(stderr, "Error sending the command. Invalid reply.\n");
+		return -2;
 	}
 	
-	// None of the speeds allowed us to ping. Maybe the robot is using another speed or there is a problem with the connection?
+	for(i = 0, sum = 0; i < ret_size + 2; i++)
+		sum += lbuf[i];
+	if(sum != lbuf[ret_size + 2])
+	{
+		fprintf(stderr, "Error sending the command. Invalid checksum in the reply.\n");
+		return -2;
+	}
 	
-	fprintf(stderr, "Connection failed.\n");
-	close(conn->fd);
-	free(conn);
-	return NULL;
+	if(reply != NULL)
+		memcpy(reply, lbuf + 2, ret_size);
+	
+	return ret_size;
 }
 
-void rcb4_deinit(rcb4_connection* conn)
+/* Same protocol as rcb4_send_command() but without the fixed delays: the reply
+ * itself tells us that the robot is done. The caller must hold the lock. */
+int rcb4_conn_transact(rcb4_connection* conn, const rcb4_comm* comm, uint8_t* reply)
 {
-	if(!conn)return;
+	int err;
+	uint8_t lbuf[256];
+	uint8_t command[128];
+	uint8_t ret_size, length;
 	
-	// Disable speed hack
-	struct serial_struct ss;
-	ioctl(conn->fd, TIOCGSERIAL, &ss);
-	ss.flags &= ~ASYNC_SPD_MASK;
-	ioctl(conn->fd, TIOCSSERIAL, &ss);
+	assert(conn);
+	assert(comm);
 	
-	tcsetattr(conn->fd, TCSANOW, &conn->old_cfg); // Pop back the original configuration
-	close(conn->fd);
-	free(conn);
+	if(conn->rom_cache)
+		rcb4_rom_cache_command(conn->rom_cache, comm);
+	if(rcb4_conn_write(conn, command, rcb4_command_encode(comm, command)) != 0)
+		return -1;
+	
+	ret_size = rcb4_command_get_response_size(comm);
+	length = (ret_size == 0) ? 4 : ret_size + 3;
+	err = rcb4_conn_read(conn, lbuf, length, COMM_TIMEOUT_USECS);
+	if(err != length)
+	{
+		fprintf(stderr, "Error sending the command. No reply.\n");
+		return (err == -10) ? -10 : -1;
+	}
+	
+	return rcb4_conn_check_reply(lbuf, comm->type, ret_size, reply);
+}
+
+// Sends a frame and, right after it, a read. Both replies are collected in a single wait
+int rcb4_exchange(rcb4_connection* conn, const rcb4_comm* write, const rcb4_comm* read, uint8_t* reply, int flags)
+{
+	int err, ret = 0, prefetched = 0;
+	uint8_t lbuf[512];
+	uint8_t command[256];
+	uint8_t key[128];
+	uint8_t ret_size = 0, key_size = 0;
+	uint16_t length = 0, expected = 0;
+	
+	assert(conn);
+	
+	if(!write && !read)
+	{
+		fprintf(stderr, "Nothing to exchange.\n");
+		return -1;
+	}
+	if(write && rcb4_command_get_response_size(write) != 0)
+	{
+		fprintf(stderr, "Invalid write command. It must not return data.\n");
+		return -1;
+	}
+	if(read)
+	{
+		ret_size = rcb4_command_get_response_size(read);
+		if(ret_size == 0)
+		{
+			fprintf(stderr, "Invalid read command. It must return data.\n");
+			return -1;
+		}
+		key_size = rcb4_command_encode(read, key);
+	}
+	if(write) // Encoded before taking the lock, the read is appended later if needed
+	{
+		length = rcb4_command_encode(write, command);
+		expected = 4;
+	}
+	
+	rcb4_conn_lock(conn); // Collects the prefetched read, if any
+	
+	// Was this same read already sent at the end of the last exchange?
+	if(read && conn->prefetch_state == RCB4_PREFETCH_READY &&
+	   conn->prefetch_key_size == key_size && memcmp(conn->prefetch_key, key, key_size) == 0)
+	{
+		prefetched = 1;
+		if(reply != NULL)
+			memcpy(reply, conn->prefetch_data, ret_size);
+		ret = ret_size;
+	}
+	conn->prefetch_state = RCB4_PREFETCH_NONE;
+	
+	if(write && conn->rom_cache)
+		rcb4_rom_cache_command(conn->rom_cache, write);
+	if(read && !prefetched)
+	{
+		memcpy(command + length, key, key_size);
+		length += key_size;
+		expected += ret_size + 3;
+	}
+	
+	if(rcb4_conn_write(conn, command, length) != 0)
+	{
+		rcb4_conn_unlock(conn);
+		return -1;
+	}
+	
+	// The robot executes the commands in order, so the ACK comes before the data
+	err = rcb4_conn_read(conn, lbuf, expected, COMM_TIMEOUT_USECS);
+	if(err != expected)
+	{
+		fprintf(stderr, "Error in the exchange. No reply.\n");
+		rcb4_conn_unlock(conn);
+		return (err == -10) ? -10 : -1;
+	}
+	if(write && (err = rcb4_conn_check_reply(lbuf, write->type, 0, NULL)) != 0)
+	{
+		rcb4_conn_unlock(conn);
+		return err;
+	}
+	if(read && !prefetched)
+	{
+		ret = rcb4_conn_check_reply(lbuf + (write ? 4 : 0), read->type, ret_size, reply);
+		if(ret < 0)
+		{
+			rcb4_conn_unlock(conn);
+			return ret;
+		}
+	}
+	
+	// Send the read of the next cycle now, it will be waiting when we come back
+	if(read && (flags & RCB4_EXCHANGE_PREFETCH) && rcb4_conn_write(conn, key, key_size) == 0)
+	{
+		memcpy(conn->prefetch_key, key, key_size);
+		conn->prefetch_key_size = key_size;
+		conn->prefetch_size = ret_size;
+		conn->prefetch_state = RCB4_PREFETCH_IN_FLIGHT;
+	}
+	
+	rcb4_conn_unlock(conn);
+	return ret;
 }
 
+
 // Sends the message via serial, returns size of the reply if all ok, < 0 if something went wrong
 int rcb4_send_command(rcb4_connection* conn, const rcb4_comm* comm, uint8_t* reply)
+{
+	int ret;
+	uint8_t command[128];
+	
+	assert(conn);
+	assert(comm);
+	
+	// Copy the command to a buffer and append the checksum. Done before taking
+	// the lock so other threads don't wait for us to encode
+	memcpy(command, (const uint8_t*)comm, comm->size - 1);
+	command[comm->size-1] =  rcb4_command_calculate_checksum(comm);
+	
+	rcb4_conn_lock(conn);
+	ret = rcb4_send_command_locked(conn, comm, command, reply);
+	rcb4_conn_unlock(conn);
+	
+	return ret;
+}
+
+int rcb4_command_ping(rcb4_connection* conn)
+{
+	int ret;
+	
+	assert(conn);
+	
+	rcb4_conn_lock(conn);
+	ret = rcb4_command_ping_locked(conn);
+	rcb4_conn_unlock(conn);
+	
+	return ret;
+}
+
+
+static
+int rcb4_send_command_locked(rcb4_connection* conn, const rcb4_comm* comm, const uint8_t* command, uint8_t* reply)
 {
 	int err;
 	uint8_t check;
 	uint8_t lbuf[256];
 	//uint8_t checksum;
-	uint8_t command[128];
 	uint8_t ret_size;
-	struct timeval timeout; // Timeout
-	int rv;
 	
 	assert(conn);
 	assert(comm);
 	
-	// Copy the command to a buffer and append the checksum
-	memcpy(command, (const uint8_t*)comm, comm->size - 1);
-	command[comm->size-1] =  rcb4_command_calculate_checksum(comm);
+	// Even if the command fails the ROM may have been written
+	if(conn->rom_cache)
+		rcb4_rom_cache_command(conn->rom_cache, comm);
 	
 #ifdef DEBUG_COMMANDS
 	printf("COMMAND TO SEND:\n");
@@ -255,39 +663,22 @@ int rcb4_send_command(rcb4_connection* conn, const rcb4_comm* comm, uint8_t* rep
 #endif // DEBUG_COMMANDS
 	
 	// Send the message
-	err = write(conn->fd, command, comm->size);
-	if(err != comm->size)
-	{
-		fprintf(stderr, "Error sending the command. Write error.\n");
+	if(rcb4_conn_write(conn, command, comm->size) != 0)
 		return -1;
-	}
 	
 	// Wait a bit
-	rcb4_util_usleep(COMM_DELAY_USECS);
-	
-	
-	timeout.tv_sec = 0;
-	timeout.tv_usec = COMM_TIMEOUT_USECS;
-	
-	FD_ZERO(&conn->fdset);
-	FD_SET(conn->fd, &conn->fdset);
-	rv = select(conn->fd + 1, &conn->fdset, NULL, NULL, &timeout); // Receive the message, or timeout
-	if(rv == -1)
-	{
-		fprintf(stderr, "Error sending the command. Select failed.\n");
-		return -1;
-	}
-	else if(rv == 0)
-	{
-		fprintf(stderr, "Error sending the command. Timed out.\n");
-		return -1;
-	}
+	rcb4_conn_delay(conn, COMM_DELAY_USECS);
 	
 	
 	ret_size = rcb4_command_get_response_size(comm); // Get how long the response should be based on the command we sent
 	if(ret_size == 0) // Does not expect a reply. Only the default ACK/NACK message
 	{
-		err = read(conn->fd, lbuf, 4); // 0x04, CMD, ACK|NAK, SUM
+		err = rcb4_conn_read(conn, lbuf, 4, COMM_TIMEOUT_USECS); // 0x04, CMD, ACK|NAK, SUM
+		if(err == -10)
+		{
+			fprintf(stderr, "Error sending the command. Timed out.\n");
+			return -1;
+		}
 		if(err != 4 || lbuf[0] != 0x04 || lbuf[1] != comm->type || lbuf[2] != RCB4_ACK || lbuf[3] != (check = (uint8_t)(0x04 + comm->type + RCB4_ACK)))
 		{
 			fprintf(stderr, "Error sending the command. Read error.\nReceived %d bytes, msg = 0x%02X, 0x%02X, 0x%02X, 0x%02X\n",
@@ -299,7 +690,12 @@ int rcb4_send_command(rcb4_connection* conn, const rcb4_comm* comm, uint8_t* rep
 	else // Does expect a reply
 	{
 		//TODO: Checksum check?
-		err = read(conn->fd, lbuf, ret_size + 3); // 0x04, CMD, RET, SUM
+		err = rcb4_conn_read(conn, lbuf, ret_size + 3, COMM_TIMEOUT_USECS); // 0x04, CMD, RET, SUM
+		if(err == -10)
+		{
+			fprintf(stderr, "Error sending the command. Timed out.\n");
+			return -1;
+		}
 		if(err != ret_size + 3 || lbuf[0] != ret_size + 3 || lbuf[1] != comm->type)
 		{
 			fprintf(stderr, "Error sending the command. Read error.\nReceived %d bytes, msg = 0x%02X, 0x%02X, 0x%02X, ...\n",
@@ -312,49 +708,32 @@ int rcb4_send_command(rcb4_connection* conn, const rcb4_comm* comm, uint8_t* rep
 			memcpy(reply, lbuf + 2, ret_size); // Does not include the checksum nor the headers. Only the data.
 	}
 	
-	rcb4_util_usleep(COMM_DELAY_USECS); // Wait a bit
+	rcb4_conn_delay(conn, COMM_DELAY_USECS); // Wait a bit
 	return ret_size; // Return the size of the reply
 }
 
 
-int rcb4_command_ping(rcb4_connection* conn)
+int rcb4_command_ping_locked(rcb4_connection* conn)
 {
 	int err;
 	uint8_t lbuf[4];
 	uint8_t command[] = {0x03, 0xFE, 0x01}; // New ping, old one is 0x04, 0xFE, 0x06, 0x08
 	//uint8_t command[] = {0x04, 0xFE, 0x06, 0x08}; // Old ping, new one is 0x03, 0xFE, 0x01
-	struct timeval timeout; // Timeout
-	int rv;
 	
 	// Send the message
-	err = write(conn->fd, command, sizeof(command));
-	if(err != sizeof(command))
-	{
-		fprintf(stderr, "Error sending the command. Write error.\n");
+	if(rcb4_conn_write(conn, command, sizeof(command)) != 0)
 		return -1;
-	}
-	
-	timeout.tv_sec = 0;
-	timeout.tv_usec = COMM_TIMEOUT_USECS;
 	
-	rcb4_util_usleep(COMM_DELAY_USECS); // Wait a bit
+	rcb4_conn_delay(conn, COMM_DELAY_USECS); // Wait a bit
 	
-	FD_ZERO(&conn->fdset);
-	FD_SET(conn->fd, &conn->fdset);
-	rv = select(conn->fd + 1, &conn->fdset, NULL, NULL, &timeout); // Receive the message or die waiting, like when you invite out a japanese girl and she never shows up
-	if(rv == -1)
-	{
-		fprintf(stderr, "Error sending the command. Select failed.\n");
-		return -1;
-	}
-	else if(rv == 0)
+	// Receive the message or die waiting, like when you invite out a japanese girl and she never shows up
+	err = rcb4_conn_read(conn, lbuf, 4, COMM_TIMEOUT_USECS); // 0x04, CMD, ACK|NAK, SUM
+	if(err == -10)
 	{
 		// Timeout (silent)
 		// I'm starting to think that even the compiler ignores my comments...
 		return -10;
 	}
-	
-	err = read(conn->fd, lbuf, 4); // 0x04, CMD, ACK|NAK, SUM
 	if(err != 4 || lbuf[0] != 0x04 || lbuf[1] != command[1])
 	{
 		fprintf(stderr, "Error sending the command. Read error.\nReceived %d bytes, msg = 0x%02X, 0x%02X, 0x%02X, 0x%02X\n",
@@ -364,7 +743,7 @@ int rcb4_command_ping(rcb4_connection* conn)
 	}
 	
 	
-	rcb4_util_usleep(COMM_DELAY_USECS);
+	rcb4_conn_delay(conn, COMM_DELAY_USECS);
 	
 	// Did we receive an ACK?
 	if(lbuf[2] == RCB4_ACK && lbuf[3] == (uint8_t)(0x04 + command[1] + RCB4_ACK))
@@ -36,6 +36,7 @@
 #include "rcb4_private.h"
 #include "rcb4_config.h"
 #include "rcb4_connection.h"
+#include "rcb4_command.h"
 
 #include <stdlib.h>
 #include <time.h>
@@ -43,46 +44,27 @@
 
 // Sends a string of bytes, expects no answer other than the 4 ACK/NACK bytes
 static
-int rcb4_send_command_private(rcb4_connection* conn, const uint8_t* command, uint8_t length)
+int rcb4_send_command_private_locked(rcb4_connection* conn, const uint8_t* command, uint8_t length)
 {
 	int err;
 	uint8_t check;
 	uint8_t lbuf[256];
-	struct timeval timeout; // Timeout
-	int rv;
 	
 	assert(conn);
 	
-	err = write(conn->fd, command, length);
-	if(err != length)
-	{
-		fprintf(stderr, "Error sending the command. Write error.\n");
+	if(rcb4_conn_write(conn, command, length) != 0)
 		return -1;
-	}
 	
 	
-	rcb4_util_usleep(COMM_DELAY_USECS);
+	rcb4_conn_delay(conn, COMM_DELAY_USECS);
 	
 	
-	timeout.tv_sec = 0;
-	timeout.tv_usec = COMM_TIMEOUT_USECS;
-	
-	FD_ZERO(&conn->fdset);
-	FD_SET(conn->fd, &conn->fdset);
-	rv = select(conn->fd + 1, &conn->fdset, NULL, NULL, &timeout);
-	if(rv == -1)
-	{
-		fprintf(stderr, "Error sending the command. Select failed.\n");
-		return -1;
-	}
-	else if(rv == 0)
+	err = rcb4_conn_read(conn, lbuf, 4, COMM_TIMEOUT_USECS); // 0x04, CMD, ACK|NAK, SUM
+	if(err == -10)
 	{
 		fprintf(stderr, "Error sending the command. Timed out.\n");
 		return -1;
 	}
-	
-	
-	err = read(conn->fd, lbuf, 4); // 0x04, CMD, ACK|NAK, SUM
 	if(err != 4 || lbuf[0] != 0x04 || lbuf[1] != command[1] || lbuf[2] != RCB4_ACK || lbuf[3] != (check = (uint8_t)(0x04 + command[1] + RCB4_ACK)))
 	{
 		fprintf(stderr, "Error sending the command. Read error.\nReceived %d bytes, msg = 0x%02X, 0x%02X, 0x%02X, 0x%02X\n",
@@ -91,51 +73,45 @@ int rcb4_send_command_private(rcb4_connection* conn, const uint8_t* command, uin
 		return -1;
 	}
 	
-	rcb4_util_usleep(COMM_DELAY_USECS);
+	rcb4_conn_delay(conn, COMM_DELAY_USECS);
 	return 0;
 }
 
-int rcb4_jmp(rcb4_connection* conn, uint32_t addr, uint8_t conditions)
+static
+int rcb4_send_command_private(rcb4_connection* conn, const uint8_t* command, uint8_t length)
 {
-	//               size, comm, (2) , (3) , (4) , (5)
-	uint8_t msg[] = {0x07, 0x0B, 0x00, 0x00, 0x00, 0x00};
+	int ret;
 	
-	//TODO: Endian...
-	msg[2] = 0xFF & (addr); // Address
-	msg[3] = 0xFF & (addr >> 8);
-	msg[4] = 0xFF & (addr >> 16);
+	assert(conn);
 	
-	msg[5] = 0x0F & conditions; // Conditions
+	rcb4_conn_lock(conn);
+	ret = rcb4_send_command_private_locked(conn, command, length);
+	rcb4_conn_unlock(conn);
 	
-	// Checksum
-	msg[6] = 0xFF & ((int)msg[0] + (int)msg[1] + (int)msg[2] + (int)msg[3] + (int)msg[4] + (int)msg[5]);
+	return ret;
+}
+
+int rcb4_jmp(rcb4_connection* conn, uint32_t addr, uint8_t conditions)
+{
+	uint8_t msg[RCB4_COMM_JUMP_SIZE];
 	
+	rcb4_command_encode_jump(RCB4_COMM_JMP, addr, conditions, msg);
 	return rcb4_send_command_private(conn, msg, sizeof(msg));
 }
 
 int rcb4_call(rcb4_connection* conn, uint32_t addr, uint8_t conditions)
 {
-	//               size, comm, (2) , (3) , (4) , (5) , (6)
-	uint8_t msg[] = {0x07, 0x0C, 0x00, 0x00, 0x00, 0x00, 0x00};
-	
-	//TODO: Endian...
-	msg[2] = 0xFF & (addr); // Address
-	msg[3] = 0xFF & (addr >> 8);
-	msg[4] = 0xFF & (addr >> 16);
-	
-	msg[5] = 0x0F & conditions; // Conditions
-	
-	// Checksum
-	msg[6] = 0xFF & ((int)msg[0] + (int)msg[1] + (int)msg[2] + (int)msg[3] + (int)msg[4] + (int)msg[5]);
+	uint8_t msg[RCB4_COMM_JUMP_SIZE];
 	
+	rcb4_command_encode_jump(RCB4_COMM_CALL, addr, conditions, msg);
 	return rcb4_send_command_private(conn, msg, sizeof(msg));
 }
 
 int rcb4_ret(rcb4_connection* conn)
 {
-	//                     size, comm, checksum
-	const uint8_t msg[] = {0x03, 0x0D, 0x10};
+	uint8_t msg[RCB4_COMM_RET_SIZE];
 	
+	rcb4_command_encode_ret(msg);
 	return rcb4_send_command_private(conn, msg, sizeof(msg));
 }
 
@@ -0,0 +1,384 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_expr.c
+ * @brief Compiler of arithmetic expressions to robot commands.
+ * 
+ * @details An expression over RAM variables, AD converters and constants is
+ * built as a graph and translated to MOV, ADD, SUB, MUL, DIV and SHIFT commands
+ * appended to a routine (see rcb4_asm.c), so simple control laws can run inside
+ * the robot.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_command.h"
+#include "rcb4_asm.h"
+#include "rcb4_expr.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+rcb4_expr* rcb4_expr_create(uint16_t temp_addr, uint8_t temps)
+{
+	rcb4_expr* e;
+	
+	if(temps > 0 && temp_addr + RCB4_EXPR_SIZE * temps - 1 > RCB4_MAX_RAM_ADDRESS)
+	{
+		fprintf(stderr, "Invalid RAM address. Allowed address: 0x0000~0x%04X\n", RCB4_MAX_RAM_ADDRESS);
+		return NULL;
+	}
+	
+	e = (rcb4_expr*)malloc(sizeof(rcb4_expr));
+	if(!e)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return NULL;
+	}
+	
+	memset(e, 0, sizeof(rcb4_expr));
+	e->temp_addr = temp_addr;
+	e->temps = temps;
+	
+	return e;
+}
+
+void rcb4_expr_delete(rcb4_expr* e)
+{
+	if(!e)return;
+	
+	free(e->node);
+	free(e);
+}
+
+// Adds a node. Returns its id or -1. Invalid operands (previous errors) are propagated
+static
+int rcb4_expr_node(rcb4_expr* e, uint8_t op, int a, int b, uint16_t value)
+{
+	struct s_rcb4_expr_node* node;
+	
+	assert(e);
+	
+	if(a >= e->nodes || b >= e->nodes ||
+	   (op >= RCB4_EXPR_ADD && a < 0) || (op >= RCB4_EXPR_ADD && op <= RCB4_EXPR_DIV && b < 0))
+		return -1;
+	
+	if(e->nodes == e->max_nodes)
+	{
+		node = (struct s_rcb4_expr_node*)realloc(e->node, (e->max_nodes ? 2 * e->max_nodes : 16) * sizeof(struct s_rcb4_expr_node));
+		if(!node)
+		{
+			fprintf(stderr, "Memory error.\n");
+			return -1;
+		}
+		e->node = node;
+		e->max_nodes = e->max_nodes ? 2 * e->max_nodes : 16;
+	}
+	
+	node = &e->node[e->nodes];
+	node->op = op;
+	node->a = a;
+	node->b = b;
+	node->value = value;
+	node->lo = 0;
+	node->hi = 0;
+	
+	return e->nodes++;
+}
+
+int rcb4_expr_const(rcb4_expr* e, int32_t value)
+{
+	// The robot compares, divides and shifts without sign, a negative constant would be a large value
+	if(value < 0 || value > 65535)
+	{
+		fprintf(stderr, "Invalid constant. Allowed values: 0~65535\n");
+		return -1;
+	}
+	
+	return rcb4_expr_node(e, RCB4_EXPR_CONST, -1, -1, (uint16_t)value);
+}
+
+int rcb4_expr_ram(rcb4_expr* e, uint16_t addr)
+{
+	if(addr + RCB4_EXPR_SIZE - 1 > RCB4_MAX_RAM_ADDRESS)
+	{
+		fprintf(stderr, "Invalid RAM address. Allowed address: 0x0000~0x%04X\n", RCB4_MAX_RAM_ADDRESS - RCB4_EXPR_SIZE + 1);
+		return -1;
+	}
+	
+	return rcb4_expr_node(e, RCB4_EXPR_RAM, -1, -1, addr);
+}
+
+int rcb4_expr_ad(rcb4_expr* e, uint8_t ad_id)
+{
+	if(ad_id > RCB4_MAX_AD_ID)
+	{
+		fprintf(stderr, "Invalid parameter value. Allowed values [0~%d].\n", RCB4_MAX_AD_ID);
+		return -1;
+	}
+	
+	return rcb4_expr_ram(e, RCB4_AD_BASE_ADDR + 2*ad_id);
+}
+
+int rcb4_expr_add(rcb4_expr* e, int a, int b)
+{
+	return rcb4_expr_node(e, RCB4_EXPR_ADD, a, b, 0);
+}
+
+int rcb4_expr_sub(rcb4_expr* e, int a, int b)
+{
+	return rcb4_expr_node(e, RCB4_EXPR_SUB, a, b, 0);
+}
+
+int rcb4_expr_mul(rcb4_expr* e, int a, int b)
+{
+	return rcb4_expr_node(e, RCB4_EXPR_MUL, a, b, 0);
+}
+
+int rcb4_expr_div(rcb4_expr* e, int a, int b)
+{
+	return rcb4_expr_node(e, RCB4_EXPR_DIV, a, b, 0);
+}
+
+int rcb4_expr_shl(rcb4_expr* e, int a, uint8_t shifts)
+{
+	if(shifts == 0 || shifts > 15)
+	{
+		fprintf(stderr, "Invalid number of shifts. Allowed values: 1~15\n");
+		return -1;
+	}
+	
+	return rcb4_expr_node(e, RCB4_EXPR_SHL, a, -1, shifts);
+}
+
+int rcb4_expr_shr(rcb4_expr* e, int a, uint8_t shifts)
+{
+	if(shifts == 0 || shifts > 15)
+	{
+		fprintf(stderr, "Invalid number of shifts. Allowed values: 1~15\n");
+		return -1;
+	}
+	
+	return rcb4_expr_node(e, RCB4_EXPR_SHR, a, -1, shifts);
+}
+
+int rcb4_expr_clamp(rcb4_expr* e, int a, uint16_t lo, uint16_t hi)
+{
+	int n;
+	
+	if(lo > hi)
+	{
+		fprintf(stderr, "Invalid limits. The minimum is bigger than the maximum.\n");
+		return -1;
+	}
+	
+	n = rcb4_expr_node(e, RCB4_EXPR_CLAMP, a, -1, 0);
+	if(n >= 0)
+	{
+		e->node[n].lo = lo;
+		e->node[n].hi = hi;
+	}
+	
+	return n;
+}
+
+// Does the expression read the 2 bytes at addr?
+static
+int rcb4_expr_reads(const rcb4_expr* e, int n, uint16_t addr)
+{
+	const struct s_rcb4_expr_node* node = &e->node[n];
+	
+	switch(node->op)
+	{
+		case RCB4_EXPR_CONST:
+			return 0;
+		case RCB4_EXPR_RAM:
+			return node->value + RCB4_EXPR_SIZE > addr && node->value < addr + RCB4_EXPR_SIZE;
+		default:
+			return rcb4_expr_reads(e, node->a, addr) || (node->b >= 0 && rcb4_expr_reads(e, node->b, addr));
+	}
+}
+
+// Appends: comm type, source = node b (constant or RAM), destination = addr
+static
+int rcb4_expr_emit_op(rcb4_asm* a, rcb4_comm* comm, uint8_t type, const struct s_rcb4_expr_node* src, uint16_t addr)
+{
+	rcb4_command_recreate(comm, type);
+	if(src->op == RCB4_EXPR_CONST)
+	{
+		if(rcb4_command_set_src_literal(comm, &src->value, RCB4_EXPR_SIZE) != 0) // TODO: Endian...
+			return -1;
+	}
+	else if(rcb4_command_set_src_ram(comm, src->value, RCB4_EXPR_SIZE) != 0)
+		return -1;
+	if(rcb4_command_set_dst_ram(comm, addr) != 0)
+		return -1;
+	
+	return rcb4_asm_add(a, comm);
+}
+
+// Compares the value at addr with a literal: SUB without saving, only the flags
+static
+int rcb4_expr_emit_compare(rcb4_asm* a, rcb4_comm* comm, uint16_t addr, uint16_t value)
+{
+	rcb4_command_recreate(comm, RCB4_COMM_SUB);
+	if(rcb4_command_set_src_literal(comm, &value, RCB4_EXPR_SIZE) != 0 || // TODO: Endian...
+	   rcb4_command_set_dst_ram(comm, addr) != 0 || rcb4_command_set_dst_do_not_save(comm) != 0)
+		return -1;
+	
+	return rcb4_asm_add(a, comm);
+}
+
+// Generates the code that leaves the value of node n at addr. depth = temporaries in use
+static
+int rcb4_expr_gen(const rcb4_expr* e, int n, uint16_t addr, uint8_t depth, rcb4_asm* a, rcb4_comm* comm)
+{
+	static const uint8_t type[] = {0, 0, RCB4_COMM_ADD, RCB4_COMM_SUB, RCB4_COMM_MUL, RCB4_COMM_DIV};
+	const struct s_rcb4_expr_node* node = &e->node[n];
+	const struct s_rcb4_expr_node* b;
+	struct s_rcb4_expr_node temp;
+	char label[RCB4_ASM_LABEL_MAX];
+	
+	switch(node->op)
+	{
+		case RCB4_EXPR_CONST:
+		case RCB4_EXPR_RAM:
+			if(node->op == RCB4_EXPR_RAM && node->value == addr)
+				return 0; // Already there
+			return rcb4_expr_emit_op(a, comm, RCB4_COMM_MOV, node, addr);
+		
+		case RCB4_EXPR_ADD:
+		case RCB4_EXPR_SUB:
+		case RCB4_EXPR_MUL:
+		case RCB4_EXPR_DIV:
+			if(rcb4_expr_gen(e, node->a, addr, depth, a, comm) != 0)
+				return -1;
+			
+			// Leaves and constants are used directly as the source, the rest go through a temporary
+			b = &e->node[node->b];
+			if(b->op != RCB4_EXPR_CONST && b->op != RCB4_EXPR_RAM)
+			{
+				if(depth >= e->temps)
+				{
+					fprintf(stderr, "The expression needs more temporaries.\n");
+					return -1;
+				}
+				temp.op = RCB4_EXPR_RAM;
+				temp.value = e->temp_addr + RCB4_EXPR_SIZE * depth;
+				if(rcb4_expr_gen(e, node->b, temp.value, depth + 1, a, comm) != 0)
+					return -1;
+				b = &temp;
+			}
+			return rcb4_expr_emit_op(a, comm, type[node->op], b, addr);
+		
+		case RCB4_EXPR_SHL:
+		case RCB4_EXPR_SHR:
+			if(rcb4_expr_gen(e, node->a, addr, depth, a, comm) != 0)
+				return -1;
+			
+			rcb4_command_recreate(comm, RCB4_COMM_SHIFT);
+			if(rcb4_command_set_dst_ram(comm, addr) != 0 || rcb4_command_set_data_size(comm, RCB4_EXPR_SIZE) != 0 ||
+			   (node->op == RCB4_EXPR_SHL ? rcb4_command_set_shift_left(comm, node->value) : rcb4_command_set_shift_right(comm, node->value)) != 0)
+				return -1;
+			return rcb4_asm_add(a, comm);
+		
+		case RCB4_EXPR_CLAMP:
+			if(rcb4_expr_gen(e, node->a, addr, depth, a, comm) != 0)
+				return -1;
+			
+			temp.op = RCB4_EXPR_CONST;
+			if(node->lo > 0) // if(x < lo) x = lo; (the subtraction borrows)
+			{
+				snprintf(label, sizeof(label), "_expr_%06X_lo", a->size);
+				temp.value = node->lo;
+				if(rcb4_expr_emit_compare(a, comm, addr, node->lo) != 0 || rcb4_asm_jmp(a, label, RCB4_CONDITION_C_CLR) != 0 ||
+				   rcb4_expr_emit_op(a, comm, RCB4_COMM_MOV, &temp, addr) != 0 || rcb4_asm_label(a, label) != 0)
+					return -1;
+			}
+			if(node->hi < 0xFFFF) // if(x >= hi + 1) x = hi;
+			{
+				snprintf(label, sizeof(label), "_expr_%06X_hi", a->size);
+				temp.value = node->hi;
+				if(rcb4_expr_emit_compare(a, comm, addr, node->hi + 1) != 0 || rcb4_asm_jmp(a, label, RCB4_CONDITION_C_SET) != 0 ||
+				   rcb4_expr_emit_op(a, comm, RCB4_COMM_MOV, &temp, addr) != 0 || rcb4_asm_label(a, label) != 0)
+					return -1;
+			}
+			return 0;
+		
+		default:
+			fprintf(stderr, "Unknown expression node.\n");
+			return -1;
+	}
+}
+
+int rcb4_expr_compile(const rcb4_expr* e, int node, uint16_t dst, rcb4_asm* a)
+{
+	int err;
+	rcb4_comm* comm;
+	struct s_rcb4_expr_node temp;
+	
+	assert(e);
+	assert(a);
+	
+	if(node < 0 || node >= e->nodes)
+	{
+		fprintf(stderr, "Invalid expression.\n");
+		return -1;
+	}
+	if(dst + RCB4_EXPR_SIZE - 1 > RCB4_MAX_RAM_ADDRESS)
+	{
+		fprintf(stderr, "Invalid RAM address. Allowed address: 0x0000~0x%04X\n", RCB4_MAX_RAM_ADDRESS - RCB4_EXPR_SIZE + 1);
+		return -1;
+	}
+	
+	comm = rcb4_command_create(RCB4_COMM_MOV);
+	if(!comm)
+		return -1;
+	
+	/* The result is built in place, so if dst is an operand (x = k - x) it
+	 * would be overwritten before being read. Go through a temporary then. */
+	if(e->node[node].op > RCB4_EXPR_RAM && rcb4_expr_reads(e, node, dst))
+	{
+		if(e->temps == 0)
+		{
+			fprintf(stderr, "The expression needs more temporaries.\n");
+			rcb4_command_delete(comm);
+			return -1;
+		}
+		temp.op = RCB4_EXPR_RAM;
+		temp.value = e->temp_addr;
+		err = rcb4_expr_gen(e, node, temp.value, 1, a, comm);
+		if(err == 0)
+			err = rcb4_expr_emit_op(a, comm, RCB4_COMM_MOV, &temp, dst);
+	}
+	else
+		err = rcb4_expr_gen(e, node, dst, 0, a, comm);
+	
+	rcb4_command_delete(comm);
+	return err;
+}
@@ -35,13 +35,14 @@
 #include "rcb4.h"
 #include "rcb4_private.h"
 #include "rcb4_config.h"
+#include "rcb4_command.h"
 
 #include <stdlib.h>
 #include <string.h>
 
 int rcb4_ad_read(rcb4_connection* conn, uint8_t ad_id, uint16_t* value)
 {
-	rcb4_comm* comm;
+	rcb4_comm comm; // On the stack: threads reading at the same time don't share anything but the lock
 	
 	assert(conn);
 	
@@ -51,36 +52,40 @@ int rcb4_ad_read(rcb4_connection* conn, uint8_t ad_id, uint16_t* value)
 		return -1;
 	}
 	
-	comm = rcb4_command_create(RCB4_COMM_MOV);
-	if(!comm)
+	rcb4_command_recreate(&comm, RCB4_COMM_MOV);
+	if(rcb4_command_set_src_ram(&comm, RCB4_AD_BASE_ADDR + 2*ad_id, 2) != 0)
 	{
 		fprintf(stderr, "Error creating the command.\n");
 		return -1;
 	}
-	
-	if(rcb4_command_set_src_ram(comm, RCB4_AD_BASE_ADDR + 2*ad_id, 2) != 0)
+	if(rcb4_command_set_dst_com(&comm) != 0)
 	{
 		fprintf(stderr, "Error creating the command.\n");
-		rcb4_command_delete(comm);
-		return -1;
-	}
-	if(rcb4_command_set_dst_com(comm) != 0)
-	{
-		fprintf(stderr, "Error creating the command.\n");
-		rcb4_command_delete(comm);
 		return -1;
 	}
 	
 	// Reply will be 2 bytes (we asked for 2 bytes in rcb4_command_set_src_ram()
 	// TODO: Endian...
-	if(rcb4_send_command(conn, comm, (uint8_t*)value) != 2)
+	if(rcb4_send_command(conn, &comm, (uint8_t*)value) != 2)
 	{
 		fprintf(stderr, "Error sending the command.\n");
-		rcb4_command_delete(comm);
 		return -1;
 	}
 	
-	rcb4_command_delete(comm);
-	
 	return 0;
 }
+
+// 64 bit FNV-1a. Can be chained to hash data that arrives in pieces
+uint64_t rcb4_util_hash(uint64_t hash, const void* data, size_t size)
+{
+	size_t i;
+	const uint8_t* ptr = (const uint8_t*)data;
+	
+	for(i = 0; i < size; i++)
+	{
+		hash ^= ptr[i];
+		hash *= 0x100000001B3ULL;
+	}
+	
+	return hash;
+}
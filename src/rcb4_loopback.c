@@ -0,0 +1,473 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file rcb4_loopback.c
+ * @brief In-process emulator of the RCB-4 board.
+ * 
+ * @details The "loop:" transport answers the commands right away from memory,
+ * with no serial port and no delays. It keeps a RAM and a ROM, runs the
+ * MOV, logic and math commands on them (flags included) and executes the
+ * routines of the ROM on CALL. The servo commands are only acknowledged.
+ * 
+ * It is meant to test and benchmark the protocol code, so it is as fast as
+ * possible rather than accurate in timing.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_transport.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define RCB4_LOOP_PING 0xFE
+
+// Queues a reply. Replies that don't fit are lost, like in a real buffer
+static
+void rcb4_loop_reply(struct s_rcb4_loop* loop, uint8_t cmd, const uint8_t* data, uint8_t size)
+{
+	uint8_t frame[RCB4_COMM_MESSAGE_SIZE_ALLOWED + 3];
+	uint8_t length, i, sum = 0;
+	
+	if(data == NULL) // ACK
+	{
+		frame[0] = 0x04;
+		frame[1] = cmd;
+		frame[2] = RCB4_ACK;
+		length = 4;
+	}
+	else
+	{
+		frame[0] = size + 3;
+		frame[1] = cmd;
+		memcpy(frame + 2, data, size);
+		length = size + 3;
+	}
+	for(i = 0; i < length - 1; i++)
+		sum += frame[i];
+	frame[length - 1] = sum;
+	
+	if(loop->tx_head > 0) // Make room at the start
+	{
+		memmove(loop->tx, loop->tx + loop->tx_head, loop->tx_size);
+		loop->tx_head = 0;
+	}
+	if(loop->tx_size + length > RCB4_LOOP_TX_SIZE)
+		return;
+	memcpy(loop->tx + loop->tx_size, frame, length);
+	loop->tx_size += length;
+}
+
+// Pointer to the memory of an address of RAM or ROM, NULL if out of range
+static
+uint8_t* rcb4_loop_ram(struct s_rcb4_loop* loop, const uint8_t* addr, uint8_t size)
+{
+	uint32_t a = addr[0] | (addr[1] << 8);
+	
+	return (a + size <= RCB4_MAX_RAM_ADDRESS + 1) ? loop->ram + a : NULL;
+}
+
+static
+uint8_t* rcb4_loop_rom(struct s_rcb4_loop* loop, const uint8_t* addr, uint8_t size)
+{
+	uint32_t a = addr[0] | (addr[1] << 8) | (addr[2] << 16);
+	
+	return (a + size <= RCB4_MAX_ROM_ADDRESS + 1) ? loop->rom + a : NULL;
+}
+
+/* MOV and the logic and math commands: type, dst (3), src (...). Returns 0 if
+ * ok. Replies to COM (or with the result) go to reply/reply_size. */
+static
+int rcb4_loop_data_command(struct s_rcb4_loop* loop, const uint8_t* f, uint8_t* reply, uint8_t* reply_size)
+{
+	static const uint8_t zeros[RCB4_COMM_MESSAGE_SIZE_ALLOWED];
+	uint8_t cmd = f[1], type = f[2], size, i;
+	const uint8_t* src;
+	uint8_t* dst = NULL;
+	int64_t a, b, r;
+	
+	*reply_size = 0;
+	
+	switch(type & COMM_SRC_MASK)
+	{
+		case COMM_SRC_RAM:
+			size = f[8];
+			src = rcb4_loop_ram(loop, f + 6, size);
+			break;
+		case COMM_SRC_ICS: // No servos here, they read as zeros
+			size = f[8];
+			src = zeros;
+			break;
+		case COMM_SRC_LIT:
+			size = f[0] - 7;
+			src = f + 6;
+			break;
+		default:
+			size = f[9];
+			src = rcb4_loop_rom(loop, f + 6, size);
+			break;
+	}
+	if(src == NULL || size == 0 || size > RCB4_COMM_MESSAGE_SIZE_ALLOWED)
+		return -1;
+	
+	switch(type & COMM_DST_MASK)
+	{
+		case COMM_DST_RAM:
+			dst = rcb4_loop_ram(loop, f + 3, size);
+			break;
+		case COMM_DST_ROM:
+			dst = rcb4_loop_rom(loop, f + 3, size);
+			break;
+		case COMM_DST_ICS:
+			dst = NULL;
+			break;
+		default: // COM
+			if(cmd != RCB4_COMM_MOV)
+				return -1;
+			memcpy(reply, src, size);
+			*reply_size = size;
+			return 0;
+	}
+	
+	if(cmd == RCB4_COMM_MOV)
+	{
+		if(dst)
+			memmove(dst, src, size);
+		return 0;
+	}
+	if((type & COMM_DST_MASK) == COMM_DST_ICS)
+		dst = (uint8_t*)zeros;
+	if(dst == NULL)
+		return -1;
+	
+	// The logic and math commands always send a copy of the result
+	if(cmd == RCB4_COMM_AND || cmd == RCB4_COMM_OR || cmd == RCB4_COMM_XOR)
+	{
+		for(i = 0, loop->zero = 1; i < size; i++)
+		{
+			reply[i] = (cmd == RCB4_COMM_AND) ? dst[i] & src[i] : (cmd == RCB4_COMM_OR) ? dst[i] | src[i] : dst[i] ^ src[i];
+			if(reply[i])
+				loop->zero = 0;
+		}
+	}
+	else
+	{
+		if(size > 4)
+			return -1;
+		a = b = 0;
+		memcpy(&a, dst, size); // TODO: Endian...
+		memcpy(&b, src, size);
+		switch(cmd)
+		{
+			case RCB4_COMM_ADD: r = a + b; break;
+			case RCB4_COMM_SUB: r = a - b; break;
+			case RCB4_COMM_MUL: r = a * b; break;
+			case RCB4_COMM_DIV: r = b ? a / b : 0; break;
+			default: r = b ? a % b : 0; break; // MOD
+		}
+		loop->carry = (r < 0 || (r >> (8 * size)) != 0);
+		r &= (size == 4) ? 0xFFFFFFFFLL : ((1LL << (8 * size)) - 1);
+		loop->zero = (r == 0);
+		memcpy(reply, &r, size);
+	}
+	
+	if(!(type & COMM_NUPDATE) && (type & COMM_DST_MASK) != COMM_DST_ICS)
+		memcpy(dst, reply, size);
+	*reply_size = size;
+	return 0;
+}
+
+// NOT and SHIFT: type, dst (3), zero, shifts, size
+static
+int rcb4_loop_unary_command(struct s_rcb4_loop* loop, const uint8_t* f, uint8_t* reply, uint8_t* reply_size)
+{
+	uint8_t type = f[2], size = f[8], i;
+	uint8_t* dst;
+	uint64_t v = 0;
+	
+	if((type & COMM_DST_MASK) == COMM_DST_ROM)
+		dst = rcb4_loop_rom(loop, f + 3, size);
+	else
+		dst = rcb4_loop_ram(loop, f + 3, size);
+	if(dst == NULL || size == 0)
+		return -1;
+	
+	if(f[1] == RCB4_COMM_NOT)
+	{
+		for(i = 0; i < size; i++)
+			reply[i] = ~dst[i];
+	}
+	else
+	{
+		if(size > 8)
+			return -1;
+		memcpy(&v, dst, size); // TODO: Endian...
+		if(f[7] < 128)
+			v <<= f[7];
+		else
+			v >>= 256 - f[7];
+		memcpy(reply, &v, size);
+	}
+	for(i = 0, loop->zero = 1; i < size; i++)
+		if(reply[i])
+			loop->zero = 0;
+	
+	if(!(type & COMM_NUPDATE))
+		memcpy(dst, reply, size);
+	*reply_size = size;
+	return 0;
+}
+
+// 1 if the conditions of a JMP or CALL are met
+static
+int rcb4_loop_condition(const struct s_rcb4_loop* loop, uint8_t cond)
+{
+	if((cond & (1 << 3)) && ((cond >> 1) & 1) != loop->carry)
+		return 0;
+	if((cond & (1 << 2)) && (cond & 1) != loop->zero)
+		return 0;
+	return 1;
+}
+
+static int rcb4_loop_execute(struct s_rcb4_loop* loop, const uint8_t* f, int from_host);
+
+// Runs a routine of the ROM until its RET
+static
+void rcb4_loop_run(struct s_rcb4_loop* loop, uint32_t pc)
+{
+	uint32_t stack[RCB4_LOOP_MAX_DEPTH];
+	int depth = 0, steps;
+	const uint8_t* f;
+	
+	for(steps = 0; steps < RCB4_LOOP_MAX_STEPS; steps++)
+	{
+		if(pc + 3 > RCB4_MAX_ROM_ADDRESS + 1 || loop->rom[pc] < 3 || pc + loop->rom[pc] > RCB4_MAX_ROM_ADDRESS + 1)
+			return; // Erased or broken ROM
+		f = loop->rom + pc;
+		
+		switch(f[1])
+		{
+			case RCB4_COMM_JMP:
+				pc = rcb4_loop_condition(loop, f[5]) ? (uint32_t)(f[2] | (f[3] << 8) | (f[4] << 16)) : pc + f[0];
+				break;
+			case RCB4_COMM_CALL:
+				if(!rcb4_loop_condition(loop, f[5]))
+				{
+					pc += f[0];
+					break;
+				}
+				if(depth >= RCB4_LOOP_MAX_DEPTH)
+					return;
+				stack[depth++] = pc + f[0];
+				pc = f[2] | (f[3] << 8) | (f[4] << 16);
+				break;
+			case RCB4_COMM_RET:
+				if(depth == 0)
+					return;
+				pc = stack[--depth];
+				break;
+			default:
+				rcb4_loop_execute(loop, f, 0);
+				pc += f[0];
+				break;
+		}
+	}
+}
+
+// Runs a complete frame (checksum already checked). Replies only if it came from the host
+static
+int rcb4_loop_execute(struct s_rcb4_loop* loop, const uint8_t* f, int from_host)
+{
+	uint8_t reply[RCB4_COMM_MESSAGE_SIZE_ALLOWED];
+	uint8_t reply_size = 0;
+	int err = 0;
+	
+	switch(f[1])
+	{
+		case RCB4_COMM_MOV:
+		case RCB4_COMM_AND:
+		case RCB4_COMM_OR:
+		case RCB4_COMM_XOR:
+		case RCB4_COMM_ADD:
+		case RCB4_COMM_SUB:
+		case RCB4_COMM_MUL:
+		case RCB4_COMM_DIV:
+		case RCB4_COMM_MOD:
+			err = (f[0] >= 10 || (f[0] >= 8 && (f[2] & COMM_SRC_MASK) == COMM_SRC_LIT)) ? rcb4_loop_data_command(loop, f, reply, &reply_size) : -1;
+			break;
+		case RCB4_COMM_NOT:
+		case RCB4_COMM_SHIFT:
+			err = (f[0] >= 10) ? rcb4_loop_unary_command(loop, f, reply, &reply_size) : -1;
+			break;
+		case RCB4_COMM_CALL:
+		case RCB4_COMM_JMP: // From the host both run the routine and come back
+			if(f[0] >= 7 && rcb4_loop_condition(loop, f[5]))
+				rcb4_loop_run(loop, f[2] | (f[3] << 8) | (f[4] << 16));
+			break;
+		case RCB4_COMM_RET:
+		case RCB4_LOOP_PING:
+		case RCB4_COMM_ICS:
+		case RCB4_COMM_SINGLE:
+		case RCB4_COMM_CONST:
+		case RCB4_COMM_SERIES:
+		case RCB4_COMM_SPEED:
+			break;
+		default:
+			err = -1;
+			break;
+	}
+	
+	if(!from_host || err != 0) // The real board doesn't answer garbage either
+		return err;
+	
+	rcb4_loop_reply(loop, f[1], (reply_size > 0) ? reply : NULL, reply_size);
+	return 0;
+}
+
+static
+int rcb4_loop_open(struct s_rcb4_transport* t, const char* path)
+{
+	struct s_rcb4_loop* loop;
+	FILE* file;
+	
+	loop = (struct s_rcb4_loop*)malloc(sizeof(struct s_rcb4_loop));
+	if(!loop)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return -1;
+	}
+	
+	memset(loop, 0, sizeof(struct s_rcb4_loop));
+	memset(loop->rom, 0xFF, sizeof(loop->rom)); // Erased flash
+	
+	// "loop:rom.bin" starts with a copy of a ROM
+	if(path && path[0] != '\0')
+	{
+		file = fopen(path, "rb");
+		if(!file)
+		{
+			fprintf(stderr, "Error opening %s.\n", path);
+			free(loop);
+			return -1;
+		}
+		if(fread(loop->rom, 1, sizeof(loop->rom), file) == 0)
+			fprintf(stderr, "Warning: %s is empty.\n", path);
+		fclose(file);
+	}
+	
+	t->fd = -1;
+	t->data = loop;
+	return 0;
+}
+
+static
+int rcb4_loop_write(struct s_rcb4_transport* t, const uint8_t* buffer, uint16_t length)
+{
+	struct s_rcb4_loop* loop = (struct s_rcb4_loop*)t->data;
+	uint8_t i, sum;
+	uint16_t n;
+	
+	while(length > 0)
+	{
+		n = (length < RCB4_LOOP_RX_SIZE - loop->rx_size) ? length : RCB4_LOOP_RX_SIZE - loop->rx_size;
+		memcpy(loop->rx + loop->rx_size, buffer, n);
+		loop->rx_size += n;
+		buffer += n;
+		length -= n;
+		
+		// Run every complete frame
+		while(loop->rx_size > 0 && loop->rx_size >= loop->rx[0])
+		{
+			n = loop->rx[0];
+			if(n >= 3)
+			{
+				for(i = 0, sum = 0; i < n - 1; i++)
+					sum += loop->rx[i];
+				if(sum == loop->rx[n - 1])
+					rcb4_loop_execute(loop, loop->rx, 1);
+			}
+			else
+			{
+				n = 1; // Can't be a frame, resynchronize
+			}
+			memmove(loop->rx, loop->rx + n, loop->rx_size - n);
+			loop->rx_size -= n;
+		}
+	}
+	
+	return 0;
+}
+
+// Nothing else will ever arrive, so there is no need to wait for the deadline
+static
+int rcb4_loop_read(struct s_rcb4_transport* t, uint8_t* buffer, uint16_t length, uint64_t deadline)
+{
+	struct s_rcb4_loop* loop = (struct s_rcb4_loop*)t->data;
+	
+	(void)deadline;
+	if(loop->tx_size == 0)
+		return -10;
+	
+	if(length > loop->tx_size)
+		length = loop->tx_size;
+	memcpy(buffer, loop->tx + loop->tx_head, length);
+	loop->tx_head += length;
+	loop->tx_size -= length;
+	if(loop->tx_size == 0)
+		loop->tx_head = 0;
+	
+	return length;
+}
+
+static
+void rcb4_loop_flush(struct s_rcb4_transport* t)
+{
+	struct s_rcb4_loop* loop = (struct s_rcb4_loop*)t->data;
+	
+	loop->tx_head = 0;
+	loop->tx_size = 0;
+}
+
+static
+void rcb4_loop_close(struct s_rcb4_transport* t)
+{
+	free(t->data);
+}
+
+const struct s_rcb4_transport_ops rcb4_transport_loop =
+{
+	"loop",
+	0,
+	rcb4_loop_open,
+	rcb4_loop_write,
+	rcb4_loop_read,
+	rcb4_loop_flush,
+	NULL,
+	rcb4_loop_close
+};
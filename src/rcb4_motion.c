@@ -0,0 +1,430 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_motion.c
+ * @brief Loader and writer of binary motion files.
+ * 
+ * @details The files are mapped in memory and used in place: opening a motion
+ * only checks the header, the checksum of the data is verified the first time
+ * a frame is used (or when rcb4_motion_validate() is called).
+ * 
+ * @sa rcb4_motion.h for the format.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_command.h"
+#include "rcb4_motion.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define RCB4_MOTION_ROUND_UP(x) (((x) + RCB4_MOTION_ALIGN - 1) & ~(uint32_t)(RCB4_MOTION_ALIGN - 1))
+#define RCB4_MOTION_FIELD(field) offsetof(struct s_rcb4_motion_header, field)
+
+// The file is little endian whatever the host is
+static inline
+uint16_t rcb4_motion_get16(const uint8_t* p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline
+uint32_t rcb4_motion_get32(const uint8_t* p)
+{
+	return (uint32_t)rcb4_motion_get16(p) | ((uint32_t)rcb4_motion_get16(p + 2) << 16);
+}
+
+static inline
+void rcb4_motion_put16(uint8_t* p, uint16_t value)
+{
+	p[0] = 0xFF & (value);
+	p[1] = 0xFF & (value >> 8);
+}
+
+static inline
+void rcb4_motion_put32(uint8_t* p, uint32_t value)
+{
+	rcb4_motion_put16(p, 0xFFFF & value);
+	rcb4_motion_put16(p + 2, 0xFFFF & (value >> 16));
+}
+
+static
+void rcb4_motion_header_decode(struct s_rcb4_motion_header* h, const uint8_t* p)
+{
+	h->magic = rcb4_motion_get32(p + RCB4_MOTION_FIELD(magic));
+	h->version = rcb4_motion_get16(p + RCB4_MOTION_FIELD(version));
+	h->header_size = rcb4_motion_get16(p + RCB4_MOTION_FIELD(header_size));
+	h->mask = rcb4_motion_get32(p + RCB4_MOTION_FIELD(mask)) | ((uint64_t)rcb4_motion_get32(p + RCB4_MOTION_FIELD(mask) + 4) << 32);
+	h->frames = rcb4_motion_get32(p + RCB4_MOTION_FIELD(frames));
+	h->servos = rcb4_motion_get16(p + RCB4_MOTION_FIELD(servos));
+	h->flags = rcb4_motion_get16(p + RCB4_MOTION_FIELD(flags));
+	h->time_offset = rcb4_motion_get32(p + RCB4_MOTION_FIELD(time_offset));
+	h->speed_offset = rcb4_motion_get32(p + RCB4_MOTION_FIELD(speed_offset));
+	h->pos_offset = rcb4_motion_get32(p + RCB4_MOTION_FIELD(pos_offset));
+	h->pos_stride = rcb4_motion_get32(p + RCB4_MOTION_FIELD(pos_stride));
+	h->file_size = rcb4_motion_get32(p + RCB4_MOTION_FIELD(file_size));
+	h->checksum = rcb4_motion_get32(p + RCB4_MOTION_FIELD(checksum));
+}
+
+static
+void rcb4_motion_header_encode(const struct s_rcb4_motion_header* h, uint8_t* p)
+{
+	rcb4_motion_put32(p + RCB4_MOTION_FIELD(magic), h->magic);
+	rcb4_motion_put16(p + RCB4_MOTION_FIELD(version), h->version);
+	rcb4_motion_put16(p + RCB4_MOTION_FIELD(header_size), h->header_size);
+	rcb4_motion_put32(p + RCB4_MOTION_FIELD(mask), 0xFFFFFFFF & h->mask);
+	rcb4_motion_put32(p + RCB4_MOTION_FIELD(mask) + 4, 0xFFFFFFFF & (h->mask >> 32));
+	rcb4_motion_put32(p + RCB4_MOTION_FIELD(frames), h->frames);
+	rcb4_motion_put16(p + RCB4_MOTION_FIELD(servos), h->servos);
+	rcb4_motion_put16(p + RCB4_MOTION_FIELD(flags), h->flags);
+	rcb4_motion_put32(p + RCB4_MOTION_FIELD(time_offset), h->time_offset);
+	rcb4_motion_put32(p + RCB4_MOTION_FIELD(speed_offset), h->speed_offset);
+	rcb4_motion_put32(p + RCB4_MOTION_FIELD(pos_offset), h->pos_offset);
+	rcb4_motion_put32(p + RCB4_MOTION_FIELD(pos_stride), h->pos_stride);
+	rcb4_motion_put32(p + RCB4_MOTION_FIELD(file_size), h->file_size);
+	rcb4_motion_put32(p + RCB4_MOTION_FIELD(checksum), h->checksum);
+}
+
+// Time of a frame and position of the j-th servo of the motion in a frame
+#define RCB4_MOTION_TIME(motion, f) rcb4_motion_get32((motion)->time + (size_t)(f) * sizeof(uint32_t))
+#define RCB4_MOTION_POS(motion, j, f) rcb4_motion_get16((motion)->pos + ((size_t)(j) * (motion)->header.pos_stride + (f)) * sizeof(uint16_t))
+
+static
+uint32_t rcb4_motion_fnv1a(const uint8_t* data, size_t size)
+{
+	size_t i;
+	uint32_t hash = 2166136261u;
+	
+	for(i = 0; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// Computes the layout of a motion. Returns the size of the file
+static
+uint32_t rcb4_motion_layout(struct s_rcb4_motion_header* h)
+{
+	h->time_offset = RCB4_MOTION_ROUND_UP(sizeof(struct s_rcb4_motion_header));
+	h->speed_offset = RCB4_MOTION_ROUND_UP(h->time_offset + h->frames * sizeof(uint32_t));
+	h->pos_offset = RCB4_MOTION_ROUND_UP(h->speed_offset + h->frames);
+	h->pos_stride = RCB4_MOTION_ROUND_UP(h->frames * sizeof(uint16_t)) / sizeof(uint16_t);
+	
+	return h->pos_offset + h->servos * h->pos_stride * sizeof(uint16_t);
+}
+
+rcb4_motion* rcb4_motion_open(const char* path)
+{
+	int fd;
+	struct stat st;
+	void* map;
+	rcb4_motion* motion;
+	struct s_rcb4_motion_header h, expected;
+	
+	assert(path);
+	
+	fd = open(path, O_RDONLY);
+	if(fd < 0)
+	{
+		fprintf(stderr, "Error opening the motion %s. (%s)\n", path, strerror(errno));
+		return NULL;
+	}
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct s_rcb4_motion_header))
+	{
+		fprintf(stderr, "Invalid motion file %s.\n", path);
+		close(fd);
+		return NULL;
+	}
+	
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // The mapping keeps the file
+	if(map == MAP_FAILED)
+	{
+		fprintf(stderr, "Error mapping the motion %s. (%s)\n", path, strerror(errno));
+		return NULL;
+	}
+	
+	// Only the header is checked now, the data is checked when it is used
+	rcb4_motion_header_decode(&h, (const uint8_t*)map);
+	if(h.magic != RCB4_MOTION_MAGIC || h.version != RCB4_MOTION_VERSION || h.header_size != sizeof(h) ||
+	   h.file_size != (uint64_t)st.st_size || (h.mask >> RCB4_ICS_QTY) != 0 ||
+	   h.servos != __builtin_popcountll(h.mask) || h.frames == 0 || h.frames > RCB4_MOTION_MAX_FRAMES)
+	{
+		fprintf(stderr, "Invalid motion file %s. Bad header.\n", path);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	
+	// The offsets must be the ones we would have written
+	expected = h;
+	if(rcb4_motion_layout(&expected) != h.file_size || expected.time_offset != h.time_offset ||
+	   expected.speed_offset != h.speed_offset || expected.pos_offset != h.pos_offset ||
+	   expected.pos_stride != h.pos_stride)
+	{
+		fprintf(stderr, "Invalid motion file %s. Bad layout.\n", path);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	
+	motion = (rcb4_motion*)malloc(sizeof(rcb4_motion));
+	if(!motion)
+	{
+		fprintf(stderr, "Memory error.\n");
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	
+	motion->map = (const uint8_t*)map;
+	motion->size = st.st_size;
+	motion->header = h;
+	motion->time = motion->map + h.time_offset;
+	motion->speed = motion->map + h.speed_offset;
+	motion->pos = motion->map + h.pos_offset;
+	motion->validated = RCB4_MOTION_NOT_VALIDATED;
+	
+	return motion;
+}
+
+void rcb4_motion_close(rcb4_motion* motion)
+{
+	if(!motion)return;
+	
+	munmap((void*)motion->map, motion->size);
+	free(motion);
+}
+
+int rcb4_motion_validate(rcb4_motion* motion)
+{
+	uint32_t f;
+	
+	assert(motion);
+	
+	if(motion->validated != RCB4_MOTION_NOT_VALIDATED)
+		return (motion->validated == RCB4_MOTION_VALID) ? 0 : -1;
+	
+	motion->validated = RCB4_MOTION_INVALID;
+	if(rcb4_motion_fnv1a(motion->map + sizeof(struct s_rcb4_motion_header), motion->size - sizeof(struct s_rcb4_motion_header)) != motion->header.checksum)
+	{
+		fprintf(stderr, "Invalid motion. Bad checksum.\n");
+		return -1;
+	}
+	for(f = 0; f < motion->header.frames; f++)
+	{
+		if(motion->speed[f] == 0 || (f > 0 && RCB4_MOTION_TIME(motion, f) <= RCB4_MOTION_TIME(motion, f-1)))
+		{
+			fprintf(stderr, "Invalid motion. Bad frame %u.\n", f);
+			return -1;
+		}
+	}
+	
+	motion->validated = RCB4_MOTION_VALID;
+	return 0;
+}
+
+uint32_t rcb4_motion_get_frames(const rcb4_motion* motion)
+{
+	assert(motion);
+	
+	return motion->header.frames;
+}
+
+uint64_t rcb4_motion_get_mask(const rcb4_motion* motion)
+{
+	assert(motion);
+	
+	return motion->header.mask;
+}
+
+uint32_t rcb4_motion_get_time(const rcb4_motion* motion, uint32_t frame)
+{
+	assert(motion);
+	
+	if(frame >= motion->header.frames)
+		return 0;
+	return RCB4_MOTION_TIME(motion, frame);
+}
+
+int rcb4_motion_get_positions(rcb4_motion* motion, uint32_t frame, uint16_t* positions)
+{
+	int i, j;
+	
+	assert(motion);
+	assert(positions);
+	
+	if(frame >= motion->header.frames)
+	{
+		fprintf(stderr, "Invalid frame. Allowed values: 0~%u\n", motion->header.frames - 1);
+		return -1;
+	}
+	if(rcb4_motion_validate(motion) != 0)
+		return -1;
+	
+	for(i = 0, j = 0; i < RCB4_ICS_QTY; i++)
+	{
+		if((motion->header.mask >> i) & 1)
+			positions[i] = RCB4_MOTION_POS(motion, j++, frame);
+	}
+	
+	return 0;
+}
+
+int rcb4_motion_get_command(rcb4_motion* motion, uint32_t frame, rcb4_comm* comm)
+{
+	int block, j;
+	
+	assert(motion);
+	assert(comm);
+	
+	if(frame >= motion->header.frames)
+	{
+		fprintf(stderr, "Invalid frame. Allowed values: 0~%u\n", motion->header.frames - 1);
+		return -1;
+	}
+	if(rcb4_motion_validate(motion) != 0)
+		return -1;
+	
+	rcb4_command_recreate(comm, RCB4_COMM_CONST);
+	rcb4_command_set_speed(comm, motion->speed[frame]);
+	
+	// The rows are already in the order of the command, so fill it directly
+	// instead of inserting the servos one by one with rcb4_command_set_servo()
+	for(block = 0; block < 5; block++)
+		comm->command.servo_const.ics_set[block] = 0xFF & (motion->header.mask >> (block * 8));
+	for(j = 0; j < motion->header.servos; j++)
+		comm->command.servo_const.pos[j] = RCB4_MOTION_POS(motion, j, frame);
+	comm->size = 9 + 2 * motion->header.servos;
+	
+	return 0;
+}
+
+int rcb4_motion_next(rcb4_motion* motion, uint32_t* cursor, rcb4_comm* comm)
+{
+	assert(motion);
+	assert(cursor);
+	
+	if(*cursor >= motion->header.frames)
+		return 0;
+	if(rcb4_motion_get_command(motion, *cursor, comm) != 0)
+		return -1;
+	
+	(*cursor)++;
+	return 1;
+}
+
+int rcb4_motion_write(const char* path, uint64_t mask, uint32_t frames, const uint32_t* time, const uint8_t* speed, const uint16_t* positions)
+{
+	int i, j;
+	uint32_t f;
+	uint8_t* buffer;
+	FILE* file;
+	struct s_rcb4_motion_header h;
+	
+	assert(path);
+	assert(time);
+	assert(speed);
+	assert(positions);
+	
+	if(mask == 0 || (mask >> RCB4_ICS_QTY) != 0)
+	{
+		fprintf(stderr, "Invalid servo mask. Allowed servos: 1~%d\n", RCB4_ICS_QTY);
+		return -1;
+	}
+	if(frames == 0 || frames > RCB4_MOTION_MAX_FRAMES)
+	{
+		fprintf(stderr, "Invalid number of frames. Allowed values: 1~%d\n", RCB4_MOTION_MAX_FRAMES);
+		return -1;
+	}
+	for(f = 0; f < frames; f++)
+	{
+		if(speed[f] == 0 || (f > 0 && time[f] <= time[f-1]))
+		{
+			fprintf(stderr, "Invalid frame %u. The speed must not be 0 and the time must increase.\n", f);
+			return -1;
+		}
+	}
+	
+	memset(&h, 0, sizeof(h));
+	h.magic = RCB4_MOTION_MAGIC;
+	h.version = RCB4_MOTION_VERSION;
+	h.header_size = sizeof(h);
+	h.mask = mask;
+	h.frames = frames;
+	h.servos = __builtin_popcountll(mask);
+	h.file_size = rcb4_motion_layout(&h);
+	
+	buffer = (uint8_t*)calloc(1, h.file_size);
+	if(!buffer)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return -1;
+	}
+	
+	for(f = 0; f < frames; f++)
+		rcb4_motion_put32(buffer + h.time_offset + (size_t)f * sizeof(uint32_t), time[f]);
+	memcpy(buffer + h.speed_offset, speed, frames);
+	
+	// The positions come frame by frame, store them servo by servo
+	for(i = 0, j = 0; i < RCB4_ICS_QTY; i++)
+	{
+		if(!((mask >> i) & 1))
+			continue;
+		for(f = 0; f < frames; f++)
+			rcb4_motion_put16(buffer + h.pos_offset + ((size_t)j * h.pos_stride + f) * sizeof(uint16_t), positions[(size_t)f * RCB4_ICS_QTY + i]);
+		j++;
+	}
+	
+	h.checksum = rcb4_motion_fnv1a(buffer + sizeof(h), h.file_size - sizeof(h));
+	rcb4_motion_header_encode(&h, buffer);
+	
+	file = fopen(path, "wb");
+	if(!file)
+	{
+		fprintf(stderr, "Error creating the motion %s. (%s)\n", path, strerror(errno));
+		free(buffer);
+		return -1;
+	}
+	if(fwrite(buffer, 1, h.file_size, file) != h.file_size)
+	{
+		fprintf(stderr, "Error writing the motion %s.\n", path);
+		fclose(file);
+		free(buffer);
+		return -1;
+	}
+	
+	fclose(file);
+	free(buffer);
+	return 0;
+}
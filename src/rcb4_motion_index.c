@@ -0,0 +1,256 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_motion_index.c
+ * @brief Index of the motions stored in the ROM.
+ * 
+ * @details The motions of the robot live in fixed slots of the ROM. The index
+ * remembers which slots are used and their names in a hash table, so a motion
+ * is started with a single CALL and no lookups over the serial link.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_connection.h"
+#include "rcb4_motion_index.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+static
+uint32_t rcb4_motion_index_hash(const char* name)
+{
+	return (uint32_t)rcb4_util_hash(RCB4_HASH_INIT, name, strlen(name)) & RCB4_MOTION_HASH_MASK;
+}
+
+// Rebuilds the name table from the slots
+static
+void rcb4_motion_index_rehash(rcb4_motion_index* index)
+{
+	int i;
+	uint32_t h;
+	
+	for(h = 0; h < RCB4_MOTION_HASH_SIZE; h++)
+		index->table[h] = -1;
+	
+	for(i = 0; i < RCB4_MOTION_SLOTS; i++)
+	{
+		if(index->slot[i].name[0] == '\0')
+			continue;
+		for(h = rcb4_motion_index_hash(index->slot[i].name); index->table[h] >= 0; h = (h + 1) & RCB4_MOTION_HASH_MASK);
+		index->table[h] = i;
+	}
+}
+
+rcb4_motion_index* rcb4_motion_index_create(void)
+{
+	rcb4_motion_index* index;
+	
+	index = (rcb4_motion_index*)malloc(sizeof(rcb4_motion_index));
+	if(!index)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return NULL;
+	}
+	
+	memset(index->slot, 0, sizeof(index->slot));
+	rcb4_motion_index_rehash(index);
+	
+	return index;
+}
+
+void rcb4_motion_index_delete(rcb4_motion_index* index)
+{
+	if(!index)return;
+	
+	free(index);
+}
+
+int rcb4_motion_index_scan(rcb4_motion_index* index, rcb4_connection* conn)
+{
+	int i, j, err = 0, used = 0;
+	uint8_t probe[RCB4_MOTION_SLOTS][RCB4_MOTION_PROBE_SIZE];
+	
+	assert(index);
+	assert(conn);
+	
+	// Without a cache all the slots are probed in a single pipelined transfer
+	if(conn->rom_cache)
+	{
+		for(i = 0; i < RCB4_MOTION_SLOTS && err == 0; i++)
+			err = rcb4_rom_cache_read(conn->rom_cache, RCB4_MOTION_SLOT_ADDRESS(i), probe[i], RCB4_MOTION_PROBE_SIZE);
+	}
+	else
+		err = rcb4_rom_read_strided(conn, RCB4_MOTION_ROM_BASE, RCB4_MOTION_SLOT_SIZE, RCB4_MOTION_PROBE_SIZE, probe, RCB4_MOTION_SLOTS);
+	if(err != 0)
+	{
+		fprintf(stderr, "Error reading the motion slots.\n");
+		return err;
+	}
+	
+	for(i = 0; i < RCB4_MOTION_SLOTS; i++)
+	{
+		for(j = 0; j < RCB4_MOTION_PROBE_SIZE && probe[i][j] == 0xFF; j++); // Erased flash
+		index->slot[i].used = (j < RCB4_MOTION_PROBE_SIZE) || index->slot[i].name[0] != '\0';
+		used += index->slot[i].used;
+	}
+	
+	return used;
+}
+
+int rcb4_motion_index_set_name(rcb4_motion_index* index, uint8_t slot, const char* name)
+{
+	int old;
+	
+	assert(index);
+	
+	if(slot >= RCB4_MOTION_SLOTS)
+	{
+		fprintf(stderr, "Invalid motion slot. Allowed values: 0~%d\n", RCB4_MOTION_SLOTS - 1);
+		return -1;
+	}
+	if(name && strlen(name) >= RCB4_MOTION_NAME_MAX)
+	{
+		fprintf(stderr, "The motion name is too long. Maximum length: %d.\n", RCB4_MOTION_NAME_MAX - 1);
+		return -1;
+	}
+	
+	if(name && name[0] != '\0' && (old = rcb4_motion_index_find(index, name)) >= 0)
+		index->slot[old].name[0] = '\0';
+	
+	strcpy(index->slot[slot].name, name ? name : "");
+	index->slot[slot].used = (name != NULL);
+	rcb4_motion_index_rehash(index);
+	
+	return 0;
+}
+
+int rcb4_motion_index_find(const rcb4_motion_index* index, const char* name)
+{
+	uint32_t h;
+	
+	assert(index);
+	assert(name);
+	
+	for(h = rcb4_motion_index_hash(name); index->table[h] >= 0; h = (h + 1) & RCB4_MOTION_HASH_MASK)
+	{
+		if(strcmp(index->slot[index->table[h]].name, name) == 0)
+			return index->table[h];
+	}
+	
+	return -1;
+}
+
+int rcb4_motion_index_save(const rcb4_motion_index* index, const char* path)
+{
+	int i;
+	FILE* file;
+	
+	assert(index);
+	assert(path);
+	
+	file = fopen(path, "w");
+	if(!file)
+	{
+		fprintf(stderr, "Error creating %s. (%s)\n", path, strerror(errno));
+		return -1;
+	}
+	
+	fprintf(file, "# slot name\n");
+	for(i = 0; i < RCB4_MOTION_SLOTS; i++)
+	{
+		if(index->slot[i].used)
+			fprintf(file, "%d %s\n", i, index->slot[i].name[0] ? index->slot[i].name : "-");
+	}
+	
+	if(fclose(file) != 0)
+	{
+		fprintf(stderr, "Error writing %s. (%s)\n", path, strerror(errno));
+		return -1;
+	}
+	
+	return 0;
+}
+
+int rcb4_motion_index_load(rcb4_motion_index* index, const char* path)
+{
+	int slot, line = 0, err = 0;
+	FILE* file;
+	char buffer[128];
+	char name[RCB4_MOTION_NAME_MAX];
+	char format[16];
+	
+	assert(index);
+	assert(path);
+	
+	snprintf(format, sizeof(format), "%%d %%%ds", RCB4_MOTION_NAME_MAX - 1); // "%d %31s"
+	
+	file = fopen(path, "r");
+	if(!file)
+	{
+		fprintf(stderr, "Error opening %s. (%s)\n", path, strerror(errno));
+		return -1;
+	}
+	
+	while(err == 0 && fgets(buffer, sizeof(buffer), file))
+	{
+		line++;
+		if(buffer[0] == '#' || buffer[0] == '\n')
+			continue;
+		
+		if(sscanf(buffer, format, &slot, name) != 2 || slot < 0 || slot >= RCB4_MOTION_SLOTS)
+		{
+			fprintf(stderr, "%s:%d: Invalid motion slot.\n", path, line);
+			err = -1;
+		}
+		else
+			err = rcb4_motion_index_set_name(index, slot, strcmp(name, "-") == 0 ? "" : name);
+	}
+	
+	fclose(file);
+	return err;
+}
+
+int rcb4_play_motion(rcb4_connection* conn, const rcb4_motion_index* index, const char* name)
+{
+	int slot;
+	
+	assert(conn);
+	assert(index);
+	assert(name);
+	
+	slot = rcb4_motion_index_find(index, name);
+	if(slot < 0)
+	{
+		fprintf(stderr, "Unknown motion %s.\n", name);
+		return -1;
+	}
+	
+	return rcb4_call(conn, RCB4_MOTION_SLOT_ADDRESS(slot), RCB4_CONDITION_ALWAYS);
+}
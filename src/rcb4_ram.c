@@ -0,0 +1,185 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file rcb4_ram.c
+ * @brief Single frame updates of variables in the RAM of the robot.
+ * 
+ * @details Setting a flag or bumping a counter the usual way takes a read, a
+ * change in the host and a write, and the robot can change the variable in
+ * between. These functions let the robot do the change itself with one
+ * OR/AND/XOR/ADD/SHIFT command, which also replies with the new value.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_connection.h"
+#include "rcb4_command.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Sends comm and saves the reply (the new value) in result
+static
+int rcb4_ram_transact(rcb4_connection* conn, const rcb4_comm* comm, uint8_t size, uint32_t* result)
+{
+	int ret;
+	uint8_t reply[RCB4_RAM_VAR_MAX_SIZE];
+	
+	rcb4_conn_lock(conn);
+	ret = rcb4_conn_transact(conn, comm, reply);
+	rcb4_conn_unlock(conn);
+	if(ret != size)
+	{
+		fprintf(stderr, "Error sending the command.\n");
+		return -1;
+	}
+	
+	if(result)
+	{
+		*result = 0;
+		memcpy(result, reply, size); // TODO: Endian...
+	}
+	
+	return 0;
+}
+
+static
+int rcb4_ram_check(uint16_t addr, uint8_t size)
+{
+	if(size == 0 || size > RCB4_RAM_VAR_MAX_SIZE)
+	{
+		fprintf(stderr, "Invalid data size. Allowed values: 1~%d\n", RCB4_RAM_VAR_MAX_SIZE);
+		return -1;
+	}
+	if(addr + size - 1 > RCB4_MAX_RAM_ADDRESS)
+	{
+		fprintf(stderr, "Invalid RAM address. Allowed address: 0x0000~0x%04X\n", RCB4_MAX_RAM_ADDRESS);
+		return -1;
+	}
+	
+	return 0;
+}
+
+// (variable OP value) with value as a literal of the size of the variable
+static
+int rcb4_ram_literal_op(rcb4_connection* conn, uint8_t type, uint16_t addr, uint32_t value, uint8_t size, uint32_t* result)
+{
+	rcb4_comm comm;
+	
+	assert(conn);
+	
+	if(rcb4_ram_check(addr, size) != 0)
+		return -1;
+	
+	rcb4_command_recreate(&comm, type);
+	if(rcb4_command_set_src_literal(&comm, &value, size) != 0 || rcb4_command_set_dst_ram(&comm, addr) != 0) // TODO: Endian...
+	{
+		fprintf(stderr, "Error creating the command.\n");
+		return -1;
+	}
+	
+	return rcb4_ram_transact(conn, &comm, size, result);
+}
+
+int rcb4_ram_set_bits(rcb4_connection* conn, uint16_t addr, uint32_t mask, uint8_t size, uint32_t* result)
+{
+	return rcb4_ram_literal_op(conn, RCB4_COMM_OR, addr, mask, size, result);
+}
+
+int rcb4_ram_clear_bits(rcb4_connection* conn, uint16_t addr, uint32_t mask, uint8_t size, uint32_t* result)
+{
+	return rcb4_ram_literal_op(conn, RCB4_COMM_AND, addr, ~mask, size, result);
+}
+
+int rcb4_ram_toggle_bits(rcb4_connection* conn, uint16_t addr, uint32_t mask, uint8_t size, uint32_t* result)
+{
+	return rcb4_ram_literal_op(conn, RCB4_COMM_XOR, addr, mask, size, result);
+}
+
+int rcb4_ram_test_bits(rcb4_connection* conn, uint16_t addr, uint32_t mask, uint8_t size, uint32_t* result)
+{
+	rcb4_comm comm;
+	
+	assert(conn);
+	assert(result);
+	
+	if(rcb4_ram_check(addr, size) != 0)
+		return -1;
+	
+	// AND without saving: the variable doesn't change, the reply is (variable AND mask)
+	rcb4_command_recreate(&comm, RCB4_COMM_AND);
+	if(rcb4_command_set_src_literal(&comm, &mask, size) != 0 || // TODO: Endian...
+	   rcb4_command_set_dst_ram(&comm, addr) != 0 || rcb4_command_set_dst_do_not_save(&comm) != 0)
+	{
+		fprintf(stderr, "Error creating the command.\n");
+		return -1;
+	}
+	
+	return rcb4_ram_transact(conn, &comm, size, result);
+}
+
+int rcb4_ram_add(rcb4_connection* conn, uint16_t addr, int32_t value, uint8_t size, uint32_t* result)
+{
+	if(size != 1 && size != 2) // The robot only adds 8 and 16 bit variables
+	{
+		fprintf(stderr, "Invalid data size. Allowed values: 1~2\n");
+		return -1;
+	}
+	
+	return rcb4_ram_literal_op(conn, RCB4_COMM_ADD, addr, (uint32_t)value, size, result);
+}
+
+int rcb4_ram_shift(rcb4_connection* conn, uint16_t addr, int8_t shifts, uint8_t size, uint32_t* result)
+{
+	rcb4_comm comm;
+	int err;
+	
+	assert(conn);
+	
+	if(rcb4_ram_check(addr, size) != 0)
+		return -1;
+	if(shifts < -127)
+	{
+		fprintf(stderr, "Invalid parameter value. Allowed values [-127~127].\n");
+		return -1;
+	}
+	
+	rcb4_command_recreate(&comm, RCB4_COMM_SHIFT);
+	if(shifts >= 0)
+		err = rcb4_command_set_shift_left(&comm, (uint8_t)shifts);
+	else
+		err = rcb4_command_set_shift_right(&comm, (uint8_t)(-shifts));
+	if(err != 0 || rcb4_command_set_dst_ram(&comm, addr) != 0 || rcb4_command_set_data_size(&comm, size) != 0)
+	{
+		fprintf(stderr, "Error creating the command.\n");
+		return -1;
+	}
+	
+	return rcb4_ram_transact(conn, &comm, size, result);
+}
@@ -0,0 +1,698 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file rcb4_reactor.c
+ * @brief Drives many robots from a single thread.
+ * 
+ * @details Instead of one blocking thread per connection, the reactor sends
+ * the requests of every robot and waits for all the replies at the same time
+ * with epoll. Nothing sleeps a fixed delay: a transaction is done as soon as
+ * its reply is complete, or when its deadline in the timer wheel expires.
+ * 
+ * The io_uring backend does the same without any read(), write() or
+ * epoll_wait() per transaction: the operations of all the robots are queued
+ * and handed to the kernel with a single system call per iteration.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_connection.h"
+#include "rcb4_command.h"
+#include "rcb4_rom_cache.h"
+#include "rcb4_reactor.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#define RCB4_REACTOR_EVENTS 16 // Per epoll_wait()
+
+static void rcb4_reactor_start(rcb4_reactor* reactor, struct s_rcb4_reactor_robot* robot);
+static void rcb4_reactor_uring_drain(rcb4_reactor* reactor);
+static void rcb4_reactor_hangup(rcb4_reactor* reactor, struct s_rcb4_reactor_robot* robot);
+
+rcb4_reactor* rcb4_reactor_create(void)
+{
+	return rcb4_reactor_create_backend(RCB4_REACTOR_EPOLL);
+}
+
+rcb4_reactor* rcb4_reactor_create_backend(uint8_t backend)
+{
+	rcb4_reactor* reactor;
+	
+	if(backend != RCB4_REACTOR_EPOLL && backend != RCB4_REACTOR_URING)
+	{
+		fprintf(stderr, "Invalid backend.\n");
+		return NULL;
+	}
+	
+	reactor = (rcb4_reactor*)malloc(sizeof(rcb4_reactor));
+	if(!reactor)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return NULL;
+	}
+	
+	memset(reactor, 0, sizeof(rcb4_reactor));
+	reactor->backend = backend;
+	reactor->epfd = -1;
+	reactor->uring.fd = -1;
+	if(backend == RCB4_REACTOR_URING)
+	{
+		if(rcb4_uring_init(&reactor->uring, RCB4_REACTOR_URING_ENTRIES) != 0)
+		{
+			free(reactor);
+			return NULL;
+		}
+	}
+	else
+	{
+		reactor->epfd = epoll_create1(EPOLL_CLOEXEC);
+		if(reactor->epfd < 0)
+		{
+			fprintf(stderr, "Error creating the epoll instance.\n");
+			free(reactor);
+			return NULL;
+		}
+	}
+	reactor->start = rcb4_util_time_ns();
+	
+	return reactor;
+}
+
+void rcb4_reactor_delete(rcb4_reactor* reactor)
+{
+	int i;
+	
+	if(!reactor)return;
+	
+	if(reactor->backend == RCB4_REACTOR_URING) // The kernel must be done with our buffers before freeing them
+	{
+		rcb4_reactor_uring_drain(reactor);
+		rcb4_uring_exit(&reactor->uring);
+	}
+	
+	for(i = 0; i < reactor->robots; i++)
+	{
+		if(reactor->robot[i]->busy) // A reply may still arrive, don't let it confuse the next command
+			rcb4_conn_flush(reactor->robot[i]->conn);
+		fcntl(reactor->robot[i]->conn->transport.fd, F_SETFL, reactor->robot[i]->fd_flags);
+		free(reactor->robot[i]);
+	}
+	if(reactor->epfd >= 0)
+		close(reactor->epfd);
+	free(reactor);
+}
+
+static
+uint64_t rcb4_reactor_now(const rcb4_reactor* reactor)
+{
+	return (rcb4_util_time_ns() - reactor->start) / RCB4_REACTOR_TICK_NS;
+}
+
+static
+void rcb4_reactor_timer_add(rcb4_reactor* reactor, struct s_rcb4_reactor_robot* robot, uint64_t expires)
+{
+	struct s_rcb4_reactor_robot** slot = &reactor->wheel[expires % RCB4_REACTOR_WHEEL_SLOTS];
+	
+	robot->expires = expires;
+	robot->timer_next = *slot;
+	if(*slot)
+		(*slot)->timer_pprev = &robot->timer_next;
+	robot->timer_pprev = slot;
+	*slot = robot;
+	reactor->timers++;
+}
+
+static
+void rcb4_reactor_timer_del(rcb4_reactor* reactor, struct s_rcb4_reactor_robot* robot)
+{
+	if(!robot->timer_pprev)
+		return;
+	
+	*robot->timer_pprev = robot->timer_next;
+	if(robot->timer_next)
+		robot->timer_next->timer_pprev = robot->timer_pprev;
+	robot->timer_pprev = NULL;
+	robot->timer_next = NULL;
+	reactor->timers--;
+}
+
+int rcb4_reactor_add(rcb4_reactor* reactor, rcb4_connection* conn)
+{
+	struct s_rcb4_reactor_robot* robot;
+	struct epoll_event ev;
+	
+	assert(reactor);
+	assert(conn);
+	
+	if(reactor->robots >= RCB4_REACTOR_MAX_ROBOTS)
+	{
+		fprintf(stderr, "Too many robots. Maximum: %d.\n", RCB4_REACTOR_MAX_ROBOTS);
+		return -1;
+	}
+	if(!(rcb4_get_capabilities(conn) & RCB4_TRANSPORT_POLLABLE))
+	{
+		fprintf(stderr, "The transport of the connection has no file descriptor.\n");
+		return -1;
+	}
+	
+	robot = (struct s_rcb4_reactor_robot*)malloc(sizeof(struct s_rcb4_reactor_robot));
+	if(!robot)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return -1;
+	}
+	memset(robot, 0, sizeof(struct s_rcb4_reactor_robot));
+	robot->conn = conn;
+	robot->id = reactor->robots;
+	
+	// Gets the read left by rcb4_exchange() out of the way, if any
+	rcb4_conn_lock(conn);
+	rcb4_conn_unlock(conn);
+	
+	robot->fd_flags = fcntl(conn->transport.fd, F_GETFL);
+	if(robot->fd_flags < 0)
+	{
+		fprintf(stderr, "Error configuring the terminal.\n");
+		free(robot);
+		return -1;
+	}
+	if(reactor->backend == RCB4_REACTOR_URING) // Blocking: io_uring returns EAGAIN instead of waiting on O_NONBLOCK files
+	{
+		reactor->robot[reactor->robots++] = robot;
+		return robot->id;
+	}
+	
+	if(fcntl(conn->transport.fd, F_SETFL, robot->fd_flags | O_NONBLOCK) != 0)
+	{
+		fprintf(stderr, "Error configuring the terminal.\n");
+		free(robot);
+		return -1;
+	}
+	
+	ev.events = EPOLLIN;
+	ev.data.ptr = robot;
+	if(epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, conn->transport.fd, &ev) != 0)
+	{
+		fprintf(stderr, "Error adding the connection to the epoll instance.\n");
+		fcntl(conn->transport.fd, F_SETFL, robot->fd_flags);
+		free(robot);
+		return -1;
+	}
+	
+	reactor->robot[reactor->robots++] = robot;
+	return robot->id;
+}
+
+int rcb4_reactor_submit(rcb4_reactor* reactor, int robot_id, const rcb4_comm* comm, rcb4_reactor_done done, void* data)
+{
+	struct s_rcb4_reactor_robot* robot;
+	struct s_rcb4_reactor_request* req;
+	
+	assert(reactor);
+	assert(comm);
+	
+	if(robot_id < 0 || robot_id >= reactor->robots)
+	{
+		fprintf(stderr, "Invalid robot. Allowed values: 0~%d\n", reactor->robots - 1);
+		return -1;
+	}
+	robot = reactor->robot[robot_id];
+	if(robot->count >= RCB4_REACTOR_QUEUE_SIZE)
+	{
+		fprintf(stderr, "The queue of the robot %d is full.\n", robot_id);
+		return -1;
+	}
+	
+	req = &robot->queue[(robot->head + robot->count) % RCB4_REACTOR_QUEUE_SIZE];
+	req->length = rcb4_command_encode(comm, req->frame);
+	req->type = comm->type;
+	req->ret_size = rcb4_command_get_response_size(comm);
+	req->done = done;
+	req->data = data;
+	robot->count++;
+	reactor->pending++;
+	
+	// Sent now or later, the ROM may be written
+	if(robot->conn->rom_cache)
+		rcb4_rom_cache_command(robot->conn->rom_cache, comm);
+	
+	rcb4_reactor_start(reactor, robot);
+	return 0;
+}
+
+// Pops the request at the head of the queue, tells the user and sends the next one
+static
+void rcb4_reactor_complete(rcb4_reactor* reactor, struct s_rcb4_reactor_robot* robot, int result, const uint8_t* reply)
+{
+	struct s_rcb4_reactor_request* req = &robot->queue[robot->head];
+	rcb4_reactor_done done = req->done;
+	void* data = req->data;
+	
+	rcb4_reactor_timer_del(reactor, robot);
+	if(result < 0) // Whatever arrives later would be taken as the next reply
+		rcb4_conn_flush(robot->conn);
+	
+	robot->head = (robot->head + 1) % RCB4_REACTOR_QUEUE_SIZE;
+	robot->count--;
+	robot->busy = 0;
+	reactor->pending--;
+	reactor->completed++;
+	
+	if(done) // Can submit more requests
+		done(reactor, robot->id, result, reply, data);
+	
+	rcb4_reactor_start(reactor, robot);
+}
+
+// Queues READ -> LINK_TIMEOUT for the rest of the reply, with the time left
+static
+int rcb4_reactor_uring_read(rcb4_reactor* reactor, struct s_rcb4_reactor_robot* robot)
+{
+	struct io_uring_sqe* sqe;
+	uint64_t now, left = 0;
+	
+	if(rcb4_uring_reserve(&reactor->uring, 2) != 0)
+		return -1;
+	
+	now = rcb4_util_time_ns();
+	if(robot->deadline > now)
+		left = robot->deadline - now;
+	robot->timeout.tv_sec = left / 1000000000ULL;
+	robot->timeout.tv_nsec = left % 1000000000ULL;
+	
+	sqe = rcb4_uring_get_sqe(&reactor->uring);
+	sqe->opcode = IORING_OP_READ;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->fd = robot->conn->transport.fd;
+	sqe->off = (uint64_t)-1; // A tty has no position
+	sqe->addr = (uintptr_t)(robot->rx + robot->received);
+	sqe->len = robot->expected - robot->received;
+	sqe->user_data = (uintptr_t)robot | RCB4_URING_OP_READ;
+	
+	sqe = rcb4_uring_get_sqe(&reactor->uring);
+	sqe->opcode = IORING_OP_LINK_TIMEOUT;
+	sqe->addr = (uintptr_t)&robot->timeout;
+	sqe->len = 1;
+	sqe->user_data = (uintptr_t)robot | RCB4_URING_OP_TIMEOUT;
+	
+	robot->inflight += 2;
+	return 0;
+}
+
+// Queues WRITE -> READ -> LINK_TIMEOUT for the request at the head of the queue
+static
+int rcb4_reactor_uring_start(rcb4_reactor* reactor, struct s_rcb4_reactor_robot* robot)
+{
+	struct io_uring_sqe* sqe;
+	struct s_rcb4_reactor_request* req = &robot->queue[robot->head];
+	
+	if(rcb4_uring_reserve(&reactor->uring, 3) != 0)
+	{
+		fprintf(stderr, "Error sending the command. The io_uring queue is full.\n");
+		return -1;
+	}
+	
+	robot->failed = 0;
+	robot->deadline = rcb4_util_time_ns() + COMM_TIMEOUT_USECS * 1000ULL;
+	
+	sqe = rcb4_uring_get_sqe(&reactor->uring);
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->fd = robot->conn->transport.fd;
+	sqe->off = (uint64_t)-1;
+	sqe->addr = (uintptr_t)req->frame;
+	sqe->len = req->length;
+	sqe->user_data = (uintptr_t)robot | RCB4_URING_OP_WRITE;
+	robot->inflight++;
+	
+	return rcb4_reactor_uring_read(reactor, robot);
+}
+
+// Sends the request at the head of the queue if the robot is idle
+static
+void rcb4_reactor_start(rcb4_reactor* reactor, struct s_rcb4_reactor_robot* robot)
+{
+	struct s_rcb4_reactor_request* req;
+	
+	if(robot->busy || robot->count == 0)
+		return;
+	
+	req = &robot->queue[robot->head];
+	robot->busy = 1;
+	if(robot->broken)
+	{
+		rcb4_reactor_complete(reactor, robot, -1, NULL);
+		return;
+	}
+	
+	robot->received = 0;
+	robot->expected = (req->ret_size == 0) ? 4 : req->ret_size + 3;
+	
+	if(reactor->backend == RCB4_REACTOR_URING)
+	{
+		if(rcb4_reactor_uring_start(reactor, robot) != 0)
+			rcb4_reactor_complete(reactor, robot, -1, NULL);
+		return;
+	}
+	
+	if(write(robot->conn->transport.fd, req->frame, req->length) != req->length)
+	{
+		if(errno == EIO) // Unplugged, before epoll told us
+		{
+			rcb4_reactor_hangup(reactor, robot);
+			return;
+		}
+		fprintf(stderr, "Error sending the command. Write error.\n");
+		rcb4_reactor_complete(reactor, robot, -1, NULL);
+		return;
+	}
+	
+	rcb4_reactor_timer_add(reactor, robot, rcb4_reactor_now(reactor) + RCB4_REACTOR_TIMEOUT_TICKS + 1);
+}
+
+// The robot is gone: out of the epoll instance (or it would wake us up forever) and fail whatever it had
+static
+void rcb4_reactor_hangup(rcb4_reactor* reactor, struct s_rcb4_reactor_robot* robot)
+{
+	fprintf(stderr, "Error reading the reply of the robot %d. The connection is broken.\n", robot->id);
+	if(reactor->backend == RCB4_REACTOR_EPOLL)
+		epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, robot->conn->transport.fd, NULL);
+	robot->broken = 1;
+	if(robot->busy) // The rest of the queue is failed as it is started
+		rcb4_reactor_complete(reactor, robot, -1, NULL);
+}
+
+static
+void rcb4_reactor_readable(rcb4_reactor* reactor, struct s_rcb4_reactor_robot* robot)
+{
+	int err;
+	uint8_t reply[RCB4_COMM_MESSAGE_SIZE_ALLOWED];
+	struct s_rcb4_reactor_request* req;
+	
+	if(!robot->busy) // Nobody asked for this
+	{
+		while((err = read(robot->conn->transport.fd, reply, sizeof(reply))) > 0);
+		if(err == 0 || (errno != EAGAIN && errno != EINTR))
+			rcb4_reactor_hangup(reactor, robot);
+		return;
+	}
+	
+	err = read(robot->conn->transport.fd, robot->rx + robot->received, robot->expected - robot->received);
+	if(err < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if(err <= 0) // EOF or EIO: unplugged or hung up
+	{
+		rcb4_reactor_hangup(reactor, robot);
+		return;
+	}
+	
+	robot->received += err;
+	if(robot->received < robot->expected) // The reply can arrive split in several chunks
+		return;
+	
+	req = &robot->queue[robot->head];
+	err = rcb4_conn_check_reply(robot->rx, req->type, req->ret_size, reply);
+	rcb4_reactor_complete(reactor, robot, err, (err > 0) ? reply : NULL);
+}
+
+// Fails every request whose deadline is before now
+static
+void rcb4_reactor_expire(rcb4_reactor* reactor, uint64_t now)
+{
+	uint64_t i, ticks;
+	struct s_rcb4_reactor_robot *robot, *next, *expired = NULL;
+	
+	if(now < reactor->tick)
+		return;
+	
+	// If we haven't been called for more than a lap every slot is checked once
+	ticks = now - reactor->tick + 1;
+	if(ticks > RCB4_REACTOR_WHEEL_SLOTS)
+		ticks = RCB4_REACTOR_WHEEL_SLOTS;
+	
+	// Collect them first, the callbacks can add timers to the wheel
+	for(i = 0; i < ticks; i++)
+	{
+		for(robot = reactor->wheel[(reactor->tick + i) % RCB4_REACTOR_WHEEL_SLOTS]; robot; robot = next)
+		{
+			next = robot->timer_next;
+			if(robot->expires > now) // Next lap
+				continue;
+			rcb4_reactor_timer_del(reactor, robot);
+			robot->timer_next = expired;
+			expired = robot;
+		}
+	}
+	reactor->tick = now + 1;
+	
+	for(robot = expired; robot; robot = next)
+	{
+		next = robot->timer_next;
+		robot->timer_next = NULL;
+		fprintf(stderr, "Error sending the command to the robot %d. Timed out.\n", robot->id);
+		rcb4_reactor_complete(reactor, robot, -10, NULL);
+	}
+}
+
+// Milliseconds until the next slot of the wheel with a deadline, -1 if none
+static
+int rcb4_reactor_next_timeout(const rcb4_reactor* reactor, uint64_t now)
+{
+	uint64_t i;
+	
+	if(reactor->timers == 0)
+		return -1;
+	
+	for(i = 0; i < RCB4_REACTOR_WHEEL_SLOTS; i++)
+	{
+		if(reactor->wheel[(reactor->tick + i) % RCB4_REACTOR_WHEEL_SLOTS])
+			break;
+	}
+	if(reactor->tick + i <= now)
+		return 0;
+	
+	return (int)((reactor->tick + i - now) * RCB4_REACTOR_TICK_NS / 1000000ULL);
+}
+
+// One operation of a chain is done. The chain is done when all of them are
+static
+void rcb4_reactor_uring_complete(rcb4_reactor* reactor, uint64_t user_data, int res)
+{
+	int err;
+	uint8_t reply[RCB4_COMM_MESSAGE_SIZE_ALLOWED];
+	struct s_rcb4_reactor_robot* robot = (struct s_rcb4_reactor_robot*)(uintptr_t)(user_data & ~(uint64_t)RCB4_URING_OP_MASK);
+	struct s_rcb4_reactor_request* req = &robot->queue[robot->head];
+	
+	robot->inflight--;
+	switch(user_data & RCB4_URING_OP_MASK)
+	{
+		case RCB4_URING_OP_WRITE:
+			if(res == -EIO) // Unplugged
+				robot->failed = RCB4_URING_HANGUP;
+			else if(res != req->length && robot->failed == 0)
+			{
+				fprintf(stderr, "Error sending the command. Write error.\n");
+				robot->failed = -1;
+			}
+			break;
+		case RCB4_URING_OP_READ:
+			if(res > 0)
+				robot->received += res;
+			else if(res == 0 || res == -EIO) // EOF or EIO: unplugged or hung up
+				robot->failed = RCB4_URING_HANGUP;
+			else if((res == -ECANCELED || res == -EINTR) && robot->failed == 0) // By the timeout
+				robot->failed = -10;
+			else if(robot->failed == 0)
+				robot->failed = -1;
+			break;
+		case RCB4_URING_OP_TIMEOUT: // -ETIME if it expired, -ECANCELED if the read won
+		default:
+			break;
+	}
+	if(robot->inflight > 0)
+		return;
+	
+	if(robot->failed == 0 && robot->received < robot->expected) // Split reply, wait for the rest
+	{
+		if(rcb4_util_time_ns() >= robot->deadline)
+			robot->failed = -10;
+		else if(rcb4_reactor_uring_read(reactor, robot) == 0)
+			return;
+		else
+			robot->failed = -1;
+	}
+	
+	if(robot->failed == RCB4_URING_HANGUP) // Fails the rest of the queue without writing to the device
+	{
+		rcb4_reactor_hangup(reactor, robot);
+		return;
+	}
+	if(robot->failed != 0)
+	{
+		if(robot->failed == -10)
+			fprintf(stderr, "Error sending the command to the robot %d. Timed out.\n", robot->id);
+		rcb4_reactor_complete(reactor, robot, robot->failed, NULL);
+		return;
+	}
+	
+	err = rcb4_conn_check_reply(robot->rx, req->type, req->ret_size, reply);
+	rcb4_reactor_complete(reactor, robot, err, (err > 0) ? reply : NULL);
+}
+
+static
+int rcb4_reactor_uring_run(rcb4_reactor* reactor, int timeout_ms)
+{
+	struct io_uring_sqe* sqe;
+	struct io_uring_cqe* cqe;
+	uint64_t user_data;
+	int res;
+	
+	// Wakes us up after timeout_ms, or as soon as anything else completes (off = 1)
+	if(timeout_ms > 0 && (sqe = rcb4_uring_get_sqe(&reactor->uring)) != NULL)
+	{
+		reactor->wait.tv_sec = timeout_ms / 1000;
+		reactor->wait.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+		sqe->opcode = IORING_OP_TIMEOUT;
+		sqe->addr = (uintptr_t)&reactor->wait;
+		sqe->len = 1;
+		sqe->off = 1;
+		sqe->user_data = 0;
+	}
+	
+	// Submits what was queued since the last call (new requests and what the
+	// callbacks queued) and waits, in the same system call
+	if(rcb4_uring_enter(&reactor->uring, (timeout_ms == 0) ? 0 : 1) != 0)
+		return -1;
+	
+	while((cqe = rcb4_uring_peek(&reactor->uring)) != NULL)
+	{
+		user_data = cqe->user_data;
+		res = cqe->res;
+		rcb4_uring_seen(&reactor->uring); // Before the callbacks, they can queue more
+		if(user_data != 0)
+			rcb4_reactor_uring_complete(reactor, user_data, res);
+	}
+	
+	return 0;
+}
+
+// Cancels everything on the wire and waits for the kernel to let go of the buffers
+static
+void rcb4_reactor_uring_drain(rcb4_reactor* reactor)
+{
+	int i, inflight;
+	struct io_uring_sqe* sqe;
+	struct io_uring_cqe* cqe;
+	struct s_rcb4_reactor_robot* robot;
+	
+	for(i = 0, inflight = 0; i < reactor->robots; i++)
+	{
+		robot = reactor->robot[i];
+		if(robot->inflight > 0 && rcb4_uring_reserve(&reactor->uring, 2) == 0)
+		{
+			sqe = rcb4_uring_get_sqe(&reactor->uring);
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->addr = (uintptr_t)robot | RCB4_URING_OP_WRITE;
+			sqe->user_data = 0;
+			sqe = rcb4_uring_get_sqe(&reactor->uring);
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->addr = (uintptr_t)robot | RCB4_URING_OP_READ; // The timeout goes with it
+			sqe->user_data = 0;
+		}
+		inflight += robot->inflight;
+	}
+	
+	while(inflight > 0 && rcb4_uring_enter(&reactor->uring, 1) == 0)
+	{
+		while((cqe = rcb4_uring_peek(&reactor->uring)) != NULL)
+		{
+			if(cqe->user_data != 0)
+			{
+				robot = (struct s_rcb4_reactor_robot*)(uintptr_t)(cqe->user_data & ~(uint64_t)RCB4_URING_OP_MASK);
+				robot->inflight--;
+				inflight--;
+			}
+			rcb4_uring_seen(&reactor->uring);
+		}
+	}
+}
+
+int rcb4_reactor_run(rcb4_reactor* reactor, int timeout_ms)
+{
+	int i, n, wait;
+	struct epoll_event ev[RCB4_REACTOR_EVENTS];
+	struct s_rcb4_reactor_robot* robot;
+	
+	assert(reactor);
+	
+	reactor->completed = 0;
+	if(reactor->pending == 0 && timeout_ms < 0) // Nothing would ever wake us up
+		return 0;
+	
+	if(reactor->backend == RCB4_REACTOR_URING)
+		return (rcb4_reactor_uring_run(reactor, timeout_ms) == 0) ? reactor->completed : -1;
+	
+	wait = rcb4_reactor_next_timeout(reactor, rcb4_reactor_now(reactor));
+	if(timeout_ms >= 0 && (wait < 0 || timeout_ms < wait))
+		wait = timeout_ms;
+	
+	n = epoll_wait(reactor->epfd, ev, RCB4_REACTOR_EVENTS, wait);
+	if(n < 0 && errno != EINTR)
+	{
+		fprintf(stderr, "Error waiting for the robots. epoll_wait failed.\n");
+		return -1;
+	}
+	
+	for(i = 0; i < n; i++)
+	{
+		robot = (struct s_rcb4_reactor_robot*)ev[i].data.ptr;
+		if(robot->broken) // Hung up by an earlier event of this same batch
+			continue;
+		if(ev[i].events & (EPOLLERR | EPOLLHUP)) // Comes with EPOLLIN when a tty is unplugged
+			rcb4_reactor_hangup(reactor, robot);
+		else if(ev[i].events & EPOLLIN)
+			rcb4_reactor_readable(reactor, robot);
+	}
+	
+	rcb4_reactor_expire(reactor, rcb4_reactor_now(reactor));
+	
+	return reactor->completed;
+}
+
+int rcb4_reactor_pending(const rcb4_reactor* reactor)
+{
+	assert(reactor);
+	
+	return reactor->pending;
+}
@@ -0,0 +1,215 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file rcb4_reconnect.c
+ * @brief Automatic reconnection when the device is lost.
+ * 
+ * @details If the transport fails (for example the USB adapter is unplugged
+ * or glitches) these functions reopen the same device, set the speed that was
+ * found when it was first opened without probing again, and send a list of
+ * commands registered by the user to bring the robot back to its state. The
+ * rcb4_connection pointer stays valid all the time.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_connection.h"
+#include "rcb4_command.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int rcb4_reconnect_enable(rcb4_connection* conn, uint32_t timeout_ms, uint32_t flags)
+{
+	assert(conn);
+	
+	rcb4_conn_lock(conn);
+	conn->reconnect_ms = timeout_ms;
+	conn->reconnect_flags = flags;
+	if(!(flags & RCB4_RECONNECT_LAST_POSE))
+		conn->last_pose_size = 0;
+	rcb4_conn_unlock(conn);
+	
+	return 0;
+}
+
+int rcb4_restore_add(rcb4_connection* conn, const rcb4_comm* comm)
+{
+	assert(conn);
+	assert(comm);
+	
+	rcb4_conn_lock(conn);
+	if(conn->restores >= RCB4_RESTORE_MAX)
+	{
+		rcb4_conn_unlock(conn);
+		fprintf(stderr, "Too many restore commands. Maximum: %d.\n", RCB4_RESTORE_MAX);
+		return -1;
+	}
+	memcpy(&conn->restore[conn->restores++], comm, sizeof(rcb4_comm));
+	rcb4_conn_unlock(conn);
+	
+	return 0;
+}
+
+void rcb4_restore_clear(rcb4_connection* conn)
+{
+	assert(conn);
+	
+	rcb4_conn_lock(conn);
+	conn->restores = 0;
+	rcb4_conn_unlock(conn);
+}
+
+uint32_t rcb4_get_reconnects(const rcb4_connection* conn)
+{
+	assert(conn);
+	
+	return __atomic_load_n(&conn->reconnects, __ATOMIC_RELAXED);
+}
+
+// Called with the lock held for every write, only if RCB4_RECONNECT_LAST_POSE
+void rcb4_conn_record(rcb4_connection* conn, const uint8_t* buffer, uint16_t length)
+{
+	uint16_t i;
+	
+	if(conn->recovering) // Sending the last pose itself
+		return;
+	
+	// The buffer may have several frames (rcb4_exchange(), the server...)
+	for(i = 0; i + 1 < length && buffer[i] >= 3 && i + buffer[i] <= length; i += buffer[i])
+	{
+		if(buffer[i + 1] == RCB4_COMM_CONST || buffer[i + 1] == RCB4_COMM_SERIES)
+		{
+			memcpy(conn->last_pose, buffer + i, buffer[i]);
+			conn->last_pose_size = buffer[i];
+		}
+	}
+}
+
+// Brings a device that has just been opened back to the state it had
+static
+int rcb4_conn_resume(rcb4_connection* conn)
+{
+	int i;
+	float error;
+	uint8_t lbuf[4];
+	
+	// The speed found by rcb4_open(), no need to probe
+	if(conn->fast >= 0 && (conn->transport.ops->caps & RCB4_TRANSPORT_SPEED) &&
+	   conn->transport.ops->set_speed(&conn->transport, conn->fast, &error) < 0)
+		return -1;
+	
+	// The first frame after a change of speed is sometimes lost
+	if(rcb4_command_ping_locked(conn) != 0)
+	{
+		rcb4_conn_flush(conn);
+		if(rcb4_command_ping_locked(conn) != 0)
+			return -1;
+	}
+	
+	for(i = 0; i < conn->restores; i++)
+		if(rcb4_conn_transact(conn, &conn->restore[i], NULL) < 0)
+			return -1;
+	
+	if((conn->reconnect_flags & RCB4_RECONNECT_LAST_POSE) && conn->last_pose_size > 0)
+	{
+		if(rcb4_conn_write(conn, conn->last_pose, conn->last_pose_size) != 0 ||
+		   rcb4_conn_read(conn, lbuf, 4, COMM_TIMEOUT_USECS) != 4 ||
+		   rcb4_conn_check_reply(lbuf, conn->last_pose[1], 0, NULL) != 0)
+			return -1;
+	}
+	
+	return 0;
+}
+
+/* Reopens the device until it works or timeout_ms runs out (0 = a single
+ * attempt). The lock must be held. Returns 0 if the device is back. */
+int rcb4_conn_recover(rcb4_connection* conn, uint32_t timeout_ms)
+{
+	const struct s_rcb4_transport_ops* ops = conn->transport.ops;
+	uint64_t start, deadline;
+	int err = -1;
+	
+	if(conn->recovering || conn->reconnect_ms == 0)
+		return -1;
+	conn->recovering = 1;
+	
+	if(conn->link == RCB4_LINK_LOST)
+	{
+		ops->close(&conn->transport);
+		conn->link = RCB4_LINK_CLOSED;
+	}
+	conn->prefetch_state = RCB4_PREFETCH_NONE; // Whatever was on the wire is gone
+	
+	start = rcb4_util_time_ns();
+	deadline = start + (uint64_t)timeout_ms * 1000000;
+	for(;;)
+	{
+		// Until the device is back open() would only fail (and complain)
+		if((conn->path[0] == '\0' || access(conn->path, F_OK) == 0) && ops->open(&conn->transport, conn->path) == 0)
+		{
+			conn->link = RCB4_LINK_UP;
+			if(rcb4_conn_resume(conn) == 0)
+			{
+				err = 0;
+				break;
+			}
+			ops->close(&conn->transport);
+			conn->link = RCB4_LINK_CLOSED;
+		}
+		
+		if(rcb4_util_time_ns() >= deadline)
+			break;
+		rcb4_util_usleep(RCB4_RECONNECT_POLL_USECS);
+	}
+	
+	conn->recovering = 0;
+	if(err == 0)
+	{
+		__atomic_add_fetch(&conn->reconnects, 1, __ATOMIC_RELAXED);
+		fprintf(stderr, "Reconnected to %s in %d ms.\n", conn->path, (int)((rcb4_util_time_ns() - start) / 1000000));
+	}
+	return err;
+}
+
+// The transport failed while writing or reading (not a timeout: the device itself is gone)
+void rcb4_conn_lost(rcb4_connection* conn)
+{
+	if(conn->reconnect_ms == 0 || conn->link != RCB4_LINK_UP)
+		return;
+	
+	conn->link = RCB4_LINK_LOST;
+	if(conn->recovering) // rcb4_conn_recover() will try again
+		return;
+	
+	fprintf(stderr, "Connection lost. Reconnecting to %s...\n", conn->path);
+	if(rcb4_conn_recover(conn, conn->reconnect_ms) != 0)
+		fprintf(stderr, "Reconnection failed. Trying again on the next command.\n");
+}
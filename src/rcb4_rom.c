@@ -0,0 +1,244 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_rom.c
+ * @brief Bulk transfers to and from the ROM of the robot.
+ * 
+ * @details Big buffers are split in the biggest chunks the protocol allows
+ * (literals for writing, COM replies for reading) and several commands are sent
+ * before waiting for the first reply, so the link is never idle waiting for an
+ * ACK.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_connection.h"
+#include "rcb4_command.h"
+#include "rcb4_rom_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define RCB4_ROM_WRITE_CHUNK (COMM_LITERAL_MAX_LEN - 1) // Biggest literal
+#define RCB4_ROM_READ_CHUNK (RCB4_COMM_MESSAGE_SIZE_ALLOWED - 3) // Biggest reply: SIZE, CMD, DATA..., SUM
+
+int rcb4_rom_set_pipeline(rcb4_connection* conn, uint8_t depth)
+{
+	assert(conn);
+	
+	if(depth == 0 || depth > RCB4_ROM_MAX_DEPTH)
+	{
+		fprintf(stderr, "Invalid pipeline depth. Allowed values: 1~%d\n", RCB4_ROM_MAX_DEPTH);
+		return -1;
+	}
+	
+	conn->rom_depth = depth;
+	return 0;
+}
+
+static
+int rcb4_rom_check_range(uint32_t addr, uint32_t len)
+{
+	if(len == 0 || addr > RCB4_MAX_ROM_ADDRESS || len - 1 > RCB4_MAX_ROM_ADDRESS - addr)
+	{
+		fprintf(stderr, "Invalid ROM range. Allowed address: 0x000000~0x%06X\n", RCB4_MAX_ROM_ADDRESS);
+		return -1;
+	}
+	return 0;
+}
+
+// ROM address of the byte offset of a transfer made of pieces stride bytes apart
+static inline
+uint32_t rcb4_rom_address(uint32_t addr, uint32_t stride, uint32_t piece, uint32_t offset)
+{
+	return addr + (offset / piece) * stride + offset % piece;
+}
+
+/* Writes src to ROM (if src != NULL) or reads the ROM into dst (if dst != NULL)
+ * and/or hashes it (if hash != NULL). The ROM side is made of pieces of piece
+ * bytes every stride bytes (piece = len for a contiguous region); the buffers
+ * are contiguous. Up to conn->rom_depth commands are on the wire at the same
+ * time; the robot answers them in order. */
+static
+int rcb4_rom_transfer(rcb4_connection* conn, uint32_t addr, uint32_t stride, uint32_t piece, const uint8_t* src, uint8_t* dst, uint32_t len, uint64_t* hash)
+{
+	int err = 0;
+	uint8_t n, expected, length;
+	uint8_t lbuf[RCB4_COMM_MESSAGE_SIZE_ALLOWED];
+	uint8_t command[RCB4_COMM_MESSAGE_SIZE_ALLOWED];
+	uint8_t size[RCB4_ROM_MAX_DEPTH]; // Sizes of the chunks on the wire
+	uint32_t sent = 0, received = 0, queued = 0, head = 0;
+	uint32_t chunk = src ? RCB4_ROM_WRITE_CHUNK : RCB4_ROM_READ_CHUNK;
+	rcb4_comm comm;
+	
+	rcb4_conn_lock(conn);
+	while(received < len && err == 0)
+	{
+		// Background transfer and a real-time thread waiting? Let it in between two chunks
+		if(queued == 0 && rcb4_conn_preempted(conn))
+		{
+			rcb4_conn_unlock(conn);
+			rcb4_conn_lock(conn);
+		}
+		
+		// Fill the pipeline. Stop early if somebody is waiting, the chunks on the wire will be the delay
+		while(sent < len && queued < conn->rom_depth && err == 0 && (queued == 0 || !rcb4_conn_preempted(conn)))
+		{
+			n = (len - sent < chunk) ? len - sent : chunk;
+			if(n > piece - sent % piece) // A command never spans two pieces
+				n = piece - sent % piece;
+			rcb4_command_recreate(&comm, RCB4_COMM_MOV);
+			if(src)
+			{
+				rcb4_command_set_dst_rom(&comm, rcb4_rom_address(addr, stride, piece, sent));
+				err = rcb4_command_set_src_literal(&comm, src + sent, n);
+			}
+			else
+			{
+				rcb4_command_set_dst_com(&comm);
+				err = rcb4_command_set_src_rom(&comm, rcb4_rom_address(addr, stride, piece, sent), n);
+			}
+			if(err == 0)
+			{
+				length = rcb4_command_encode(&comm, command);
+				err = rcb4_conn_write(conn, command, length);
+			}
+			
+			size[(head + queued) % RCB4_ROM_MAX_DEPTH] = n;
+			queued++;
+			sent += n;
+		}
+		if(err != 0)
+			break;
+		
+		// Wait for the oldest one
+		n = size[head];
+		expected = src ? 4 : n + 3;
+		if(rcb4_conn_read(conn, lbuf, expected, COMM_TIMEOUT_USECS) != expected)
+		{
+			fprintf(stderr, "Error in the ROM transfer at 0x%06X. No reply.\n", rcb4_rom_address(addr, stride, piece, received));
+			err = -1;
+			break;
+		}
+		err = rcb4_conn_check_reply(lbuf, RCB4_COMM_MOV, src ? 0 : n, dst ? dst + received : NULL);
+		if(err < 0)
+			break;
+		err = 0;
+		
+		if(hash)
+			*hash = rcb4_util_hash(*hash, src ? src + received : lbuf + 2, n);
+		
+		head = (head + 1) % RCB4_ROM_MAX_DEPTH;
+		queued--;
+		received += n;
+	}
+	
+	if(err != 0 && queued > 0) // Don't let the replies still on the wire confuse the next command
+	{
+		rcb4_util_usleep(COMM_DELAY_USECS);
+		rcb4_conn_flush(conn);
+	}
+	rcb4_conn_unlock(conn);
+	
+	return err;
+}
+
+int rcb4_rom_write(rcb4_connection* conn, uint32_t addr, const void* buf, uint32_t len)
+{
+	int err;
+	
+	assert(conn);
+	assert(buf);
+	
+	if(rcb4_rom_check_range(addr, len) != 0)
+		return -1;
+	
+	err = rcb4_rom_transfer(conn, addr, 0, len, (const uint8_t*)buf, NULL, len, NULL);
+	if(conn->rom_cache) // Write-through, or forget whatever may have been written
+	{
+		if(err == 0)
+			rcb4_rom_cache_update(conn->rom_cache, addr, (const uint8_t*)buf, len);
+		else
+			rcb4_rom_cache_invalidate(conn->rom_cache, addr, len);
+	}
+	
+	return err;
+}
+
+int rcb4_rom_read(rcb4_connection* conn, uint32_t addr, void* buf, uint32_t len)
+{
+	assert(conn);
+	assert(buf);
+	
+	if(rcb4_rom_check_range(addr, len) != 0)
+		return -1;
+	
+	return rcb4_rom_transfer(conn, addr, 0, len, NULL, (uint8_t*)buf, len, NULL);
+}
+
+int rcb4_rom_read_strided(rcb4_connection* conn, uint32_t addr, uint32_t stride, uint32_t piece, void* buf, uint32_t count)
+{
+	assert(conn);
+	assert(buf);
+	
+	if(count == 0 || piece == 0 || piece > stride)
+	{
+		fprintf(stderr, "Invalid ROM pieces.\n");
+		return -1;
+	}
+	if(rcb4_rom_check_range(addr, (count - 1) * stride + piece) != 0)
+		return -1;
+	
+	return rcb4_rom_transfer(conn, addr, stride, piece, NULL, (uint8_t*)buf, count * piece, NULL);
+}
+
+int rcb4_rom_hash(rcb4_connection* conn, uint32_t addr, uint32_t len, uint64_t* hash)
+{
+	assert(conn);
+	assert(hash);
+	
+	if(rcb4_rom_check_range(addr, len) != 0)
+		return -1;
+	
+	*hash = RCB4_HASH_INIT;
+	return rcb4_rom_transfer(conn, addr, 0, len, NULL, NULL, len, hash);
+}
+
+int rcb4_rom_verify(rcb4_connection* conn, uint32_t addr, const void* buf, uint32_t len)
+{
+	uint64_t hash;
+	
+	assert(conn);
+	assert(buf);
+	
+	// The ROM is hashed as it arrives, nothing is buffered
+	if(rcb4_rom_hash(conn, addr, len, &hash) != 0)
+		return -1;
+	
+	return (hash == rcb4_util_hash(RCB4_HASH_INIT, buf, len)) ? 0 : 1;
+}
@@ -0,0 +1,352 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_rom_cache.c
+ * @brief Persistent cache of the ROM contents.
+ * 
+ * @details The blocks of ROM read from a robot are kept in a file named after
+ * a fingerprint of the robot, so the next time the program starts they are
+ * read from the disk. A few random blocks are checked against the robot when
+ * the cache is opened, and every write to the ROM done through the library
+ * updates or invalidates the cache.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_connection.h"
+#include "rcb4_command.h"
+#include "rcb4_rom_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+static void rcb4_rom_cache_store_locked(rcb4_rom_cache* cache, uint32_t addr, const uint8_t* data, uint32_t len);
+
+static
+void rcb4_rom_cache_reset(rcb4_rom_cache* cache, uint64_t fingerprint)
+{
+	memset(&cache->file, 0, sizeof(cache->file));
+	cache->file.magic = RCB4_CACHE_MAGIC;
+	cache->file.version = RCB4_CACHE_VERSION;
+	cache->file.header_size = offsetof(struct s_rcb4_cache_file, valid);
+	cache->file.block_size = RCB4_CACHE_BLOCK_SIZE;
+	cache->file.blocks = RCB4_CACHE_BLOCKS;
+	cache->file.fingerprint = fingerprint;
+}
+
+// Loads the file. Returns 0 if it exists and is valid
+static
+int rcb4_rom_cache_load(rcb4_rom_cache* cache, uint64_t fingerprint)
+{
+	FILE* file;
+	int ok;
+	
+	file = fopen(cache->path, "rb");
+	if(!file)
+		return -1;
+	
+	ok = fread(&cache->file, sizeof(cache->file), 1, file) == 1 && cache->file.magic == RCB4_CACHE_MAGIC &&
+	     cache->file.version == RCB4_CACHE_VERSION && cache->file.header_size == offsetof(struct s_rcb4_cache_file, valid) &&
+	     cache->file.block_size == RCB4_CACHE_BLOCK_SIZE && cache->file.blocks == RCB4_CACHE_BLOCKS &&
+	     cache->file.fingerprint == fingerprint;
+	fclose(file);
+	
+	return ok ? 0 : -1;
+}
+
+// Checks some random valid blocks. Returns 0 if they match the robot
+static
+int rcb4_rom_cache_check(rcb4_rom_cache* cache, uint32_t samples)
+{
+	uint32_t b, n, count = 0, seed;
+	uint32_t valid[RCB4_CACHE_BLOCKS];
+	uint64_t hash;
+	
+	for(b = 0; b < RCB4_CACHE_BLOCKS; b++)
+	{
+		if(cache->file.valid[b])
+			valid[count++] = b;
+	}
+	
+	seed = (uint32_t)rcb4_util_time_ns() | 1;
+	for(n = 0; n < samples && n < count; n++)
+	{
+		seed ^= seed << 13; // xorshift32
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		b = valid[n + seed % (count - n)];
+		valid[n + seed % (count - n)] = valid[n];
+		
+		if(rcb4_rom_hash(cache->conn, b * RCB4_CACHE_BLOCK_SIZE, RCB4_CACHE_BLOCK_SIZE, &hash) != 0 ||
+		   hash != rcb4_util_hash(RCB4_HASH_INIT, cache->file.data + b * RCB4_CACHE_BLOCK_SIZE, RCB4_CACHE_BLOCK_SIZE))
+			return -1;
+	}
+	
+	return 0;
+}
+
+rcb4_rom_cache* rcb4_rom_cache_open(rcb4_connection* conn, const char* dir, uint32_t samples)
+{
+	uint64_t fingerprint;
+	rcb4_rom_cache* cache;
+	
+	assert(conn);
+	
+	if(conn->rom_cache)
+	{
+		fprintf(stderr, "The connection already has a ROM cache.\n");
+		return NULL;
+	}
+	
+	cache = (rcb4_rom_cache*)malloc(sizeof(rcb4_rom_cache));
+	if(!cache)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return NULL;
+	}
+	cache->conn = conn;
+	cache->dirty = 0;
+	cache->generation = 0;
+	
+	// The robot is identified by the start of its ROM (its configuration)
+	if(rcb4_rom_hash(conn, 0, RCB4_CACHE_FINGERPRINT_SIZE, &fingerprint) != 0)
+	{
+		fprintf(stderr, "Error reading the fingerprint of the robot.\n");
+		free(cache);
+		return NULL;
+	}
+	if((size_t)snprintf(cache->path, sizeof(cache->path), "%s/%016llx.cache", dir ? dir : ".", (unsigned long long)fingerprint) >= sizeof(cache->path))
+	{
+		fprintf(stderr, "The cache path is too long.\n");
+		free(cache);
+		return NULL;
+	}
+	
+	if(rcb4_rom_cache_load(cache, fingerprint) != 0 || rcb4_rom_cache_check(cache, samples) != 0)
+	{
+		rcb4_rom_cache_reset(cache, fingerprint); // Missing or stale, start empty
+		cache->dirty = 1;
+	}
+	
+	pthread_mutex_init(&cache->lock, NULL);
+	rcb4_conn_lock(conn);
+	conn->rom_cache = cache;
+	rcb4_conn_unlock(conn);
+	
+	return cache;
+}
+
+int rcb4_rom_cache_flush(rcb4_rom_cache* cache)
+{
+	FILE* file;
+	char tmp[520];
+	int err = 0;
+	
+	assert(cache);
+	
+	pthread_mutex_lock(&cache->lock);
+	if(!cache->dirty)
+	{
+		pthread_mutex_unlock(&cache->lock);
+		return 0;
+	}
+	
+	snprintf(tmp, sizeof(tmp), "%s.tmp", cache->path);
+	file = fopen(tmp, "wb");
+	if(!file || fwrite(&cache->file, sizeof(cache->file), 1, file) != 1 || fflush(file) != 0 || fsync(fileno(file)) != 0) // On disk before the rename
+	{
+		fprintf(stderr, "Error saving the ROM cache %s. (%s)\n", cache->path, strerror(errno));
+		err = -1;
+	}
+	if(file)
+		fclose(file);
+	if(err == 0 && rename(tmp, cache->path) != 0)
+	{
+		fprintf(stderr, "Error saving the ROM cache %s. (%s)\n", cache->path, strerror(errno));
+		err = -1;
+	}
+	if(err != 0)
+		unlink(tmp);
+	else
+		cache->dirty = 0;
+	pthread_mutex_unlock(&cache->lock);
+	
+	return err;
+}
+
+void rcb4_rom_cache_close(rcb4_rom_cache* cache)
+{
+	if(!cache)return;
+	
+	rcb4_rom_cache_flush(cache);
+	
+	rcb4_conn_lock(cache->conn);
+	cache->conn->rom_cache = NULL;
+	rcb4_conn_unlock(cache->conn);
+	
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+int rcb4_rom_cache_read(rcb4_rom_cache* cache, uint32_t addr, void* buf, uint32_t len)
+{
+	int err = 0;
+	uint32_t b, end, first, last;
+	uint64_t generation;
+	uint8_t block[RCB4_CACHE_BLOCK_SIZE * 8];
+	
+	assert(cache);
+	assert(buf);
+	
+	if(len == 0 || addr > RCB4_MAX_ROM_ADDRESS || len - 1 > RCB4_MAX_ROM_ADDRESS - addr)
+	{
+		fprintf(stderr, "Invalid ROM range. Allowed address: 0x000000~0x%06X\n", RCB4_MAX_ROM_ADDRESS);
+		return -1;
+	}
+	
+	first = addr / RCB4_CACHE_BLOCK_SIZE;
+	last = (addr + len - 1) / RCB4_CACHE_BLOCK_SIZE;
+	
+	// Fetch the missing blocks, contiguous ones with a single transfer
+	for(b = first; b <= last && err == 0; b = end)
+	{
+		pthread_mutex_lock(&cache->lock);
+		for(; b <= last && cache->file.valid[b]; b++);
+		for(end = b; end <= last && !cache->file.valid[end] && end - b < sizeof(block) / RCB4_CACHE_BLOCK_SIZE; end++);
+		generation = cache->generation;
+		pthread_mutex_unlock(&cache->lock);
+		if(b > last)
+			break;
+		
+		// Not holding the cache lock. If the ROM is written in the meantime what we read may be old, so it is only kept if nothing changed
+		err = rcb4_rom_read(cache->conn, b * RCB4_CACHE_BLOCK_SIZE, block, (end - b) * RCB4_CACHE_BLOCK_SIZE);
+		if(err == 0)
+		{
+			pthread_mutex_lock(&cache->lock);
+			if(cache->generation == generation)
+				rcb4_rom_cache_store_locked(cache, b * RCB4_CACHE_BLOCK_SIZE, block, (end - b) * RCB4_CACHE_BLOCK_SIZE);
+			pthread_mutex_unlock(&cache->lock);
+		}
+	}
+	if(err != 0)
+		return err;
+	
+	pthread_mutex_lock(&cache->lock);
+	for(b = first; b <= last && cache->file.valid[b]; b++);
+	if(b > last)
+		memcpy(buf, cache->file.data + addr, len);
+	pthread_mutex_unlock(&cache->lock);
+	
+	if(b <= last) // Invalidated while we were reading, go to the robot
+		return rcb4_rom_read(cache->conn, addr, buf, len);
+	
+	return 0;
+}
+
+void rcb4_rom_cache_invalidate(rcb4_rom_cache* cache, uint32_t addr, uint32_t len)
+{
+	uint32_t b, last;
+	
+	assert(cache);
+	
+	if(len == 0 || addr > RCB4_MAX_ROM_ADDRESS)
+		return;
+	if(len - 1 > RCB4_MAX_ROM_ADDRESS - addr)
+		len = RCB4_MAX_ROM_ADDRESS - addr + 1;
+	
+	last = (addr + len - 1) / RCB4_CACHE_BLOCK_SIZE;
+	pthread_mutex_lock(&cache->lock);
+	cache->generation++; // The reads in progress are old now
+	for(b = addr / RCB4_CACHE_BLOCK_SIZE; b <= last; b++)
+	{
+		if(cache->file.valid[b])
+		{
+			cache->file.valid[b] = 0;
+			cache->dirty = 1;
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/* The ROM holds data at addr. Copy it; the blocks that are fully covered
+ * become valid, the partial ones stay as they were (still right if they were
+ * valid). */
+static
+void rcb4_rom_cache_store_locked(rcb4_rom_cache* cache, uint32_t addr, const uint8_t* data, uint32_t len)
+{
+	uint32_t b, last;
+	
+	memcpy(cache->file.data + addr, data, len);
+	last = (addr + len - 1) / RCB4_CACHE_BLOCK_SIZE;
+	for(b = addr / RCB4_CACHE_BLOCK_SIZE; b <= last; b++)
+	{
+		if(b * RCB4_CACHE_BLOCK_SIZE >= addr && (b + 1) * RCB4_CACHE_BLOCK_SIZE <= addr + len)
+			cache->file.valid[b] = 1;
+	}
+	cache->dirty = 1;
+}
+
+// The library has just written data at addr
+void rcb4_rom_cache_update(rcb4_rom_cache* cache, uint32_t addr, const uint8_t* data, uint32_t len)
+{
+	pthread_mutex_lock(&cache->lock);
+	cache->generation++; // The reads in progress are old now
+	rcb4_rom_cache_store_locked(cache, addr, data, len);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+// Any other command with a ROM destination invalidates what it may have touched
+void rcb4_rom_cache_command(rcb4_rom_cache* cache, const rcb4_comm* comm)
+{
+	uint32_t addr;
+	
+	switch(comm->type)
+	{
+		case RCB4_COMM_MOV:
+		case RCB4_COMM_AND:
+		case RCB4_COMM_OR:
+		case RCB4_COMM_XOR:
+		case RCB4_COMM_NOT:
+		case RCB4_COMM_SHIFT:
+		case RCB4_COMM_ADD:
+		case RCB4_COMM_SUB:
+		case RCB4_COMM_MUL:
+		case RCB4_COMM_DIV:
+		case RCB4_COMM_MOD:
+			// All of them have the type and the destination in the same place
+			if((comm->command.mov.type & COMM_DST_MASK) != COMM_DST_ROM)
+				return;
+			addr = comm->command.mov.dst.rom.addr[0] | (comm->command.mov.dst.rom.addr[1] << 8) | ((uint32_t)comm->command.mov.dst.rom.addr[2] << 16);
+			rcb4_rom_cache_invalidate(cache, addr, RCB4_COMM_MESSAGE_SIZE_ALLOWED);
+			break;
+		default:
+			break;
+	}
+}
@@ -0,0 +1,244 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_rom_mirror.c
+ * @brief Local copy of the ROM that can be edited like memory.
+ * 
+ * @details The whole ROM address space is mapped in memory (optionally backed
+ * by a file). Next to it there is a shadow copy of what the robot is known to
+ * have, so rcb4_rom_flush() can find the changed bytes by itself and send them
+ * in as few MOV commands as possible.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_connection.h"
+#include "rcb4_rom_mirror.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+rcb4_rom_mirror* rcb4_rom_mirror_create(rcb4_connection* conn, const char* path)
+{
+	rcb4_rom_mirror* mirror;
+	
+	assert(conn);
+	
+	mirror = (rcb4_rom_mirror*)malloc(sizeof(rcb4_rom_mirror));
+	if(!mirror)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return NULL;
+	}
+	memset(mirror, 0, sizeof(rcb4_rom_mirror));
+	mirror->conn = conn;
+	mirror->fd = -1;
+	
+	mirror->shadow = (uint8_t*)malloc(RCB4_MIRROR_SIZE);
+	if(!mirror->shadow)
+	{
+		fprintf(stderr, "Memory error.\n");
+		free(mirror);
+		return NULL;
+	}
+	
+	if(path)
+	{
+		mirror->fd = open(path, O_RDWR | O_CREAT, 0644);
+		if(mirror->fd < 0 || ftruncate(mirror->fd, RCB4_MIRROR_SIZE) != 0)
+		{
+			fprintf(stderr, "Error opening the mirror file %s. (%s)\n", path, strerror(errno));
+			if(mirror->fd >= 0)
+				close(mirror->fd);
+			free(mirror->shadow);
+			free(mirror);
+			return NULL;
+		}
+		mirror->data = (uint8_t*)mmap(NULL, RCB4_MIRROR_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, mirror->fd, 0);
+	}
+	else
+		mirror->data = (uint8_t*)mmap(NULL, RCB4_MIRROR_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	
+	if(mirror->data == MAP_FAILED)
+	{
+		fprintf(stderr, "Error mapping the mirror. (%s)\n", strerror(errno));
+		if(mirror->fd >= 0)
+			close(mirror->fd);
+		free(mirror->shadow);
+		free(mirror);
+		return NULL;
+	}
+	
+	return mirror;
+}
+
+void rcb4_rom_mirror_delete(rcb4_rom_mirror* mirror)
+{
+	if(!mirror)return;
+	
+	munmap(mirror->data, RCB4_MIRROR_SIZE);
+	if(mirror->fd >= 0)
+		close(mirror->fd);
+	free(mirror->shadow);
+	free(mirror);
+}
+
+uint8_t* rcb4_rom_mirror_get_data(rcb4_rom_mirror* mirror)
+{
+	assert(mirror);
+	
+	return mirror->data;
+}
+
+int rcb4_rom_mirror_load(rcb4_rom_mirror* mirror, uint32_t addr, uint32_t len)
+{
+	int err;
+	uint32_t p, first, last;
+	
+	assert(mirror);
+	
+	if(len == 0 || addr > RCB4_MAX_ROM_ADDRESS || len - 1 > RCB4_MAX_ROM_ADDRESS - addr)
+	{
+		fprintf(stderr, "Invalid ROM range. Allowed address: 0x000000~0x%06X\n", RCB4_MAX_ROM_ADDRESS);
+		return -1;
+	}
+	
+	// Whole pages, the shadow is only tracked per page
+	first = addr / RCB4_MIRROR_PAGE_SIZE;
+	last = (addr + len - 1) / RCB4_MIRROR_PAGE_SIZE;
+	addr = first * RCB4_MIRROR_PAGE_SIZE;
+	len = (last - first + 1) * RCB4_MIRROR_PAGE_SIZE;
+	
+	if(mirror->conn->rom_cache)
+		err = rcb4_rom_cache_read(mirror->conn->rom_cache, addr, mirror->shadow + addr, len);
+	else
+		err = rcb4_rom_read(mirror->conn, addr, mirror->shadow + addr, len);
+	if(err != 0)
+		return err;
+	
+	memcpy(mirror->data + addr, mirror->shadow + addr, len);
+	for(p = first; p <= last; p++)
+	{
+		mirror->known[p] = 1;
+		mirror->dirty[p] = 0;
+	}
+	
+	return 0;
+}
+
+void rcb4_rom_mirror_mark_dirty(rcb4_rom_mirror* mirror, uint32_t addr, uint32_t len)
+{
+	uint32_t p, last;
+	
+	assert(mirror);
+	
+	if(len == 0 || addr > RCB4_MAX_ROM_ADDRESS)
+		return;
+	if(len - 1 > RCB4_MAX_ROM_ADDRESS - addr)
+		len = RCB4_MAX_ROM_ADDRESS - addr + 1;
+	
+	last = (addr + len - 1) / RCB4_MIRROR_PAGE_SIZE;
+	for(p = addr / RCB4_MIRROR_PAGE_SIZE; p <= last; p++)
+		mirror->dirty[p] = 1;
+}
+
+// Writes [start, end) and updates the shadow. Returns 0 if ok
+static
+int rcb4_rom_flush_run(rcb4_rom_mirror* mirror, uint32_t start, uint32_t end)
+{
+	int err;
+	uint32_t p;
+	
+	err = rcb4_rom_write(mirror->conn, start, mirror->data + start, end - start);
+	if(err != 0)
+		return err;
+	
+	memcpy(mirror->shadow + start, mirror->data + start, end - start);
+	for(p = (start + RCB4_MIRROR_PAGE_SIZE - 1) / RCB4_MIRROR_PAGE_SIZE; (p + 1) * RCB4_MIRROR_PAGE_SIZE <= end; p++)
+	{
+		mirror->known[p] = 1; // Fully written
+		mirror->dirty[p] = 0;
+	}
+	
+	return 0;
+}
+
+int rcb4_rom_flush(rcb4_rom_mirror* mirror)
+{
+	int err;
+	int written = 0;
+	uint32_t p, a, base, start = 0, end = 0;
+	
+	assert(mirror);
+	
+	/* Build runs of bytes to write: dirty pages entirely, known pages only
+	 * where they differ from the shadow. Two runs are merged if the bytes
+	 * between them are known (and thus unchanged) and the gap is small. */
+	for(p = 0; p < RCB4_MIRROR_PAGES; p++)
+	{
+		base = p * RCB4_MIRROR_PAGE_SIZE;
+		if(!mirror->dirty[p] && (!mirror->known[p] || memcmp(mirror->data + base, mirror->shadow + base, RCB4_MIRROR_PAGE_SIZE) == 0))
+			continue;
+		
+		for(a = base; a < base + RCB4_MIRROR_PAGE_SIZE; a++)
+		{
+			if(!mirror->dirty[p] && mirror->data[a] == mirror->shadow[a])
+				continue;
+			
+			if(end > start && (a == end || (a - end <= RCB4_MIRROR_MERGE_GAP &&
+			   mirror->known[end / RCB4_MIRROR_PAGE_SIZE] && mirror->known[(a - 1) / RCB4_MIRROR_PAGE_SIZE])))
+			{
+				end = a + 1;
+				continue;
+			}
+			
+			if(end > start)
+			{
+				if((err = rcb4_rom_flush_run(mirror, start, end)) != 0)
+					return err;
+				written += end - start;
+			}
+			start = a;
+			end = a + 1;
+		}
+	}
+	if(end > start)
+	{
+		if((err = rcb4_rom_flush_run(mirror, start, end)) != 0)
+			return err;
+		written += end - start;
+	}
+	
+	if(mirror->fd >= 0 && msync(mirror->data, RCB4_MIRROR_SIZE, MS_ASYNC) != 0)
+		fprintf(stderr, "Error syncing the mirror file. (%s)\n", strerror(errno));
+	
+	return written;
+}
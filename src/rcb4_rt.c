@@ -0,0 +1,325 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_rt.c
+ * @brief Fixed-rate executor for control loops.
+ * 
+ * @details Calls a user function at a fixed period using absolute deadlines,
+ * optionally with real-time priority, pinned to a CPU and with the memory
+ * locked. Every cycle measures how late it started, how long the step took,
+ * how much of it was spent using the serial link and if the deadline was
+ * missed.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#define _GNU_SOURCE // CPU_SET and pthread_setaffinity_np
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_connection.h"
+#include "rcb4_rt.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+rcb4_rt* rcb4_rt_create(rcb4_connection* conn, uint32_t period_usecs, rcb4_rt_step step, void* data)
+{
+	rcb4_rt* rt;
+	
+	assert(conn);
+	assert(step);
+	
+	if(period_usecs == 0)
+	{
+		fprintf(stderr, "Invalid period.\n");
+		return NULL;
+	}
+	
+	rt = (rcb4_rt*)malloc(sizeof(rcb4_rt));
+	if(!rt)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return NULL;
+	}
+	
+	memset(rt, 0, sizeof(rcb4_rt));
+	rt->conn = conn;
+	rt->period_ns = (uint64_t)period_usecs * 1000;
+	rt->step = step;
+	rt->data = data;
+	rt->cpu = -1;
+	
+	return rt;
+}
+
+void rcb4_rt_delete(rcb4_rt* rt)
+{
+	if(!rt)return;
+	
+	rcb4_rt_stop(rt);
+	free(rt);
+}
+
+int rcb4_rt_set_priority(rcb4_rt* rt, int priority)
+{
+	assert(rt);
+	
+	if(priority < 0 || priority > sched_get_priority_max(SCHED_FIFO))
+	{
+		fprintf(stderr, "Invalid priority. Allowed values: 0~%d\n", sched_get_priority_max(SCHED_FIFO));
+		return -1;
+	}
+	
+	rt->priority = priority;
+	return 0;
+}
+
+int rcb4_rt_set_cpu(rcb4_rt* rt, int cpu)
+{
+	assert(rt);
+	
+	if(cpu < -1 || cpu >= CPU_SETSIZE)
+	{
+		fprintf(stderr, "Invalid CPU.\n");
+		return -1;
+	}
+	
+	rt->cpu = cpu;
+	return 0;
+}
+
+int rcb4_rt_set_mlock(rcb4_rt* rt, int enable)
+{
+	assert(rt);
+	
+	rt->mlock = enable;
+	return 0;
+}
+
+
+static
+void rcb4_rt_sleep_until(uint64_t deadline)
+{
+	struct timespec ts;
+	
+	ts.tv_sec = deadline / 1000000000ULL;
+	ts.tv_nsec = deadline % 1000000000ULL;
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static
+void rcb4_rt_time_add(rcb4_rt_time* t, uint64_t value, uint64_t cycles)
+{
+	t->last = value;
+	t->total += value;
+	if(cycles == 1 || value < t->min)
+		t->min = value;
+	if(value > t->max)
+		t->max = value;
+}
+
+// Applies the real-time configuration to the calling thread
+static
+int rcb4_rt_setup(rcb4_rt* rt)
+{
+	int err;
+	cpu_set_t cpus;
+	struct sched_param param;
+	
+	if(rt->mlock && mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+	{
+		fprintf(stderr, "Error locking the memory. Do you have the permissions? (%s)\n", strerror(errno));
+		return -1;
+	}
+	
+	if(rt->cpu >= 0)
+	{
+		CPU_ZERO(&cpus);
+		CPU_SET(rt->cpu, &cpus);
+		err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if(err != 0)
+		{
+			fprintf(stderr, "Error pinning the thread to CPU %d. (%s)\n", rt->cpu, strerror(err));
+			return -1;
+		}
+	}
+	
+	if(rt->priority > 0)
+	{
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = rt->priority;
+		err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if(err != 0)
+		{
+			fprintf(stderr, "Error setting the real-time priority. Do you have the permissions? (%s)\n", strerror(err));
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+static
+int rcb4_rt_loop(rcb4_rt* rt)
+{
+	int ret = 0;
+	uint64_t next, start, end, io;
+	
+	if(rcb4_rt_setup(rt) != 0)
+		return -1;
+	
+	next = rcb4_util_time_ns() + rt->period_ns;
+	while(__atomic_load_n(&rt->running, __ATOMIC_ACQUIRE))
+	{
+		rcb4_rt_sleep_until(next);
+		
+		start = rcb4_util_time_ns();
+		io = rcb4_thread_get_io_time();
+		ret = rt->step(rt->conn, rt->data);
+		end = rcb4_util_time_ns();
+		io = rcb4_thread_get_io_time() - io;
+		
+		// Publish the stats (seqlock, the readers retry while it is odd)
+		__atomic_add_fetch(&rt->seq, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		if(__atomic_exchange_n(&rt->reset, 0, __ATOMIC_ACQ_REL))
+			memset(&rt->stats, 0, sizeof(rcb4_rt_stats));
+		rt->stats.cycles++;
+		rcb4_rt_time_add(&rt->stats.jitter, start - next, rt->stats.cycles);
+		rcb4_rt_time_add(&rt->stats.step, end - start, rt->stats.cycles);
+		rcb4_rt_time_add(&rt->stats.io, io, rt->stats.cycles);
+		
+		next += rt->period_ns;
+		if(end > next) // Overrun. Skip the cycles we lost instead of running them back to back
+		{
+			rt->stats.missed += (end - next) / rt->period_ns + 1;
+			next += ((end - next) / rt->period_ns + 1) * rt->period_ns;
+		}
+		__atomic_add_fetch(&rt->seq, 1, __ATOMIC_RELEASE);
+		
+		if(ret != 0)
+			break;
+	}
+	
+	__atomic_store_n(&rt->running, 0, __ATOMIC_RELEASE);
+	return ret;
+}
+
+int rcb4_rt_run(rcb4_rt* rt)
+{
+	assert(rt);
+	
+	if(__atomic_exchange_n(&rt->running, 1, __ATOMIC_ACQ_REL))
+	{
+		fprintf(stderr, "The executor is already running.\n");
+		return -1;
+	}
+	
+	return rcb4_rt_loop(rt);
+}
+
+static
+void* rcb4_rt_thread(void* arg)
+{
+	rcb4_rt* rt = (rcb4_rt*)arg;
+	
+	rt->result = rcb4_rt_loop(rt);
+	return NULL;
+}
+
+int rcb4_rt_start(rcb4_rt* rt)
+{
+	assert(rt);
+	
+	if(__atomic_exchange_n(&rt->running, 1, __ATOMIC_ACQ_REL))
+	{
+		fprintf(stderr, "The executor is already running.\n");
+		return -1;
+	}
+	
+	if(rt->threaded) // The last thread stopped by itself (the step failed), but it was never joined
+	{
+		pthread_join(rt->thread, NULL);
+		rt->threaded = 0;
+	}
+	
+	rt->result = 0;
+	if(pthread_create(&rt->thread, NULL, rcb4_rt_thread, rt) != 0)
+	{
+		fprintf(stderr, "Error creating the executor thread.\n");
+		__atomic_store_n(&rt->running, 0, __ATOMIC_RELEASE);
+		return -1;
+	}
+	rt->threaded = 1;
+	
+	return 0;
+}
+
+int rcb4_rt_stop(rcb4_rt* rt)
+{
+	assert(rt);
+	
+	__atomic_store_n(&rt->running, 0, __ATOMIC_RELEASE);
+	if(!rt->threaded)
+		return 0; // rcb4_rt_run() will return by itself
+	
+	pthread_join(rt->thread, NULL);
+	rt->threaded = 0;
+	
+	return rt->result;
+}
+
+void rcb4_rt_get_stats(const rcb4_rt* rt, rcb4_rt_stats* stats)
+{
+	uint32_t seq;
+	
+	assert(rt);
+	assert(stats);
+	
+	do
+	{
+		while((seq = __atomic_load_n(&rt->seq, __ATOMIC_ACQUIRE)) & 1);
+		memcpy(stats, &rt->stats, sizeof(rcb4_rt_stats));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	}while(__atomic_load_n(&rt->seq, __ATOMIC_RELAXED) != seq);
+}
+
+void rcb4_rt_reset_stats(rcb4_rt* rt)
+{
+	assert(rt);
+	
+	if(__atomic_load_n(&rt->running, __ATOMIC_ACQUIRE))
+	{
+		__atomic_store_n(&rt->reset, 1, __ATOMIC_RELEASE); // The loop is the only writer
+		return;
+	}
+	
+	memset(&rt->stats, 0, sizeof(rcb4_rt_stats));
+}
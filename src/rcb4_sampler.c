@@ -0,0 +1,302 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_sampler.c
+ * @brief Sensor sampling done by the robot itself.
+ * 
+ * @details A routine in the ROM keeps copying a RAM region (usually the AD
+ * converters) to a ring of slots in RAM, each one tagged with a counter. The
+ * host reads the whole ring with one MOV whenever it wants and keeps the
+ * samples it hasn't seen yet, so the sample rate doesn't depend on the latency
+ * of the link.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_connection.h"
+#include "rcb4_command.h"
+#include "rcb4_sampler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+rcb4_sampler* rcb4_sampler_create(rcb4_connection* conn, uint16_t addr, uint8_t size, uint16_t ram_addr, uint32_t rom_addr)
+{
+	rcb4_sampler* sampler;
+	
+	assert(conn);
+	
+	if(size == 0 || size > RCB4_SAMPLER_RING_BYTES / 2 - RCB4_SAMPLER_COUNTER_SIZE)
+	{
+		fprintf(stderr, "Invalid data size. Allowed values: 1~%d\n", RCB4_SAMPLER_RING_BYTES / 2 - RCB4_SAMPLER_COUNTER_SIZE);
+		return NULL;
+	}
+	if(addr + size - 1 > RCB4_MAX_RAM_ADDRESS || ram_addr + RCB4_SAMPLER_RAM_SIZE - 1 > RCB4_MAX_RAM_ADDRESS)
+	{
+		fprintf(stderr, "Invalid RAM address. Allowed address: 0x0000~0x%04X\n", RCB4_MAX_RAM_ADDRESS);
+		return NULL;
+	}
+	if(addr < ram_addr + RCB4_SAMPLER_RAM_SIZE && ram_addr < addr + size)
+	{
+		fprintf(stderr, "The sampled region and the ring overlap.\n");
+		return NULL;
+	}
+	
+	sampler = (rcb4_sampler*)malloc(sizeof(rcb4_sampler));
+	if(!sampler)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return NULL;
+	}
+	
+	memset(sampler, 0, sizeof(rcb4_sampler));
+	sampler->conn = conn;
+	sampler->ram_addr = ram_addr;
+	sampler->rom_addr = rom_addr;
+	sampler->addr = addr;
+	sampler->size = size;
+	sampler->slots = RCB4_SAMPLER_RING_BYTES / RCB4_SAMPLER_SLOT_SIZE(sampler);
+	
+	if(rom_addr + RCB4_SAMPLER_ROM_SIZE(sampler->slots) - 1 > RCB4_MAX_ROM_ADDRESS)
+	{
+		fprintf(stderr, "Invalid ROM address. The routine doesn't fit in the ROM.\n");
+		free(sampler);
+		return NULL;
+	}
+	
+	return sampler;
+}
+
+void rcb4_sampler_delete(rcb4_sampler* sampler)
+{
+	if(!sampler)return;
+	
+	free(sampler);
+}
+
+int rcb4_sampler_install(rcb4_sampler* sampler)
+{
+	int err = 0;
+	uint8_t k, mask = 0xFF;
+	uint16_t one = 1; // TODO: Endian...
+	rcb4_asm* a;
+	rcb4_comm* comm;
+	
+	assert(sampler);
+	
+	a = rcb4_asm_create();
+	comm = rcb4_command_create(RCB4_COMM_MOV);
+	if(!a || !comm)
+	{
+		rcb4_asm_delete(a);
+		rcb4_command_delete(comm);
+		return -1;
+	}
+	
+	err = rcb4_asm_label(a, "loop");
+	for(k = 0; k < sampler->slots && err == 0; k++)
+	{
+		// Data first, so a slot with a new counter always has its new data
+		rcb4_command_recreate(comm, RCB4_COMM_MOV);
+		err |= rcb4_command_set_src_ram(comm, sampler->addr, sampler->size);
+		err |= rcb4_command_set_dst_ram(comm, RCB4_SAMPLER_SLOT(sampler, k) + RCB4_SAMPLER_COUNTER_SIZE);
+		err |= rcb4_asm_add(a, comm);
+		
+		rcb4_command_recreate(comm, RCB4_COMM_ADD);
+		err |= rcb4_command_set_src_literal(comm, &one, RCB4_SAMPLER_COUNTER_SIZE);
+		err |= rcb4_command_set_dst_ram(comm, RCB4_SAMPLER_COUNTER(sampler));
+		err |= rcb4_asm_add(a, comm);
+		
+		rcb4_command_recreate(comm, RCB4_COMM_MOV);
+		err |= rcb4_command_set_src_ram(comm, RCB4_SAMPLER_COUNTER(sampler), RCB4_SAMPLER_COUNTER_SIZE);
+		err |= rcb4_command_set_dst_ram(comm, RCB4_SAMPLER_SLOT(sampler, k));
+		err |= rcb4_asm_add(a, comm);
+	}
+	if(err == 0) // Go on while stop is 0
+	{
+		rcb4_command_recreate(comm, RCB4_COMM_AND);
+		err |= rcb4_command_set_src_literal(comm, &mask, 1);
+		err |= rcb4_command_set_dst_ram(comm, RCB4_SAMPLER_STOP(sampler));
+		err |= rcb4_command_set_dst_do_not_save(comm);
+		err |= rcb4_asm_add(a, comm);
+		err |= rcb4_asm_jmp(a, "loop", RCB4_CONDITION_Z_SET);
+		err |= rcb4_asm_ret(a);
+	}
+	if(err == 0)
+		err = rcb4_asm_upload(a, sampler->conn, sampler->rom_addr);
+	
+	sampler->installed = (err == 0);
+	
+	rcb4_asm_delete(a);
+	rcb4_command_delete(comm);
+	return err ? -1 : 0;
+}
+
+int rcb4_sampler_start(rcb4_sampler* sampler)
+{
+	int err;
+	uint8_t init[RCB4_SAMPLER_RAM_SIZE];
+	rcb4_comm comm;
+	
+	assert(sampler);
+	
+	if(!sampler->installed)
+	{
+		fprintf(stderr, "The sampler is not installed.\n");
+		return -1;
+	}
+	
+	// Clear stop, the counter and the ring: no slot looks new
+	memset(init, 0, sizeof(init));
+	rcb4_command_recreate(&comm, RCB4_COMM_MOV);
+	rcb4_command_set_src_literal(&comm, init, 1 + RCB4_SAMPLER_COUNTER_SIZE + sampler->slots * RCB4_SAMPLER_SLOT_SIZE(sampler));
+	rcb4_command_set_dst_ram(&comm, sampler->ram_addr);
+	
+	rcb4_conn_lock(sampler->conn);
+	err = rcb4_conn_transact(sampler->conn, &comm, NULL);
+	rcb4_conn_unlock(sampler->conn);
+	if(err != 0)
+		return err;
+	
+	sampler->last = 0;
+	sampler->last_time = rcb4_util_time_ns();
+	
+	return rcb4_call(sampler->conn, sampler->rom_addr, RCB4_CONDITION_ALWAYS);
+}
+
+int rcb4_sampler_stop(rcb4_sampler* sampler)
+{
+	int err;
+	uint8_t stop = 1;
+	rcb4_comm comm;
+	
+	assert(sampler);
+	
+	rcb4_command_recreate(&comm, RCB4_COMM_MOV);
+	rcb4_command_set_src_literal(&comm, &stop, 1);
+	rcb4_command_set_dst_ram(&comm, RCB4_SAMPLER_STOP(sampler));
+	
+	rcb4_conn_lock(sampler->conn);
+	err = rcb4_conn_transact(sampler->conn, &comm, NULL);
+	rcb4_conn_unlock(sampler->conn);
+	
+	return err;
+}
+
+// Counter of slot k of a copy of the ring
+static
+uint16_t rcb4_sampler_seq(const rcb4_sampler* sampler, const uint8_t* ring, int k)
+{
+	const uint8_t* slot = ring + k * RCB4_SAMPLER_SLOT_SIZE(sampler);
+	
+	return slot[0] | (slot[1] << 8); // TODO: Endian...
+}
+
+int rcb4_sampler_drain(rcb4_sampler* sampler, rcb4_sample* samples, int max)
+{
+	int k, n, out, count, ret;
+	uint8_t ring[RCB4_SAMPLER_RING_BYTES];
+	uint16_t newest, age, seq;
+	uint64_t now, period;
+	const uint8_t* slot;
+	rcb4_comm comm;
+	
+	assert(sampler);
+	assert(samples);
+	
+	rcb4_command_recreate(&comm, RCB4_COMM_MOV);
+	rcb4_command_set_src_ram(&comm, RCB4_SAMPLER_SLOT(sampler, 0), sampler->slots * RCB4_SAMPLER_SLOT_SIZE(sampler));
+	rcb4_command_set_dst_com(&comm);
+	
+	rcb4_conn_lock(sampler->conn);
+	ret = rcb4_conn_transact(sampler->conn, &comm, ring);
+	now = rcb4_util_time_ns();
+	rcb4_conn_unlock(sampler->conn);
+	if(ret != sampler->slots * RCB4_SAMPLER_SLOT_SIZE(sampler))
+		return -1;
+	
+	// The newest slot is the one furthest ahead of the last sample seen (less than half a lap of the counter)
+	newest = sampler->last;
+	for(k = 0; k < sampler->slots; k++)
+	{
+		seq = rcb4_sampler_seq(sampler, ring, k);
+		if((uint16_t)(seq - sampler->last) > (uint16_t)(newest - sampler->last) && (uint16_t)(seq - sampler->last) < 0x8000)
+			newest = seq;
+	}
+	count = (uint16_t)(newest - sampler->last);
+	if(count == 0)
+		return 0;
+	
+	if(count > sampler->slots) // Overwritten before we could read them
+	{
+		sampler->lost += count - sampler->slots;
+		sampler->sequence += count - sampler->slots;
+		count = sampler->slots;
+	}
+	if(count > max) // No room for all of them, keep the newest
+	{
+		sampler->lost += count - max;
+		sampler->sequence += count - max;
+		count = max;
+	}
+	
+	// Spread the timestamps over the time since the last drain
+	period = (now - sampler->last_time) / (uint16_t)(newest - sampler->last);
+	
+	for(n = 0, out = 0; n < count; n++)
+	{
+		age = count - 1 - n;
+		seq = newest - age;
+		for(k = 0; k < sampler->slots && rcb4_sampler_seq(sampler, ring, k) != seq; k++);
+		if(k == sampler->slots) // Overwritten while we were reading the ring
+		{
+			sampler->lost++;
+			sampler->sequence++;
+			continue;
+		}
+		slot = ring + k * RCB4_SAMPLER_SLOT_SIZE(sampler);
+		
+		samples[out].timestamp = now - age * period;
+		samples[out].sequence = sampler->sequence++;
+		samples[out].size = sampler->size;
+		memcpy(samples[out].data, slot + RCB4_SAMPLER_COUNTER_SIZE, sampler->size);
+		out++;
+	}
+	
+	sampler->last = newest;
+	sampler->last_time = now;
+	
+	return out;
+}
+
+uint32_t rcb4_sampler_get_lost(const rcb4_sampler* sampler)
+{
+	assert(sampler);
+	
+	return sampler->lost;
+}
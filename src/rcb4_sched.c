@@ -0,0 +1,437 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_sched.c
+ * @brief Multi-rate acquisition of RAM values.
+ * 
+ * @details Each channel (a RAM range) has its own period. The channels are
+ * compiled into a cyclic table: the channels that are due in the same tick are
+ * merged into as few MOV commands as possible and the slow channels are placed
+ * in the ticks with less traffic, so the fast channels always have the link
+ * available.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_connection.h"
+#include "rcb4_command.h"
+#include "rcb4_sched.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+rcb4_sched* rcb4_sched_create(rcb4_connection* conn, uint32_t tick_usecs)
+{
+	rcb4_sched* sched;
+	
+	assert(conn);
+	
+	if(tick_usecs == 0)
+	{
+		fprintf(stderr, "Invalid tick period.\n");
+		return NULL;
+	}
+	
+	sched = (rcb4_sched*)malloc(sizeof(rcb4_sched));
+	if(!sched)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return NULL;
+	}
+	
+	memset(sched, 0, sizeof(rcb4_sched));
+	sched->conn = conn;
+	sched->tick_usecs = tick_usecs;
+	
+	return sched;
+}
+
+void rcb4_sched_delete(rcb4_sched* sched)
+{
+	if(!sched)return;
+	
+	free(sched->slot);
+	free(sched->read);
+	free(sched);
+}
+
+int rcb4_sched_add_ram(rcb4_sched* sched, uint16_t addr, uint8_t size, uint32_t period_usecs)
+{
+	uint32_t period;
+	
+	assert(sched);
+	
+	if(size == 0 || size > RCB4_SCHED_MAX_READ)
+	{
+		fprintf(stderr, "Invalid data size. Allowed values: 1~%d\n", RCB4_SCHED_MAX_READ);
+		return -1;
+	}
+	if(addr + size - 1 > RCB4_MAX_RAM_ADDRESS)
+	{
+		fprintf(stderr, "Invalid RAM address. Allowed address: 0x0000~0x%04X\n", RCB4_MAX_RAM_ADDRESS);
+		return -1;
+	}
+	if(sched->channels >= RCB4_SCHED_MAX_CHANNELS)
+	{
+		fprintf(stderr, "Too many channels. Maximum: %d.\n", RCB4_SCHED_MAX_CHANNELS);
+		return -1;
+	}
+	
+	// Round to the nearest number of ticks
+	period = (period_usecs + sched->tick_usecs / 2) / sched->tick_usecs;
+	if(period == 0)
+		period = 1;
+	if(period > RCB4_SCHED_MAX_HYPERPERIOD)
+	{
+		fprintf(stderr, "The period is too long. Maximum: %d ticks.\n", RCB4_SCHED_MAX_HYPERPERIOD);
+		return -1;
+	}
+	
+	sched->channel[sched->channels].addr = addr;
+	sched->channel[sched->channels].size = size;
+	sched->channel[sched->channels].period = period;
+	sched->channel[sched->channels].phase = 0;
+	sched->channels++;
+	sched->dirty = 1;
+	
+	return 0;
+}
+
+int rcb4_sched_add_ad(rcb4_sched* sched, uint8_t ad_id, uint32_t period_usecs)
+{
+	assert(sched);
+	
+	if(ad_id > RCB4_MAX_AD_ID)
+	{
+		fprintf(stderr, "Invalid parameter value. Allowed values [0~%d].\n", RCB4_MAX_AD_ID);
+		return -1;
+	}
+	
+	return rcb4_sched_add_ram(sched, RCB4_AD_BASE_ADDR + 2*ad_id, 2, period_usecs);
+}
+
+
+static
+uint32_t rcb4_sched_gcd(uint32_t a, uint32_t b)
+{
+	uint32_t t;
+	
+	while(b != 0)
+	{
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+// Fast channels first, and the big ones first among the same period
+static
+int rcb4_sched_channel_cmp(const void* a, const void* b)
+{
+	const struct s_rcb4_sched_channel* ca = *(const struct s_rcb4_sched_channel* const*)a;
+	const struct s_rcb4_sched_channel* cb = *(const struct s_rcb4_sched_channel* const*)b;
+	
+	if(ca->period != cb->period)
+		return (int)ca->period - (int)cb->period;
+	return (int)cb->size - (int)ca->size;
+}
+
+static
+int rcb4_sched_read_cmp(const void* a, const void* b)
+{
+	return (int)((const struct s_rcb4_sched_read*)a)->addr - (int)((const struct s_rcb4_sched_read*)b)->addr;
+}
+
+/* Bytes that channel c adds to tick t given the channels already placed. If it
+ * is close to a channel read in the same tick it will be merged into its MOV
+ * and only the data counts. */
+static
+uint32_t rcb4_sched_cost(const struct s_rcb4_sched_channel* const* placed, int n, const struct s_rcb4_sched_channel* c, uint32_t t)
+{
+	int i;
+	const struct s_rcb4_sched_channel* p;
+	
+	for(i = 0; i < n; i++)
+	{
+		p = placed[i];
+		if(t % p->period != p->phase)
+			continue;
+		if(c->addr <= p->addr + p->size + RCB4_SCHED_OVERHEAD && p->addr <= c->addr + c->size + RCB4_SCHED_OVERHEAD)
+			return c->size;
+	}
+	
+	return c->size + RCB4_SCHED_OVERHEAD;
+}
+
+int rcb4_sched_build(rcb4_sched* sched)
+{
+	int i, n, first;
+	uint32_t t, hyper, phase, best_phase, worst, best_worst, sum, best_sum, cost, end;
+	uint32_t* load;
+	struct s_rcb4_sched_channel* order[RCB4_SCHED_MAX_CHANNELS];
+	struct s_rcb4_sched_channel* c;
+	struct s_rcb4_sched_read* r;
+	
+	assert(sched);
+	
+	if(sched->channels == 0)
+	{
+		fprintf(stderr, "Nothing to schedule. Add some channels first.\n");
+		return -1;
+	}
+	
+	// The table repeats every least common multiple of the periods
+	hyper = 1;
+	for(i = 0; i < sched->channels; i++)
+	{
+		hyper = hyper / rcb4_sched_gcd(hyper, sched->channel[i].period) * sched->channel[i].period;
+		if(hyper > RCB4_SCHED_MAX_HYPERPERIOD)
+		{
+			fprintf(stderr, "The periods are not compatible. The schedule would be longer than %d ticks.\n", RCB4_SCHED_MAX_HYPERPERIOD);
+			return -1;
+		}
+	}
+	
+	free(sched->slot);
+	free(sched->read);
+	sched->slot = (uint16_t*)malloc((hyper + 1) * sizeof(uint16_t));
+	sched->read = (struct s_rcb4_sched_read*)malloc(hyper * sched->channels * sizeof(struct s_rcb4_sched_read));
+	load = (uint32_t*)calloc(hyper, sizeof(uint32_t));
+	if(!sched->slot || !sched->read || !load)
+	{
+		fprintf(stderr, "Memory error.\n");
+		free(sched->slot);
+		free(sched->read);
+		free(load);
+		sched->slot = NULL;
+		sched->read = NULL;
+		sched->dirty = 1;
+		return -1;
+	}
+	
+	for(i = 0; i < sched->channels; i++)
+		order[i] = &sched->channel[i];
+	qsort(order, sched->channels, sizeof(order[0]), rcb4_sched_channel_cmp);
+	
+	// Place each channel in the phase where the busiest tick it touches is the least busy
+	for(n = 0; n < sched->channels; n++)
+	{
+		c = order[n];
+		best_phase = 0;
+		best_worst = best_sum = UINT32_MAX;
+		for(phase = 0; phase < c->period; phase++)
+		{
+			c->phase = phase;
+			worst = sum = 0;
+			for(t = phase; t < hyper; t += c->period)
+			{
+				cost = load[t] + rcb4_sched_cost((const struct s_rcb4_sched_channel* const*)order, n, c, t);
+				if(cost > worst)
+					worst = cost;
+				sum += cost;
+			}
+			if(worst < best_worst || (worst == best_worst && sum < best_sum))
+			{
+				best_phase = phase;
+				best_worst = worst;
+				best_sum = sum;
+			}
+		}
+		
+		c->phase = best_phase;
+		for(t = best_phase; t < hyper; t += c->period)
+			load[t] += rcb4_sched_cost((const struct s_rcb4_sched_channel* const*)order, n, c, t);
+	}
+	free(load);
+	
+	// Build the reads of each tick merging the channels that are close enough
+	n = 0;
+	for(t = 0; t < hyper; t++)
+	{
+		sched->slot[t] = n;
+		first = n;
+		for(i = 0; i < sched->channels; i++)
+		{
+			c = &sched->channel[i];
+			if(t % c->period == c->phase)
+			{
+				sched->read[n].addr = c->addr;
+				sched->read[n].size = c->size;
+				n++;
+			}
+		}
+		if(n - first < 2)
+			continue;
+		
+		qsort(&sched->read[first], n - first, sizeof(struct s_rcb4_sched_read), rcb4_sched_read_cmp);
+		r = &sched->read[first];
+		for(i = first + 1; i < n; i++)
+		{
+			end = sched->read[i].addr + sched->read[i].size;
+			if(end < (uint32_t)r->addr + r->size)
+				end = r->addr + r->size;
+			
+			// Reading the gap is cheaper than sending another command
+			if(sched->read[i].addr <= r->addr + r->size + RCB4_SCHED_OVERHEAD && end - r->addr <= RCB4_SCHED_MAX_READ)
+			{
+				r->size = end - r->addr;
+			}
+			else
+			{
+				r++;
+				*r = sched->read[i];
+			}
+		}
+		n = (r - sched->read) + 1;
+	}
+	sched->slot[hyper] = n;
+	
+	sched->hyperperiod = hyper;
+	sched->tick = 0;
+	sched->dirty = 0;
+	
+	return 0;
+}
+
+int rcb4_sched_tick(rcb4_sched* sched)
+{
+	int i;
+	uint16_t b;
+	uint32_t t;
+	uint64_t start, stamp;
+	rcb4_comm comm;
+	const struct s_rcb4_sched_read* r;
+	
+	assert(sched);
+	
+	if(sched->dirty && rcb4_sched_build(sched) != 0)
+		return -1;
+	
+	t = sched->tick % sched->hyperperiod;
+	sched->tick++;
+	
+	rcb4_conn_lock(sched->conn);
+	for(i = sched->slot[t]; i < sched->slot[t+1]; i++)
+	{
+		r = &sched->read[i];
+		rcb4_command_recreate(&comm, RCB4_COMM_MOV);
+		rcb4_command_set_src_ram(&comm, r->addr, r->size);
+		rcb4_command_set_dst_com(&comm);
+		
+		start = rcb4_util_time_ns();
+		if(rcb4_conn_transact(sched->conn, &comm, sched->ram + r->addr) != r->size)
+		{
+			rcb4_conn_unlock(sched->conn);
+			return -1;
+		}
+		stamp = start + (rcb4_util_time_ns() - start) / 2;
+		
+		for(b = r->addr; b < r->addr + r->size; b++)
+			sched->stamp[b] = stamp;
+	}
+	rcb4_conn_unlock(sched->conn);
+	
+	return sched->slot[t+1] - sched->slot[t];
+}
+
+int rcb4_sched_get_ram(const rcb4_sched* sched, uint16_t addr, void* value, uint8_t size, uint64_t* timestamp)
+{
+	uint16_t b;
+	uint64_t oldest = UINT64_MAX;
+	
+	assert(sched);
+	assert(value);
+	
+	if(size == 0 || addr + size - 1 > RCB4_MAX_RAM_ADDRESS)
+	{
+		fprintf(stderr, "Invalid RAM address. Allowed address: 0x0000~0x%04X\n", RCB4_MAX_RAM_ADDRESS);
+		return -1;
+	}
+	
+	for(b = addr; b < addr + size; b++)
+	{
+		if(sched->stamp[b] < oldest)
+			oldest = sched->stamp[b];
+	}
+	if(oldest == 0) // Not read yet
+		return -1;
+	
+	memcpy(value, sched->ram + addr, size);
+	if(timestamp)
+		*timestamp = oldest;
+	
+	return 0;
+}
+
+int rcb4_sched_get_ad(const rcb4_sched* sched, uint8_t ad_id, uint16_t* value, uint64_t* timestamp)
+{
+	if(ad_id > RCB4_MAX_AD_ID)
+	{
+		fprintf(stderr, "Invalid parameter value. Allowed values [0~%d].\n", RCB4_MAX_AD_ID);
+		return -1;
+	}
+	
+	// TODO: Endian...
+	return rcb4_sched_get_ram(sched, RCB4_AD_BASE_ADDR + 2*ad_id, value, 2, timestamp);
+}
+
+void rcb4_sched_debug_print(const rcb4_sched* sched)
+{
+	int i;
+	uint32_t t, bytes;
+	
+	if(!sched) // Don't sigfault! Print NULL instead.
+	{
+		printf("Scheduler = NULL\n");
+		return;
+	}
+	if(sched->dirty)
+	{
+		printf("Scheduler not built\n");
+		return;
+	}
+	
+	for(i = 0; i < sched->channels; i++)
+	{
+		printf("Channel %d: 0x%04X (%d bytes) every %d ticks, phase %d\n", i, sched->channel[i].addr,
+		       sched->channel[i].size, sched->channel[i].period, sched->channel[i].phase);
+	}
+	
+	for(t = 0; t < sched->hyperperiod; t++)
+	{
+		printf("Tick %u:", t);
+		bytes = 0;
+		for(i = sched->slot[t]; i < sched->slot[t+1]; i++)
+		{
+			printf(" [0x%04X, %d]", sched->read[i].addr, sched->read[i].size);
+			bytes += sched->read[i].size + RCB4_SCHED_OVERHEAD;
+		}
+		printf(" -> %u bytes\n", bytes);
+	}
+}
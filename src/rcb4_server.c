@@ -0,0 +1,606 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file rcb4_server.c
+ * @brief Server that shares one connection to the robot among many processes.
+ * 
+ * @details Only one process can own the serial port. These functions let a
+ * daemon (see samples/rcb4d.c) keep the connection and serve it to other
+ * processes through a Unix socket, merging identical reads, sending the
+ * frames of several clients in a single batch and giving priority to the
+ * real-time clients.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#define _GNU_SOURCE // accept4
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_connection.h"
+#include "rcb4_command.h"
+#include "rcb4_rom_cache.h"
+#include "rcb4_server.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+// Removes the socket left by a server that was killed, but not the one of a server that is running
+static
+int rcb4_server_claim(const char* path)
+{
+	int fd, err;
+	struct sockaddr_un addr;
+	
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0)
+		return -1;
+	err = connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+	if(err != 0)
+		err = errno;
+	close(fd);
+	
+	if(err == 0)
+	{
+		fprintf(stderr, "Another server is already running on %s.\n", path);
+		return -1;
+	}
+	if(err == ECONNREFUSED) // Nobody listening
+		unlink(path);
+	else if(err != ENOENT)
+	{
+		fprintf(stderr, "Error checking %s.\n", path);
+		return -1;
+	}
+	
+	return 0;
+}
+
+rcb4_server* rcb4_server_create(rcb4_connection* conn, const char* path)
+{
+	rcb4_server* server;
+	struct epoll_event ev;
+	
+	assert(conn);
+	assert(path);
+	
+	if(strlen(path) >= sizeof(server->addr.sun_path))
+	{
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return NULL;
+	}
+	
+	server = (rcb4_server*)malloc(sizeof(rcb4_server));
+	if(!server)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return NULL;
+	}
+	memset(server, 0, sizeof(rcb4_server));
+	server->conn = conn;
+	server->addr.sun_family = AF_UNIX;
+	strcpy(server->addr.sun_path, path);
+	
+	server->epfd = epoll_create1(EPOLL_CLOEXEC);
+	server->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(server->epfd < 0 || server->stop_fd < 0 || server->listen_fd < 0)
+	{
+		fprintf(stderr, "Error creating the server.\n");
+		goto error;
+	}
+	
+	if(rcb4_server_claim(path) != 0 || bind(server->listen_fd, (struct sockaddr*)&server->addr, sizeof(server->addr)) != 0)
+	{
+		fprintf(stderr, "Error listening on %s.\n", path);
+		close(server->listen_fd); // Not ours, rcb4_server_delete() must not unlink it
+		server->listen_fd = -1;
+		goto error;
+	}
+	if(listen(server->listen_fd, RCB4_SERVER_MAX_CLIENTS) != 0)
+	{
+		fprintf(stderr, "Error listening on %s.\n", path);
+		goto error;
+	}
+	
+	ev.events = EPOLLIN;
+	ev.data.ptr = &server->listen_fd;
+	if(epoll_ctl(server->epfd, EPOLL_CTL_ADD, server->listen_fd, &ev) != 0)
+		goto error;
+	ev.data.ptr = &server->stop_fd;
+	if(epoll_ctl(server->epfd, EPOLL_CTL_ADD, server->stop_fd, &ev) != 0)
+		goto error;
+	
+	return server;
+	
+error:
+	rcb4_server_delete(server);
+	return NULL;
+}
+
+void rcb4_server_delete(rcb4_server* server)
+{
+	int i;
+	
+	if(!server)return;
+	
+	for(i = 0; i < server->clients; i++)
+	{
+		if(server->client[i]->fd >= 0)
+			close(server->client[i]->fd);
+		free(server->client[i]);
+	}
+	if(server->listen_fd >= 0)
+	{
+		close(server->listen_fd);
+		unlink(server->addr.sun_path);
+	}
+	if(server->stop_fd >= 0)
+		close(server->stop_fd);
+	if(server->epfd >= 0)
+		close(server->epfd);
+	free(server);
+}
+
+void rcb4_server_stop(rcb4_server* server)
+{
+	uint64_t one = 1;
+	
+	assert(server);
+	
+	if(write(server->stop_fd, &one, sizeof(one)) != sizeof(one))
+		return; // Only fails if it was already stopped many times
+}
+
+void rcb4_server_get_stats(const rcb4_server* server, rcb4_server_stats* stats)
+{
+	assert(server);
+	assert(stats);
+	
+	*stats = server->stats;
+	stats->clients = server->clients;
+}
+
+// Size of the whole reply to a frame, -1 if the robot doesn't know it
+static
+int rcb4_server_reply_length(const uint8_t* frame)
+{
+	rcb4_comm comm;
+	
+	switch(frame[1])
+	{
+		case RCB4_COMM_MOV:
+		case RCB4_COMM_AND:
+		case RCB4_COMM_OR:
+		case RCB4_COMM_XOR:
+		case RCB4_COMM_NOT:
+		case RCB4_COMM_SHIFT:
+		case RCB4_COMM_ADD:
+		case RCB4_COMM_SUB:
+		case RCB4_COMM_MUL:
+		case RCB4_COMM_DIV:
+		case RCB4_COMM_MOD:
+			memcpy(&comm, frame, frame[0] - 1); // Same layout, without the checksum
+			return (rcb4_command_get_response_size(&comm) == 0) ? 4 : rcb4_command_get_response_size(&comm) + 3;
+		case RCB4_COMM_ICS:
+		case RCB4_COMM_SINGLE:
+		case RCB4_COMM_CONST:
+		case RCB4_COMM_SERIES:
+		case RCB4_COMM_SPEED:
+		case RCB4_COMM_JMP:
+		case RCB4_COMM_CALL:
+		case RCB4_COMM_RET:
+		case 0xFE: // Ping
+			return 4;
+		default:
+			return -1;
+	}
+}
+
+// The client hung up or broke the protocol. Its frames already sent to the robot are answered anyway
+static
+void rcb4_server_drop(rcb4_server* server, struct s_rcb4_server_client* client)
+{
+	if(client->fd < 0)
+		return;
+	
+	epoll_ctl(server->epfd, EPOLL_CTL_DEL, client->fd, NULL);
+	close(client->fd);
+	client->fd = -1;
+	server->pending -= client->count - client->batched;
+	client->count = client->batched;
+}
+
+static
+void rcb4_server_send(rcb4_server* server, struct s_rcb4_server_client* client, const uint8_t* buffer, uint16_t length)
+{
+	if(client->fd < 0)
+		return;
+	
+	// The replies are small and the client waits for them, so the socket is never full
+	if(send(client->fd, buffer, length, MSG_NOSIGNAL | MSG_DONTWAIT) != length)
+		rcb4_server_drop(server, client);
+}
+
+static
+void rcb4_server_accept(rcb4_server* server)
+{
+	int fd;
+	struct s_rcb4_server_client* client;
+	struct epoll_event ev;
+	
+	while((fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+	{
+		if(server->clients >= RCB4_SERVER_MAX_CLIENTS)
+		{
+			fprintf(stderr, "Too many clients. Maximum: %d.\n", RCB4_SERVER_MAX_CLIENTS);
+			close(fd);
+			continue;
+		}
+		
+		client = (struct s_rcb4_server_client*)malloc(sizeof(struct s_rcb4_server_client));
+		if(!client)
+		{
+			fprintf(stderr, "Memory error.\n");
+			close(fd);
+			continue;
+		}
+		memset(client, 0, sizeof(struct s_rcb4_server_client));
+		client->fd = fd;
+		client->lane = RCB4_LANE_REALTIME;
+		
+		ev.events = EPOLLIN;
+		ev.data.ptr = client;
+		if(epoll_ctl(server->epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+		{
+			close(fd);
+			free(client);
+			continue;
+		}
+		server->client[server->clients++] = client;
+	}
+}
+
+// Moves the complete frames of a client to its queue
+static
+void rcb4_server_parse(rcb4_server* server, struct s_rcb4_server_client* client)
+{
+	struct s_rcb4_server_request* req;
+	uint8_t ack[4], sum, n;
+	int i, length;
+	
+	while(client->fd >= 0 && client->rx_size > 0 && client->rx_size >= client->rx[0] && client->count < RCB4_SERVER_QUEUE_SIZE)
+	{
+		n = client->rx[0];
+		if(n < 3 || n > RCB4_COMM_MESSAGE_SIZE_ALLOWED)
+		{
+			fprintf(stderr, "Invalid frame from a client. Disconnecting it.\n");
+			rcb4_server_drop(server, client);
+			return;
+		}
+		for(i = 0, sum = 0; i < n - 1; i++)
+			sum += client->rx[i];
+		length = (sum == client->rx[n - 1]) ? rcb4_server_reply_length(client->rx) : -1;
+		
+		if(client->rx[1] == RCB4_SERVER_HELLO && n == 4 && sum == client->rx[3] &&
+		   (client->rx[2] == RCB4_LANE_REALTIME || client->rx[2] == RCB4_LANE_BACKGROUND))
+		{
+			client->lane = client->rx[2];
+			ack[0] = 0x04;
+			ack[1] = RCB4_SERVER_HELLO;
+			ack[2] = RCB4_ACK;
+			ack[3] = (uint8_t)(0x04 + RCB4_SERVER_HELLO + RCB4_ACK);
+			rcb4_server_send(server, client, ack, sizeof(ack));
+		}
+		else if(length < 0)
+		{
+			// The robot would ignore it and the client would wait for nothing
+			fprintf(stderr, "Invalid frame from a client. Disconnecting it.\n");
+			rcb4_server_drop(server, client);
+			return;
+		}
+		else
+		{
+			req = &client->queue[(client->head + client->count) % RCB4_SERVER_QUEUE_SIZE];
+			memcpy(req->frame, client->rx, n);
+			req->length = n;
+			req->reply_length = length;
+			client->count++;
+			server->pending++;
+			server->stats.requests++;
+		}
+		
+		memmove(client->rx, client->rx + n, client->rx_size - n);
+		client->rx_size -= n;
+	}
+}
+
+static
+void rcb4_server_readable(rcb4_server* server, struct s_rcb4_server_client* client)
+{
+	ssize_t err;
+	
+	if(client->rx_size < sizeof(client->rx)) // If full, the queue is too: wait until it drains
+	{
+		err = recv(client->fd, client->rx + client->rx_size, sizeof(client->rx) - client->rx_size, 0);
+		if(err == 0 || (err < 0 && errno != EAGAIN && errno != EINTR))
+		{
+			rcb4_server_drop(server, client);
+			return;
+		}
+		if(err > 0)
+			client->rx_size += err;
+	}
+	
+	rcb4_server_parse(server, client);
+}
+
+// Only MOV to COM can be answered twice with the same reply, the rest change something
+static
+int rcb4_server_is_read(const struct s_rcb4_server_request* req)
+{
+	return req->frame[1] == RCB4_COMM_MOV && (req->frame[2] & COMM_DST_MASK) == COMM_DST_COM;
+}
+
+// Fills the slots of the next batch. Returns the number of slots
+static
+int rcb4_server_batch(rcb4_server* server)
+{
+	int i, j, k, slots = 0, sent = 0, has_realtime = 0, has_background = 0, first_read = 0;
+	uint8_t lane;
+	uint16_t offset = 0;
+	struct s_rcb4_server_client* client;
+	const struct s_rcb4_server_request* req;
+	
+	for(i = 0; i < server->clients; i++)
+	{
+		if(server->client[i]->count == 0)
+			continue;
+		if(server->client[i]->lane == RCB4_LANE_REALTIME)
+			has_realtime = 1;
+		else
+			has_background = 1;
+	}
+	
+	// The background lane waits for the real-time one, but not forever
+	if(has_background && (!has_realtime || server->realtime_streak >= RCB4_SERVER_BACKGROUND_EVERY))
+	{
+		lane = RCB4_LANE_BACKGROUND;
+		server->realtime_streak = 0;
+	}
+	else
+	{
+		lane = RCB4_LANE_REALTIME;
+		if(has_background)
+			server->realtime_streak++;
+	}
+	
+	for(i = 0; i < server->clients && sent < server->conn->rom_depth && slots < RCB4_SERVER_BATCH_SIZE; i++)
+	{
+		client = server->client[(server->next + i) % server->clients];
+		if(client->lane != lane)
+			continue;
+		
+		// In order: the robot runs the frames of a client one after the other
+		while(client->batched < client->count && sent < server->conn->rom_depth && slots < RCB4_SERVER_BATCH_SIZE)
+		{
+			req = &client->queue[(client->head + client->batched) % RCB4_SERVER_QUEUE_SIZE];
+			client->batched++;
+			
+			server->slot[slots].client = client;
+			server->slot[slots].req = req;
+			server->slot[slots].same = slots;
+			if(!rcb4_server_is_read(req))
+				first_read = slots + 1; // The reads before it could see another value
+			else
+			{
+				for(j = first_read; j < slots; j++)
+				{
+					k = server->slot[j].same;
+					if(k == j && server->slot[k].req->length == req->length && memcmp(server->slot[k].req->frame, req->frame, req->length) == 0)
+					{
+						server->slot[slots].same = k;
+						server->stats.merged++;
+						break;
+					}
+				}
+			}
+			if(server->slot[slots].same == slots)
+			{
+				server->slot[slots].offset = offset;
+				offset += req->reply_length;
+				sent++;
+			}
+			slots++;
+		}
+	}
+	server->next = (server->next + 1) % server->clients; // Nobody is always first
+	
+	return slots;
+}
+
+// Sends a batch to the robot and answers the clients
+static
+void rcb4_server_execute(rcb4_server* server)
+{
+	int i, slots, err;
+	uint8_t command[RCB4_SERVER_BATCH_SIZE * RCB4_COMM_MESSAGE_SIZE_ALLOWED];
+	uint8_t reply[RCB4_SERVER_BATCH_SIZE * RCB4_COMM_MESSAGE_SIZE_ALLOWED];
+	uint16_t length = 0, expected = 0;
+	const struct s_rcb4_server_slot* slot;
+	rcb4_comm comm;
+	
+	slots = rcb4_server_batch(server);
+	if(slots == 0)
+		return;
+	
+	for(i = 0; i < slots; i++)
+	{
+		slot = &server->slot[i];
+		if(slot->same != i)
+			continue;
+		memcpy(command + length, slot->req->frame, slot->req->length);
+		length += slot->req->length;
+		expected += slot->req->reply_length;
+	}
+	
+	rcb4_conn_lock(server->conn);
+	if(server->conn->rom_cache) // Even if the batch fails the ROM may have been written
+	{
+		for(i = 0; i < slots; i++)
+		{
+			if(server->slot[i].same != i || server->slot[i].req->frame[1] > RCB4_COMM_MOD)
+				continue;
+			memcpy(&comm, server->slot[i].req->frame, server->slot[i].req->length - 1);
+			rcb4_rom_cache_command(server->conn->rom_cache, &comm);
+		}
+	}
+	err = rcb4_conn_write(server->conn, command, length);
+	if(err == 0)
+		err = (rcb4_conn_read(server->conn, reply, expected, COMM_TIMEOUT_USECS) == expected) ? 0 : -1;
+	if(err != 0) // The clients get no reply, like if the robot didn't answer them
+		rcb4_conn_flush(server->conn);
+	rcb4_conn_unlock(server->conn);
+	server->stats.transactions++;
+	
+	for(i = 0; i < slots; i++)
+	{
+		slot = &server->slot[i];
+		if(err == 0)
+			rcb4_server_send(server, slot->client, reply + server->slot[slot->same].offset, slot->req->reply_length);
+		else
+			server->stats.failed++;
+		
+		slot->client->head = (slot->client->head + 1) % RCB4_SERVER_QUEUE_SIZE;
+		slot->client->count--;
+		slot->client->batched--;
+		server->pending--;
+	}
+	
+	// Frames that were waiting for room in the queue
+	for(i = 0; i < server->clients; i++)
+		rcb4_server_parse(server, server->client[i]);
+}
+
+// Frees the clients that hung up and have nothing left on the wire
+static
+void rcb4_server_sweep(rcb4_server* server)
+{
+	int i, j;
+	
+	for(i = 0, j = 0; i < server->clients; i++)
+	{
+		if(server->client[i]->fd < 0 && server->client[i]->count == 0)
+			free(server->client[i]);
+		else
+			server->client[j++] = server->client[i];
+	}
+	server->clients = j;
+	if(server->next >= server->clients)
+		server->next = 0;
+}
+
+int rcb4_server_run(rcb4_server* server)
+{
+	int i, n;
+	uint64_t value;
+	struct epoll_event ev[RCB4_SERVER_EVENTS];
+	
+	assert(server);
+	
+	for(;;)
+	{
+		// Don't sleep while there is work, but collect everything that arrived before the next batch
+		n = epoll_wait(server->epfd, ev, RCB4_SERVER_EVENTS, (server->pending > 0) ? 0 : -1);
+		if(n < 0 && errno != EINTR)
+		{
+			fprintf(stderr, "Error waiting for the clients.\n");
+			return -1;
+		}
+		
+		for(i = 0; i < n; i++)
+		{
+			if(ev[i].data.ptr == &server->stop_fd)
+			{
+				if(read(server->stop_fd, &value, sizeof(value)) == sizeof(value))
+					return 0;
+			}
+			else if(ev[i].data.ptr == &server->listen_fd)
+			{
+				rcb4_server_accept(server);
+			}
+			else
+			{
+				rcb4_server_readable(server, (struct s_rcb4_server_client*)ev[i].data.ptr);
+			}
+		}
+		
+		if(server->pending > 0)
+			rcb4_server_execute(server);
+		rcb4_server_sweep(server);
+	}
+}
+
+int rcb4_client_set_lane(rcb4_connection* conn, uint8_t lane)
+{
+	int err;
+	uint8_t lbuf[4];
+	uint8_t msg[] = {0x04, RCB4_SERVER_HELLO, 0x00, 0x00};
+	
+	assert(conn);
+	
+	if(lane != RCB4_LANE_REALTIME && lane != RCB4_LANE_BACKGROUND)
+	{
+		fprintf(stderr, "Invalid lane.\n");
+		return -1;
+	}
+	if(conn->transport.ops != &rcb4_transport_unix)
+	{
+		fprintf(stderr, "Only the connections to a server (unix:) have a lane.\n");
+		return -1;
+	}
+	
+	msg[2] = lane;
+	msg[3] = 0xFF & ((int)msg[0] + (int)msg[1] + (int)msg[2]); // Checksum
+	
+	rcb4_conn_lock(conn);
+	err = rcb4_conn_write(conn, msg, sizeof(msg));
+	if(err == 0)
+		err = (rcb4_conn_read(conn, lbuf, sizeof(lbuf), COMM_TIMEOUT_USECS) == sizeof(lbuf)) ? rcb4_conn_check_reply(lbuf, RCB4_SERVER_HELLO, 0, NULL) : -1;
+	rcb4_conn_unlock(conn);
+	
+	return err;
+}
@@ -0,0 +1,253 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_stage.c
+ * @brief Servo frames loaded in advance and applied with a single call.
+ * 
+ * @details Frames are written to RAM slots as ICS packets whenever the link is
+ * free. For each slot there is a routine in the ROM that sends its packets to
+ * the servos with RCB4_COMM_ICS, so applying a frame at the right time only
+ * costs a 7 byte CALL.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_connection.h"
+#include "rcb4_command.h"
+#include "rcb4_stage.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// RAM address of the packet of the n-th servo of a slot
+static inline
+uint16_t rcb4_stage_packet_addr(const rcb4_stage* stage, uint8_t slot, uint8_t n)
+{
+	return stage->ram_addr + RCB4_STAGE_REPLY_SIZE + (slot * stage->servos + n) * RCB4_STAGE_PACKET_SIZE;
+}
+
+rcb4_stage* rcb4_stage_create(rcb4_connection* conn, uint64_t mask, uint8_t slots, uint16_t ram_addr, uint32_t rom_addr)
+{
+	int i;
+	rcb4_stage* stage;
+	
+	assert(conn);
+	
+	if(mask == 0 || (RCB4_ICS_QTY < 64 && (mask >> RCB4_ICS_QTY) != 0))
+	{
+		fprintf(stderr, "Invalid servo mask. Allowed servos: 1~%d\n", RCB4_ICS_QTY);
+		return NULL;
+	}
+	if(slots == 0 || slots > RCB4_STAGE_MAX_SLOTS)
+	{
+		fprintf(stderr, "Invalid number of slots. Allowed values: 1~%d\n", RCB4_STAGE_MAX_SLOTS);
+		return NULL;
+	}
+	
+	stage = (rcb4_stage*)malloc(sizeof(rcb4_stage));
+	if(!stage)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return NULL;
+	}
+	
+	memset(stage, 0, sizeof(rcb4_stage));
+	stage->conn = conn;
+	stage->mask = mask;
+	for(i = 0; i < RCB4_ICS_QTY; i++)
+		stage->servos += (mask >> i) & 1;
+	stage->slots = slots;
+	stage->ram_addr = ram_addr;
+	stage->rom_addr = rom_addr;
+	
+	if(ram_addr + RCB4_STAGE_RAM_SIZE(stage->servos, slots) - 1 > RCB4_MAX_RAM_ADDRESS)
+	{
+		fprintf(stderr, "Invalid RAM address. The slots don't fit in the RAM.\n");
+		free(stage);
+		return NULL;
+	}
+	if(rom_addr + RCB4_STAGE_ROM_SIZE(stage->servos, slots) - 1 > RCB4_MAX_ROM_ADDRESS)
+	{
+		fprintf(stderr, "Invalid ROM address. The routines don't fit in the ROM.\n");
+		free(stage);
+		return NULL;
+	}
+	
+	return stage;
+}
+
+void rcb4_stage_delete(rcb4_stage* stage)
+{
+	if(!stage)return;
+	
+	free(stage);
+}
+
+int rcb4_stage_install(rcb4_stage* stage)
+{
+	int err = 0;
+	uint8_t slot, ics, n;
+	char label[RCB4_ASM_LABEL_MAX];
+	rcb4_asm* a;
+	rcb4_comm* comm;
+	int32_t addr;
+	
+	assert(stage);
+	
+	a = rcb4_asm_create();
+	comm = rcb4_command_create(RCB4_COMM_ICS);
+	if(!a || !comm)
+	{
+		rcb4_asm_delete(a);
+		rcb4_command_delete(comm);
+		return -1;
+	}
+	
+	// One routine per slot: an ICS command per servo, then return
+	for(slot = 0; slot < stage->slots && err == 0; slot++)
+	{
+		snprintf(label, sizeof(label), "slot%d", slot);
+		err = rcb4_asm_label(a, label);
+		for(ics = 1, n = 0; ics <= RCB4_ICS_QTY && err == 0; ics++)
+		{
+			if(!((stage->mask >> (ics - 1)) & 1))
+				continue;
+			
+			rcb4_command_recreate(comm, RCB4_COMM_ICS);
+			err = rcb4_command_set_ics(comm, RCB4_STAGE_SIO(ics));
+			if(err == 0)
+				err = rcb4_command_set_src_ram(comm, rcb4_stage_packet_addr(stage, slot, n++), RCB4_STAGE_PACKET_SIZE);
+			if(err == 0)
+				err = rcb4_command_set_dst_ram(comm, stage->ram_addr); // The replies are not used
+			if(err == 0)
+				err = rcb4_asm_add(a, comm);
+		}
+		if(err == 0)
+			err = rcb4_asm_ret(a);
+	}
+	if(err == 0)
+		err = rcb4_asm_upload(a, stage->conn, stage->rom_addr);
+	
+	for(slot = 0; slot < stage->slots && err == 0; slot++)
+	{
+		snprintf(label, sizeof(label), "slot%d", slot);
+		addr = rcb4_asm_get_label(a, label);
+		if(addr < 0)
+		{
+			err = -1;
+			break;
+		}
+		
+		rcb4_command_encode_jump(RCB4_COMM_CALL, addr, RCB4_CONDITION_ALWAYS, stage->call[slot]);
+	}
+	
+	stage->installed = (err == 0);
+	
+	rcb4_asm_delete(a);
+	rcb4_command_delete(comm);
+	return err;
+}
+
+int rcb4_stage_load(rcb4_stage* stage, uint8_t slot, const uint16_t* positions)
+{
+	int err = 0;
+	uint8_t ics, n;
+	uint16_t pos, offset, size;
+	uint8_t packets[RCB4_ICS_QTY * RCB4_STAGE_PACKET_SIZE];
+	rcb4_comm comm;
+	
+	assert(stage);
+	assert(positions);
+	
+	if(slot >= stage->slots)
+	{
+		fprintf(stderr, "Invalid slot. Allowed values: 0~%d\n", stage->slots - 1);
+		return -1;
+	}
+	
+	for(ics = 1, n = 0; ics <= RCB4_ICS_QTY; ics++)
+	{
+		if(!((stage->mask >> (ics - 1)) & 1))
+			continue;
+		
+		pos = positions[ics - 1];
+		if(pos > 0x3FFF)
+		{
+			fprintf(stderr, "Invalid position for ICS %d. Allowed values: 0~%d\n", ics, 0x3FFF);
+			return -1;
+		}
+		packets[n * RCB4_STAGE_PACKET_SIZE + 0] = 0x80 | RCB4_STAGE_ID(ics);
+		packets[n * RCB4_STAGE_PACKET_SIZE + 1] = (pos >> 7) & 0x7F;
+		packets[n * RCB4_STAGE_PACKET_SIZE + 2] = pos & 0x7F;
+		n++;
+	}
+	
+	// As few literals as possible
+	rcb4_conn_lock(stage->conn);
+	for(offset = 0; offset < n * RCB4_STAGE_PACKET_SIZE && err == 0; offset += size)
+	{
+		size = n * RCB4_STAGE_PACKET_SIZE - offset;
+		if(size > COMM_LITERAL_MAX_LEN - 1)
+			size = COMM_LITERAL_MAX_LEN - 1;
+		
+		rcb4_command_recreate(&comm, RCB4_COMM_MOV);
+		rcb4_command_set_src_literal(&comm, packets + offset, size);
+		rcb4_command_set_dst_ram(&comm, rcb4_stage_packet_addr(stage, slot, 0) + offset);
+		err = rcb4_conn_transact(stage->conn, &comm, NULL);
+	}
+	rcb4_conn_unlock(stage->conn);
+	
+	return err;
+}
+
+int rcb4_stage_apply(rcb4_stage* stage, uint8_t slot)
+{
+	int err;
+	uint8_t lbuf[4];
+	
+	assert(stage);
+	
+	if(slot >= stage->slots || !stage->installed)
+	{
+		fprintf(stderr, "Invalid slot or the stage is not installed.\n");
+		return -1;
+	}
+	
+	rcb4_conn_lock(stage->conn);
+	err = rcb4_conn_write(stage->conn, stage->call[slot], sizeof(stage->call[slot]));
+	if(err == 0 && rcb4_conn_read(stage->conn, lbuf, 4, COMM_TIMEOUT_USECS) != 4)
+	{
+		fprintf(stderr, "Error applying the frame. No reply.\n");
+		err = -1;
+	}
+	if(err == 0)
+		err = rcb4_conn_check_reply(lbuf, RCB4_COMM_CALL, 0, NULL);
+	rcb4_conn_unlock(stage->conn);
+	
+	return err;
+}
@@ -0,0 +1,328 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_stream.c
+ * @brief Background acquisition of sensor and RAM values.
+ * 
+ * @details These functions start a thread that keeps reading a set of RAM
+ * regions (usually the AD converters) and publishes every sample with its
+ * timestamp in a lock-free ring, so the control threads never have to wait for
+ * the serial link to know the state of the robot.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_connection.h"
+#include "rcb4_command.h"
+#include "rcb4_stream.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+rcb4_stream* rcb4_stream_create(rcb4_connection* conn)
+{
+	rcb4_stream* stream;
+	
+	assert(conn);
+	
+	stream = (rcb4_stream*)malloc(sizeof(rcb4_stream));
+	if(!stream)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return NULL;
+	}
+	
+	memset(stream, 0, offsetof(rcb4_stream, ring)); // Everything before the ring, rcb4_ring_init() zeroes it
+	rcb4_ring_init(&stream->ring);
+	stream->conn = conn;
+	
+	return stream;
+}
+
+void rcb4_stream_delete(rcb4_stream* stream)
+{
+	if(!stream)return;
+	
+	rcb4_stream_stop(stream);
+	free(stream);
+}
+
+int rcb4_stream_add_ram(rcb4_stream* stream, uint16_t addr, uint8_t size)
+{
+	struct s_rcb4_stream_region* last;
+	
+	assert(stream);
+	
+	if(__atomic_load_n(&stream->running, __ATOMIC_ACQUIRE))
+	{
+		fprintf(stderr, "The stream is already running.\n");
+		return -1;
+	}
+	if(size == 0 || size > RCB4_COMM_MESSAGE_SIZE_ALLOWED - 10)
+	{
+		fprintf(stderr, "Invalid data size. Allowed values: 1~%d\n", RCB4_COMM_MESSAGE_SIZE_ALLOWED - 10);
+		return -1;
+	}
+	if(addr + size - 1 > RCB4_MAX_RAM_ADDRESS)
+	{
+		fprintf(stderr, "Invalid RAM address. Allowed address: 0x0000~0x%04X\n", RCB4_MAX_RAM_ADDRESS);
+		return -1;
+	}
+	if(stream->sample_size + size > RCB4_STREAM_MAX_SIZE)
+	{
+		fprintf(stderr, "The sample is too big. Maximum size: %d bytes.\n", RCB4_STREAM_MAX_SIZE);
+		return -1;
+	}
+	
+	// Contiguous to the last region? Then read both with the same MOV
+	if(stream->regions > 0)
+	{
+		last = &stream->region[stream->regions - 1];
+		if(last->addr + last->size == addr && last->size + size <= RCB4_COMM_MESSAGE_SIZE_ALLOWED - 10)
+		{
+			last->size += size;
+			stream->sample_size += size;
+			return 0;
+		}
+	}
+	
+	if(stream->regions >= RCB4_STREAM_MAX_REGIONS)
+	{
+		fprintf(stderr, "Too many regions. Maximum: %d.\n", RCB4_STREAM_MAX_REGIONS);
+		return -1;
+	}
+	
+	stream->region[stream->regions].addr = addr;
+	stream->region[stream->regions].size = size;
+	stream->region[stream->regions].offset = stream->sample_size;
+	stream->regions++;
+	stream->sample_size += size;
+	
+	return 0;
+}
+
+int rcb4_stream_add_ad(rcb4_stream* stream, uint8_t ad_id)
+{
+	assert(stream);
+	
+	if(ad_id > RCB4_MAX_AD_ID)
+	{
+		fprintf(stderr, "Invalid parameter value. Allowed values [0~%d].\n", RCB4_MAX_AD_ID);
+		return -1;
+	}
+	
+	return rcb4_stream_add_ram(stream, RCB4_AD_BASE_ADDR + 2*ad_id, 2);
+}
+
+int rcb4_stream_set_period(rcb4_stream* stream, uint32_t usecs)
+{
+	assert(stream);
+	
+	if(__atomic_load_n(&stream->running, __ATOMIC_ACQUIRE))
+	{
+		fprintf(stderr, "The stream is already running.\n");
+		return -1;
+	}
+	
+	stream->period_usecs = usecs;
+	return 0;
+}
+
+// Reads all the regions into sample. Returns 0 if ok.
+static
+int rcb4_stream_acquire(rcb4_stream* stream, rcb4_comm* comm, rcb4_sample* sample)
+{
+	int i, err = 0;
+	uint64_t start;
+	
+	rcb4_conn_lock(stream->conn);
+	start = rcb4_util_time_ns();
+	for(i = 0; i < stream->regions && err == 0; i++)
+	{
+		rcb4_command_recreate(comm, RCB4_COMM_MOV);
+		rcb4_command_set_src_ram(comm, stream->region[i].addr, stream->region[i].size);
+		rcb4_command_set_dst_com(comm);
+		if(rcb4_conn_transact(stream->conn, comm, sample->data + stream->region[i].offset) != stream->region[i].size)
+			err = -1;
+	}
+	// The value was read somewhere between the request and the reply
+	sample->timestamp = start + (rcb4_util_time_ns() - start) / 2;
+	rcb4_conn_unlock(stream->conn);
+	
+	return err;
+}
+
+static
+void* rcb4_stream_thread(void* arg)
+{
+	rcb4_stream* stream = (rcb4_stream*)arg;
+	rcb4_comm comm;
+	rcb4_sample sample;
+	struct timespec next;
+	
+	sample.size = stream->sample_size;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	
+	while(__atomic_load_n(&stream->running, __ATOMIC_ACQUIRE))
+	{
+		if(rcb4_stream_acquire(stream, &comm, &sample) == 0)
+		{
+			rcb4_ring_push(&stream->ring, &sample);
+			if(stream->shared)
+				rcb4_ring_push(stream->shared, &sample);
+		}
+		else
+			__atomic_add_fetch(&stream->errors, 1, __ATOMIC_RELAXED);
+		
+		if(stream->period_usecs > 0) // Absolute time so the period doesn't drift
+		{
+			next.tv_nsec += (long)(stream->period_usecs % 1000000) * 1000;
+			next.tv_sec += stream->period_usecs / 1000000 + next.tv_nsec / 1000000000;
+			next.tv_nsec %= 1000000000;
+			while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR);
+		}
+	}
+	
+	return NULL;
+}
+
+// Makes the stream publish in a second ring. Only before it starts: each ring has a single writer
+int rcb4_stream_share(rcb4_stream* stream, struct s_rcb4_ring* ring)
+{
+	assert(stream);
+	
+	if(__atomic_load_n(&stream->running, __ATOMIC_ACQUIRE))
+	{
+		fprintf(stderr, "The stream is already running.\n");
+		return -1;
+	}
+	
+	stream->shared = ring;
+	return 0;
+}
+
+int rcb4_stream_start(rcb4_stream* stream)
+{
+	assert(stream);
+	
+	if(__atomic_load_n(&stream->running, __ATOMIC_ACQUIRE))
+		return 0; // Already running
+	
+	if(stream->regions == 0)
+	{
+		fprintf(stderr, "Nothing to stream. Add some regions first.\n");
+		return -1;
+	}
+	
+	__atomic_store_n(&stream->running, 1, __ATOMIC_RELEASE);
+	if(pthread_create(&stream->thread, NULL, rcb4_stream_thread, stream) != 0)
+	{
+		fprintf(stderr, "Error creating the stream thread.\n");
+		__atomic_store_n(&stream->running, 0, __ATOMIC_RELEASE);
+		return -1;
+	}
+	
+	return 0;
+}
+
+int rcb4_stream_stop(rcb4_stream* stream)
+{
+	assert(stream);
+	
+	if(!__atomic_exchange_n(&stream->running, 0, __ATOMIC_ACQ_REL))
+		return 0; // Not running
+	
+	pthread_join(stream->thread, NULL);
+	return 0;
+}
+
+int rcb4_stream_latest(const rcb4_stream* stream, rcb4_sample* sample)
+{
+	assert(stream);
+	assert(sample);
+	
+	return rcb4_seqlock_load(&stream->ring.latest, sample);
+}
+
+int rcb4_stream_read(const rcb4_stream* stream, uint64_t* cursor, rcb4_sample* sample)
+{
+	assert(stream);
+	assert(cursor);
+	assert(sample);
+	
+	return rcb4_ring_read(&stream->ring, cursor, sample);
+}
+
+// Also used by the bridge, that keeps a copy of the regions in shared memory
+int rcb4_stream_find(const struct s_rcb4_stream_region* region, int regions, const rcb4_sample* sample, uint16_t addr, void* value, uint8_t size)
+{
+	int i;
+	
+	for(i = 0; i < regions; i++)
+	{
+		if(addr >= region[i].addr && addr + size <= region[i].addr + region[i].size)
+		{
+			memcpy(value, sample->data + region[i].offset + (addr - region[i].addr), size);
+			return 0;
+		}
+	}
+	
+	fprintf(stderr, "The address 0x%04X is not part of the stream.\n", addr);
+	return -1;
+}
+
+int rcb4_stream_get_ram(const rcb4_stream* stream, const rcb4_sample* sample, uint16_t addr, void* value, uint8_t size)
+{
+	assert(stream);
+	assert(sample);
+	assert(value);
+	
+	return rcb4_stream_find(stream->region, stream->regions, sample, addr, value, size);
+}
+
+int rcb4_stream_get_ad(const rcb4_stream* stream, const rcb4_sample* sample, uint8_t ad_id, uint16_t* value)
+{
+	if(ad_id > RCB4_MAX_AD_ID)
+	{
+		fprintf(stderr, "Invalid parameter value. Allowed values [0~%d].\n", RCB4_MAX_AD_ID);
+		return -1;
+	}
+	
+	// TODO: Endian...
+	return rcb4_stream_get_ram(stream, sample, RCB4_AD_BASE_ADDR + 2*ad_id, value, 2);
+}
+
+uint32_t rcb4_stream_get_errors(const rcb4_stream* stream)
+{
+	assert(stream);
+	
+	return __atomic_load_n(&stream->errors, __ATOMIC_RELAXED);
+}
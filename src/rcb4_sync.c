@@ -0,0 +1,317 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_sync.c
+ * @brief Incremental upload of ROM images.
+ * 
+ * @details A local index remembers what was written to each block of the ROM
+ * of every robot. When a new image is synced only the blocks whose hash
+ * changed are uploaded. A random sample of the blocks that should not have
+ * changed is checked against the robot first; if any of them differs the
+ * index can't be trusted and every block is checked.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_sync.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+// Block states during a sync
+#define RCB4_SYNC_SAME 0 // Already in the robot (according to the index)
+#define RCB4_SYNC_CHANGED 1 // Must be uploaded
+#define RCB4_SYNC_CHECKED 2 // Checked against the robot, same contents
+
+static
+int rcb4_sync_path(char* path, size_t size, const char* index_dir, const char* robot_id)
+{
+	size_t len = strlen(robot_id);
+	
+	if(len == 0 || len >= RCB4_SYNC_MAX_ID || strchr(robot_id, '/') || robot_id[0] == '.')
+	{
+		fprintf(stderr, "Invalid robot id \"%s\".\n", robot_id);
+		return -1;
+	}
+	if((size_t)snprintf(path, size, "%s/%s.idx", index_dir ? index_dir : ".", robot_id) >= size)
+	{
+		fprintf(stderr, "The index path is too long.\n");
+		return -1;
+	}
+	return 0;
+}
+
+// Loads the index. If there is none (or it is not valid) all the blocks are unknown
+static
+void rcb4_sync_load(const char* path, struct s_rcb4_sync_index* index)
+{
+	FILE* file;
+	
+	file = fopen(path, "rb");
+	if(file)
+	{
+		if(fread(index, sizeof(*index), 1, file) == 1 && index->header.magic == RCB4_SYNC_MAGIC &&
+		   index->header.version == RCB4_SYNC_VERSION && index->header.header_size == sizeof(index->header) &&
+		   index->header.block_size == RCB4_SYNC_BLOCK_SIZE && index->header.blocks == RCB4_SYNC_BLOCKS)
+		{
+			fclose(file);
+			return;
+		}
+		fprintf(stderr, "Ignoring invalid index %s.\n", path);
+		fclose(file);
+	}
+	
+	memset(index, 0, sizeof(*index));
+	index->header.magic = RCB4_SYNC_MAGIC;
+	index->header.version = RCB4_SYNC_VERSION;
+	index->header.header_size = sizeof(index->header);
+	index->header.block_size = RCB4_SYNC_BLOCK_SIZE;
+	index->header.blocks = RCB4_SYNC_BLOCKS;
+}
+
+// Saves the index (to a temporary file first so a crash never leaves half an index)
+static
+int rcb4_sync_save(const char* path, const struct s_rcb4_sync_index* index)
+{
+	FILE* file;
+	char tmp[512];
+	
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	file = fopen(tmp, "wb");
+	if(!file)
+	{
+		fprintf(stderr, "Error saving the index %s. (%s)\n", path, strerror(errno));
+		return -1;
+	}
+	if(fwrite(index, sizeof(*index), 1, file) != 1 || fflush(file) != 0 || fsync(fileno(file)) != 0)
+	{
+		fprintf(stderr, "Error saving the index %s.\n", path);
+		fclose(file);
+		unlink(tmp);
+		return -1;
+	}
+	fclose(file);
+	
+	if(rename(tmp, path) != 0)
+	{
+		fprintf(stderr, "Error saving the index %s. (%s)\n", path, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+// Checks a block against the robot. Returns 1 if it is the same, 0 if not, < 0 on error
+static
+int rcb4_sync_check(rcb4_connection* conn, uint32_t block, uint64_t hash, uint32_t length)
+{
+	uint64_t rom;
+	
+	if(rcb4_rom_hash(conn, block * RCB4_SYNC_BLOCK_SIZE, length, &rom) != 0)
+		return -1;
+	return rom == hash;
+}
+
+int rcb4_rom_sync(rcb4_connection* conn, const char* index_dir, const char* robot_id, uint32_t addr,
+                  const void* image, uint32_t len, uint32_t samples, rcb4_sync_stats* stats)
+{
+	int err = 0;
+	uint32_t b, first, last, end, n, candidates, pick, seed;
+	uint8_t state[RCB4_SYNC_BLOCKS];
+	uint64_t hash[RCB4_SYNC_BLOCKS];
+	uint32_t length[RCB4_SYNC_BLOCKS];
+	uint32_t same[RCB4_SYNC_BLOCKS];
+	char path[512];
+	const uint8_t* data = (const uint8_t*)image;
+	struct s_rcb4_sync_index* index;
+	rcb4_sync_stats local;
+	
+	assert(conn);
+	assert(robot_id);
+	assert(image);
+	
+	if(!stats)
+		stats = &local;
+	memset(stats, 0, sizeof(*stats));
+	
+	if(addr % RCB4_SYNC_BLOCK_SIZE != 0)
+	{
+		fprintf(stderr, "The address must be a multiple of %d.\n", RCB4_SYNC_BLOCK_SIZE);
+		return -1;
+	}
+	if(len == 0 || addr > RCB4_MAX_ROM_ADDRESS || len - 1 > RCB4_MAX_ROM_ADDRESS - addr)
+	{
+		fprintf(stderr, "Invalid ROM range. Allowed address: 0x000000~0x%06X\n", RCB4_MAX_ROM_ADDRESS);
+		return -1;
+	}
+	if(rcb4_sync_path(path, sizeof(path), index_dir, robot_id) != 0)
+		return -1;
+	
+	index = (struct s_rcb4_sync_index*)malloc(sizeof(struct s_rcb4_sync_index));
+	if(!index)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return -1;
+	}
+	rcb4_sync_load(path, index);
+	
+	// Compare the image with the index
+	first = addr / RCB4_SYNC_BLOCK_SIZE;
+	last = (addr + len - 1) / RCB4_SYNC_BLOCK_SIZE;
+	candidates = 0;
+	for(b = first; b <= last; b++)
+	{
+		n = (b == last) ? addr + len - b * RCB4_SYNC_BLOCK_SIZE : RCB4_SYNC_BLOCK_SIZE;
+		length[b] = n;
+		hash[b] = rcb4_util_hash(RCB4_HASH_INIT, data + (b - first) * RCB4_SYNC_BLOCK_SIZE, n);
+		if(index->block[b].length == n && index->block[b].hash == hash[b])
+		{
+			state[b] = RCB4_SYNC_SAME;
+			same[candidates++] = b;
+		}
+		else
+		{
+			state[b] = RCB4_SYNC_CHANGED;
+			stats->changed++;
+		}
+		stats->blocks++;
+	}
+	
+	// Spot-check some of the blocks the index says are already there
+	seed = (uint32_t)rcb4_util_time_ns() | 1;
+	for(n = 0; n < samples && n < candidates && err == 0; n++)
+	{
+		seed ^= seed << 13; // xorshift32
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		pick = n + seed % (candidates - n);
+		b = same[pick];
+		same[pick] = same[n];
+		same[n] = b;
+		
+		err = rcb4_sync_check(conn, b, hash[b], length[b]);
+		stats->verified++;
+		if(err == 1)
+		{
+			state[b] = RCB4_SYNC_CHECKED;
+			err = 0;
+		}
+		else if(err == 0)
+		{
+			err = 1; // Someone else wrote to the robot, the index is stale
+		}
+	}
+	
+	// Stale index: check every block (reading is cheaper than writing flash)
+	if(err == 1)
+	{
+		stats->stale = 1;
+		err = 0;
+		for(b = first; b <= last && err >= 0; b++)
+		{
+			if(state[b] != RCB4_SYNC_SAME)
+				continue;
+			
+			err = rcb4_sync_check(conn, b, hash[b], length[b]);
+			stats->verified++;
+			if(err == 0)
+			{
+				state[b] = RCB4_SYNC_CHANGED;
+				stats->changed++;
+			}
+			else if(err == 1)
+			{
+				state[b] = RCB4_SYNC_CHECKED;
+			}
+		}
+		if(err > 0)
+			err = 0;
+	}
+	
+	// Upload the changed blocks, contiguous ones in a single transfer
+	for(b = first; b <= last && err == 0; b = end)
+	{
+		if(state[b] != RCB4_SYNC_CHANGED)
+		{
+			end = b + 1;
+			continue;
+		}
+		
+		n = 0;
+		for(end = b; end <= last && state[end] == RCB4_SYNC_CHANGED; end++)
+		{
+			index->block[end].length = 0; // Unknown until the write finishes
+			n += length[end];
+		}
+		
+		err = rcb4_rom_write(conn, b * RCB4_SYNC_BLOCK_SIZE, data + (b - first) * RCB4_SYNC_BLOCK_SIZE, n);
+		if(err == 0)
+		{
+			for(; b < end; b++)
+			{
+				index->block[b].hash = hash[b];
+				index->block[b].length = length[b];
+			}
+			stats->bytes_written += n;
+		}
+	}
+	
+	// The blocks that were checked against the robot are known to be right
+	for(b = first; b <= last; b++)
+	{
+		if(state[b] == RCB4_SYNC_CHECKED)
+		{
+			index->block[b].hash = hash[b];
+			index->block[b].length = length[b];
+		}
+	}
+	
+	if(rcb4_sync_save(path, index) != 0 && err == 0)
+		err = -1;
+	
+	free(index);
+	return err;
+}
+
+int rcb4_rom_sync_forget(const char* index_dir, const char* robot_id)
+{
+	char path[512];
+	
+	assert(robot_id);
+	
+	if(rcb4_sync_path(path, sizeof(path), index_dir, robot_id) != 0)
+		return -1;
+	if(unlink(path) != 0 && errno != ENOENT)
+	{
+		fprintf(stderr, "Error deleting the index %s. (%s)\n", path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
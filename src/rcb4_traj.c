@@ -0,0 +1,481 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rcb4_traj.c
+ * @brief Host side interpolation and streaming of motions.
+ * 
+ * @details The motion is described with timed keyframes. The positions of all
+ * the servos are interpolated on the host and sent as RCB4_COMM_CONST frames at
+ * a fixed rate. The frame to send is chosen from the elapsed time, not from the
+ * number of frames sent, so a slow link drops frames instead of slowing the
+ * motion down.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_config.h"
+#include "rcb4_connection.h"
+#include "rcb4_command.h"
+#include "rcb4_traj.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+// Allocates keys rows aligned to RCB4_TRAJ_ALIGN
+static
+float* rcb4_traj_alloc_rows(int keys)
+{
+	return (float*)aligned_alloc(RCB4_TRAJ_ALIGN, (size_t)keys * RCB4_TRAJ_STRIDE * sizeof(float));
+}
+
+rcb4_traj* rcb4_traj_create(rcb4_connection* conn, uint32_t period_usecs)
+{
+	rcb4_traj* traj;
+	
+	assert(conn);
+	
+	if(period_usecs == 0)
+	{
+		fprintf(stderr, "Invalid period.\n");
+		return NULL;
+	}
+	
+	traj = (rcb4_traj*)malloc(sizeof(rcb4_traj));
+	if(!traj)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return NULL;
+	}
+	
+	memset(traj, 0, sizeof(rcb4_traj));
+	traj->conn = conn;
+	traj->period_usecs = period_usecs;
+	traj->mode = RCB4_TRAJ_MINJERK;
+	traj->speed = 255; // The interpolation is done here, let the servos follow as fast as they can
+	traj->capacity = RCB4_TRAJ_INITIAL_KEYS;
+	traj->time = (uint32_t*)malloc(traj->capacity * sizeof(uint32_t));
+	traj->pos = rcb4_traj_alloc_rows(traj->capacity);
+	traj->tangent = rcb4_traj_alloc_rows(traj->capacity);
+	if(!traj->time || !traj->pos || !traj->tangent)
+	{
+		fprintf(stderr, "Memory error.\n");
+		rcb4_traj_delete(traj);
+		return NULL;
+	}
+	
+	return traj;
+}
+
+void rcb4_traj_delete(rcb4_traj* traj)
+{
+	if(!traj)return;
+	
+	free(traj->time);
+	free(traj->pos);
+	free(traj->tangent);
+	free(traj);
+}
+
+int rcb4_traj_set_interpolation(rcb4_traj* traj, int mode)
+{
+	assert(traj);
+	
+	if(mode != RCB4_TRAJ_LINEAR && mode != RCB4_TRAJ_CUBIC && mode != RCB4_TRAJ_MINJERK)
+	{
+		fprintf(stderr, "Invalid interpolation mode.\n");
+		return -1;
+	}
+	
+	traj->mode = mode;
+	traj->start = 0; // The lookahead frames are no longer valid
+	return 0;
+}
+
+int rcb4_traj_set_speed(rcb4_traj* traj, uint8_t speed)
+{
+	assert(traj);
+	
+	if(speed == 0)
+	{
+		fprintf(stderr, "Invalid speed value.\n");
+		return -1;
+	}
+	
+	traj->speed = speed;
+	traj->start = 0;
+	return 0;
+}
+
+void rcb4_traj_clear(rcb4_traj* traj)
+{
+	assert(traj);
+	
+	traj->keys = 0;
+	traj->used = 0;
+	traj->prepared = 0;
+	traj->start = 0;
+}
+
+static
+int rcb4_traj_grow(rcb4_traj* traj)
+{
+	int capacity = traj->capacity * 2;
+	uint32_t* time;
+	float *pos, *tangent;
+	
+	time = (uint32_t*)realloc(traj->time, capacity * sizeof(uint32_t));
+	if(!time)
+		return -1;
+	traj->time = time;
+	
+	pos = rcb4_traj_alloc_rows(capacity);
+	tangent = rcb4_traj_alloc_rows(capacity);
+	if(!pos || !tangent)
+	{
+		free(pos);
+		free(tangent);
+		return -1;
+	}
+	
+	memcpy(pos, traj->pos, (size_t)traj->keys * RCB4_TRAJ_STRIDE * sizeof(float));
+	free(traj->pos);
+	free(traj->tangent);
+	traj->pos = pos;
+	traj->tangent = tangent;
+	traj->capacity = capacity;
+	traj->prepared = 0;
+	
+	return 0;
+}
+
+int rcb4_traj_add_keyframe(rcb4_traj* traj, uint32_t time_ms, uint64_t mask, const uint16_t* positions)
+{
+	int i, k;
+	float* row;
+	
+	assert(traj);
+	assert(positions);
+	
+	if(mask == 0 || (mask >> RCB4_ICS_QTY) != 0)
+	{
+		fprintf(stderr, "Invalid servo mask. Allowed servos: 1~%d\n", RCB4_ICS_QTY);
+		return -1;
+	}
+	if(traj->keys > 0 && time_ms <= traj->time[traj->keys - 1])
+	{
+		fprintf(stderr, "The keyframes must be added in order. Last time: %u ms.\n", traj->time[traj->keys - 1]);
+		return -1;
+	}
+	if(traj->keys == traj->capacity && rcb4_traj_grow(traj) != 0)
+	{
+		fprintf(stderr, "Memory error.\n");
+		return -1;
+	}
+	
+	row = traj->pos + (size_t)traj->keys * RCB4_TRAJ_STRIDE;
+	if(traj->keys > 0) // The servos that are not in the mask keep their position
+		memcpy(row, row - RCB4_TRAJ_STRIDE, RCB4_TRAJ_STRIDE * sizeof(float));
+	else
+		memset(row, 0, RCB4_TRAJ_STRIDE * sizeof(float));
+	
+	for(i = 0; i < RCB4_ICS_QTY; i++)
+	{
+		if(!((mask >> i) & 1))
+			continue;
+		
+		row[i] = positions[i];
+		if(!((traj->used >> i) & 1)) // First time we see this servo, hold it until now
+		{
+			for(k = 0; k < traj->keys; k++)
+				traj->pos[(size_t)k * RCB4_TRAJ_STRIDE + i] = positions[i];
+		}
+	}
+	
+	traj->time[traj->keys] = time_ms;
+	traj->used |= mask;
+	traj->keys++;
+	traj->prepared = 0;
+	traj->start = 0;
+	
+	return 0;
+}
+
+uint32_t rcb4_traj_get_duration(const rcb4_traj* traj)
+{
+	assert(traj);
+	
+	return (traj->keys > 0) ? traj->time[traj->keys - 1] : 0;
+}
+
+// Catmull-Rom tangents, zero at both ends so the motion starts and stops smoothly
+static
+void rcb4_traj_prepare(rcb4_traj* traj)
+{
+	int i, k;
+	float dt;
+	const float *prev, *next;
+	float* m;
+	
+	for(k = 0; k < traj->keys; k++)
+	{
+		m = traj->tangent + (size_t)k * RCB4_TRAJ_STRIDE;
+		if(k == 0 || k == traj->keys - 1)
+		{
+			memset(m, 0, RCB4_TRAJ_STRIDE * sizeof(float));
+			continue;
+		}
+		
+		prev = traj->pos + (size_t)(k - 1) * RCB4_TRAJ_STRIDE;
+		next = traj->pos + (size_t)(k + 1) * RCB4_TRAJ_STRIDE;
+		dt = (float)(traj->time[k + 1] - traj->time[k - 1]);
+		for(i = 0; i < RCB4_TRAJ_STRIDE; i++)
+			m[i] = (next[i] - prev[i]) / dt;
+	}
+	
+	traj->prepared = 1;
+}
+
+/* out = a*p0 + b*p1 + c*m0 + d*m1 for all the servos. Every interpolation mode
+ * reduces to this, only the coefficients change. */
+static
+void rcb4_traj_blend(float* restrict out, const float* restrict p0, const float* restrict p1,
+                     const float* restrict m0, const float* restrict m1, float a, float b, float c, float d)
+{
+	int i;
+	
+	p0 = __builtin_assume_aligned(p0, RCB4_TRAJ_ALIGN);
+	p1 = __builtin_assume_aligned(p1, RCB4_TRAJ_ALIGN);
+	m0 = __builtin_assume_aligned(m0, RCB4_TRAJ_ALIGN);
+	m1 = __builtin_assume_aligned(m1, RCB4_TRAJ_ALIGN);
+	
+	for(i = 0; i < RCB4_TRAJ_STRIDE; i++)
+		out[i] = a*p0[i] + b*p1[i] + c*m0[i] + d*m1[i];
+}
+
+// Positions of all the servos at time t (milliseconds)
+static
+void rcb4_traj_eval(rcb4_traj* traj, double t, float* out)
+{
+	int lo, hi, mid;
+	size_t k;
+	float s, s2, s3, T, a, b, c = 0, d = 0;
+	
+	if(!traj->prepared)
+		rcb4_traj_prepare(traj);
+	
+	if(traj->keys == 1 || t <= traj->time[0])
+	{
+		memcpy(out, traj->pos, RCB4_TRAJ_STRIDE * sizeof(float));
+		return;
+	}
+	if(t >= traj->time[traj->keys - 1])
+	{
+		memcpy(out, traj->pos + (size_t)(traj->keys - 1) * RCB4_TRAJ_STRIDE, RCB4_TRAJ_STRIDE * sizeof(float));
+		return;
+	}
+	
+	// Find the segment: time[lo] <= t < time[lo+1]
+	lo = 0;
+	hi = traj->keys - 1;
+	while(hi - lo > 1)
+	{
+		mid = (lo + hi) / 2;
+		if(traj->time[mid] <= t)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	
+	k = (size_t)lo * RCB4_TRAJ_STRIDE;
+	T = (float)(traj->time[lo + 1] - traj->time[lo]);
+	s = (float)(t - traj->time[lo]) / T;
+	s2 = s*s;
+	s3 = s2*s;
+	
+	switch(traj->mode)
+	{
+		case RCB4_TRAJ_LINEAR:
+			b = s;
+			break;
+		case RCB4_TRAJ_MINJERK: // 10s^3 - 15s^4 + 6s^5
+			b = s3 * (10.0f - 15.0f*s + 6.0f*s2);
+			break;
+		case RCB4_TRAJ_CUBIC: // Hermite
+		default:
+			b = -2.0f*s3 + 3.0f*s2;
+			c = (s3 - 2.0f*s2 + s) * T;
+			d = (s3 - s2) * T;
+			break;
+	}
+	a = 1.0f - b;
+	
+	rcb4_traj_blend(out, traj->pos + k, traj->pos + k + RCB4_TRAJ_STRIDE,
+	                traj->tangent + k, traj->tangent + k + RCB4_TRAJ_STRIDE, a, b, c, d);
+}
+
+int rcb4_traj_sample(rcb4_traj* traj, uint64_t time_usecs, uint16_t* positions)
+{
+	int i;
+	float out[RCB4_TRAJ_STRIDE] __attribute__((aligned(RCB4_TRAJ_ALIGN)));
+	
+	assert(traj);
+	assert(positions);
+	
+	if(traj->keys == 0)
+	{
+		fprintf(stderr, "The trajectory has no keyframes.\n");
+		return -1;
+	}
+	
+	rcb4_traj_eval(traj, time_usecs / 1000.0, out);
+	for(i = 0; i < RCB4_ICS_QTY; i++)
+		positions[i] = (out[i] <= 0.0f) ? 0 : (out[i] >= 65535.0f) ? 65535 : (uint16_t)(out[i] + 0.5f);
+	
+	return 0;
+}
+
+// Builds the CONST frame of frame number n
+static
+void rcb4_traj_encode(rcb4_traj* traj, int64_t n, struct s_rcb4_traj_frame* frame)
+{
+	int i;
+	uint16_t positions[RCB4_ICS_QTY];
+	
+	rcb4_traj_sample(traj, (uint64_t)n * traj->period_usecs, positions);
+	
+	rcb4_command_recreate(&frame->comm, RCB4_COMM_CONST);
+	rcb4_command_set_speed(&frame->comm, traj->speed);
+	for(i = 0; i < RCB4_ICS_QTY; i++)
+	{
+		if((traj->used >> i) & 1)
+			rcb4_command_set_servo(&frame->comm, i + 1, traj->speed, positions[i]);
+	}
+	frame->number = n;
+}
+
+// Frame that lands on (or just after) the last keyframe
+static
+int64_t rcb4_traj_last_frame(const rcb4_traj* traj)
+{
+	uint64_t duration = (uint64_t)traj->time[traj->keys - 1] * 1000;
+	
+	return (duration + traj->period_usecs - 1) / traj->period_usecs;
+}
+
+int rcb4_traj_start(rcb4_traj* traj)
+{
+	int i;
+	int64_t last;
+	
+	assert(traj);
+	
+	if(traj->keys == 0)
+	{
+		fprintf(stderr, "The trajectory has no keyframes.\n");
+		return -1;
+	}
+	
+	last = rcb4_traj_last_frame(traj);
+	for(i = 0; i < RCB4_TRAJ_LOOKAHEAD; i++)
+	{
+		traj->frame[i].number = -1;
+		if(i <= last)
+			rcb4_traj_encode(traj, i, &traj->frame[i]);
+	}
+	traj->sent = -1;
+	traj->start = rcb4_util_time_ns();
+	
+	return 0;
+}
+
+int rcb4_traj_update(rcb4_traj* traj)
+{
+	int err;
+	int64_t n, m, last;
+	struct s_rcb4_traj_frame* frame;
+	
+	assert(traj);
+	
+	if(traj->start == 0)
+	{
+		fprintf(stderr, "The trajectory is not started.\n");
+		return -1;
+	}
+	
+	// The frame is chosen by time. If we are late the frames in between are dropped.
+	last = rcb4_traj_last_frame(traj);
+	n = (rcb4_util_time_ns() - traj->start) / ((uint64_t)traj->period_usecs * 1000);
+	if(n > last)
+		n = last;
+	if(n <= traj->sent)
+		return (traj->sent >= last) ? 0 : 1;
+	
+	frame = &traj->frame[n % RCB4_TRAJ_LOOKAHEAD];
+	if(frame->number != n) // Too late even for the lookahead
+		rcb4_traj_encode(traj, n, frame);
+	
+	rcb4_conn_lock(traj->conn);
+	err = rcb4_conn_transact(traj->conn, &frame->comm, NULL);
+	rcb4_conn_unlock(traj->conn);
+	if(err < 0)
+		return err;
+	traj->sent = n;
+	
+	// Encode the next frames now, so the next updates only have to send them
+	for(m = n + 1; m < n + RCB4_TRAJ_LOOKAHEAD && m <= last; m++)
+	{
+		frame = &traj->frame[m % RCB4_TRAJ_LOOKAHEAD];
+		if(frame->number != m)
+			rcb4_traj_encode(traj, m, frame);
+	}
+	
+	return (n >= last) ? 0 : 1;
+}
+
+int rcb4_traj_play(rcb4_traj* traj)
+{
+	int ret;
+	uint64_t next;
+	struct timespec ts;
+	
+	assert(traj);
+	
+	if(rcb4_traj_start(traj) != 0)
+		return -1;
+	
+	while((ret = rcb4_traj_update(traj)) > 0)
+	{
+		next = traj->start + (uint64_t)(traj->sent + 1) * traj->period_usecs * 1000;
+		ts.tv_sec = next / 1000000000ULL;
+		ts.tv_nsec = next % 1000000000ULL;
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+	}
+	
+	return ret;
+}
@@ -0,0 +1,418 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file rcb4_transport.c
+ * @brief Transports built on a file descriptor: serial port, pseudo-terminal
+ * and Unix socket.
+ * 
+ * @details The serial port backend is the one rcb4_init() has always used,
+ * speed hack included. The pseudo-terminal backend talks to emulators and
+ * simulators without touching the serial driver, and the Unix socket backend
+ * connects to a bridge (for example a daemon that owns the real port).
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#define _GNU_SOURCE // ppoll
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_transport.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/serial.h>
+
+int rcb4_transport_fd_write(struct s_rcb4_transport* t, const uint8_t* buffer, uint16_t length)
+{
+	int err;
+	uint16_t sent = 0;
+	
+	while(sent < length)
+	{
+		err = write(t->fd, buffer + sent, length - sent);
+		if(err < 0 && errno == EINTR)
+			continue;
+		if(err <= 0)
+			return -1;
+		sent += err;
+	}
+	
+	return 0;
+}
+
+int rcb4_transport_fd_read(struct s_rcb4_transport* t, uint8_t* buffer, uint16_t length, uint64_t deadline)
+{
+	int rv;
+	uint64_t now;
+	struct pollfd pfd;
+	struct timespec timeout;
+	
+	for(;;)
+	{
+		now = rcb4_util_time_ns();
+		if(now >= deadline)
+			return -10;
+		
+		timeout.tv_sec = (deadline - now) / 1000000000ULL;
+		timeout.tv_nsec = (deadline - now) % 1000000000ULL;
+		pfd.fd = t->fd;
+		pfd.events = POLLIN;
+		rv = ppoll(&pfd, 1, &timeout, NULL);
+		if(rv < 0 && errno == EINTR)
+			continue;
+		if(rv < 0)
+			return -1;
+		if(rv == 0)
+			return -10;
+		
+		rv = read(t->fd, buffer, length);
+		if(rv < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		return (rv > 0) ? rv : -1; // 0 = the other end is gone
+	}
+}
+
+
+/***************
+ * SERIAL PORT *
+ ***************/
+
+/* The kernel may give the adapter another ttyUSB number when it is plugged
+ * back, but udev keeps a link named after its serial number. Copies that link
+ * to stable, or path itself if there is none. Returns 0 if a link was found. */
+int rcb4_transport_stable_path(const char* path, char* stable, size_t size)
+{
+	DIR* dir;
+	struct dirent* entry;
+	char real[PATH_MAX], link[PATH_MAX], target[PATH_MAX];
+	
+	snprintf(stable, size, "%s", path);
+	if(!realpath(path, real) || !(dir = opendir(RCB4_SERIAL_BY_ID)))
+		return -1;
+	
+	while((entry = readdir(dir)) != NULL)
+	{
+		if(entry->d_name[0] == '.')
+			continue;
+		if(snprintf(link, sizeof(link), "%s/%s", RCB4_SERIAL_BY_ID, entry->d_name) >= (int)sizeof(link))
+			continue;
+		if(realpath(link, target) && strcmp(target, real) == 0)
+		{
+			snprintf(stable, size, "%s", link);
+			closedir(dir);
+			return 0;
+		}
+	}
+	
+	closedir(dir);
+	return -1;
+}
+
+static
+int rcb4_tty_open(struct s_rcb4_transport* t, const char* path)
+{
+	struct s_rcb4_tty* tty;
+	struct serial_struct ss;
+	const int speed = RCB4_FAST_BAUD_RATE;
+	
+	tty = (struct s_rcb4_tty*)malloc(sizeof(struct s_rcb4_tty));
+	if(!tty)
+	{
+		fprintf(stderr, "Error opening %s for read/write.\nMemory error.\n", path);
+		return -1;
+	}
+	
+	// Check serial access
+	if((t->fd = open(path, O_RDWR | O_NOCTTY | O_SYNC)) < 0)
+	{
+		if(errno == EBUSY)
+			fprintf(stderr, "Error opening %s for read/write.\nAnother program (rcb4d?) is using the device.\n", path);
+		else
+			fprintf(stderr, "Error opening %s for read/write.\nCheck that you have permission to access the device and that it is plugged correctly.\n", path);
+		free(tty);
+		return -1;
+	}
+	
+	// Nobody else can open it until we close it, two programs driving the same robot would mix their frames
+	if(ioctl(t->fd, TIOCEXCL) < 0)
+	{
+		fprintf(stderr, "Error opening %s for read/write.\nCannot get exclusive access.\n", path);
+		close(t->fd);
+		free(tty);
+		return -1;
+	}
+	
+	// Save old configuration
+	tcgetattr(t->fd, &tty->old_cfg);
+	
+	// Speed hack (https://stackoverflow.com/questions/4968529/how-to-set-baud-rate-to-307200-on-linux)
+	ss.reserved_char[0] = 0;
+	if(ioctl(t->fd, TIOCGSERIAL, &ss) < 0)
+	{
+		fprintf(stderr, "Cannot set serial port speed. ioctl failed.\n");
+		close(t->fd);
+		free(tty);
+		return -1;
+	}
+	
+	ss.flags = (ss.flags & ~ASYNC_SPD_MASK) | ASYNC_SPD_CUST;
+	ss.custom_divisor = (ss.baud_base + (speed / 2)) / speed;
+	
+	if(ss.custom_divisor < 1) 
+		ss.custom_divisor = 1;
+	if(ioctl(t->fd, TIOCSSERIAL, &ss) < 0 || ioctl(t->fd, TIOCGSERIAL, &ss) < 0)
+	{
+		fprintf(stderr, "Cannot set serial port speed. ioctl failed.\n");
+		close(t->fd);
+		free(tty);
+		return -1;
+	}
+	
+	// Check that the speed is not too far away from what we want
+	tty->closest_speed = ss.baud_base / ss.custom_divisor;
+	
+	if(tty->closest_speed < speed * 98 / 100 || tty->closest_speed > speed * 102 / 100)
+	{
+	    fprintf(stderr, "Cannot set serial port speed to %d. Closest possible is %d\n", speed, tty->closest_speed);
+	}
+	
+	// End of speed hack
+	
+	// Configure the terminal
+	memset(&tty->cfg, 0, sizeof(tty->cfg));
+	tty->cfg.c_cflag = PARENB | CS8 | CLOCAL | CREAD; // Control flags: Parity (even), 8bits, ignore control lines, enable read
+	tty->cfg.c_iflag = 0; // Input flags
+	tty->cfg.c_oflag = 0; // Output flags
+	tty->cfg.c_lflag = 0; // Local flags
+	tty->cfg.c_cc[VTIME] = 0; // Inter-character timer off
+	tty->cfg.c_cc[VMIN] = 1; // Minimum 1 byte to return from read()
+	
+	fcntl(t->fd, F_SETFL, 0); // Blocking mode
+	
+	t->data = tty;
+	return 0;
+}
+
+// Slow speed (115200) or the speed hack (1250000, B38400 is replaced by the custom divisor)
+static
+int rcb4_tty_set_speed(struct s_rcb4_transport* t, int fast, float* error)
+{
+	struct s_rcb4_tty* tty = (struct s_rcb4_tty*)t->data;
+	
+	cfsetispeed(&tty->cfg, fast ? B38400 : RCB4_BAUD_RATE); // Input speed
+	cfsetospeed(&tty->cfg, fast ? B38400 : RCB4_BAUD_RATE); // Output speed
+	
+	tcflush(t->fd, TCIFLUSH); // Flush old messages
+	
+	if(tcsetattr(t->fd, TCSANOW, &tty->cfg) != 0) // Apply the configuration
+	{
+		fprintf(stderr, "Error configuring the terminal.\n");
+		return -1;
+	}
+	
+	if(!fast)
+	{
+		*error = 0.0f;
+		return 115200;
+	}
+	*error = 100.0f * abs(tty->closest_speed - RCB4_FAST_BAUD_RATE) / RCB4_FAST_BAUD_RATE;
+	return tty->closest_speed;
+}
+
+static
+void rcb4_tty_flush(struct s_rcb4_transport* t)
+{
+	tcflush(t->fd, TCIFLUSH);
+}
+
+static
+void rcb4_tty_close(struct s_rcb4_transport* t)
+{
+	struct s_rcb4_tty* tty = (struct s_rcb4_tty*)t->data;
+	struct serial_struct ss;
+	
+	// Disable speed hack
+	ioctl(t->fd, TIOCGSERIAL, &ss);
+	ss.flags &= ~ASYNC_SPD_MASK;
+	ioctl(t->fd, TIOCSSERIAL, &ss);
+	
+	tcsetattr(t->fd, TCSANOW, &tty->old_cfg); // Pop back the original configuration
+	close(t->fd);
+	free(tty);
+}
+
+const struct s_rcb4_transport_ops rcb4_transport_tty =
+{
+	"tty",
+	RCB4_TRANSPORT_POLLABLE | RCB4_TRANSPORT_SPEED | RCB4_TRANSPORT_PACED,
+	rcb4_tty_open,
+	rcb4_transport_fd_write,
+	rcb4_transport_fd_read,
+	rcb4_tty_flush,
+	rcb4_tty_set_speed,
+	rcb4_tty_close
+};
+
+
+/*******************
+ * PSEUDO-TERMINAL *
+ *******************/
+
+// Raw mode, no speed hack (the pty driver doesn't have one)
+static
+int rcb4_pty_open(struct s_rcb4_transport* t, const char* path)
+{
+	struct s_rcb4_tty* tty;
+	
+	tty = (struct s_rcb4_tty*)malloc(sizeof(struct s_rcb4_tty));
+	if(!tty)
+	{
+		fprintf(stderr, "Error opening %s for read/write.\nMemory error.\n", path);
+		return -1;
+	}
+	
+	if((t->fd = open(path, O_RDWR | O_NOCTTY)) < 0)
+	{
+		fprintf(stderr, "Error opening %s for read/write.\n", path);
+		free(tty);
+		return -1;
+	}
+	
+	if(tcgetattr(t->fd, &tty->old_cfg) != 0)
+	{
+		fprintf(stderr, "Error configuring the terminal. Is %s a terminal?\n", path);
+		close(t->fd);
+		free(tty);
+		return -1;
+	}
+	tty->cfg = tty->old_cfg;
+	cfmakeraw(&tty->cfg);
+	tcflush(t->fd, TCIFLUSH);
+	if(tcsetattr(t->fd, TCSANOW, &tty->cfg) != 0)
+	{
+		fprintf(stderr, "Error configuring the terminal.\n");
+		close(t->fd);
+		free(tty);
+		return -1;
+	}
+	
+	t->data = tty;
+	return 0;
+}
+
+static
+void rcb4_pty_close(struct s_rcb4_transport* t)
+{
+	struct s_rcb4_tty* tty = (struct s_rcb4_tty*)t->data;
+	
+	tcsetattr(t->fd, TCSANOW, &tty->old_cfg);
+	close(t->fd);
+	free(tty);
+}
+
+const struct s_rcb4_transport_ops rcb4_transport_pty =
+{
+	"pty",
+	RCB4_TRANSPORT_POLLABLE,
+	rcb4_pty_open,
+	rcb4_transport_fd_write,
+	rcb4_transport_fd_read,
+	rcb4_tty_flush,
+	NULL,
+	rcb4_pty_close
+};
+
+
+/***************
+ * UNIX SOCKET *
+ ***************/
+
+static
+int rcb4_unix_open(struct s_rcb4_transport* t, const char* path)
+{
+	struct sockaddr_un addr;
+	
+	if(strlen(path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return -1;
+	}
+	
+	t->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(t->fd < 0)
+	{
+		fprintf(stderr, "Error creating the socket.\n");
+		return -1;
+	}
+	
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if(connect(t->fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+	{
+		fprintf(stderr, "Error connecting to %s.\n", path);
+		close(t->fd);
+		return -1;
+	}
+	
+	return 0;
+}
+
+static
+void rcb4_unix_flush(struct s_rcb4_transport* t)
+{
+	uint8_t buffer[256];
+	
+	while(recv(t->fd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0);
+}
+
+static
+void rcb4_unix_close(struct s_rcb4_transport* t)
+{
+	close(t->fd);
+}
+
+const struct s_rcb4_transport_ops rcb4_transport_unix =
+{
+	"unix",
+	RCB4_TRANSPORT_POLLABLE,
+	rcb4_unix_open,
+	rcb4_transport_fd_write,
+	rcb4_transport_fd_read,
+	rcb4_unix_flush,
+	NULL,
+	rcb4_unix_close
+};
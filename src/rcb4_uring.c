@@ -0,0 +1,225 @@
+/*
+ *  This file is part of librcb4.
+ *
+ *  librcb4 is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  librcb4 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with librcb4.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file rcb4_uring.c
+ * @brief Minimal io_uring wrapper used by the reactor.
+ * 
+ * @details Sets up the submission and completion rings with the raw system
+ * calls, so the library doesn't depend on liburing.
+ * 
+ * @version 1.0
+ * @date October 2026
+ * 
+ * @author Alfonso Arbona Gimeno (alargi@etsii.upv.es, alf@katolab.nitech.ac.jp).
+ * 
+ * @copyright Copyright 2015 Alfonso Arbona Gimeno.
+ * This project is released under the GNU Public License v3.
+ * See COPYING for a full copy of the license.
+ */
+
+#include "rcb4.h"
+#include "rcb4_private.h"
+#include "rcb4_uring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+int rcb4_uring_init(struct s_rcb4_uring* u, uint32_t entries)
+{
+	struct io_uring_params p;
+	uint8_t* sq;
+	uint8_t* cq;
+	
+	assert(u);
+	
+	memset(u, 0, sizeof(struct s_rcb4_uring));
+	memset(&p, 0, sizeof(p));
+	u->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if(u->fd < 0)
+	{
+		fprintf(stderr, "Error setting up io_uring.\n");
+		u->fd = -1;
+		return -1;
+	}
+	
+	u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP) // One mapping for both rings
+	{
+		if(u->cq_ring_size > u->sq_ring_size)
+			u->sq_ring_size = u->cq_ring_size;
+		u->cq_ring_size = 0;
+	}
+	
+	u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if(u->sq_ring == MAP_FAILED)
+	{
+		fprintf(stderr, "Error mapping the io_uring rings.\n");
+		close(u->fd);
+		u->fd = -1;
+		return -1;
+	}
+	if(u->cq_ring_size == 0)
+	{
+		u->cq_ring = u->sq_ring;
+	}
+	else
+	{
+		u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if(u->cq_ring == MAP_FAILED)
+		{
+			fprintf(stderr, "Error mapping the io_uring rings.\n");
+			munmap(u->sq_ring, u->sq_ring_size);
+			close(u->fd);
+			u->fd = -1;
+			return -1;
+		}
+	}
+	
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = (struct io_uring_sqe*)mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if(u->sqes == MAP_FAILED)
+	{
+		fprintf(stderr, "Error mapping the io_uring rings.\n");
+		if(u->cq_ring_size != 0)
+			munmap(u->cq_ring, u->cq_ring_size);
+		munmap(u->sq_ring, u->sq_ring_size);
+		close(u->fd);
+		u->fd = -1;
+		return -1;
+	}
+	
+	sq = (uint8_t*)u->sq_ring;
+	u->sq_head = (uint32_t*)(sq + p.sq_off.head);
+	u->sq_tail = (uint32_t*)(sq + p.sq_off.tail);
+	u->sq_mask = (uint32_t*)(sq + p.sq_off.ring_mask);
+	u->sq_array = (uint32_t*)(sq + p.sq_off.array);
+	u->sq_entries = p.sq_entries;
+	
+	cq = (uint8_t*)u->cq_ring;
+	u->cq_head = (uint32_t*)(cq + p.cq_off.head);
+	u->cq_tail = (uint32_t*)(cq + p.cq_off.tail);
+	u->cq_mask = (uint32_t*)(cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+	
+	return 0;
+}
+
+void rcb4_uring_exit(struct s_rcb4_uring* u)
+{
+	assert(u);
+	
+	if(u->fd < 0)
+		return;
+	
+	munmap(u->sqes, u->sqes_size);
+	if(u->cq_ring_size != 0)
+		munmap(u->cq_ring, u->cq_ring_size);
+	munmap(u->sq_ring, u->sq_ring_size);
+	close(u->fd);
+	u->fd = -1;
+}
+
+int rcb4_uring_reserve(struct s_rcb4_uring* u, uint32_t n)
+{
+	assert(u);
+	
+	if(n > u->sq_entries)
+		return -1;
+	if(*u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) + n <= u->sq_entries)
+		return 0;
+	
+	if(rcb4_uring_enter(u, 0) < 0)
+		return -1;
+	return (*u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) + n <= u->sq_entries) ? 0 : -1;
+}
+
+struct io_uring_sqe* rcb4_uring_get_sqe(struct s_rcb4_uring* u)
+{
+	uint32_t tail, head;
+	struct io_uring_sqe* sqe;
+	
+	assert(u);
+	
+	tail = *u->sq_tail;
+	head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	if(tail - head >= u->sq_entries) // Full, give them to the kernel to make room
+	{
+		if(rcb4_uring_enter(u, 0) < 0)
+			return NULL;
+		head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+		if(tail - head >= u->sq_entries)
+			return NULL;
+	}
+	
+	sqe = &u->sqes[tail & *u->sq_mask];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	u->sq_array[tail & *u->sq_mask] = tail & *u->sq_mask;
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	u->queued++;
+	
+	return sqe;
+}
+
+int rcb4_uring_enter(struct s_rcb4_uring* u, uint32_t wait)
+{
+	int ret;
+	
+	assert(u);
+	
+	if(u->queued == 0 && wait == 0)
+		return 0;
+	
+	do
+	{
+		ret = syscall(__NR_io_uring_enter, u->fd, u->queued, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	}while(ret < 0 && errno == EINTR);
+	if(ret < 0)
+	{
+		fprintf(stderr, "Error submitting to io_uring.\n");
+		return -1;
+	}
+	
+	u->queued -= (ret < (int)u->queued) ? (uint32_t)ret : u->queued;
+	return 0;
+}
+
+struct io_uring_cqe* rcb4_uring_peek(struct s_rcb4_uring* u)
+{
+	uint32_t head;
+	
+	assert(u);
+	
+	head = *u->cq_head;
+	if(head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+	
+	return &u->cqes[head & *u->cq_mask];
+}
+
+void rcb4_uring_seen(struct s_rcb4_uring* u)
+{
+	assert(u);
+	
+	__atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}